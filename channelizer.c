@@ -0,0 +1,604 @@
+/* channelizer: extracts one or more narrowband channels from the stream on
+ * worker threads, and writes each of them as cf32 to its own output
+ * - direct mode: one thread; NCO mix + polyphase rational resampler per channel
+ * - FFT mode: fast convolution filter bank (overlap-save); one forward FFT
+ *   per block is shared by all channels, which are spread over a pool of
+ *   worker threads, each doing a small inverse FFT per channel and block
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "channelizer.h"
+#include "dsp_kernels.h"
+#include "sample_kernels.h"
+
+#define UNUSED(x) (void)(x)
+#define CHANNELIZER_CHUNK_SAMPLES 4096
+#define CHANNELIZER_POLL_INTERVAL_NS 1000000   /* 1ms */
+/* FFT mode: the FFT size is picked so that the filter transition band is
+ * about 1/20 of the narrowest channel */
+#define CHANNELIZER_FFT_MIN_SIZE 4096
+#define CHANNELIZER_FFT_MAX_SIZE (1024 * 1024)
+#define CHANNELIZER_FFT_RATE_FACTOR 100
+
+static int channel_init(Channelizer *channelizer, Channel *channel, const ChannelSpec *spec);
+static int channel_init_fft(Channelizer *channelizer, Channel *channel);
+static void channel_free(Channel *channel);
+static void channel_write(Channelizer *channelizer, Channel *channel, unsigned int nout);
+static void channel_process(Channelizer *channelizer, Channel *channel, const short *iq, unsigned int n);
+static void channel_process_block(Channelizer *channelizer, Channel *channel, const float *spectrum);
+static int fft_init(Channelizer *channelizer, unsigned int min_rate, int nworkers);
+static void fft_free(Channelizer *channelizer);
+static void fft_dispatch_block(Channelizer *channelizer);
+static void *channelizer_thread(void *arg);
+static void *channelizer_fft_thread(void *arg);
+static void *channelizer_worker_thread(void *arg);
+static void channelizer_sink_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index);
+static void channelizer_sink_stop(Sink *sink);
+static void channelizer_sink_free(Sink *sink);
+
+
+/* <offset (Hz)>,<output rate (Hz)>,<output file> */
+int channel_spec_parse(const char *spec, ChannelSpec *channel_spec)
+{
+    int n;
+    if (sscanf(spec, "%lg,%u,%n", &channel_spec->offset, &channel_spec->rate, &n) != 2 || spec[n] == '\0' || channel_spec->rate == 0) {
+        return -1;
+    }
+    channel_spec->filename = spec + n;
+    return 0;
+}
+
+int channelizer_init(Channelizer *channelizer, double input_rate, const ChannelSpec *specs, int nchannels,
+                     int nworkers, OutputOpenFn open_fn, void *open_arg)
+{
+    memset(channelizer, 0, sizeof(Channelizer));
+    channelizer->sink.name = "channelizer";
+    channelizer->sink.push = channelizer_sink_push;
+    channelizer->sink.stop = channelizer_sink_stop;
+    channelizer->sink.free = channelizer_sink_free;
+    channelizer->sink.ring = &channelizer->ring;
+    channelizer->input_rate = input_rate;
+    atomic_init(&channelizer->stop, 0);
+    atomic_init(&channelizer->write_errors, 0);
+
+    if (fabs(input_rate - llround(input_rate)) > 1e-6) {
+        fprintf(stderr, "channelizer input rate (%lf) must be a whole number of Hz\n", input_rate);
+        return -1;
+    }
+    for (int i = 0; i < nchannels; i++) {
+        if (fabs(specs[i].offset) + specs[i].rate / 2.0 > input_rate / 2) {
+            fprintf(stderr, "channel at offset %.0lfHz is outside of the input bandwidth\n", specs[i].offset);
+            return -1;
+        }
+    }
+
+    if (nworkers > 0) {
+        /* the FFT size depends on the narrowest channel */
+        unsigned int min_rate = specs[0].rate;
+        for (int i = 1; i < nchannels; i++) {
+            min_rate = specs[i].rate < min_rate ? specs[i].rate : min_rate;
+        }
+        if (fft_init(channelizer, min_rate, nworkers < nchannels ? nworkers : nchannels) == -1) {
+            channelizer_free(channelizer);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < nchannels; i++) {
+        Channel *channel = &channelizer->channels[i];
+        if (channel_init(channelizer, channel, &specs[i]) == -1) {
+            channelizer_free(channelizer);
+            return -1;
+        }
+        channelizer->nchannels++;
+        channel->output = open_fn(specs[i].filename, open_arg);
+        if (channel->output == NULL) {
+            channelizer_free(channelizer);
+            return -1;
+        }
+        if (channelizer->fft != NULL) {
+            channel->worker = i % channelizer->fft->nworkers;
+            fprintf(stderr, "channel %d: offset=%.0lfHz rate=%u bin=%ld decimation=%u resampling=%u/%u worker=%d -> %s\n", i, channel->spec.offset, channel->spec.rate, channel->bin, channel->decimation, channel->resample ? channel->resampler.L : 1, channel->resample ? channel->resampler.M : 1, channel->worker, channel->spec.filename);
+        } else {
+            fprintf(stderr, "channel %d: offset=%.0lfHz rate=%u resampling=%u/%u taps=%u -> %s\n", i, channel->spec.offset, channel->spec.rate, channel->resampler.L, channel->resampler.M, channel->resampler.L * channel->resampler.taps, channel->spec.filename);
+        }
+    }
+
+    if (ring_buffer_init(&channelizer->ring, CHANNELIZER_RING_SIZE) == -1) {
+        fprintf(stderr, "channelizer ring buffer allocation failed\n");
+        channelizer_free(channelizer);
+        return -1;
+    }
+    return 0;
+}
+
+int channelizer_start(Channelizer *channelizer)
+{
+    ChannelizerFFT *fft = channelizer->fft;
+    if (fft != NULL) {
+        for (int i = 0; i < fft->nworkers; i++) {
+            ChannelizerWorker *worker = &fft->workers[i];
+            worker->channelizer = channelizer;
+            worker->index = i;
+            worker->next_block = 0;
+            int ret = pthread_create(&worker->thread, NULL, channelizer_worker_thread, worker);
+            if (ret != 0) {
+                fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+                /* let the workers already started exit */
+                pthread_mutex_lock(&fft->mutex);
+                fft->done = 1;
+                pthread_cond_broadcast(&fft->cond);
+                pthread_mutex_unlock(&fft->mutex);
+                for (int j = 0; j < i; j++) {
+                    pthread_join(fft->workers[j].thread, NULL);
+                }
+                return -1;
+            }
+        }
+    }
+    int ret = pthread_create(&channelizer->thread, NULL, fft != NULL ? channelizer_fft_thread : channelizer_thread, channelizer);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/* copy the samples into the channelizer ring buffer; never blocks */
+void channelizer_push(Channelizer *channelizer, const short *xi, const short *xq, unsigned int numSamples)
+{
+    size_t count = numSamples * 2 * sizeof(short);
+    void *data1;
+    void *data2;
+    size_t count1 = ring_buffer_reserve(&channelizer->ring, count, &data1, &data2);
+    if (count1 == 0) {
+        return;
+    }
+    /* the sample range is tracked by the stream callback already */
+    SampleRange range;
+    sample_range_init(&range);
+    unsigned int n1 = count1 / (2 * sizeof(short));
+    interleave_minmax(xi, xq, (short *)data1, n1, &range);
+    interleave_minmax(xi + n1, xq + n1, (short *)data2, numSamples - n1, &range);
+    ring_buffer_commit(&channelizer->ring, count);
+}
+
+/* stop the channelizer threads after they have processed everything left in
+ * the ring buffer, then close the channel outputs */
+void channelizer_stop(Channelizer *channelizer)
+{
+    atomic_store(&channelizer->stop, 1);
+    pthread_join(channelizer->thread, NULL);
+    for (int i = 0; i < channelizer->nchannels; i++) {
+        Channel *channel = &channelizer->channels[i];
+        channel->output->close(channel->output);
+        channel->output = NULL;
+        fprintf(stderr, "channel %d: samples_out=%llu\n", i, channel->samples_out);
+    }
+    if (channelizer->fft != NULL) {
+        fprintf(stderr, "channelizer: mode=fft fft_size=%u overlap=%u workers=%d blocks=%llu\n", channelizer->fft->size, channelizer->fft->overlap, channelizer->fft->nworkers, channelizer->fft->blocks_ready);
+    }
+    fprintf(stderr, "channelizer: dsp_kernels=%s high_water_mark=%zu (%.1lf%%) overruns=%llu overrun_bytes=%llu write_errors=%llu\n", dsp_kernels_name(), channelizer->ring.high_water_mark, 100.0 * channelizer->ring.high_water_mark / channelizer->ring.size, channelizer->ring.overruns, channelizer->ring.overrun_bytes, atomic_load(&channelizer->write_errors));
+}
+
+void channelizer_free(Channelizer *channelizer)
+{
+    for (int i = 0; i < channelizer->nchannels; i++) {
+        Channel *channel = &channelizer->channels[i];
+        if (channel->output != NULL) {
+            channel->output->close(channel->output);
+        }
+        channel_free(channel);
+    }
+    channelizer->nchannels = 0;
+    fft_free(channelizer);
+    if (channelizer->ring.buffer != NULL) {
+        ring_buffer_free(&channelizer->ring);
+        channelizer->ring.buffer = NULL;
+    }
+}
+
+static int channel_init(Channelizer *channelizer, Channel *channel, const ChannelSpec *spec)
+{
+    memset(channel, 0, sizeof(Channel));
+    channel->spec = *spec;
+    channel->phase = 0;
+    if (channelizer->fft != NULL) {
+        return channel_init_fft(channelizer, channel);
+    }
+
+    /* direct mode: mix to baseband at the input rate, then resample; the
+     * resampler gain of 1/32768 scales the output to [-1.0, 1.0) */
+    channel->phase_inc = -spec->offset / channelizer->input_rate;
+    channel->resample = 1;
+    if (resampler_init(&channel->resampler, llround(channelizer->input_rate), spec->rate, 1.0f / 32768.0f, CHANNELIZER_CHUNK_SAMPLES) == -1) {
+        return -1;
+    }
+    channel->out = (float *) malloc((CHANNELIZER_CHUNK_SAMPLES + 1) * 2 * sizeof(float));
+    if (channel->out == NULL) {
+        fprintf(stderr, "channel buffer allocation failed\n");
+        channel_free(channel);
+        return -1;
+    }
+    return 0;
+}
+
+/* FFT mode: pick the bins around the channel (the nearest bin takes care of
+ * the frequency shift), filter them, and decimate by taking only
+ * fft_size / decimation of them into the inverse FFT; the resampler then
+ * takes the decimated rate to the exact output rate if needed */
+static int channel_init_fft(Channelizer *channelizer, Channel *channel)
+{
+    ChannelizerFFT *fft = channelizer->fft;
+    double input_rate = channelizer->input_rate;
+    unsigned long long input_rate_Hz = llround(input_rate);
+    unsigned int rate = channel->spec.rate;
+    double transition = 5.0 * input_rate / fft->overlap;
+
+    /* largest power of two decimation that keeps the channel (and, if the
+     * output needs resampling, the filter transition band) below Nyquist */
+    unsigned int decimation = fft->overlap;
+    while (decimation > 1 && (input_rate_Hz % decimation != 0 || input_rate_Hz / decimation < rate)) {
+        decimation /= 2;
+    }
+    channel->resample = input_rate_Hz / decimation != rate;
+    if (channel->resample) {
+        while (decimation > 1 && input_rate_Hz / decimation < rate + 2 * transition) {
+            decimation /= 2;
+        }
+    }
+    channel->decimation = decimation;
+    unsigned int nbins = fft->size / decimation;
+    double decimated_rate = (double)input_rate_Hz / decimation;
+
+    channel->bin = lround(channel->spec.offset * fft->size / input_rate);
+    double residual = channel->spec.offset - channel->bin * input_rate / fft->size;
+    channel->phase_inc = -residual / decimated_rate;
+    unsigned long long bin_mod = ((channel->bin % (long)fft->size) + fft->size) % fft->size;
+    channel->block_phase = 0;
+    channel->block_phase_inc = (bin_mod * fft->step) % fft->size;
+
+    channel->response = (float *) malloc(nbins * 2 * sizeof(float));
+    channel->ifft_buf = (float *) malloc(nbins * 2 * sizeof(float));
+    unsigned int max_out = fft->step / decimation;
+    channel->out = (float *) malloc((max_out + 1) * 2 * sizeof(float));
+    float *h = (float *) calloc(fft->size * 2, sizeof(float));
+    if (channel->response == NULL || channel->ifft_buf == NULL || channel->out == NULL || h == NULL) {
+        fprintf(stderr, "channel buffer allocation failed\n");
+        free(h);
+        channel_free(channel);
+        return -1;
+    }
+    if (fft_plan_init(&channel->ifft, nbins) == -1) {
+        free(h);
+        channel_free(channel);
+        return -1;
+    }
+    if (channel->resample && resampler_init(&channel->resampler, (unsigned long long)decimated_rate, rate, 1.0f, max_out) == -1) {
+        free(h);
+        channel_free(channel);
+        return -1;
+    }
+
+    /* Kaiser windowed sinc with overlap + 1 taps; with resampling the
+     * passband extends to the channel edge (the resampler does the final
+     * filtering), otherwise the stopband starts at the output Nyquist */
+    unsigned int ntaps = fft->overlap + 1;
+    double cutoff = (channel->resample ? rate / 2.0 + transition / 2 : rate / 2.0 - transition / 2) / input_rate;
+    double center = (ntaps - 1) / 2.0;
+    for (unsigned int i = 0; i < ntaps; i++) {
+        double t = i - center;
+        double sinc = t == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+        h[2*i] = sinc * kaiser_window(i, ntaps, RESAMPLER_KAISER_BETA);
+    }
+    fft_forward(&fft->plan, h);
+    /* 1/fft_size for the unnormalized transforms, 1/32768 to scale the
+     * output to [-1.0, 1.0) */
+    float gain = 1.0f / fft->size / 32768.0f;
+    for (long m = -(long)nbins / 2; m < (long)nbins / 2; m++) {
+        unsigned int src = (m + fft->size) % fft->size;
+        unsigned int dst = (m + nbins) % nbins;
+        channel->response[2*dst] = h[2*src] * gain;
+        channel->response[2*dst+1] = h[2*src+1] * gain;
+    }
+    free(h);
+    return 0;
+}
+
+static void channel_free(Channel *channel)
+{
+    if (channel->resample) {
+        resampler_free(&channel->resampler);
+    }
+    fft_plan_free(&channel->ifft);
+    free(channel->response);
+    free(channel->ifft_buf);
+    free(channel->out);
+    channel->resample = 0;
+    channel->response = NULL;
+    channel->ifft_buf = NULL;
+    channel->out = NULL;
+}
+
+static void channel_write(Channelizer *channelizer, Channel *channel, unsigned int nout)
+{
+    if (nout > 0) {
+        if (channel->output->write(channel->output, channel->out, nout * 2 * sizeof(float)) == -1) {
+            atomic_fetch_add(&channelizer->write_errors, 1);
+        }
+        channel->samples_out += nout;
+    }
+}
+
+/* direct mode */
+static void channel_process(Channelizer *channelizer, Channel *channel, const short *iq, unsigned int n)
+{
+    mix_iq16(iq, resampler_input_i(&channel->resampler), resampler_input_q(&channel->resampler), n, channel->phase, channel->phase_inc);
+    channel->phase = fmod(channel->phase + n * channel->phase_inc, 1.0);
+    channel_write(channelizer, channel, resampler_run(&channel->resampler, n, channel->out));
+}
+
+/* FFT mode */
+static void channel_process_block(Channelizer *channelizer, Channel *channel, const float *spectrum)
+{
+    ChannelizerFFT *fft = channelizer->fft;
+    unsigned int nbins = fft->size / channel->decimation;
+    float *y = channel->ifft_buf;
+    for (long m = -(long)nbins / 2; m < (long)nbins / 2; m++) {
+        unsigned int src = ((channel->bin + m) % (long)fft->size + fft->size) % fft->size;
+        unsigned int dst = (m + nbins) % nbins;
+        const float *x = spectrum + 2 * src;
+        const float *h = channel->response + 2 * dst;
+        y[2*dst] = x[0] * h[0] - x[1] * h[1];
+        y[2*dst+1] = x[0] * h[1] + x[1] * h[0];
+    }
+    fft_inverse(&channel->ifft, y);
+
+    /* the first overlap / decimation samples are the circular convolution
+     * wrap around; the bin shift was done relative to the start of the block,
+     * so add back the phase of the block start, together with the residual
+     * offset NCO */
+    unsigned int skip = fft->overlap / channel->decimation;
+    unsigned int n = fft->step / channel->decimation;
+    double phase = channel->phase - (double)channel->block_phase / fft->size;
+    double pr = cos(2 * M_PI * phase);
+    double pi = sin(2 * M_PI * phase);
+    double wr = cos(2 * M_PI * channel->phase_inc);
+    double wi = sin(2 * M_PI * channel->phase_inc);
+    float *out_i = channel->resample ? resampler_input_i(&channel->resampler) : NULL;
+    float *out_q = channel->resample ? resampler_input_q(&channel->resampler) : NULL;
+    for (unsigned int i = 0; i < n; i++) {
+        float xr = y[2*(skip+i)];
+        float xq = y[2*(skip+i)+1];
+        float zr = xr * pr - xq * pi;
+        float zq = xr * pi + xq * pr;
+        if (channel->resample) {
+            out_i[i] = zr;
+            out_q[i] = zq;
+        } else {
+            channel->out[2*i] = zr;
+            channel->out[2*i+1] = zq;
+        }
+        double npr = pr * wr - pi * wi;
+        pi = pr * wi + pi * wr;
+        pr = npr;
+    }
+    channel->phase = fmod(channel->phase + n * channel->phase_inc, 1.0);
+    channel->block_phase = (channel->block_phase + channel->block_phase_inc) % fft->size;
+    channel_write(channelizer, channel, channel->resample ? resampler_run(&channel->resampler, n, channel->out) : n);
+}
+
+static int fft_init(Channelizer *channelizer, unsigned int min_rate, int nworkers)
+{
+    ChannelizerFFT *fft = (ChannelizerFFT *) calloc(1, sizeof(ChannelizerFFT));
+    if (fft == NULL) {
+        fprintf(stderr, "FFT channelizer allocation failed\n");
+        return -1;
+    }
+    pthread_mutex_init(&fft->mutex, NULL);
+    pthread_cond_init(&fft->cond, NULL);
+    double want = CHANNELIZER_FFT_RATE_FACTOR * channelizer->input_rate / min_rate;
+    unsigned int size = CHANNELIZER_FFT_MIN_SIZE;
+    while (size < want && size < CHANNELIZER_FFT_MAX_SIZE) {
+        size *= 2;
+    }
+    fft->size = size;
+    fft->overlap = size / 4;
+    fft->step = size - fft->overlap;
+    fft->input_fill = fft->overlap;
+    fft->nworkers = nworkers;
+    channelizer->fft = fft;
+    if (fft_plan_init(&fft->plan, size) == -1) {
+        return -1;
+    }
+    fft->input = (float *) calloc(size * 2, sizeof(float));
+    if (fft->input == NULL) {
+        fprintf(stderr, "FFT channelizer allocation failed\n");
+        return -1;
+    }
+    for (int i = 0; i < CHANNELIZER_FFT_SLOTS; i++) {
+        fft->spectra[i] = (float *) malloc(size * 2 * sizeof(float));
+        if (fft->spectra[i] == NULL) {
+            fprintf(stderr, "FFT channelizer allocation failed\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+static void fft_free(Channelizer *channelizer)
+{
+    ChannelizerFFT *fft = channelizer->fft;
+    if (fft == NULL) {
+        return;
+    }
+    fft_plan_free(&fft->plan);
+    free(fft->input);
+    for (int i = 0; i < CHANNELIZER_FFT_SLOTS; i++) {
+        free(fft->spectra[i]);
+    }
+    pthread_mutex_destroy(&fft->mutex);
+    pthread_cond_destroy(&fft->cond);
+    free(fft);
+    channelizer->fft = NULL;
+}
+
+/* transform the input block into the next free slot and hand it to the workers */
+static void fft_dispatch_block(Channelizer *channelizer)
+{
+    ChannelizerFFT *fft = channelizer->fft;
+    unsigned int slot = fft->blocks_ready % CHANNELIZER_FFT_SLOTS;
+
+    pthread_mutex_lock(&fft->mutex);
+    while (fft->pending[slot] > 0) {
+        pthread_cond_wait(&fft->cond, &fft->mutex);
+    }
+    pthread_mutex_unlock(&fft->mutex);
+
+    memcpy(fft->spectra[slot], fft->input, fft->size * 2 * sizeof(float));
+    fft_forward(&fft->plan, fft->spectra[slot]);
+    memmove(fft->input, fft->input + 2 * fft->step, fft->overlap * 2 * sizeof(float));
+    fft->input_fill = fft->overlap;
+
+    pthread_mutex_lock(&fft->mutex);
+    fft->pending[slot] = fft->nworkers;
+    fft->blocks_ready++;
+    pthread_cond_broadcast(&fft->cond);
+    pthread_mutex_unlock(&fft->mutex);
+}
+
+/* direct mode */
+static void *channelizer_thread(void *arg)
+{
+    Channelizer *channelizer = (Channelizer *)arg;
+    RingBuffer *ring = &channelizer->ring;
+    struct timespec poll_interval = { 0, CHANNELIZER_POLL_INTERVAL_NS };
+
+    while (1) {
+        int stop = atomic_load(&channelizer->stop);
+        size_t available = ring_buffer_read_available(ring);
+        if (available == 0 && stop) {
+            break;
+        }
+        if (available == 0) {
+            nanosleep(&poll_interval, NULL);
+            continue;
+        }
+        const void *data;
+        size_t contiguous = ring_buffer_peek(ring, &data);
+        size_t count = contiguous < CHANNELIZER_CHUNK_SAMPLES * 2 * sizeof(short) ? contiguous : CHANNELIZER_CHUNK_SAMPLES * 2 * sizeof(short);
+        unsigned int n = count / (2 * sizeof(short));
+        for (int i = 0; i < channelizer->nchannels; i++) {
+            channel_process(channelizer, &channelizer->channels[i], (const short *)data, n);
+        }
+        ring_buffer_consume(ring, count);
+    }
+    return NULL;
+}
+
+/* FFT mode dispatcher: builds the overlapping blocks and does the forward FFT;
+ * the last partial block is not processed */
+static void *channelizer_fft_thread(void *arg)
+{
+    Channelizer *channelizer = (Channelizer *)arg;
+    ChannelizerFFT *fft = channelizer->fft;
+    RingBuffer *ring = &channelizer->ring;
+    struct timespec poll_interval = { 0, CHANNELIZER_POLL_INTERVAL_NS };
+
+    while (1) {
+        int stop = atomic_load(&channelizer->stop);
+        size_t available = ring_buffer_read_available(ring);
+        if (available == 0 && stop) {
+            break;
+        }
+        if (available == 0) {
+            nanosleep(&poll_interval, NULL);
+            continue;
+        }
+        const void *data;
+        size_t contiguous = ring_buffer_peek(ring, &data);
+        unsigned int n = contiguous / (2 * sizeof(short));
+        unsigned int space = fft->size - fft->input_fill;
+        n = n < space ? n : space;
+        const short *iq = (const short *)data;
+        float *input = fft->input + 2 * fft->input_fill;
+        for (unsigned int i = 0; i < 2 * n; i++) {
+            input[i] = iq[i];
+        }
+        fft->input_fill += n;
+        ring_buffer_consume(ring, n * 2 * sizeof(short));
+        if (fft->input_fill == fft->size) {
+            fft_dispatch_block(channelizer);
+        }
+    }
+
+    pthread_mutex_lock(&fft->mutex);
+    fft->done = 1;
+    pthread_cond_broadcast(&fft->cond);
+    pthread_mutex_unlock(&fft->mutex);
+    for (int i = 0; i < fft->nworkers; i++) {
+        pthread_join(fft->workers[i].thread, NULL);
+    }
+    return NULL;
+}
+
+/* FFT mode worker: processes its own channels for every block, in order */
+static void *channelizer_worker_thread(void *arg)
+{
+    ChannelizerWorker *worker = (ChannelizerWorker *)arg;
+    Channelizer *channelizer = worker->channelizer;
+    ChannelizerFFT *fft = channelizer->fft;
+
+    while (1) {
+        pthread_mutex_lock(&fft->mutex);
+        while (worker->next_block >= fft->blocks_ready && !fft->done) {
+            pthread_cond_wait(&fft->cond, &fft->mutex);
+        }
+        if (worker->next_block >= fft->blocks_ready) {
+            pthread_mutex_unlock(&fft->mutex);
+            break;
+        }
+        pthread_mutex_unlock(&fft->mutex);
+
+        unsigned int slot = worker->next_block % CHANNELIZER_FFT_SLOTS;
+        for (int i = 0; i < channelizer->nchannels; i++) {
+            if (channelizer->channels[i].worker == worker->index) {
+                channel_process_block(channelizer, &channelizer->channels[i], fft->spectra[slot]);
+            }
+        }
+
+        pthread_mutex_lock(&fft->mutex);
+        fft->pending[slot]--;
+        pthread_cond_broadcast(&fft->cond);
+        pthread_mutex_unlock(&fft->mutex);
+        worker->next_block++;
+    }
+    return NULL;
+}
+
+static void channelizer_sink_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index)
+{
+    UNUSED(sample_index);
+    channelizer_push((Channelizer *)sink, xi, xq, numSamples);
+}
+
+static void channelizer_sink_stop(Sink *sink)
+{
+    channelizer_stop((Channelizer *)sink);
+}
+
+static void channelizer_sink_free(Sink *sink)
+{
+    channelizer_free((Channelizer *)sink);
+}
@@ -0,0 +1,112 @@
+/* channelizer: extracts one or more narrowband channels from the stream on
+ * worker threads, and writes each of them as cf32 to its own output
+ * - direct mode: one thread; NCO mix + polyphase rational resampler per channel
+ * - FFT mode: fast convolution filter bank (overlap-save); one forward FFT
+ *   per block is shared by all channels, which are spread over a pool of
+ *   worker threads, each doing a small inverse FFT per channel and block
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CHANNELIZER_H
+#define CHANNELIZER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+#include "fft.h"
+#include "output.h"
+#include "pipeline.h"
+#include "resampler.h"
+#include "ring_buffer.h"
+
+#define MAX_CHANNELS 64
+#define MAX_CHANNELIZER_WORKERS 64
+#define CHANNELIZER_RING_SIZE (32 * 1024 * 1024)
+/* FFT mode: number of forward FFT blocks in flight between the dispatcher
+ * and the workers */
+#define CHANNELIZER_FFT_SLOTS 8
+
+typedef struct {
+    double offset;          /* Hz, relative to the center frequency */
+    unsigned int rate;      /* output sample rate in Hz */
+    const char *filename;
+} ChannelSpec;
+
+typedef struct {
+    ChannelSpec spec;
+    Output *output;
+    /* NCO - at the input rate in direct mode, at the decimated rate in FFT
+     * mode (where it only takes care of the offset left over by the bin
+     * selection) */
+    double phase;           /* cycles */
+    double phase_inc;       /* cycles per sample */
+    /* FFT mode only */
+    int worker;
+    unsigned int decimation;
+    long bin;
+    unsigned int block_phase;       /* bin shift phase of the current block, in 1/fft_size cycles */
+    unsigned int block_phase_inc;
+    float *response;        /* filter frequency response (fft_size / decimation bins) */
+    FFTPlan ifft;
+    float *ifft_buf;
+    /* resampler to the exact output rate (always used in direct mode) */
+    int resample;
+    Resampler resampler;
+    float *out;
+    unsigned long long samples_out;
+} Channel;
+
+struct Channelizer;
+
+typedef struct {
+    struct Channelizer *channelizer;
+    int index;
+    pthread_t thread;
+    unsigned long long next_block;
+} ChannelizerWorker;
+
+typedef struct {
+    FFTPlan plan;
+    unsigned int size;
+    unsigned int overlap;   /* filter length - 1 */
+    unsigned int step;      /* new input samples per block */
+    float *input;           /* time domain block being filled (interleaved) */
+    unsigned int input_fill;
+    float *spectra[CHANNELIZER_FFT_SLOTS];
+    unsigned int pending[CHANNELIZER_FFT_SLOTS];   /* workers still using the slot */
+    unsigned long long blocks_ready;
+    int done;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int nworkers;
+    ChannelizerWorker workers[MAX_CHANNELIZER_WORKERS];
+} ChannelizerFFT;
+
+typedef struct Channelizer {
+    Sink sink;              /* pipeline sink (stop/free -> channelizer_stop/free) */
+    RingBuffer ring;
+    Channel channels[MAX_CHANNELS];
+    int nchannels;
+    double input_rate;
+    ChannelizerFFT *fft;    /* NULL in direct mode */
+    pthread_t thread;
+    atomic_int stop;
+    atomic_ullong write_errors;
+} Channelizer;
+
+int channel_spec_parse(const char *spec, ChannelSpec *channel_spec);
+/* nworkers = 0 -> direct mode; > 0 -> FFT mode with that many workers */
+int channelizer_init(Channelizer *channelizer, double input_rate, const ChannelSpec *specs, int nchannels,
+                     int nworkers, OutputOpenFn open_fn, void *open_arg);
+int channelizer_start(Channelizer *channelizer);
+/* called from the stream callback */
+void channelizer_push(Channelizer *channelizer, const short *xi, const short *xq, unsigned int numSamples);
+void channelizer_stop(Channelizer *channelizer);
+void channelizer_free(Channelizer *channelizer);
+
+#endif /* CHANNELIZER_H */
@@ -0,0 +1,176 @@
+/* control socket: a UNIX stream socket that takes one command per line
+ * (e.g. "freq 162400000") while streaming, and answers each of them with
+ * one line
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+
+#include "control.h"
+
+static void *control_thread(void *arg);
+static void serve_client(Control *control, char *line, size_t *length);
+static void send_reply(Control *control, const char *reply);
+
+
+int control_start(Control *control, const char *socket_path, ControlHandler handler, void *handler_arg)
+{
+    struct sockaddr_un addr;
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "control socket path too long: %s\n", socket_path);
+        return -1;
+    }
+    snprintf(control->socket_path, sizeof(control->socket_path), "%s", socket_path);
+    control->client_fd = -1;
+    control->handler = handler;
+    control->handler_arg = handler_arg;
+    atomic_init(&control->stop, 0);
+
+    control->listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (control->listen_fd == -1) {
+        fprintf(stderr, "socket(AF_UNIX) failed: %s\n", strerror(errno));
+        return -1;
+    }
+    if (unlink(socket_path) == -1 && errno != ENOENT) {
+        fprintf(stderr, "unlink(%s) failed: %s\n", socket_path, strerror(errno));
+        close(control->listen_fd);
+        return -1;
+    }
+    memset(&addr, 0, sizeof(addr));
+    addr.sun_family = AF_UNIX;
+    snprintf(addr.sun_path, sizeof(addr.sun_path), "%s", socket_path);
+    if (bind(control->listen_fd, (struct sockaddr *)&addr, sizeof(addr)) == -1) {
+        fprintf(stderr, "bind(%s) failed: %s\n", socket_path, strerror(errno));
+        close(control->listen_fd);
+        return -1;
+    }
+    if (listen(control->listen_fd, 1) == -1) {
+        fprintf(stderr, "listen(%s) failed: %s\n", socket_path, strerror(errno));
+        close(control->listen_fd);
+        unlink(socket_path);
+        return -1;
+    }
+
+    int ret = pthread_create(&control->thread, NULL, control_thread, control);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        close(control->listen_fd);
+        unlink(socket_path);
+        return -1;
+    }
+    return 0;
+}
+
+void control_stop(Control *control)
+{
+    atomic_store(&control->stop, 1);
+    pthread_join(control->thread, NULL);
+    if (control->client_fd != -1) {
+        close(control->client_fd);
+    }
+    close(control->listen_fd);
+    unlink(control->socket_path);
+}
+
+/* poll with a timeout, so that the stop flag is checked every
+ * CONTROL_POLL_INTERVAL_MS */
+static void *control_thread(void *arg)
+{
+    Control *control = (Control *)arg;
+    char line[CONTROL_MAX_LINE_SIZE];
+    size_t length = 0;
+
+    while (!atomic_load(&control->stop)) {
+        struct pollfd pfd;
+        pfd.fd = control->client_fd != -1 ? control->client_fd : control->listen_fd;
+        pfd.events = POLLIN;
+        int n = poll(&pfd, 1, CONTROL_POLL_INTERVAL_MS);
+        if (n == -1 && errno != EINTR) {
+            fprintf(stderr, "poll() failed: %s\n", strerror(errno));
+            break;
+        }
+        if (n <= 0) {
+            continue;
+        }
+        if (control->client_fd == -1) {
+            control->client_fd = accept4(control->listen_fd, NULL, NULL, SOCK_CLOEXEC);
+            if (control->client_fd == -1 && errno != EINTR && errno != EAGAIN && errno != ECONNABORTED) {
+                fprintf(stderr, "accept() failed: %s\n", strerror(errno));
+            }
+            length = 0;
+            continue;
+        }
+        serve_client(control, line, &length);
+    }
+    return NULL;
+}
+
+/* read what the client sent, and run the complete lines */
+static void serve_client(Control *control, char *line, size_t *length)
+{
+    ssize_t nread = read(control->client_fd, line + *length, CONTROL_MAX_LINE_SIZE - *length);
+    if (nread <= 0) {
+        if (nread == -1 && errno == EINTR) {
+            return;
+        }
+        close(control->client_fd);
+        control->client_fd = -1;
+        return;
+    }
+    *length += nread;
+
+    char *start = line;
+    char *end;
+    while ((end = memchr(start, '\n', *length - (start - line))) != NULL) {
+        *end = '\0';
+        if (end > start && end[-1] == '\r') {
+            end[-1] = '\0';
+        }
+        char reply[CONTROL_MAX_REPLY_SIZE];
+        reply[0] = '\0';
+        control->handler(control->handler_arg, start, reply, sizeof(reply));
+        send_reply(control, reply);
+        start = end + 1;
+    }
+    *length -= start - line;
+    memmove(line, start, *length);
+    if (*length == CONTROL_MAX_LINE_SIZE) {
+        send_reply(control, "error: line too long");
+        *length = 0;
+    }
+}
+
+static void send_reply(Control *control, const char *reply)
+{
+    char buffer[CONTROL_MAX_REPLY_SIZE + 1];
+    size_t length = snprintf(buffer, sizeof(buffer), "%s\n", reply);
+    if (length >= sizeof(buffer)) {
+        length = sizeof(buffer) - 1;
+        buffer[length - 1] = '\n';
+    }
+    /* MSG_NOSIGNAL: a client gone away is not a reason to die of SIGPIPE */
+    size_t sent = 0;
+    while (sent < length) {
+        ssize_t n = send(control->client_fd, buffer + sent, length - sent, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        sent += n;
+    }
+}
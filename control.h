@@ -0,0 +1,43 @@
+/* control socket: a UNIX stream socket that takes one command per line
+ * (e.g. "freq 162400000") while streaming, and answers each of them with
+ * one line
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef CONTROL_H
+#define CONTROL_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stddef.h>
+
+#define CONTROL_MAX_LINE_SIZE 256
+#define CONTROL_MAX_REPLY_SIZE 1024
+#define CONTROL_POLL_INTERVAL_MS 100
+
+/* called from the control thread for each command line (without the
+ * newline); it writes its reply (without the newline) to reply */
+typedef void (*ControlHandler)(void *arg, char *command, char *reply, size_t reply_size);
+
+typedef struct {
+    char socket_path[108];
+    int listen_fd;
+    int client_fd;
+    ControlHandler handler;
+    void *handler_arg;
+    pthread_t thread;
+    atomic_int stop;
+} Control;
+
+/* listen on socket_path (an old socket there is removed) and start the
+ * control thread; one client at a time */
+int control_start(Control *control, const char *socket_path, ControlHandler handler, void *handler_arg);
+/* stop the control thread, and remove the socket */
+void control_stop(Control *control);
+
+#endif /* CONTROL_H */
@@ -0,0 +1,198 @@
+/* DSP kernels for the channelizer: NCO mixer and complex FIR dot product
+ * (AVX2/FMA/NEON with runtime CPU dispatch and a scalar fallback)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define HAVE_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+#include "dsp_kernels.h"
+
+static void mix_iq16_scalar(const short *iq, float *out_i, float *out_q, unsigned int n, double phase, double phase_inc);
+static void dot_complex_scalar(const float *h, const float *xi, const float *xq, unsigned int n, float *yi, float *yq);
+
+MixIQ16Fn mix_iq16 = mix_iq16_scalar;
+DotComplexFn dot_complex = dot_complex_scalar;
+static const char *kernels_name = "scalar";
+
+
+/* scalar versions - also used for the tail of the SIMD versions */
+static void mix_iq16_scalar(const short *iq, float *out_i, float *out_q, unsigned int n, double phase, double phase_inc)
+{
+    float pr = cos(2 * M_PI * phase);
+    float pi = sin(2 * M_PI * phase);
+    float wr = cos(2 * M_PI * phase_inc);
+    float wi = sin(2 * M_PI * phase_inc);
+    for (unsigned int i = 0; i < n; i++) {
+        float xr = iq[2*i];
+        float xq = iq[2*i+1];
+        out_i[i] = xr * pr - xq * pi;
+        out_q[i] = xr * pi + xq * pr;
+        float npr = pr * wr - pi * wi;
+        pi = pr * wi + pi * wr;
+        pr = npr;
+    }
+}
+
+static void dot_complex_scalar(const float *h, const float *xi, const float *xq, unsigned int n, float *yi, float *yq)
+{
+    float si = 0;
+    float sq = 0;
+    for (unsigned int k = 0; k < n; k++) {
+        si += h[k] * xi[k];
+        sq += h[k] * xq[k];
+    }
+    *yi = si;
+    *yq = sq;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("avx2,fma")))
+static void mix_iq16_avx2(const short *iq, float *out_i, float *out_q, unsigned int n, double phase, double phase_inc)
+{
+    /* one phasor per lane, all rotated by 8 samples at a time */
+    float lane_r[8];
+    float lane_i[8];
+    for (int k = 0; k < 8; k++) {
+        lane_r[k] = cos(2 * M_PI * (phase + k * phase_inc));
+        lane_i[k] = sin(2 * M_PI * (phase + k * phase_inc));
+    }
+    __m256 pr = _mm256_loadu_ps(lane_r);
+    __m256 pi = _mm256_loadu_ps(lane_i);
+    __m256 wr = _mm256_set1_ps(cos(2 * M_PI * 8 * phase_inc));
+    __m256 wi = _mm256_set1_ps(sin(2 * M_PI * 8 * phase_inc));
+    unsigned int i = 0;
+    for (; i + 8 <= n; i += 8) {
+        /* I is the low half of each 32 bit I/Q pair, Q the high half */
+        __m256i v = _mm256_loadu_si256((const __m256i *)(iq + 2*i));
+        __m256 xr = _mm256_cvtepi32_ps(_mm256_srai_epi32(_mm256_slli_epi32(v, 16), 16));
+        __m256 xq = _mm256_cvtepi32_ps(_mm256_srai_epi32(v, 16));
+        _mm256_storeu_ps(out_i + i, _mm256_fmsub_ps(xr, pr, _mm256_mul_ps(xq, pi)));
+        _mm256_storeu_ps(out_q + i, _mm256_fmadd_ps(xr, pi, _mm256_mul_ps(xq, pr)));
+        __m256 npr = _mm256_fmsub_ps(pr, wr, _mm256_mul_ps(pi, wi));
+        pi = _mm256_fmadd_ps(pr, wi, _mm256_mul_ps(pi, wr));
+        pr = npr;
+    }
+    mix_iq16_scalar(iq + 2*i, out_i + i, out_q + i, n - i, phase + i * phase_inc, phase_inc);
+}
+
+__attribute__((target("avx2,fma")))
+static inline float hsum_ps(__m256 v)
+{
+    __m128 s = _mm_add_ps(_mm256_castps256_ps128(v), _mm256_extractf128_ps(v, 1));
+    s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+    s = _mm_add_ss(s, _mm_shuffle_ps(s, s, 1));
+    return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+static void dot_complex_avx2(const float *h, const float *xi, const float *xq, unsigned int n, float *yi, float *yq)
+{
+    /* two accumulators per output to hide the FMA latency */
+    __m256 si0 = _mm256_setzero_ps();
+    __m256 si1 = _mm256_setzero_ps();
+    __m256 sq0 = _mm256_setzero_ps();
+    __m256 sq1 = _mm256_setzero_ps();
+    unsigned int k = 0;
+    for (; k + 16 <= n; k += 16) {
+        __m256 h0 = _mm256_loadu_ps(h + k);
+        __m256 h1 = _mm256_loadu_ps(h + k + 8);
+        si0 = _mm256_fmadd_ps(h0, _mm256_loadu_ps(xi + k), si0);
+        sq0 = _mm256_fmadd_ps(h0, _mm256_loadu_ps(xq + k), sq0);
+        si1 = _mm256_fmadd_ps(h1, _mm256_loadu_ps(xi + k + 8), si1);
+        sq1 = _mm256_fmadd_ps(h1, _mm256_loadu_ps(xq + k + 8), sq1);
+    }
+    for (; k + 8 <= n; k += 8) {
+        __m256 h0 = _mm256_loadu_ps(h + k);
+        si0 = _mm256_fmadd_ps(h0, _mm256_loadu_ps(xi + k), si0);
+        sq0 = _mm256_fmadd_ps(h0, _mm256_loadu_ps(xq + k), sq0);
+    }
+    float ti, tq;
+    dot_complex_scalar(h + k, xi + k, xq + k, n - k, &ti, &tq);
+    *yi = hsum_ps(_mm256_add_ps(si0, si1)) + ti;
+    *yq = hsum_ps(_mm256_add_ps(sq0, sq1)) + tq;
+}
+#endif /* HAVE_X86_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+static void mix_iq16_neon(const short *iq, float *out_i, float *out_q, unsigned int n, double phase, double phase_inc)
+{
+    float lane_r[4];
+    float lane_i[4];
+    for (int k = 0; k < 4; k++) {
+        lane_r[k] = cos(2 * M_PI * (phase + k * phase_inc));
+        lane_i[k] = sin(2 * M_PI * (phase + k * phase_inc));
+    }
+    float32x4_t pr = vld1q_f32(lane_r);
+    float32x4_t pi = vld1q_f32(lane_i);
+    float wr = cos(2 * M_PI * 4 * phase_inc);
+    float wi = sin(2 * M_PI * 4 * phase_inc);
+    unsigned int i = 0;
+    for (; i + 4 <= n; i += 4) {
+        int16x4x2_t v = vld2_s16(iq + 2*i);
+        float32x4_t xr = vcvtq_f32_s32(vmovl_s16(v.val[0]));
+        float32x4_t xq = vcvtq_f32_s32(vmovl_s16(v.val[1]));
+        vst1q_f32(out_i + i, vmlsq_f32(vmulq_f32(xr, pr), xq, pi));
+        vst1q_f32(out_q + i, vmlaq_f32(vmulq_f32(xr, pi), xq, pr));
+        float32x4_t npr = vmlsq_n_f32(vmulq_n_f32(pr, wr), pi, wi);
+        pi = vmlaq_n_f32(vmulq_n_f32(pr, wi), pi, wr);
+        pr = npr;
+    }
+    mix_iq16_scalar(iq + 2*i, out_i + i, out_q + i, n - i, phase + i * phase_inc, phase_inc);
+}
+
+static void dot_complex_neon(const float *h, const float *xi, const float *xq, unsigned int n, float *yi, float *yq)
+{
+    float32x4_t si0 = vdupq_n_f32(0);
+    float32x4_t si1 = vdupq_n_f32(0);
+    float32x4_t sq0 = vdupq_n_f32(0);
+    float32x4_t sq1 = vdupq_n_f32(0);
+    unsigned int k = 0;
+    for (; k + 8 <= n; k += 8) {
+        float32x4_t h0 = vld1q_f32(h + k);
+        float32x4_t h1 = vld1q_f32(h + k + 4);
+        si0 = vfmaq_f32(si0, h0, vld1q_f32(xi + k));
+        sq0 = vfmaq_f32(sq0, h0, vld1q_f32(xq + k));
+        si1 = vfmaq_f32(si1, h1, vld1q_f32(xi + k + 4));
+        sq1 = vfmaq_f32(sq1, h1, vld1q_f32(xq + k + 4));
+    }
+    float ti, tq;
+    dot_complex_scalar(h + k, xi + k, xq + k, n - k, &ti, &tq);
+    *yi = vaddvq_f32(vaddq_f32(si0, si1)) + ti;
+    *yq = vaddvq_f32(vaddq_f32(sq0, sq1)) + tq;
+}
+#endif /* HAVE_NEON_KERNELS */
+
+/* pick the best kernels for this CPU; must be called before the channelizer starts */
+void dsp_kernels_init(void)
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma")) {
+        mix_iq16 = mix_iq16_avx2;
+        dot_complex = dot_complex_avx2;
+        kernels_name = "avx2+fma";
+    }
+#elif defined(HAVE_NEON_KERNELS)
+    mix_iq16 = mix_iq16_neon;
+    dot_complex = dot_complex_neon;
+    kernels_name = "neon";
+#endif
+}
+
+const char *dsp_kernels_name(void)
+{
+    return kernels_name;
+}
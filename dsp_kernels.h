@@ -0,0 +1,28 @@
+/* DSP kernels for the channelizer: NCO mixer and complex FIR dot product
+ * (AVX2/FMA/NEON with runtime CPU dispatch and a scalar fallback)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef DSP_KERNELS_H
+#define DSP_KERNELS_H
+
+/* multiply interleaved 16 bit I/Q samples by exp(j*2*pi*(phase + n*phase_inc))
+ * and store them split into out_i and out_q; phase and phase_inc are in
+ * cycles. The phasor is updated recursively, so callers should keep n small
+ * (a few thousand samples) and pass an exact starting phase on every call */
+typedef void (*MixIQ16Fn)(const short *iq, float *out_i, float *out_q, unsigned int n, double phase, double phase_inc);
+/* y = sum(h[k] * x[k]) for k in [0, n) with a real h and a complex (split) x */
+typedef void (*DotComplexFn)(const float *h, const float *xi, const float *xq, unsigned int n, float *yi, float *yq);
+
+extern MixIQ16Fn mix_iq16;
+extern DotComplexFn dot_complex;
+
+void dsp_kernels_init(void);
+const char *dsp_kernels_name(void);
+
+#endif /* DSP_KERNELS_H */
@@ -0,0 +1,101 @@
+/* minimal in-place radix-2 complex FFT (interleaved re/im floats)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "fft.h"
+
+static void fft(const FFTPlan *plan, float *data, float sign);
+
+
+int fft_plan_init(FFTPlan *plan, unsigned int size)
+{
+    if (size < 2 || (size & (size - 1)) != 0) {
+        fprintf(stderr, "FFT size (%u) must be a power of two\n", size);
+        return -1;
+    }
+    plan->size = size;
+    plan->log2_size = 0;
+    while ((1u << plan->log2_size) < size) {
+        plan->log2_size++;
+    }
+    plan->twiddles = (float *) malloc(size * sizeof(float));
+    plan->bitrev = (unsigned int *) malloc(size * sizeof(unsigned int));
+    if (plan->twiddles == NULL || plan->bitrev == NULL) {
+        fprintf(stderr, "FFT plan allocation failed\n");
+        fft_plan_free(plan);
+        return -1;
+    }
+    for (unsigned int k = 0; k < size / 2; k++) {
+        plan->twiddles[2*k] = cos(2 * M_PI * k / size);
+        plan->twiddles[2*k+1] = -sin(2 * M_PI * k / size);
+    }
+    for (unsigned int i = 0; i < size; i++) {
+        unsigned int r = 0;
+        for (unsigned int b = 0; b < plan->log2_size; b++) {
+            r |= ((i >> b) & 1) << (plan->log2_size - 1 - b);
+        }
+        plan->bitrev[i] = r;
+    }
+    return 0;
+}
+
+void fft_plan_free(FFTPlan *plan)
+{
+    free(plan->twiddles);
+    free(plan->bitrev);
+    plan->twiddles = NULL;
+    plan->bitrev = NULL;
+}
+
+void fft_forward(const FFTPlan *plan, float *data)
+{
+    fft(plan, data, 1.0f);
+}
+
+void fft_inverse(const FFTPlan *plan, float *data)
+{
+    fft(plan, data, -1.0f);
+}
+
+/* iterative decimation in time; sign = -1 conjugates the twiddles */
+static void fft(const FFTPlan *plan, float *data, float sign)
+{
+    unsigned int size = plan->size;
+    for (unsigned int i = 0; i < size; i++) {
+        unsigned int j = plan->bitrev[i];
+        if (i < j) {
+            float re = data[2*i];
+            float im = data[2*i+1];
+            data[2*i] = data[2*j];
+            data[2*i+1] = data[2*j+1];
+            data[2*j] = re;
+            data[2*j+1] = im;
+        }
+    }
+    for (unsigned int half = 1; half < size; half *= 2) {
+        unsigned int stride = size / (2 * half);
+        for (unsigned int start = 0; start < size; start += 2 * half) {
+            for (unsigned int k = 0; k < half; k++) {
+                float wr = plan->twiddles[2*k*stride];
+                float wi = sign * plan->twiddles[2*k*stride+1];
+                float *a = data + 2 * (start + k);
+                float *b = data + 2 * (start + k + half);
+                float tr = b[0] * wr - b[1] * wi;
+                float ti = b[0] * wi + b[1] * wr;
+                b[0] = a[0] - tr;
+                b[1] = a[1] - ti;
+                a[0] += tr;
+                a[1] += ti;
+            }
+        }
+    }
+}
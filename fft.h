@@ -0,0 +1,26 @@
+/* minimal in-place radix-2 complex FFT (interleaved re/im floats)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef FFT_H
+#define FFT_H
+
+typedef struct {
+    unsigned int size;          /* power of two */
+    unsigned int log2_size;
+    float *twiddles;            /* size/2 complex values exp(-j*2*pi*k/size) */
+    unsigned int *bitrev;
+} FFTPlan;
+
+int fft_plan_init(FFTPlan *plan, unsigned int size);
+void fft_plan_free(FFTPlan *plan);
+/* unnormalized: inverse(forward(x)) = size * x */
+void fft_forward(const FFTPlan *plan, float *data);
+void fft_inverse(const FFTPlan *plan, float *data);
+
+#endif /* FFT_H */
@@ -0,0 +1,249 @@
+/* iqchunk extract: reads back a compressed recording (-z), i.e. a chunked
+ * container (see sample_codec.h), and writes out the iq16 stream, or just
+ * checks it
+ * - the chunks are read in sequence, from one chunk header to the next, so
+ *   a container without the index at the end (e.g. the recorder was
+ *   killed) can still be extracted
+ * - every chunk is decoded, and its frames and position are checked; when
+ *   the index is there, it is checked against the chunks
+ * - the output is the iq16 file the recorder would have written without
+ *   -z, so the SigMF metadata of the recording applies to it as is
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _FILE_OFFSET_BITS 64
+
+#include <errno.h>
+#include <getopt.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample_codec.h"
+
+#define FRAME_SIZE (2 * sizeof(short))
+
+static void usage(const char* progname);
+static int check_index(FILE *fp, const char *filename, const ChunkIndexEntry *chunks, uint64_t nchunks, uint64_t index_offset);
+
+
+int main(int argc, char *argv[])
+{
+    int verbose = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "vh")) != -1) {
+        switch (c) {
+            case 'v':
+                verbose = 1;
+                break;
+
+            /* other options */
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            case '?':
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (optind >= argc || argc - optind > 2) {
+        usage(argv[0]);
+        exit(1);
+    }
+    const char *input_file = argv[optind];
+    const char *output_file = optind + 1 < argc ? argv[optind + 1] : NULL;
+
+    FILE *fp = fopen(input_file, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "fopen(%s) failed: %s\n", input_file, strerror(errno));
+        exit(1);
+    }
+    ChunkFileHeader file_header;
+    if (fread(&file_header, sizeof(file_header), 1, fp) != 1 ||
+        memcmp(file_header.magic, CHUNK_FILE_MAGIC, sizeof(file_header.magic)) != 0) {
+        fprintf(stderr, "%s: not a chunked container\n", input_file);
+        exit(1);
+    }
+    if (file_header.version != CHUNK_FILE_VERSION || file_header.frame_size != FRAME_SIZE ||
+        file_header.chunk_frames == 0 || file_header.block_frames != SAMPLE_CODEC_BLOCK_FRAMES) {
+        fprintf(stderr, "%s: unsupported container (version=%u frame_size=%u chunk_frames=%u block_frames=%u)\n", input_file,
+                file_header.version, file_header.frame_size, file_header.chunk_frames, file_header.block_frames);
+        exit(1);
+    }
+
+    FILE *out = NULL;
+    if (output_file != NULL) {
+        out = strcmp(output_file, "-") == 0 ? stdout : fopen(output_file, "wb");
+        if (out == NULL) {
+            fprintf(stderr, "fopen(%s) failed: %s\n", output_file, strerror(errno));
+            exit(1);
+        }
+    }
+
+    size_t max_size = file_header.chunk_frames * FRAME_SIZE;
+    unsigned char *payload = (unsigned char *) malloc(max_size);
+    short *frames = (short *) malloc(max_size);
+    ChunkIndexEntry *chunks = NULL;
+    size_t chunks_capacity = 0;
+    if (payload == NULL || frames == NULL) {
+        fprintf(stderr, "buffer allocation failed\n");
+        exit(1);
+    }
+
+    int ret = 0;
+    uint64_t nchunks = 0;
+    uint64_t next_frame = 0;
+    uint64_t raw_chunks = 0;
+    uint64_t packed_bytes = 0;
+    uint64_t offset = sizeof(file_header);
+    while (1) {
+        ChunkHeader header;
+        if (fread(&header, sizeof(header), 1, fp) != 1) {
+            if (ferror(fp)) {
+                fprintf(stderr, "fread(%s) failed: %s\n", input_file, strerror(errno));
+                ret = -1;
+            }
+            break;
+        }
+        /* the index (or garbage) after the last chunk */
+        if (header.magic != CHUNK_MAGIC) {
+            break;
+        }
+        if (header.nframes == 0 || header.nframes > file_header.chunk_frames || header.size > max_size ||
+            (header.codec == CHUNK_CODEC_RAW && header.size != header.nframes * FRAME_SIZE) ||
+            (header.codec != CHUNK_CODEC_RAW && header.codec != CHUNK_CODEC_RICE)) {
+            fprintf(stderr, "chunk %llu at offset %llu: invalid header (codec=%u nframes=%u size=%u)\n", (unsigned long long)nchunks,
+                    (unsigned long long)offset, header.codec, header.nframes, header.size);
+            ret = -1;
+            break;
+        }
+        if (fread(payload, 1, header.size, fp) != header.size) {
+            fprintf(stderr, "chunk %llu at offset %llu: truncated\n", (unsigned long long)nchunks, (unsigned long long)offset);
+            ret = -1;
+            break;
+        }
+        if (header.first_frame != next_frame) {
+            fprintf(stderr, "chunk %llu at offset %llu: first frame %llu, expected %llu\n", (unsigned long long)nchunks,
+                    (unsigned long long)offset, (unsigned long long)header.first_frame, (unsigned long long)next_frame);
+            ret = -1;
+        }
+        const void *data = payload;
+        if (header.codec == CHUNK_CODEC_RICE) {
+            if (sample_codec_decode(payload, header.size, frames, header.nframes) == -1) {
+                fprintf(stderr, "chunk %llu at offset %llu: corrupt payload\n", (unsigned long long)nchunks, (unsigned long long)offset);
+                ret = -1;
+                break;
+            }
+            data = frames;
+        } else {
+            raw_chunks++;
+        }
+        if (verbose) {
+            fprintf(stderr, "chunk %llu: offset=%llu first_frame=%llu nframes=%u codec=%s size=%u\n", (unsigned long long)nchunks,
+                    (unsigned long long)offset, (unsigned long long)header.first_frame, header.nframes,
+                    header.codec == CHUNK_CODEC_RICE ? "rice" : "raw", header.size);
+        }
+        if (out != NULL && fwrite(data, FRAME_SIZE, header.nframes, out) != header.nframes) {
+            fprintf(stderr, "fwrite(%s) failed: %s\n", output_file, strerror(errno));
+            ret = -1;
+            break;
+        }
+
+        /* what the index should say */
+        if (nchunks == chunks_capacity) {
+            chunks_capacity = chunks_capacity > 0 ? 2 * chunks_capacity : 1024;
+            ChunkIndexEntry *new_chunks = (ChunkIndexEntry *) realloc(chunks, chunks_capacity * sizeof(ChunkIndexEntry));
+            if (new_chunks == NULL) {
+                fprintf(stderr, "realloc() failed: %s\n", strerror(errno));
+                exit(1);
+            }
+            chunks = new_chunks;
+        }
+        ChunkIndexEntry *entry = &chunks[nchunks];
+        entry->offset = offset;
+        entry->first_frame = header.first_frame;
+        entry->nframes = header.nframes;
+        entry->size = header.size;
+
+        nchunks++;
+        next_frame = header.first_frame + header.nframes;
+        packed_bytes += sizeof(header) + header.size;
+        offset += sizeof(header) + header.size;
+    }
+
+    /* not checked after a bad chunk */
+    int index_ok = 2;
+    if (ret == 0) {
+        index_ok = check_index(fp, input_file, chunks, nchunks, offset);
+        if (index_ok == -1) {
+            ret = -1;
+        }
+    }
+    fclose(fp);
+    if (out != NULL && out != stdout && fclose(out) != 0) {
+        fprintf(stderr, "fclose(%s) failed: %s\n", output_file, strerror(errno));
+        ret = -1;
+    }
+
+    fprintf(stderr, "chunks=%llu raw_chunks=%llu frames=%llu ratio=%.3lf index=%s%s\n", (unsigned long long)nchunks,
+            (unsigned long long)raw_chunks, (unsigned long long)next_frame,
+            packed_bytes > 0 ? (double)(next_frame * FRAME_SIZE) / packed_bytes : 0.0,
+            index_ok == 1 ? "ok" : index_ok == 0 ? "missing" : index_ok == -1 ? "bad" : "unchecked", ret == 0 ? "" : " - errors");
+    free(payload);
+    free(frames);
+    free(chunks);
+    exit(ret == 0 ? 0 : 1);
+}
+
+static void usage(const char* progname)
+{
+    fprintf(stderr, "usage: %s [options...] <compressed recording> [<iq16 output file>|-]\n", progname);
+    fprintf(stderr, "    (without an output file the recording is just checked)\n");
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "    -v print each chunk\n");
+    fprintf(stderr, "    -h show usage\n");
+}
+
+/* the index right after the last chunk, and the trailer right after the
+ * index; returns 1 if they match the chunks, 0 if there is no trailer, -1
+ * if they don't match */
+static int check_index(FILE *fp, const char *filename, const ChunkIndexEntry *chunks, uint64_t nchunks, uint64_t index_offset)
+{
+    ChunkFileTrailer trailer;
+    if (fseeko(fp, -(off_t)sizeof(trailer), SEEK_END) != 0 || fread(&trailer, sizeof(trailer), 1, fp) != 1 ||
+        memcmp(trailer.magic, CHUNK_INDEX_MAGIC, sizeof(trailer.magic)) != 0) {
+        fprintf(stderr, "%s: no index (read in sequence)\n", filename);
+        return 0;
+    }
+    if (trailer.index_offset != index_offset || trailer.nchunks != nchunks) {
+        fprintf(stderr, "%s: the index (%llu chunks at offset %llu) doesn't match the chunks (%llu, ending at offset %llu)\n", filename,
+                (unsigned long long)trailer.nchunks, (unsigned long long)trailer.index_offset,
+                (unsigned long long)nchunks, (unsigned long long)index_offset);
+        return -1;
+    }
+    if (fseeko(fp, index_offset, SEEK_SET) != 0) {
+        fprintf(stderr, "fseeko(%s) failed: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    for (uint64_t i = 0; i < nchunks; i++) {
+        ChunkIndexEntry entry;
+        if (fread(&entry, sizeof(entry), 1, fp) != 1) {
+            fprintf(stderr, "%s: index truncated\n", filename);
+            return -1;
+        }
+        if (entry.offset != chunks[i].offset || entry.first_frame != chunks[i].first_frame ||
+            entry.nframes != chunks[i].nframes || entry.size != chunks[i].size) {
+            fprintf(stderr, "%s: index entry %llu doesn't match chunk %llu\n", filename, (unsigned long long)i, (unsigned long long)i);
+            return -1;
+        }
+    }
+    return 1;
+}
@@ -0,0 +1,74 @@
+/* log bucketed latency histogram (about 6% resolution) with percentiles
+ * recording a value is a few integer instructions and never allocates
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <string.h>
+
+#include "latency_histogram.h"
+
+static uint64_t bucket_value(int bucket);
+
+
+void latency_histogram_init(LatencyHistogram *histogram)
+{
+    memset(histogram->counts, 0, sizeof(histogram->counts));
+    histogram->total_count = 0;
+    histogram->min = UINT64_MAX;
+    histogram->max = 0;
+    histogram->sum = 0.0;
+}
+
+/* percentile in [0,100]; returns the upper edge of the matching bucket
+ * (clamped to the largest value recorded) */
+uint64_t latency_histogram_percentile(const LatencyHistogram *histogram, double percentile)
+{
+    if (histogram->total_count == 0) {
+        return 0;
+    }
+    uint64_t target = (uint64_t)(percentile / 100.0 * histogram->total_count + 0.5);
+    if (target == 0) {
+        target = 1;
+    }
+    uint64_t cumulative = 0;
+    for (int bucket = 0; bucket < LATENCY_HISTOGRAM_BUCKETS; bucket++) {
+        cumulative += histogram->counts[bucket];
+        if (cumulative >= target) {
+            uint64_t value = bucket + 1 < LATENCY_HISTOGRAM_BUCKETS ? bucket_value(bucket + 1) - 1 : UINT64_MAX;
+            return value < histogram->max ? value : histogram->max;
+        }
+    }
+    return histogram->max;
+}
+
+void latency_histogram_print(const LatencyHistogram *histogram, const char *name, FILE *stream)
+{
+    if (histogram->total_count == 0) {
+        fprintf(stream, "%s: count=0\n", name);
+        return;
+    }
+    fprintf(stream, "%s: count=%llu min=%llu avg=%.0lf p50=%llu p99=%llu p99.9=%llu max=%llu\n", name,
+            (unsigned long long)histogram->total_count,
+            (unsigned long long)histogram->min,
+            histogram->sum / histogram->total_count,
+            (unsigned long long)latency_histogram_percentile(histogram, 50.0),
+            (unsigned long long)latency_histogram_percentile(histogram, 99.0),
+            (unsigned long long)latency_histogram_percentile(histogram, 99.9),
+            (unsigned long long)histogram->max);
+}
+
+/* smallest value that goes into this bucket */
+static uint64_t bucket_value(int bucket)
+{
+    if (bucket < LATENCY_HISTOGRAM_SUB_BUCKETS) {
+        return bucket;
+    }
+    int shift = bucket / LATENCY_HISTOGRAM_SUB_BUCKETS - 1;
+    uint64_t mantissa = LATENCY_HISTOGRAM_SUB_BUCKETS + bucket % LATENCY_HISTOGRAM_SUB_BUCKETS;
+    return mantissa << shift;
+}
@@ -0,0 +1,217 @@
+/* non-blocking logging for the real time threads (stream and event
+ * callbacks): events go through a lock-free queue per producer thread and
+ * are printed by a background thread, with the dropped samples aggregated
+ * and the messages rate limited
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+
+#include "logger.h"
+
+#define LOGGER_POLL_INTERVAL_NS 10000000   /* 10ms */
+
+typedef enum {
+    LOG_EVENT_MESSAGE,
+    LOG_EVENT_DROPPED_SAMPLES,
+} LogEventType;
+
+typedef struct {
+    uint32_t type;
+    uint32_t dropped_samples;
+    char message[LOGGER_MESSAGE_SIZE];
+} LogEvent;
+
+_Static_assert(LOGGER_QUEUE_SIZE % sizeof(LogEvent) == 0, "the log queue size must be a multiple of the event size");
+
+static LogEvent *reserve_event(LogQueue *queue);
+static void *logger_thread(void *arg);
+static void logger_drain(Logger *logger);
+static void logger_flush_interval(Logger *logger, double interval);
+static uint64_t now_ns(void);
+
+
+void logger_init(Logger *logger, FILE *stream)
+{
+    memset(logger, 0, sizeof(Logger));
+    logger->stream = stream;
+    atomic_init(&logger->stop, 0);
+}
+
+LogQueue *logger_queue(Logger *logger, const char *name)
+{
+    if (logger->started || logger->nqueues == LOGGER_MAX_QUEUES) {
+        fprintf(stderr, "too many log queues (max %d)\n", LOGGER_MAX_QUEUES);
+        return NULL;
+    }
+    LogQueue *queue = &logger->queues[logger->nqueues];
+    if (ring_buffer_init(&queue->ring, LOGGER_QUEUE_SIZE) == -1) {
+        fprintf(stderr, "log queue allocation failed\n");
+        return NULL;
+    }
+    queue->name = name;
+    queue->dropped_samples = 0;
+    queue->drop_events = 0;
+    logger->nqueues++;
+    return queue;
+}
+
+int logger_start(Logger *logger)
+{
+    int ret = pthread_create(&logger->thread, NULL, logger_thread, logger);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        return -1;
+    }
+    logger->started = 1;
+    return 0;
+}
+
+void logger_stop(Logger *logger)
+{
+    if (!logger->started) {
+        return;
+    }
+    atomic_store(&logger->stop, 1);
+    pthread_join(logger->thread, NULL);
+    logger->started = 0;
+}
+
+void logger_free(Logger *logger)
+{
+    logger_stop(logger);
+    for (int i = 0; i < logger->nqueues; i++) {
+        ring_buffer_free(&logger->queues[i].ring);
+    }
+    logger->nqueues = 0;
+}
+
+/* events are written in place; on overrun they are lost (and counted in
+ * the ring statistics) */
+void log_dropped_samples(LogQueue *queue, unsigned int dropped_samples)
+{
+    LogEvent *event = reserve_event(queue);
+    if (event == NULL) {
+        return;
+    }
+    event->type = LOG_EVENT_DROPPED_SAMPLES;
+    event->dropped_samples = dropped_samples;
+    ring_buffer_commit(&queue->ring, sizeof(LogEvent));
+}
+
+void log_message(LogQueue *queue, const char *format, ...)
+{
+    LogEvent *event = reserve_event(queue);
+    if (event == NULL) {
+        return;
+    }
+    event->type = LOG_EVENT_MESSAGE;
+    event->dropped_samples = 0;
+    va_list ap;
+    va_start(ap, format);
+    vsnprintf(event->message, sizeof(event->message), format, ap);
+    va_end(ap);
+    ring_buffer_commit(&queue->ring, sizeof(LogEvent));
+}
+
+/* events never wrap around, since the ring size is a multiple of the event size */
+static LogEvent *reserve_event(LogQueue *queue)
+{
+    void *data1;
+    void *data2;
+    if (ring_buffer_reserve(&queue->ring, sizeof(LogEvent), &data1, &data2) == 0) {
+        return NULL;
+    }
+    return (LogEvent *)data1;
+}
+
+static void *logger_thread(void *arg)
+{
+    Logger *logger = (Logger *)arg;
+    struct timespec poll_interval = { 0, LOGGER_POLL_INTERVAL_NS };
+    uint64_t interval_start = now_ns();
+
+    while (1) {
+        int stop = atomic_load(&logger->stop);
+        logger_drain(logger);
+        uint64_t now = now_ns();
+        if (stop || now - interval_start >= LOGGER_AGGREGATION_INTERVAL_NS) {
+            logger_flush_interval(logger, (now - interval_start) * 1e-9);
+            interval_start = now;
+        }
+        if (stop) {
+            break;
+        }
+        nanosleep(&poll_interval, NULL);
+    }
+    return NULL;
+}
+
+static void logger_drain(Logger *logger)
+{
+    for (int i = 0; i < logger->nqueues; i++) {
+        LogQueue *queue = &logger->queues[i];
+        RingBuffer *ring = &queue->ring;
+        while (ring_buffer_read_available(ring) >= sizeof(LogEvent)) {
+            const void *data;
+            ring_buffer_peek(ring, &data);
+            const LogEvent *event = (const LogEvent *)data;
+            if (event->type == LOG_EVENT_DROPPED_SAMPLES) {
+                queue->dropped_samples += event->dropped_samples;
+                queue->drop_events++;
+            } else if (logger->messages < LOGGER_MAX_MESSAGES_PER_INTERVAL) {
+                if (queue->name != NULL) {
+                    fprintf(logger->stream, "%s: ", queue->name);
+                }
+                fprintf(logger->stream, "%s\n", event->message);
+                logger->messages++;
+            } else {
+                logger->suppressed_messages++;
+            }
+            ring_buffer_consume(ring, sizeof(LogEvent));
+        }
+    }
+}
+
+static void logger_flush_interval(Logger *logger, double interval)
+{
+    for (int i = 0; i < logger->nqueues; i++) {
+        LogQueue *queue = &logger->queues[i];
+        if (queue->drop_events > 0) {
+            if (queue->name != NULL) {
+                fprintf(logger->stream, "%s: ", queue->name);
+            }
+            fprintf(logger->stream, "dropped %llu samples in %llu events over last %.1lfs\n", queue->dropped_samples, queue->drop_events, interval);
+        }
+        queue->dropped_samples = 0;
+        queue->drop_events = 0;
+    }
+    if (logger->suppressed_messages > 0) {
+        fprintf(logger->stream, "(%llu messages suppressed over last %.1lfs)\n", logger->suppressed_messages, interval);
+    }
+    unsigned long long lost_events = 0;
+    for (int i = 0; i < logger->nqueues; i++) {
+        lost_events += logger->queues[i].ring.overruns;
+    }
+    if (lost_events > logger->lost_events) {
+        fprintf(logger->stream, "(%llu log events lost - queue full)\n", lost_events - logger->lost_events);
+        logger->lost_events = lost_events;
+    }
+    logger->messages = 0;
+    logger->suppressed_messages = 0;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
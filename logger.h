@@ -0,0 +1,63 @@
+/* non-blocking logging for the real time threads (stream and event
+ * callbacks): events go through a lock-free queue per producer thread and
+ * are printed by a background thread, with the dropped samples aggregated
+ * and the messages rate limited
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef LOGGER_H
+#define LOGGER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+#include "ring_buffer.h"
+
+#define LOGGER_MAX_QUEUES 32
+#define LOGGER_QUEUE_SIZE (64 * 1024)
+#define LOGGER_MESSAGE_SIZE 120     /* 128 bytes per event */
+#define LOGGER_AGGREGATION_INTERVAL_NS 1000000000   /* 1s */
+#define LOGGER_MAX_MESSAGES_PER_INTERVAL 10
+
+/* single producer (one thread), single consumer (the logger thread) */
+typedef struct {
+    RingBuffer ring;
+    const char *name;       /* prefix for its lines (NULL -> none) */
+    /* current aggregation interval (logger thread only) */
+    unsigned long long dropped_samples;
+    unsigned long long drop_events;
+} LogQueue;
+
+typedef struct {
+    LogQueue queues[LOGGER_MAX_QUEUES];
+    int nqueues;
+    FILE *stream;
+    pthread_t thread;
+    atomic_int stop;
+    int started;
+    /* current aggregation interval (logger thread only) */
+    unsigned int messages;
+    unsigned long long suppressed_messages;
+    unsigned long long lost_events;
+} Logger;
+
+void logger_init(Logger *logger, FILE *stream);
+/* one queue for each producer thread; all of them before logger_start();
+ * name (e.g. the serial number of the RSP) is printed before its lines */
+LogQueue *logger_queue(Logger *logger, const char *name);
+int logger_start(Logger *logger);
+/* print everything still queued, then stop the logger thread */
+void logger_stop(Logger *logger);
+void logger_free(Logger *logger);
+
+/* producer side: never block, never call into stdio */
+void log_dropped_samples(LogQueue *queue, unsigned int dropped_samples);
+void log_message(LogQueue *queue, const char *format, ...) __attribute__((format(printf, 2, 3)));
+
+#endif /* LOGGER_H */
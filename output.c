@@ -0,0 +1,88 @@
+/* output backends for the recorded I/Q stream
+ * plain write() backend (also used for stdout)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+
+typedef struct {
+    Output output;
+    int fd;
+} OutputFd;
+
+static ssize_t output_fd_write(Output *output, const void *data, size_t count);
+static int output_fd_close(Output *output);
+
+
+/* takes ownership of fd (except for stdout) */
+Output *output_fd_open(int fd)
+{
+    OutputFd *output_fd = (OutputFd *) malloc(sizeof(OutputFd));
+    if (output_fd == NULL) {
+        return NULL;
+    }
+    output_fd->output.name = "write";
+    output_fd->output.write = output_fd_write;
+    output_fd->output.close = output_fd_close;
+    output_fd->output.bytes_written = 0;
+    output_fd->fd = fd;
+    return &output_fd->output;
+}
+
+static ssize_t output_fd_write(Output *output, const void *data, size_t count)
+{
+    OutputFd *output_fd = (OutputFd *)output;
+    const unsigned char *p = (const unsigned char *)data;
+    size_t total = count;
+    while (count > 0) {
+        ssize_t nwritten = write(output_fd->fd, p, count);
+        if (nwritten == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "write() failed: %s\n", strerror(errno));
+            return -1;
+        }
+        p += nwritten;
+        count -= nwritten;
+        output->bytes_written += nwritten;
+    }
+    return total;
+}
+
+static int output_fd_close(Output *output)
+{
+    OutputFd *output_fd = (OutputFd *)output;
+    int ret = 0;
+    if (output_fsync(output_fd->fd) == -1) {
+        ret = -1;
+    }
+    if (output_fd->fd != STDOUT_FILENO) {
+        if (close(output_fd->fd) == -1) {
+            fprintf(stderr, "close(%d) failed: %s\n", output_fd->fd, strerror(errno));
+            ret = -1;
+        }
+    }
+    free(output_fd);
+    return ret;
+}
+
+int output_fsync(int fd)
+{
+    if (fsync(fd) == -1 && errno != EINVAL && errno != EROFS) {
+        fprintf(stderr, "fsync(%d) failed: %s\n", fd, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
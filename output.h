@@ -0,0 +1,56 @@
+/* output backends for the recorded I/Q stream
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+#define OUTPUT_MMAP_WINDOW_SIZE (64 * 1024 * 1024)
+#define OUTPUT_DIRECT_ALIGNMENT 4096
+#define OUTPUT_URING_BLOCK_SIZE (1024 * 1024)
+#define MAX_SEGMENT_FILENAME_SIZE 1024
+#define MAX_COMPRESSED_WORKERS 64
+
+typedef struct Output Output;
+
+/* every backend embeds this struct as its first member */
+struct Output {
+    const char *name;
+    /* write 'count' bytes; returns the bytes taken: count, or fewer if the
+     * backend dropped the rest rather than wait (an overrun; never part of
+     * a frame, as long as 'count' is whole frames), or -1 on error */
+    ssize_t (*write)(Output *output, const void *data, size_t count);
+    /* flush everything, close the output and free the backend */
+    int (*close)(Output *output);
+    unsigned long long bytes_written;
+};
+
+Output *output_fd_open(int fd);
+Output *output_mmap_open(const char *filename, unsigned long long expected_size, size_t window_size);
+Output *output_direct_open(const char *filename, size_t block_size);
+Output *output_uring_open(const char *filename, size_t block_size, unsigned int queue_depth, int may_block);
+/* compressed (iq16 only): chunks of chunk_size bytes compressed on nworkers
+ * threads and written to inner as a chunked container (see sample_codec.h);
+ * write() waits for a free chunk, and writes the compressed ones to inner,
+ * so it's only for the writer thread */
+Output *output_compressed_open(Output *inner, size_t chunk_size, unsigned int nworkers);
+
+/* fsync() that doesn't complain about pipes, sockets, and the like */
+int output_fsync(int fd);
+
+/* segmented output: each segment is opened with open_fn(filename, open_arg) */
+typedef Output *(*OutputOpenFn)(const char *filename, void *open_arg);
+Output *output_segmented_open(const char *filename, OutputOpenFn open_fn, void *open_arg,
+                              unsigned long long segment_bytes, double segment_seconds,
+                              size_t frame_size, unsigned int *segment_count);
+void output_segment_filename(const char *filename, unsigned int index, char *segment_filename, size_t size);
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,380 @@
+/* output backends for the recorded I/Q stream
+ * compressed output: the stream (iq16) is cut into fixed size chunks, which
+ * are compressed losslessly (sample_codec.c) on a pool of worker threads
+ * and written in order to another output, as a chunked container with an
+ * index at the end, so that a reader can seek to any chunk
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "output.h"
+#include "sample_codec.h"
+
+#define COMPRESSED_FRAME_SIZE (2 * sizeof(short))
+#define COMPRESSED_SLOTS_PER_WORKER 2
+
+typedef enum {
+    SLOT_FREE,
+    SLOT_QUEUED,                /* full, waiting for a worker (or being compressed) */
+    SLOT_DONE,                  /* compressed, waiting to be written */
+} SlotState;
+
+typedef struct {
+    unsigned char *raw;
+    unsigned char *packed;
+    size_t raw_size;
+    ChunkHeader header;
+    SlotState state;
+} CompressedSlot;
+
+typedef struct {
+    Output output;
+    Output *inner;
+    size_t chunk_size;
+    unsigned int nslots;
+    CompressedSlot *slots;
+    /* chunk sequence numbers: filled < queued, compressed by the workers
+     * starting from next_job, written in order starting from next_write */
+    unsigned long long next_chunk;      /* the one being filled */
+    unsigned long long next_job;
+    unsigned long long next_write;
+    int filling;                        /* slot of next_chunk taken */
+    unsigned long long frames;          /* frames taken so far */
+    uint64_t file_offset;
+    ChunkIndexEntry *index;
+    size_t nindex;
+    size_t index_capacity;
+    int write_error;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int done;
+    unsigned int nworkers;
+    pthread_t workers[MAX_COMPRESSED_WORKERS];
+    /* statistics */
+    unsigned long long raw_bytes;
+    unsigned long long packed_bytes;
+    unsigned long long raw_chunks;      /* that didn't compress */
+    unsigned long long waits;           /* for a free slot */
+} OutputCompressed;
+
+static ssize_t output_compressed_write(Output *output, const void *data, size_t count);
+static int output_compressed_close(Output *output);
+static int write_done_chunks(OutputCompressed *output_compressed);
+static int write_inner(OutputCompressed *output_compressed, const void *data, size_t count);
+static void *compress_thread(void *arg);
+static void free_slots(OutputCompressed *output_compressed);
+
+
+/* takes ownership of inner (closed with this output, or on failure) */
+Output *output_compressed_open(Output *inner, size_t chunk_size, unsigned int nworkers)
+{
+    chunk_size = chunk_size / COMPRESSED_FRAME_SIZE * COMPRESSED_FRAME_SIZE;
+    if (chunk_size == 0 || chunk_size / COMPRESSED_FRAME_SIZE > UINT32_MAX || nworkers == 0 || nworkers > MAX_COMPRESSED_WORKERS) {
+        fprintf(stderr, "invalid compressed output chunk size or number of workers\n");
+        inner->close(inner);
+        return NULL;
+    }
+    OutputCompressed *output_compressed = (OutputCompressed *) calloc(1, sizeof(OutputCompressed));
+    if (output_compressed == NULL) {
+        inner->close(inner);
+        return NULL;
+    }
+    output_compressed->output.name = "compressed";
+    output_compressed->output.write = output_compressed_write;
+    output_compressed->output.close = output_compressed_close;
+    output_compressed->output.bytes_written = 0;
+    output_compressed->inner = inner;
+    output_compressed->chunk_size = chunk_size;
+    output_compressed->nslots = nworkers * COMPRESSED_SLOTS_PER_WORKER;
+    output_compressed->slots = (CompressedSlot *) calloc(output_compressed->nslots, sizeof(CompressedSlot));
+    if (output_compressed->slots == NULL) {
+        inner->close(inner);
+        free(output_compressed);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < output_compressed->nslots; i++) {
+        CompressedSlot *slot = &output_compressed->slots[i];
+        slot->raw = (unsigned char *) malloc(chunk_size);
+        slot->packed = (unsigned char *) malloc(chunk_size);
+        if (slot->raw == NULL || slot->packed == NULL) {
+            free_slots(output_compressed);
+            inner->close(inner);
+            free(output_compressed);
+            return NULL;
+        }
+        /* touch every page now, so the stream callback never page faults */
+        memset(slot->raw, 0, chunk_size);
+        memset(slot->packed, 0, chunk_size);
+        slot->state = SLOT_FREE;
+    }
+
+    ChunkFileHeader file_header;
+    memset(&file_header, 0, sizeof(file_header));
+    memcpy(file_header.magic, CHUNK_FILE_MAGIC, sizeof(file_header.magic));
+    file_header.version = CHUNK_FILE_VERSION;
+    file_header.frame_size = COMPRESSED_FRAME_SIZE;
+    file_header.chunk_frames = chunk_size / COMPRESSED_FRAME_SIZE;
+    file_header.block_frames = SAMPLE_CODEC_BLOCK_FRAMES;
+    if (write_inner(output_compressed, &file_header, sizeof(file_header)) == -1) {
+        free_slots(output_compressed);
+        inner->close(inner);
+        free(output_compressed);
+        return NULL;
+    }
+
+    pthread_mutex_init(&output_compressed->mutex, NULL);
+    pthread_cond_init(&output_compressed->cond, NULL);
+    for (unsigned int i = 0; i < nworkers; i++) {
+        int ret = pthread_create(&output_compressed->workers[i], NULL, compress_thread, output_compressed);
+        if (ret != 0) {
+            fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+            /* let the workers already started exit */
+            pthread_mutex_lock(&output_compressed->mutex);
+            output_compressed->done = 1;
+            pthread_cond_broadcast(&output_compressed->cond);
+            pthread_mutex_unlock(&output_compressed->mutex);
+            for (unsigned int j = 0; j < i; j++) {
+                pthread_join(output_compressed->workers[j], NULL);
+            }
+            pthread_mutex_destroy(&output_compressed->mutex);
+            pthread_cond_destroy(&output_compressed->cond);
+            free_slots(output_compressed);
+            inner->close(inner);
+            free(output_compressed);
+            return NULL;
+        }
+    }
+    output_compressed->nworkers = nworkers;
+    return &output_compressed->output;
+}
+
+static ssize_t output_compressed_write(Output *output, const void *data, size_t count)
+{
+    OutputCompressed *output_compressed = (OutputCompressed *)output;
+    const unsigned char *p = (const unsigned char *)data;
+    size_t total = count;
+    int ret = 0;
+
+    pthread_mutex_lock(&output_compressed->mutex);
+    while (count > 0) {
+        CompressedSlot *slot = &output_compressed->slots[output_compressed->next_chunk % output_compressed->nslots];
+        if (!output_compressed->filling) {
+            if (write_done_chunks(output_compressed) == -1) {
+                ret = -1;
+            }
+            /* every slot is busy: wait (it's the writer thread) */
+            if (slot->state != SLOT_FREE) {
+                output_compressed->waits++;
+            }
+            while (slot->state != SLOT_FREE) {
+                pthread_cond_wait(&output_compressed->cond, &output_compressed->mutex);
+                if (write_done_chunks(output_compressed) == -1) {
+                    ret = -1;
+                }
+            }
+            slot->raw_size = 0;
+            slot->header.first_frame = output_compressed->frames;
+            output_compressed->filling = 1;
+        }
+        /* the workers never touch the slot being filled */
+        pthread_mutex_unlock(&output_compressed->mutex);
+        size_t n = output_compressed->chunk_size - slot->raw_size;
+        if (n > count) {
+            n = count;
+        }
+        memcpy(slot->raw + slot->raw_size, p, n);
+        slot->raw_size += n;
+        output_compressed->frames += n / COMPRESSED_FRAME_SIZE;
+        output->bytes_written += n;
+        p += n;
+        count -= n;
+        pthread_mutex_lock(&output_compressed->mutex);
+        if (slot->raw_size == output_compressed->chunk_size) {
+            slot->state = SLOT_QUEUED;
+            output_compressed->next_chunk++;
+            output_compressed->filling = 0;
+            pthread_cond_broadcast(&output_compressed->cond);
+        }
+    }
+    if (write_done_chunks(output_compressed) == -1) {
+        ret = -1;
+    }
+    pthread_mutex_unlock(&output_compressed->mutex);
+    return ret == -1 ? -1 : (ssize_t)total;
+}
+
+static int output_compressed_close(Output *output)
+{
+    OutputCompressed *output_compressed = (OutputCompressed *)output;
+    int ret = 0;
+
+    pthread_mutex_lock(&output_compressed->mutex);
+    if (output_compressed->filling) {
+        CompressedSlot *slot = &output_compressed->slots[output_compressed->next_chunk % output_compressed->nslots];
+        if (slot->raw_size > 0) {
+            slot->state = SLOT_QUEUED;
+            output_compressed->next_chunk++;
+            pthread_cond_broadcast(&output_compressed->cond);
+        }
+        output_compressed->filling = 0;
+    }
+    while (output_compressed->next_write < output_compressed->next_chunk) {
+        if (write_done_chunks(output_compressed) == -1) {
+            ret = -1;
+        }
+        if (output_compressed->next_write < output_compressed->next_chunk) {
+            pthread_cond_wait(&output_compressed->cond, &output_compressed->mutex);
+        }
+    }
+    output_compressed->done = 1;
+    pthread_cond_broadcast(&output_compressed->cond);
+    pthread_mutex_unlock(&output_compressed->mutex);
+    for (unsigned int i = 0; i < output_compressed->nworkers; i++) {
+        pthread_join(output_compressed->workers[i], NULL);
+    }
+
+    /* index and trailer */
+    ChunkFileTrailer trailer;
+    memset(&trailer, 0, sizeof(trailer));
+    trailer.index_offset = output_compressed->file_offset;
+    trailer.nchunks = output_compressed->nindex;
+    memcpy(trailer.magic, CHUNK_INDEX_MAGIC, sizeof(trailer.magic));
+    if (write_inner(output_compressed, output_compressed->index, output_compressed->nindex * sizeof(ChunkIndexEntry)) == -1 ||
+        write_inner(output_compressed, &trailer, sizeof(trailer)) == -1) {
+        ret = -1;
+    }
+
+    fprintf(stderr, "compressed: workers=%u chunk_size=%zu chunks=%llu raw_chunks=%llu ratio=%.3lf waits=%llu\n",
+            output_compressed->nworkers, output_compressed->chunk_size, output_compressed->next_write,
+            output_compressed->raw_chunks,
+            output_compressed->packed_bytes > 0 ? (double)output_compressed->raw_bytes / output_compressed->packed_bytes : 0.0,
+            output_compressed->waits);
+
+    if (output_compressed->inner->close(output_compressed->inner) == -1) {
+        ret = -1;
+    }
+    pthread_mutex_destroy(&output_compressed->mutex);
+    pthread_cond_destroy(&output_compressed->cond);
+    free_slots(output_compressed);
+    free(output_compressed->index);
+    free(output_compressed);
+    return ret;
+}
+
+/* write the compressed chunks that are next in order (with the mutex held;
+ * the inner write is done without it) */
+static int write_done_chunks(OutputCompressed *output_compressed)
+{
+    int ret = 0;
+    while (output_compressed->next_write < output_compressed->next_chunk) {
+        CompressedSlot *slot = &output_compressed->slots[output_compressed->next_write % output_compressed->nslots];
+        if (slot->state != SLOT_DONE) {
+            break;
+        }
+        if (output_compressed->nindex == output_compressed->index_capacity) {
+            size_t capacity = output_compressed->index_capacity > 0 ? 2 * output_compressed->index_capacity : 1024;
+            ChunkIndexEntry *index = (ChunkIndexEntry *) realloc(output_compressed->index, capacity * sizeof(ChunkIndexEntry));
+            if (index != NULL) {
+                output_compressed->index = index;
+                output_compressed->index_capacity = capacity;
+            } else {
+                /* without the index the container is no good anyway */
+                fprintf(stderr, "realloc() failed: %s\n", strerror(errno));
+                output_compressed->write_error = 1;
+            }
+        }
+        if (output_compressed->nindex < output_compressed->index_capacity) {
+            ChunkIndexEntry *entry = &output_compressed->index[output_compressed->nindex++];
+            entry->offset = output_compressed->file_offset;
+            entry->first_frame = slot->header.first_frame;
+            entry->nframes = slot->header.nframes;
+            entry->size = slot->header.size;
+        }
+
+        pthread_mutex_unlock(&output_compressed->mutex);
+        const unsigned char *payload = slot->header.codec == CHUNK_CODEC_RAW ? slot->raw : slot->packed;
+        if (write_inner(output_compressed, &slot->header, sizeof(slot->header)) == -1 ||
+            write_inner(output_compressed, payload, slot->header.size) == -1) {
+            ret = -1;
+        }
+        pthread_mutex_lock(&output_compressed->mutex);
+        output_compressed->raw_bytes += slot->raw_size;
+        output_compressed->packed_bytes += sizeof(slot->header) + slot->header.size;
+        if (slot->header.codec == CHUNK_CODEC_RAW) {
+            output_compressed->raw_chunks++;
+        }
+        slot->state = SLOT_FREE;
+        output_compressed->next_write++;
+        pthread_cond_broadcast(&output_compressed->cond);
+    }
+    return ret;
+}
+
+/* after the first error every write fails, so that the container doesn't
+ * go on with a hole in it */
+static int write_inner(OutputCompressed *output_compressed, const void *data, size_t count)
+{
+    if (output_compressed->write_error) {
+        return -1;
+    }
+    if (output_compressed->inner->write(output_compressed->inner, data, count) != (ssize_t)count) {
+        output_compressed->write_error = 1;
+        return -1;
+    }
+    output_compressed->file_offset += count;
+    return 0;
+}
+
+static void *compress_thread(void *arg)
+{
+    OutputCompressed *output_compressed = (OutputCompressed *)arg;
+    pthread_mutex_lock(&output_compressed->mutex);
+    while (1) {
+        while (output_compressed->next_job >= output_compressed->next_chunk && !output_compressed->done) {
+            pthread_cond_wait(&output_compressed->cond, &output_compressed->mutex);
+        }
+        if (output_compressed->next_job >= output_compressed->next_chunk) {
+            break;
+        }
+        CompressedSlot *slot = &output_compressed->slots[output_compressed->next_job % output_compressed->nslots];
+        output_compressed->next_job++;
+        pthread_mutex_unlock(&output_compressed->mutex);
+
+        unsigned int nframes = slot->raw_size / COMPRESSED_FRAME_SIZE;
+        size_t size = 0;
+        if (slot->raw_size % COMPRESSED_FRAME_SIZE == 0) {
+            /* anything that doesn't come out smaller is stored raw */
+            size = sample_codec_encode((const short *)slot->raw, nframes, slot->packed, slot->raw_size - 1);
+        }
+        slot->header.magic = CHUNK_MAGIC;
+        slot->header.codec = size > 0 ? CHUNK_CODEC_RICE : CHUNK_CODEC_RAW;
+        slot->header.nframes = nframes;
+        slot->header.size = size > 0 ? size : slot->raw_size;
+
+        pthread_mutex_lock(&output_compressed->mutex);
+        slot->state = SLOT_DONE;
+        pthread_cond_broadcast(&output_compressed->cond);
+    }
+    pthread_mutex_unlock(&output_compressed->mutex);
+    return NULL;
+}
+
+static void free_slots(OutputCompressed *output_compressed)
+{
+    for (unsigned int i = 0; i < output_compressed->nslots; i++) {
+        free(output_compressed->slots[i].raw);
+        free(output_compressed->slots[i].packed);
+    }
+    free(output_compressed->slots);
+}
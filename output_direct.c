@@ -0,0 +1,246 @@
+/* output backends for the recorded I/Q stream
+ * O_DIRECT output file, written from page aligned double buffered blocks
+ * (one block is being filled while the other one is written to disk)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "output.h"
+
+typedef struct {
+    Output output;
+    int fd;
+    size_t block_size;
+    unsigned char *blocks[2];
+    int fill_block;       /* index of the block being filled */
+    size_t fill_used;
+    unsigned long long file_offset;
+    /* I/O thread */
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    int pending_block;    /* index of the block waiting to be written (or -1) */
+    size_t pending_size;
+    int stop;
+    int error;
+} OutputDirect;
+
+static ssize_t output_direct_write(Output *output, const void *data, size_t count);
+static int output_direct_close(Output *output);
+static void *output_direct_thread(void *arg);
+static int submit_block(OutputDirect *output_direct, size_t size);
+static int wait_block(OutputDirect *output_direct);
+
+
+Output *output_direct_open(const char *filename, size_t block_size)
+{
+    if (block_size == 0 || block_size % OUTPUT_DIRECT_ALIGNMENT != 0) {
+        fprintf(stderr, "O_DIRECT block size (%zu) must be a multiple of %d\n", block_size, OUTPUT_DIRECT_ALIGNMENT);
+        return NULL;
+    }
+
+    OutputDirect *output_direct = (OutputDirect *) malloc(sizeof(OutputDirect));
+    if (output_direct == NULL) {
+        return NULL;
+    }
+    output_direct->output.name = "direct";
+    output_direct->output.write = output_direct_write;
+    output_direct->output.close = output_direct_close;
+    output_direct->output.bytes_written = 0;
+    output_direct->block_size = block_size;
+    output_direct->fill_block = 0;
+    output_direct->fill_used = 0;
+    output_direct->file_offset = 0;
+    output_direct->pending_block = -1;
+    output_direct->pending_size = 0;
+    output_direct->stop = 0;
+    output_direct->error = 0;
+
+    for (int i = 0; i < 2; i++) {
+        void *block;
+        int ret = posix_memalign(&block, OUTPUT_DIRECT_ALIGNMENT, block_size);
+        if (ret != 0) {
+            fprintf(stderr, "posix_memalign() failed: %s\n", strerror(ret));
+            if (i == 1) {
+                free(output_direct->blocks[0]);
+            }
+            free(output_direct);
+            return NULL;
+        }
+        memset(block, 0, block_size);
+        output_direct->blocks[i] = (unsigned char *)block;
+    }
+
+    output_direct->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC | O_DIRECT, 0644);
+    if (output_direct->fd == -1) {
+        fprintf(stderr, "open(%s) with O_DIRECT for writing failed: %s\n", filename, strerror(errno));
+        free(output_direct->blocks[0]);
+        free(output_direct->blocks[1]);
+        free(output_direct);
+        return NULL;
+    }
+
+    pthread_mutex_init(&output_direct->mutex, NULL);
+    pthread_cond_init(&output_direct->cond, NULL);
+    int ret = pthread_create(&output_direct->thread, NULL, output_direct_thread, output_direct);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        pthread_mutex_destroy(&output_direct->mutex);
+        pthread_cond_destroy(&output_direct->cond);
+        close(output_direct->fd);
+        free(output_direct->blocks[0]);
+        free(output_direct->blocks[1]);
+        free(output_direct);
+        return NULL;
+    }
+    return &output_direct->output;
+}
+
+static ssize_t output_direct_write(Output *output, const void *data, size_t count)
+{
+    OutputDirect *output_direct = (OutputDirect *)output;
+    const unsigned char *p = (const unsigned char *)data;
+    size_t total = count;
+    while (count > 0) {
+        size_t n = output_direct->block_size - output_direct->fill_used;
+        if (n > count) {
+            n = count;
+        }
+        memcpy(output_direct->blocks[output_direct->fill_block] + output_direct->fill_used, p, n);
+        output_direct->fill_used += n;
+        output->bytes_written += n;
+        p += n;
+        count -= n;
+        if (output_direct->fill_used == output_direct->block_size) {
+            if (submit_block(output_direct, output_direct->block_size) == -1) {
+                return -1;
+            }
+        }
+    }
+    return total;
+}
+
+static int output_direct_close(Output *output)
+{
+    OutputDirect *output_direct = (OutputDirect *)output;
+    int ret = 0;
+
+    /* O_DIRECT writes must be a multiple of the alignment: pad the last
+     * block with zeros here and truncate the file to its real size below */
+    if (output_direct->fill_used > 0) {
+        size_t size = (output_direct->fill_used + OUTPUT_DIRECT_ALIGNMENT - 1) / OUTPUT_DIRECT_ALIGNMENT * OUTPUT_DIRECT_ALIGNMENT;
+        memset(output_direct->blocks[output_direct->fill_block] + output_direct->fill_used, 0, size - output_direct->fill_used);
+        if (submit_block(output_direct, size) == -1) {
+            ret = -1;
+        }
+    }
+    if (wait_block(output_direct) == -1) {
+        ret = -1;
+    }
+
+    pthread_mutex_lock(&output_direct->mutex);
+    output_direct->stop = 1;
+    pthread_cond_broadcast(&output_direct->cond);
+    pthread_mutex_unlock(&output_direct->mutex);
+    pthread_join(output_direct->thread, NULL);
+    pthread_mutex_destroy(&output_direct->mutex);
+    pthread_cond_destroy(&output_direct->cond);
+
+    if (ftruncate(output_direct->fd, output->bytes_written) == -1) {
+        fprintf(stderr, "ftruncate() failed: %s\n", strerror(errno));
+        ret = -1;
+    }
+    if (output_fsync(output_direct->fd) == -1) {
+        ret = -1;
+    }
+    if (close(output_direct->fd) == -1) {
+        fprintf(stderr, "close(%d) failed: %s\n", output_direct->fd, strerror(errno));
+        ret = -1;
+    }
+    free(output_direct->blocks[0]);
+    free(output_direct->blocks[1]);
+    free(output_direct);
+    return ret;
+}
+
+/* hand the block being filled to the I/O thread and switch to the other one
+ * (waiting for its previous write to complete first) */
+static int submit_block(OutputDirect *output_direct, size_t size)
+{
+    int ret = wait_block(output_direct);
+    pthread_mutex_lock(&output_direct->mutex);
+    output_direct->pending_block = output_direct->fill_block;
+    output_direct->pending_size = size;
+    pthread_cond_broadcast(&output_direct->cond);
+    pthread_mutex_unlock(&output_direct->mutex);
+    output_direct->fill_block ^= 1;
+    output_direct->fill_used = 0;
+    return ret;
+}
+
+static int wait_block(OutputDirect *output_direct)
+{
+    pthread_mutex_lock(&output_direct->mutex);
+    while (output_direct->pending_block != -1) {
+        pthread_cond_wait(&output_direct->cond, &output_direct->mutex);
+    }
+    int error = output_direct->error;
+    output_direct->error = 0;
+    pthread_mutex_unlock(&output_direct->mutex);
+    return error ? -1 : 0;
+}
+
+static void *output_direct_thread(void *arg)
+{
+    OutputDirect *output_direct = (OutputDirect *)arg;
+
+    pthread_mutex_lock(&output_direct->mutex);
+    while (1) {
+        while (output_direct->pending_block == -1 && !output_direct->stop) {
+            pthread_cond_wait(&output_direct->cond, &output_direct->mutex);
+        }
+        if (output_direct->pending_block == -1) {
+            break;
+        }
+        const unsigned char *block = output_direct->blocks[output_direct->pending_block];
+        size_t size = output_direct->pending_size;
+        pthread_mutex_unlock(&output_direct->mutex);
+
+        int error = 0;
+        size_t done = 0;
+        while (done < size) {
+            ssize_t nwritten = pwrite(output_direct->fd, block + done, size - done, output_direct->file_offset + done);
+            if (nwritten == -1) {
+                if (errno == EINTR) {
+                    continue;
+                }
+                fprintf(stderr, "pwrite() failed: %s\n", strerror(errno));
+                error = 1;
+                break;
+            }
+            done += nwritten;
+        }
+        output_direct->file_offset += size;
+
+        pthread_mutex_lock(&output_direct->mutex);
+        output_direct->pending_block = -1;
+        output_direct->error |= error;
+        pthread_cond_broadcast(&output_direct->cond);
+    }
+    pthread_mutex_unlock(&output_direct->mutex);
+    return NULL;
+}
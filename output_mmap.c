@@ -0,0 +1,305 @@
+/* output backends for the recorded I/Q stream
+ * memory mapped output file, preallocated with fallocate() and written
+ * through a rolling mmap() window; the next window is mapped and prefaulted
+ * for writing ahead of time, and the one that filled up is written back and
+ * unmapped, by a helper thread, so moving to the next window is just a
+ * pointer swap for whoever calls write(), without page faults after it
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "output.h"
+
+typedef struct {
+    Output output;
+    int fd;
+    size_t window_size;
+    /* current window - used only by the writing thread */
+    unsigned char *window;
+    unsigned long long window_offset;
+    size_t window_used;
+    unsigned long long waits;
+    /* shared with the helper thread */
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    unsigned char *next;                /* mapped ahead, at next_offset */
+    unsigned long long next_offset;
+    unsigned char *retired;             /* filled up, waiting for its writeback */
+    unsigned long long retired_offset;
+    int stop;
+    int error;
+    pthread_t thread;
+    /* helper thread only */
+    unsigned long long allocated_size;
+} OutputMmap;
+
+static ssize_t output_mmap_write(Output *output, const void *data, size_t count);
+static int output_mmap_close(Output *output);
+static int preallocate(OutputMmap *output_mmap, unsigned long long offset, unsigned long long len);
+static unsigned char *map_window(OutputMmap *output_mmap, unsigned long long offset);
+static void populate_window(OutputMmap *output_mmap, unsigned char *window);
+static void release_window(OutputMmap *output_mmap, unsigned char *window, unsigned long long offset);
+static int advance_window(OutputMmap *output_mmap);
+static void *output_mmap_thread(void *arg);
+
+
+Output *output_mmap_open(const char *filename, unsigned long long expected_size, size_t window_size)
+{
+    long page_size = sysconf(_SC_PAGESIZE);
+    if (window_size % page_size != 0) {
+        fprintf(stderr, "mmap window size (%zu) must be a multiple of the page size (%ld)\n", window_size, page_size);
+        return NULL;
+    }
+
+    OutputMmap *output_mmap = (OutputMmap *) calloc(1, sizeof(OutputMmap));
+    if (output_mmap == NULL) {
+        return NULL;
+    }
+    output_mmap->output.name = "mmap";
+    output_mmap->output.write = output_mmap_write;
+    output_mmap->output.close = output_mmap_close;
+    output_mmap->output.bytes_written = 0;
+    output_mmap->window_size = window_size;
+
+    output_mmap->fd = open(filename, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (output_mmap->fd == -1) {
+        fprintf(stderr, "open(%s) for writing failed: %s\n", filename, strerror(errno));
+        free(output_mmap);
+        return NULL;
+    }
+
+    /* preallocate the whole expected file size (rounded up to a whole window)
+     * in one go, to keep the file extents contiguous */
+    unsigned long long nwindows = (expected_size + window_size - 1) / window_size;
+    if (nwindows == 0) {
+        nwindows = 1;
+    }
+    if (preallocate(output_mmap, 0, nwindows * window_size) == -1 ||
+        (output_mmap->window = map_window(output_mmap, 0)) == NULL) {
+        close(output_mmap->fd);
+        free(output_mmap);
+        return NULL;
+    }
+    output_mmap->next_offset = window_size;
+
+    pthread_mutex_init(&output_mmap->mutex, NULL);
+    pthread_cond_init(&output_mmap->cond, NULL);
+    int ret = pthread_create(&output_mmap->thread, NULL, output_mmap_thread, output_mmap);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        pthread_mutex_destroy(&output_mmap->mutex);
+        pthread_cond_destroy(&output_mmap->cond);
+        munmap(output_mmap->window, window_size);
+        close(output_mmap->fd);
+        free(output_mmap);
+        return NULL;
+    }
+    return &output_mmap->output;
+}
+
+static ssize_t output_mmap_write(Output *output, const void *data, size_t count)
+{
+    OutputMmap *output_mmap = (OutputMmap *)output;
+    const unsigned char *p = (const unsigned char *)data;
+    size_t total = count;
+    while (count > 0) {
+        if (output_mmap->window_used == output_mmap->window_size) {
+            if (advance_window(output_mmap) == -1) {
+                return -1;
+            }
+        }
+        size_t n = output_mmap->window_size - output_mmap->window_used;
+        if (n > count) {
+            n = count;
+        }
+        memcpy(output_mmap->window + output_mmap->window_used, p, n);
+        output_mmap->window_used += n;
+        output->bytes_written += n;
+        p += n;
+        count -= n;
+    }
+    return total;
+}
+
+static int output_mmap_close(Output *output)
+{
+    OutputMmap *output_mmap = (OutputMmap *)output;
+    int ret = 0;
+
+    /* the helper thread retires the last full window before it exits */
+    pthread_mutex_lock(&output_mmap->mutex);
+    output_mmap->stop = 1;
+    pthread_cond_broadcast(&output_mmap->cond);
+    pthread_mutex_unlock(&output_mmap->mutex);
+    pthread_join(output_mmap->thread, NULL);
+    pthread_mutex_destroy(&output_mmap->mutex);
+    pthread_cond_destroy(&output_mmap->cond);
+    if (output_mmap->error) {
+        ret = -1;
+    }
+    if (output_mmap->next != NULL) {
+        munmap(output_mmap->next, output_mmap->window_size);
+    }
+    if (output_mmap->window != NULL) {
+        if (msync(output_mmap->window, output_mmap->window_size, MS_SYNC) == -1) {
+            fprintf(stderr, "msync() failed: %s\n", strerror(errno));
+            ret = -1;
+        }
+        munmap(output_mmap->window, output_mmap->window_size);
+    }
+    if (output_mmap->waits > 0) {
+        fprintf(stderr, "mmap: %llu waits for the next window (writeback slower than the stream)\n", output_mmap->waits);
+    }
+    /* give back the preallocated space we didn't use */
+    if (ftruncate(output_mmap->fd, output->bytes_written) == -1) {
+        fprintf(stderr, "ftruncate() failed: %s\n", strerror(errno));
+        ret = -1;
+    }
+    if (output_fsync(output_mmap->fd) == -1) {
+        ret = -1;
+    }
+    if (close(output_mmap->fd) == -1) {
+        fprintf(stderr, "close(%d) failed: %s\n", output_mmap->fd, strerror(errno));
+        ret = -1;
+    }
+    free(output_mmap);
+    return ret;
+}
+
+/* no fallback to a sparse file: a full disk would then be a SIGBUS on
+ * whoever writes to the mapping */
+static int preallocate(OutputMmap *output_mmap, unsigned long long offset, unsigned long long len)
+{
+    if (fallocate(output_mmap->fd, 0, offset, len) == -1) {
+        if (errno == EOPNOTSUPP) {
+            fprintf(stderr, "fallocate() failed: %s - the memory mapped output needs a filesystem that can preallocate\n", strerror(errno));
+        } else {
+            fprintf(stderr, "fallocate() failed: %s\n", strerror(errno));
+        }
+        return -1;
+    }
+    output_mmap->allocated_size = offset + len;
+    return 0;
+}
+
+static unsigned char *map_window(OutputMmap *output_mmap, unsigned long long offset)
+{
+    /* the recording ran longer than expected; grow the file one window at a time */
+    if (offset + output_mmap->window_size > output_mmap->allocated_size) {
+        if (preallocate(output_mmap, output_mmap->allocated_size, offset + output_mmap->window_size - output_mmap->allocated_size) == -1) {
+            return NULL;
+        }
+    }
+    void *window = mmap(NULL, output_mmap->window_size, PROT_READ | PROT_WRITE, MAP_SHARED, output_mmap->fd, offset);
+    if (window == MAP_FAILED) {
+        fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+        return NULL;
+    }
+    populate_window(output_mmap, (unsigned char *)window);
+    madvise(window, output_mmap->window_size, MADV_SEQUENTIAL);
+    return (unsigned char *)window;
+}
+
+/* take the page faults (and the filesystem page_mkwrite() of a shared file
+ * mapping) for the whole window now, rather than in write(): with
+ * MADV_POPULATE_WRITE (Linux 5.14), or else by writing to every page (the
+ * window isn't in use yet, and the preallocated file is all zeros) */
+static void populate_window(OutputMmap *output_mmap, unsigned char *window)
+{
+#ifdef MADV_POPULATE_WRITE
+    if (madvise(window, output_mmap->window_size, MADV_POPULATE_WRITE) == 0) {
+        return;
+    }
+#endif
+    long page_size = sysconf(_SC_PAGESIZE);
+    for (size_t offset = 0; offset < output_mmap->window_size; offset += page_size) {
+        ((volatile unsigned char *)window)[offset] = 0;
+    }
+}
+
+/* write back a window and wait for it, then drop its pages from both the
+ * mapping and the page cache, to keep page cache usage bounded */
+static void release_window(OutputMmap *output_mmap, unsigned char *window, unsigned long long offset)
+{
+    sync_file_range(output_mmap->fd, offset, output_mmap->window_size, SYNC_FILE_RANGE_WAIT_BEFORE | SYNC_FILE_RANGE_WRITE | SYNC_FILE_RANGE_WAIT_AFTER);
+    madvise(window, output_mmap->window_size, MADV_DONTNEED);
+    munmap(window, output_mmap->window_size);
+    posix_fadvise(output_mmap->fd, offset, output_mmap->window_size, POSIX_FADV_DONTNEED);
+}
+
+/* hand the window that just filled up to the helper thread and switch to
+ * the one it mapped ahead; waits only if the helper is still busy with the
+ * previous window (i.e. the disk doesn't keep up) */
+static int advance_window(OutputMmap *output_mmap)
+{
+    pthread_mutex_lock(&output_mmap->mutex);
+    if (output_mmap->retired != NULL || output_mmap->next == NULL) {
+        output_mmap->waits++;
+    }
+    while ((output_mmap->retired != NULL || output_mmap->next == NULL) && !output_mmap->error) {
+        pthread_cond_wait(&output_mmap->cond, &output_mmap->mutex);
+    }
+    if (output_mmap->next == NULL) {
+        pthread_mutex_unlock(&output_mmap->mutex);
+        return -1;
+    }
+    output_mmap->retired = output_mmap->window;
+    output_mmap->retired_offset = output_mmap->window_offset;
+    output_mmap->window = output_mmap->next;
+    output_mmap->window_offset = output_mmap->next_offset;
+    output_mmap->window_used = 0;
+    output_mmap->next = NULL;
+    output_mmap->next_offset += output_mmap->window_size;
+    pthread_cond_broadcast(&output_mmap->cond);
+    pthread_mutex_unlock(&output_mmap->mutex);
+    return 0;
+}
+
+static void *output_mmap_thread(void *arg)
+{
+    OutputMmap *output_mmap = (OutputMmap *)arg;
+
+    pthread_mutex_lock(&output_mmap->mutex);
+    while (1) {
+        /* the next window first: it is quick, and the writing thread may
+         * soon need it */
+        if (output_mmap->next == NULL && !output_mmap->error && !output_mmap->stop) {
+            unsigned long long offset = output_mmap->next_offset;
+            pthread_mutex_unlock(&output_mmap->mutex);
+            unsigned char *next = map_window(output_mmap, offset);
+            pthread_mutex_lock(&output_mmap->mutex);
+            output_mmap->next = next;
+            output_mmap->error = next == NULL;
+            pthread_cond_broadcast(&output_mmap->cond);
+        } else if (output_mmap->retired != NULL) {
+            unsigned char *retired = output_mmap->retired;
+            unsigned long long offset = output_mmap->retired_offset;
+            pthread_mutex_unlock(&output_mmap->mutex);
+            release_window(output_mmap, retired, offset);
+            pthread_mutex_lock(&output_mmap->mutex);
+            output_mmap->retired = NULL;
+            pthread_cond_broadcast(&output_mmap->cond);
+        } else if (output_mmap->stop) {
+            break;
+        } else {
+            pthread_cond_wait(&output_mmap->cond, &output_mmap->mutex);
+        }
+    }
+    pthread_mutex_unlock(&output_mmap->mutex);
+    return NULL;
+}
@@ -0,0 +1,276 @@
+/* output backends for the recorded I/Q stream
+ * segmented output: rotates the output file every N bytes or N seconds
+ * without stopping the stream; the next segment is opened ahead of time and
+ * the previous one is closed by a helper thread, so a rotation is just a
+ * pointer swap for whoever calls write()
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "output.h"
+
+typedef struct {
+    Output output;
+    char *filename;
+    OutputOpenFn open_fn;
+    void *open_arg;
+    unsigned long long segment_bytes;    /* 0 -> no size limit */
+    uint64_t segment_ns;                 /* 0 -> no time limit */
+    size_t frame_size;
+    unsigned int *segment_count;
+    /* used only by the writing thread */
+    Output *current;
+    unsigned int current_index;
+    unsigned long long current_bytes;
+    uint64_t current_start_ns;
+    unsigned long long late_rotations;
+    int late;                            /* the rotation due is late (counted once) */
+    /* shared with the helper thread */
+    _Atomic(Output *) next;
+    _Atomic(Output *) retired;
+    atomic_int stop;
+    atomic_int open_failed;
+    sem_t wakeup;
+    pthread_t thread;
+} OutputSegmented;
+
+static ssize_t output_segmented_write(Output *output, const void *data, size_t count);
+static int output_segmented_close(Output *output);
+static void *output_segmented_thread(void *arg);
+static int rotate(OutputSegmented *output_segmented);
+static ssize_t write_current(OutputSegmented *output_segmented, const void *data, size_t count);
+static uint64_t now_ns(void);
+
+
+Output *output_segmented_open(const char *filename, OutputOpenFn open_fn, void *open_arg,
+                              unsigned long long segment_bytes, double segment_seconds,
+                              size_t frame_size, unsigned int *segment_count)
+{
+    OutputSegmented *output_segmented = (OutputSegmented *) calloc(1, sizeof(OutputSegmented));
+    if (output_segmented == NULL) {
+        return NULL;
+    }
+    output_segmented->output.name = "segmented";
+    output_segmented->output.write = output_segmented_write;
+    output_segmented->output.close = output_segmented_close;
+    output_segmented->output.bytes_written = 0;
+    output_segmented->filename = strdup(filename);
+    output_segmented->open_fn = open_fn;
+    output_segmented->open_arg = open_arg;
+    /* segments always end on a whole frame (I/Q pair) */
+    output_segmented->segment_bytes = segment_bytes / frame_size * frame_size;
+    output_segmented->segment_ns = (uint64_t)(segment_seconds * 1e9);
+    output_segmented->frame_size = frame_size;
+    output_segmented->segment_count = segment_count;
+    atomic_init(&output_segmented->next, NULL);
+    atomic_init(&output_segmented->retired, NULL);
+    atomic_init(&output_segmented->stop, 0);
+    atomic_init(&output_segmented->open_failed, 0);
+
+    char segment_filename[MAX_SEGMENT_FILENAME_SIZE];
+    output_segment_filename(filename, 0, segment_filename, sizeof(segment_filename));
+    output_segmented->current = open_fn(segment_filename, open_arg);
+    if (output_segmented->current == NULL) {
+        free(output_segmented->filename);
+        free(output_segmented);
+        return NULL;
+    }
+    output_segmented->current_index = 0;
+    output_segmented->current_bytes = 0;
+    output_segmented->current_start_ns = now_ns();
+    *segment_count = 1;
+
+    sem_init(&output_segmented->wakeup, 0, 0);
+    int ret = pthread_create(&output_segmented->thread, NULL, output_segmented_thread, output_segmented);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        output_segmented->current->close(output_segmented->current);
+        sem_destroy(&output_segmented->wakeup);
+        free(output_segmented->filename);
+        free(output_segmented);
+        return NULL;
+    }
+    /* have the helper thread open the second segment right away */
+    sem_post(&output_segmented->wakeup);
+    return &output_segmented->output;
+}
+
+/* insert the segment index before the file name extension:
+ * noaa-SAMPLERATE.iq16 -> noaa-SAMPLERATE-000012.iq16 */
+void output_segment_filename(const char *filename, unsigned int index, char *segment_filename, size_t size)
+{
+    const char *basename = strrchr(filename, '/');
+    basename = basename != NULL ? basename + 1 : filename;
+    const char *extension = strrchr(basename, '.');
+    if (extension == NULL) {
+        extension = basename + strlen(basename);
+    }
+    snprintf(segment_filename, size, "%.*s-%06u%s", (int)(extension - filename), filename, index, extension);
+}
+
+static ssize_t output_segmented_write(Output *output, const void *data, size_t count)
+{
+    OutputSegmented *output_segmented = (OutputSegmented *)output;
+    const unsigned char *p = (const unsigned char *)data;
+    size_t total = count;
+
+    if (output_segmented->segment_ns > 0 && output_segmented->current_bytes > 0 &&
+        now_ns() - output_segmented->current_start_ns >= output_segmented->segment_ns) {
+        /* time is up: cut at the first frame boundary in this block */
+        size_t partial = output_segmented->current_bytes % output_segmented->frame_size;
+        size_t n = partial > 0 ? output_segmented->frame_size - partial : 0;
+        n = n < count ? n : count;
+        if (n > 0) {
+            ssize_t taken = write_current(output_segmented, p, n);
+            if (taken != (ssize_t)n) {
+                return taken;
+            }
+            p += n;
+            count -= n;
+        }
+        if (output_segmented->current_bytes % output_segmented->frame_size == 0) {
+            rotate(output_segmented);
+        }
+    }
+
+    while (count > 0) {
+        size_t n = count;
+        if (output_segmented->segment_bytes > 0) {
+            unsigned long long space = output_segmented->segment_bytes > output_segmented->current_bytes ? output_segmented->segment_bytes - output_segmented->current_bytes : 0;
+            if (space == 0 && rotate(output_segmented) == 0) {
+                space = output_segmented->segment_bytes;
+            }
+            if (space > 0 && n > space) {
+                n = space;
+            }
+        }
+        ssize_t taken = write_current(output_segmented, p, n);
+        if (taken != (ssize_t)n) {
+            /* the rest of this write is dropped too, so that what was
+             * taken is the beginning of it */
+            return taken == -1 ? -1 : (ssize_t)(total - count) + taken;
+        }
+        p += n;
+        count -= n;
+    }
+    return total;
+}
+
+/* only what the segment took counts, so that the segments still end on
+ * whole frames when it drops data */
+static ssize_t write_current(OutputSegmented *output_segmented, const void *data, size_t count)
+{
+    ssize_t taken = output_segmented->current->write(output_segmented->current, data, count);
+    if (taken > 0) {
+        output_segmented->current_bytes += taken;
+        output_segmented->output.bytes_written += taken;
+    }
+    return taken;
+}
+
+static int output_segmented_close(Output *output)
+{
+    OutputSegmented *output_segmented = (OutputSegmented *)output;
+
+    atomic_store(&output_segmented->stop, 1);
+    sem_post(&output_segmented->wakeup);
+    pthread_join(output_segmented->thread, NULL);
+    sem_destroy(&output_segmented->wakeup);
+
+    int ret = output_segmented->current->close(output_segmented->current);
+    /* the segment opened ahead of time was never used */
+    Output *next = atomic_exchange(&output_segmented->next, NULL);
+    if (next != NULL) {
+        next->close(next);
+        char segment_filename[MAX_SEGMENT_FILENAME_SIZE];
+        output_segment_filename(output_segmented->filename, output_segmented->current_index + 1, segment_filename, sizeof(segment_filename));
+        if (unlink(segment_filename) == -1) {
+            fprintf(stderr, "unlink(%s) failed: %s\n", segment_filename, strerror(errno));
+        }
+    }
+    *output_segmented->segment_count = output_segmented->current_index + 1;
+    if (output_segmented->late_rotations > 0) {
+        fprintf(stderr, "segmented output: %llu late rotations (next segment not ready)\n", output_segmented->late_rotations);
+    }
+    free(output_segmented->filename);
+    free(output_segmented);
+    return ret;
+}
+
+/* switch to the segment opened ahead of time by the helper thread; if it
+ * isn't ready yet keep writing to the current one and try again later */
+static int rotate(OutputSegmented *output_segmented)
+{
+    Output *next = NULL;
+    if (atomic_load(&output_segmented->retired) != NULL ||
+        (next = atomic_exchange(&output_segmented->next, NULL)) == NULL) {
+        if (!output_segmented->late) {
+            output_segmented->late = 1;
+            output_segmented->late_rotations++;
+        }
+        return -1;
+    }
+    output_segmented->late = 0;
+    atomic_store(&output_segmented->retired, output_segmented->current);
+    output_segmented->current = next;
+    output_segmented->current_index++;
+    output_segmented->current_bytes = 0;
+    output_segmented->current_start_ns = now_ns();
+    *output_segmented->segment_count = output_segmented->current_index + 1;
+    sem_post(&output_segmented->wakeup);
+    return 0;
+}
+
+static void *output_segmented_thread(void *arg)
+{
+    OutputSegmented *output_segmented = (OutputSegmented *)arg;
+    unsigned int next_index = 1;
+
+    while (1) {
+        sem_wait(&output_segmented->wakeup);
+        Output *retired = atomic_load(&output_segmented->retired);
+        if (retired != NULL) {
+            retired->close(retired);
+            atomic_store(&output_segmented->retired, NULL);
+        }
+        if (atomic_load(&output_segmented->stop)) {
+            break;
+        }
+        if (atomic_load(&output_segmented->next) == NULL && !atomic_load(&output_segmented->open_failed)) {
+            char segment_filename[MAX_SEGMENT_FILENAME_SIZE];
+            output_segment_filename(output_segmented->filename, next_index, segment_filename, sizeof(segment_filename));
+            Output *next = output_segmented->open_fn(segment_filename, output_segmented->open_arg);
+            if (next == NULL) {
+                /* keep going with the current segment */
+                fprintf(stderr, "segmented output: open of %s failed - no more rotations\n", segment_filename);
+                atomic_store(&output_segmented->open_failed, 1);
+            } else {
+                next_index++;
+                atomic_store(&output_segmented->next, next);
+            }
+        }
+    }
+    return NULL;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,425 @@
+/* output backends for the recorded I/Q stream
+ * io_uring asynchronous output: filled blocks are submitted as batched
+ * writes and completions are reaped from the completion queue in shared
+ * memory, so the caller never waits for the disk
+ * (raw io_uring system calls, so no dependency on liburing)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "latency_histogram.h"
+#include "output.h"
+
+typedef struct {
+    unsigned char *data;
+    size_t size;              /* bytes in the block */
+    size_t done;              /* bytes already written (short writes) */
+    unsigned long long file_offset;
+    uint64_t submit_time;
+    int busy;
+} UringBlock;
+
+typedef struct {
+    Output output;
+    int fd;
+    int may_block;
+    size_t block_size;
+    unsigned int queue_depth;
+    UringBlock *blocks;
+    unsigned int fill_block;   /* index of the block being filled (or queue_depth if none is free) */
+    unsigned long long file_offset;
+    /* io_uring */
+    int ring_fd;
+    void *sq_ring;
+    size_t sq_ring_size;
+    void *cq_ring;
+    size_t cq_ring_size;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+    _Atomic unsigned int *sq_head;
+    _Atomic unsigned int *sq_tail;
+    unsigned int sq_mask;
+    unsigned int *sq_array;
+    _Atomic unsigned int *cq_head;
+    _Atomic unsigned int *cq_tail;
+    unsigned int cq_mask;
+    struct io_uring_cqe *cqes;
+    /* statistics */
+    unsigned int in_flight;
+    unsigned int max_in_flight;
+    unsigned long long in_flight_sum;
+    unsigned long long submissions;
+    unsigned long long overruns;
+    unsigned long long overrun_bytes;
+    unsigned long long write_errors;
+    LatencyHistogram submit_latency;
+    LatencyHistogram completion_latency;
+} OutputUring;
+
+static ssize_t output_uring_write(Output *output, const void *data, size_t count);
+static int output_uring_close(Output *output);
+static int uring_setup(OutputUring *output_uring);
+static void uring_teardown(OutputUring *output_uring);
+static int submit_block(OutputUring *output_uring, unsigned int index);
+static void reap_completions(OutputUring *output_uring, unsigned int min_complete);
+static int next_free_block(OutputUring *output_uring);
+static size_t free_space(const OutputUring *output_uring);
+static uint64_t now_ns(void);
+
+
+Output *output_uring_open(const char *filename, size_t block_size, unsigned int queue_depth, int may_block)
+{
+    OutputUring *output_uring = (OutputUring *) calloc(1, sizeof(OutputUring));
+    if (output_uring == NULL) {
+        return NULL;
+    }
+    output_uring->output.name = "io_uring";
+    output_uring->output.write = output_uring_write;
+    output_uring->output.close = output_uring_close;
+    output_uring->output.bytes_written = 0;
+    output_uring->may_block = may_block;
+    output_uring->block_size = block_size;
+    output_uring->queue_depth = queue_depth;
+    output_uring->fill_block = 0;
+    latency_histogram_init(&output_uring->submit_latency);
+    latency_histogram_init(&output_uring->completion_latency);
+
+    output_uring->blocks = (UringBlock *) calloc(queue_depth, sizeof(UringBlock));
+    if (output_uring->blocks == NULL) {
+        free(output_uring);
+        return NULL;
+    }
+    for (unsigned int i = 0; i < queue_depth; i++) {
+        void *data;
+        int ret = posix_memalign(&data, OUTPUT_DIRECT_ALIGNMENT, block_size);
+        if (ret != 0) {
+            fprintf(stderr, "posix_memalign() failed: %s\n", strerror(ret));
+            for (unsigned int j = 0; j < i; j++) {
+                free(output_uring->blocks[j].data);
+            }
+            free(output_uring->blocks);
+            free(output_uring);
+            return NULL;
+        }
+        /* touch every page now, so the stream callback never page faults */
+        memset(data, 0, block_size);
+        output_uring->blocks[i].data = (unsigned char *)data;
+    }
+
+    output_uring->fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (output_uring->fd == -1) {
+        fprintf(stderr, "open(%s) for writing failed: %s\n", filename, strerror(errno));
+    } else if (uring_setup(output_uring) == 0) {
+        return &output_uring->output;
+    } else {
+        close(output_uring->fd);
+    }
+    for (unsigned int i = 0; i < queue_depth; i++) {
+        free(output_uring->blocks[i].data);
+    }
+    free(output_uring->blocks);
+    free(output_uring);
+    return NULL;
+}
+
+static ssize_t output_uring_write(Output *output, const void *data, size_t count)
+{
+    OutputUring *output_uring = (OutputUring *)output;
+    const unsigned char *p = (const unsigned char *)data;
+    size_t total = count;
+
+    /* cheap - no system call unless there are completions to reap */
+    reap_completions(output_uring, 0);
+
+    /* not enough free blocks: drop the whole write rather than wait, so that
+     * the stream is cut where the caller's data ends (a frame boundary) */
+    if (!output_uring->may_block && count > free_space(output_uring)) {
+        output_uring->overruns++;
+        output_uring->overrun_bytes += count;
+        /* and get the partly filled block going, or with every other block
+         * in flight it would never fill up */
+        if (output_uring->fill_block < output_uring->queue_depth && output_uring->blocks[output_uring->fill_block].size > 0) {
+            submit_block(output_uring, output_uring->fill_block);
+            output_uring->fill_block = output_uring->queue_depth;
+        }
+        return 0;
+    }
+
+    while (count > 0) {
+        if (output_uring->fill_block == output_uring->queue_depth && next_free_block(output_uring) == -1) {
+            return -1;
+        }
+        UringBlock *block = &output_uring->blocks[output_uring->fill_block];
+        size_t n = output_uring->block_size - block->size;
+        if (n > count) {
+            n = count;
+        }
+        memcpy(block->data + block->size, p, n);
+        block->size += n;
+        output->bytes_written += n;
+        p += n;
+        count -= n;
+        if (block->size == output_uring->block_size) {
+            if (submit_block(output_uring, output_uring->fill_block) == -1) {
+                return -1;
+            }
+            output_uring->fill_block = output_uring->queue_depth;
+        }
+    }
+    return total;
+}
+
+static int output_uring_close(Output *output)
+{
+    OutputUring *output_uring = (OutputUring *)output;
+    int ret = 0;
+
+    if (output_uring->fill_block < output_uring->queue_depth && output_uring->blocks[output_uring->fill_block].size > 0) {
+        if (submit_block(output_uring, output_uring->fill_block) == -1) {
+            ret = -1;
+        }
+    }
+    while (output_uring->in_flight > 0) {
+        reap_completions(output_uring, 1);
+    }
+
+    fprintf(stderr, "io_uring: queue_depth=%u block_size=%zu submissions=%llu max_in_flight=%u avg_in_flight=%.2lf overruns=%llu overrun_bytes=%llu write_errors=%llu\n",
+            output_uring->queue_depth, output_uring->block_size, output_uring->submissions,
+            output_uring->max_in_flight,
+            output_uring->submissions > 0 ? (double)output_uring->in_flight_sum / output_uring->submissions : 0.0,
+            output_uring->overruns, output_uring->overrun_bytes, output_uring->write_errors);
+    latency_histogram_print(&output_uring->submit_latency, "io_uring submit latency (ns)", stderr);
+    latency_histogram_print(&output_uring->completion_latency, "io_uring completion latency (submit to reap, ns)", stderr);
+    if (output_uring->write_errors > 0) {
+        ret = -1;
+    }
+
+    uring_teardown(output_uring);
+    if (output_fsync(output_uring->fd) == -1) {
+        ret = -1;
+    }
+    if (close(output_uring->fd) == -1) {
+        fprintf(stderr, "close(%d) failed: %s\n", output_uring->fd, strerror(errno));
+        ret = -1;
+    }
+    for (unsigned int i = 0; i < output_uring->queue_depth; i++) {
+        free(output_uring->blocks[i].data);
+    }
+    free(output_uring->blocks);
+    free(output_uring);
+    return ret;
+}
+
+static int uring_setup(OutputUring *output_uring)
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    output_uring->ring_fd = syscall(__NR_io_uring_setup, output_uring->queue_depth, &params);
+    if (output_uring->ring_fd == -1) {
+        fprintf(stderr, "io_uring_setup() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    output_uring->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    output_uring->cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (output_uring->cq_ring_size > output_uring->sq_ring_size) {
+            output_uring->sq_ring_size = output_uring->cq_ring_size;
+        }
+        output_uring->cq_ring_size = 0;
+    }
+    output_uring->sq_ring = mmap(NULL, output_uring->sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, output_uring->ring_fd, IORING_OFF_SQ_RING);
+    if (output_uring->sq_ring == MAP_FAILED) {
+        fprintf(stderr, "mmap(io_uring SQ ring) failed: %s\n", strerror(errno));
+        close(output_uring->ring_fd);
+        return -1;
+    }
+    if (output_uring->cq_ring_size == 0) {
+        output_uring->cq_ring = output_uring->sq_ring;
+    } else {
+        output_uring->cq_ring = mmap(NULL, output_uring->cq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, output_uring->ring_fd, IORING_OFF_CQ_RING);
+        if (output_uring->cq_ring == MAP_FAILED) {
+            fprintf(stderr, "mmap(io_uring CQ ring) failed: %s\n", strerror(errno));
+            munmap(output_uring->sq_ring, output_uring->sq_ring_size);
+            close(output_uring->ring_fd);
+            return -1;
+        }
+    }
+    output_uring->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    output_uring->sqes = (struct io_uring_sqe *) mmap(NULL, output_uring->sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, output_uring->ring_fd, IORING_OFF_SQES);
+    if (output_uring->sqes == MAP_FAILED) {
+        fprintf(stderr, "mmap(io_uring SQEs) failed: %s\n", strerror(errno));
+        if (output_uring->cq_ring_size != 0) {
+            munmap(output_uring->cq_ring, output_uring->cq_ring_size);
+        }
+        munmap(output_uring->sq_ring, output_uring->sq_ring_size);
+        close(output_uring->ring_fd);
+        return -1;
+    }
+
+    unsigned char *sq = (unsigned char *)output_uring->sq_ring;
+    unsigned char *cq = (unsigned char *)output_uring->cq_ring;
+    output_uring->sq_head = (_Atomic unsigned int *)(sq + params.sq_off.head);
+    output_uring->sq_tail = (_Atomic unsigned int *)(sq + params.sq_off.tail);
+    output_uring->sq_mask = *(unsigned int *)(sq + params.sq_off.ring_mask);
+    output_uring->sq_array = (unsigned int *)(sq + params.sq_off.array);
+    output_uring->cq_head = (_Atomic unsigned int *)(cq + params.cq_off.head);
+    output_uring->cq_tail = (_Atomic unsigned int *)(cq + params.cq_off.tail);
+    output_uring->cq_mask = *(unsigned int *)(cq + params.cq_off.ring_mask);
+    output_uring->cqes = (struct io_uring_cqe *)(cq + params.cq_off.cqes);
+    return 0;
+}
+
+static void uring_teardown(OutputUring *output_uring)
+{
+    munmap(output_uring->sqes, output_uring->sqes_size);
+    if (output_uring->cq_ring_size != 0) {
+        munmap(output_uring->cq_ring, output_uring->cq_ring_size);
+    }
+    munmap(output_uring->sq_ring, output_uring->sq_ring_size);
+    close(output_uring->ring_fd);
+}
+
+/* queue a write for the remaining part of a block and tell the kernel about it */
+static int submit_block(OutputUring *output_uring, unsigned int index)
+{
+    UringBlock *block = &output_uring->blocks[index];
+    if (!block->busy) {
+        block->busy = 1;
+        block->done = 0;
+        block->file_offset = output_uring->file_offset;
+        output_uring->file_offset += block->size;
+        output_uring->in_flight++;
+        block->submit_time = now_ns();
+    }
+
+    unsigned int tail = atomic_load_explicit(output_uring->sq_tail, memory_order_relaxed);
+    unsigned int sq_index = tail & output_uring->sq_mask;
+    struct io_uring_sqe *sqe = &output_uring->sqes[sq_index];
+    memset(sqe, 0, sizeof(*sqe));
+    sqe->opcode = IORING_OP_WRITE;
+    /* go straight to the kernel worker threads, instead of trying to copy
+     * the block into the page cache inline in io_uring_enter() */
+    sqe->flags = IOSQE_ASYNC;
+    sqe->fd = output_uring->fd;
+    sqe->addr = (uint64_t)(uintptr_t)(block->data + block->done);
+    sqe->len = block->size - block->done;
+    sqe->off = block->file_offset + block->done;
+    sqe->user_data = index;
+    output_uring->sq_array[sq_index] = sq_index;
+    atomic_store_explicit(output_uring->sq_tail, tail + 1, memory_order_release);
+
+    uint64_t start = now_ns();
+    int ret;
+    do {
+        ret = syscall(__NR_io_uring_enter, output_uring->ring_fd, 1, 0, 0, NULL, 0);
+    } while (ret == -1 && errno == EINTR);
+    latency_histogram_record(&output_uring->submit_latency, now_ns() - start);
+    if (ret == -1) {
+        fprintf(stderr, "io_uring_enter() failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    output_uring->submissions++;
+    output_uring->in_flight_sum += output_uring->in_flight;
+    if (output_uring->in_flight > output_uring->max_in_flight) {
+        output_uring->max_in_flight = output_uring->in_flight;
+    }
+    return 0;
+}
+
+/* process the completion queue; waits for at least min_complete completions */
+static void reap_completions(OutputUring *output_uring, unsigned int min_complete)
+{
+    if (min_complete > 0) {
+        int ret;
+        do {
+            ret = syscall(__NR_io_uring_enter, output_uring->ring_fd, 0, min_complete, IORING_ENTER_GETEVENTS, NULL, 0);
+        } while (ret == -1 && errno == EINTR);
+    }
+
+    unsigned int head = atomic_load_explicit(output_uring->cq_head, memory_order_relaxed);
+    unsigned int tail = atomic_load_explicit(output_uring->cq_tail, memory_order_acquire);
+    while (head != tail) {
+        struct io_uring_cqe *cqe = &output_uring->cqes[head & output_uring->cq_mask];
+        unsigned int index = (unsigned int)cqe->user_data;
+        int res = cqe->res;
+        head++;
+        atomic_store_explicit(output_uring->cq_head, head, memory_order_release);
+
+        UringBlock *block = &output_uring->blocks[index];
+        if (res < 0) {
+            fprintf(stderr, "io_uring write failed: %s\n", strerror(-res));
+            output_uring->write_errors++;
+        } else {
+            block->done += res;
+            if (block->done < block->size && res > 0) {
+                /* short write - queue the rest of the block */
+                submit_block(output_uring, index);
+                tail = atomic_load_explicit(output_uring->cq_tail, memory_order_acquire);
+                continue;
+            }
+        }
+        latency_histogram_record(&output_uring->completion_latency, now_ns() - block->submit_time);
+        block->busy = 0;
+        block->size = 0;
+        output_uring->in_flight--;
+        tail = atomic_load_explicit(output_uring->cq_tail, memory_order_acquire);
+    }
+}
+
+static int next_free_block(OutputUring *output_uring)
+{
+    while (1) {
+        for (unsigned int i = 0; i < output_uring->queue_depth; i++) {
+            if (!output_uring->blocks[i].busy) {
+                output_uring->fill_block = i;
+                return 0;
+            }
+        }
+        if (!output_uring->may_block) {
+            return -1;
+        }
+        reap_completions(output_uring, 1);
+    }
+}
+
+/* bytes that can be copied without waiting: the rest of the block being
+ * filled and the blocks not in flight */
+static size_t free_space(const OutputUring *output_uring)
+{
+    size_t space = 0;
+    for (unsigned int i = 0; i < output_uring->queue_depth; i++) {
+        const UringBlock *block = &output_uring->blocks[i];
+        if (!block->busy) {
+            space += output_uring->block_size - block->size;
+        }
+    }
+    return space;
+}
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
@@ -0,0 +1,301 @@
+/* stream pipeline: the stream callback hands each block to a fan-out of
+ * sinks, after the bookkeeping they all share (sample count, dropped
+ * samples, sample clock)
+ * - instrumentation: callback and per sink processing time, interval
+ *   between callbacks, and ring buffer fill, kept in a statistics block
+ *   that can live in a POSIX shared memory object; the hot path only does
+ *   clock_gettime() (vDSO) and plain stores
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pipeline.h"
+
+static inline uint64_t now_ns(void);
+static inline void stat_add(_Atomic uint64_t *stat, uint64_t value);
+static inline void stat_max(_Atomic uint64_t *stat, uint64_t value);
+static inline uint64_t stat_get(_Atomic uint64_t *stat);
+static inline void stat_set(_Atomic uint64_t *stat, uint64_t value);
+
+
+int pipeline_init(Pipeline *pipeline, const char *stats_shm_name)
+{
+    pipeline->nsinks = 0;
+    pipeline->total_samples = 0;
+    pipeline->next_sample_num = 0xffffffff;
+    pipeline->dropped_samples = 0;
+    pipeline->sample_index = 0;
+    atomic_init(&pipeline->published_sample_index, 0);
+    pipeline->first_sample_num = 0;
+    atomic_init(&pipeline->started, 0);
+    pipeline->master = NULL;
+    sample_clock_init(&pipeline->clock, SAMPLE_CLOCK_BLOCK_INTERVAL);
+    pipeline->log = NULL;
+    pipeline->stats_shm_name = stats_shm_name;
+    pipeline->prev_entry_time = 0;
+    latency_histogram_init(&pipeline->durations);
+    pipeline->report_blocks = 0;
+    pipeline->report_duration = 0;
+    pipeline->report_interval = 0;
+
+    if (stats_shm_name == NULL) {
+        pipeline->stats = (PipelineStats *) calloc(1, sizeof(PipelineStats));
+        if (pipeline->stats == NULL) {
+            fprintf(stderr, "pipeline stats allocation failed\n");
+            return -1;
+        }
+    } else {
+        int fd = shm_open(stats_shm_name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            fprintf(stderr, "shm_open(%s) failed: %s\n", stats_shm_name, strerror(errno));
+            return -1;
+        }
+        if (ftruncate(fd, sizeof(PipelineStats)) == -1) {
+            fprintf(stderr, "ftruncate() failed: %s\n", strerror(errno));
+            close(fd);
+            shm_unlink(stats_shm_name);
+            return -1;
+        }
+        void *stats = mmap(NULL, sizeof(PipelineStats), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+        close(fd);
+        if (stats == MAP_FAILED) {
+            fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+            shm_unlink(stats_shm_name);
+            return -1;
+        }
+        /* freshly truncated, so all zeros */
+        pipeline->stats = (PipelineStats *)stats;
+    }
+    pipeline->stats->magic = PIPELINE_STATS_MAGIC;
+    pipeline->stats->version = PIPELINE_STATS_VERSION;
+    return 0;
+}
+
+int pipeline_add(Pipeline *pipeline, Sink *sink)
+{
+    if (pipeline->nsinks == PIPELINE_MAX_SINKS) {
+        fprintf(stderr, "too many pipeline sinks (max %d)\n", PIPELINE_MAX_SINKS);
+        return -1;
+    }
+    SinkStats *sink_stats = &pipeline->stats->sinks[pipeline->nsinks];
+    strncpy(sink_stats->name, sink->name, PIPELINE_STATS_NAME_SIZE - 1);
+    if (sink->ring != NULL && sink->ring->buffer != NULL) {
+        stat_set(&sink_stats->ring_size, sink->ring->size);
+    }
+    pipeline->sinks[pipeline->nsinks++] = sink;
+    pipeline->stats->nsinks = pipeline->nsinks;
+    return 0;
+}
+
+void pipeline_follow(Pipeline *pipeline, const Pipeline *master)
+{
+    pipeline->master = master;
+}
+
+void pipeline_push(Pipeline *pipeline, const short *xi, const short *xq, unsigned int firstSampleNum, unsigned int numSamples)
+{
+    PipelineStats *stats = pipeline->stats;
+    uint64_t entry_time = now_ns();
+
+    if (!atomic_load_explicit(&pipeline->started, memory_order_relaxed)) {
+        if (pipeline->master != NULL) {
+            /* skip the blocks before the master start */
+            if (!atomic_load_explicit(&pipeline->master->started, memory_order_acquire)) {
+                return;
+            }
+            unsigned int offset = firstSampleNum - pipeline->master->first_sample_num;
+            if (offset > UINT_MAX / 2) {
+                return;
+            }
+            pipeline->sample_index = offset;
+        }
+        pipeline->first_sample_num = firstSampleNum;
+        atomic_store_explicit(&pipeline->started, 1, memory_order_release);
+    }
+
+    pipeline->total_samples += numSamples;
+
+    /* check for dropped samples */
+    if (pipeline->next_sample_num != 0xffffffff && firstSampleNum != pipeline->next_sample_num) {
+        unsigned int dropped_samples;
+        if (pipeline->next_sample_num < firstSampleNum) {
+            dropped_samples = firstSampleNum - pipeline->next_sample_num;
+        } else {
+            dropped_samples = UINT_MAX - (firstSampleNum - pipeline->next_sample_num) + 1;
+        }
+        if (pipeline->log != NULL) {
+            log_dropped_samples(pipeline->log, dropped_samples);
+        } else {
+            fprintf(stderr, "dropped %d samples\n", dropped_samples);
+        }
+        pipeline->dropped_samples += dropped_samples;
+        pipeline->sample_index += dropped_samples;
+        stat_set(&stats->dropped_samples, pipeline->dropped_samples);
+    }
+    pipeline->next_sample_num = firstSampleNum + numSamples;
+    uint64_t block_index = pipeline->sample_index;
+    pipeline->sample_index += numSamples;
+    atomic_store_explicit(&pipeline->published_sample_index, pipeline->sample_index, memory_order_relaxed);
+    /* the block has just arrived, so its last sample is (about) now */
+    sample_clock_update(&pipeline->clock, pipeline->sample_index, entry_time);
+
+    uint64_t sink_start = now_ns();
+    for (int i = 0; i < pipeline->nsinks; i++) {
+        Sink *sink = pipeline->sinks[i];
+        sink->push(sink, xi, xq, numSamples, block_index);
+        uint64_t sink_end = now_ns();
+        SinkStats *sink_stats = &stats->sinks[i];
+        stat_add(&sink_stats->total_duration, sink_end - sink_start);
+        stat_max(&sink_stats->max_duration, sink_end - sink_start);
+        RingBuffer *ring = sink->ring;
+        if (ring != NULL && ring->buffer != NULL) {
+            stat_set(&sink_stats->ring_fill, ring_buffer_read_available(ring));
+            stat_set(&sink_stats->ring_high_water_mark, ring->high_water_mark);
+            stat_set(&sink_stats->ring_overruns, ring->overruns);
+        }
+        sink_start = sink_end;
+    }
+
+    uint64_t duration = sink_start - entry_time;
+    latency_histogram_record(&pipeline->durations, duration);
+    stat_set(&stats->last_duration, duration);
+    stat_max(&stats->max_duration, duration);
+    stat_add(&stats->total_duration, duration);
+    if (pipeline->prev_entry_time != 0) {
+        uint64_t interval = entry_time - pipeline->prev_entry_time;
+        stat_set(&stats->last_interval, interval);
+        stat_max(&stats->max_interval, interval);
+        stat_add(&stats->total_interval, interval);
+    }
+    pipeline->prev_entry_time = entry_time;
+    stat_add(&stats->blocks, 1);
+    stat_add(&stats->samples, numSamples);
+    stat_set(&stats->update_time, sink_start);
+}
+
+/* from any thread (e.g. the API event thread): the index published by the
+ * stream callback after its last block */
+uint64_t pipeline_sample_index(const Pipeline *pipeline)
+{
+    return atomic_load_explicit(&pipeline->published_sample_index, memory_order_relaxed);
+}
+
+void pipeline_stop(Pipeline *pipeline)
+{
+    for (int i = 0; i < pipeline->nsinks; i++) {
+        Sink *sink = pipeline->sinks[i];
+        sink->stop(sink);
+    }
+
+    PipelineStats *stats = pipeline->stats;
+    latency_histogram_print(&pipeline->durations, "callback duration (ns)", stderr);
+    uint64_t blocks = stat_get(&stats->blocks);
+    uint64_t total_interval = stat_get(&stats->total_interval);
+    for (int i = 0; i < pipeline->nsinks; i++) {
+        SinkStats *sink_stats = &stats->sinks[i];
+        uint64_t total_duration = stat_get(&sink_stats->total_duration);
+        fprintf(stderr, "sink %s: avg_duration=%.0lfns max_duration=%lluns\n", sink_stats->name,
+                blocks > 0 ? (double)total_duration / blocks : 0.0,
+                (unsigned long long)stat_get(&sink_stats->max_duration));
+    }
+    /* the last interval of the last callback is not known */
+    fprintf(stderr, "callback_load=%.2lf%% max_interval=%lluns\n",
+            total_interval > 0 ? 100.0 * (stat_get(&stats->total_duration) - stat_get(&stats->last_duration)) / total_interval : 0.0,
+            (unsigned long long)stat_get(&stats->max_interval));
+}
+
+double pipeline_actual_sample_rate(const Pipeline *pipeline)
+{
+    return sample_clock_rate(&pipeline->clock);
+}
+
+void pipeline_print_stats(Pipeline *pipeline, FILE *stream)
+{
+    PipelineStats *stats = pipeline->stats;
+    uint64_t blocks = stat_get(&stats->blocks);
+    uint64_t total_duration = stat_get(&stats->total_duration);
+    uint64_t total_interval = stat_get(&stats->total_interval);
+    uint64_t duration = total_duration - pipeline->report_duration;
+    uint64_t interval = total_interval - pipeline->report_interval;
+    fprintf(stream, "stats: blocks=%llu (+%llu) samples=%llu dropped=%llu load=%.1lf%% max_duration=%lluns max_interval=%lluns",
+            (unsigned long long)blocks, (unsigned long long)(blocks - pipeline->report_blocks),
+            (unsigned long long)stat_get(&stats->samples),
+            (unsigned long long)stat_get(&stats->dropped_samples),
+            interval > 0 ? 100.0 * duration / interval : 0.0,
+            (unsigned long long)stat_get(&stats->max_duration),
+            (unsigned long long)stat_get(&stats->max_interval));
+    for (int i = 0; i < pipeline->nsinks; i++) {
+        SinkStats *sink_stats = &stats->sinks[i];
+        uint64_t ring_size = stat_get(&sink_stats->ring_size);
+        if (ring_size > 0) {
+            fprintf(stream, " %s_ring=%.1lf%%/%.1lf%%/%llu", sink_stats->name,
+                    100.0 * stat_get(&sink_stats->ring_fill) / ring_size,
+                    100.0 * stat_get(&sink_stats->ring_high_water_mark) / ring_size,
+                    (unsigned long long)stat_get(&sink_stats->ring_overruns));
+        }
+    }
+    fprintf(stream, "\n");
+    pipeline->report_blocks = blocks;
+    pipeline->report_duration = total_duration;
+    pipeline->report_interval = total_interval;
+}
+
+void pipeline_free(Pipeline *pipeline)
+{
+    for (int i = 0; i < pipeline->nsinks; i++) {
+        Sink *sink = pipeline->sinks[i];
+        sink->free(sink);
+    }
+    pipeline->nsinks = 0;
+    if (pipeline->stats_shm_name != NULL) {
+        munmap(pipeline->stats, sizeof(PipelineStats));
+        shm_unlink(pipeline->stats_shm_name);
+    } else {
+        free(pipeline->stats);
+    }
+    pipeline->stats = NULL;
+}
+
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+/* single writer: no need for read-modify-write atomics */
+static inline void stat_add(_Atomic uint64_t *stat, uint64_t value)
+{
+    atomic_store_explicit(stat, atomic_load_explicit(stat, memory_order_relaxed) + value, memory_order_relaxed);
+}
+
+static inline void stat_max(_Atomic uint64_t *stat, uint64_t value)
+{
+    if (value > atomic_load_explicit(stat, memory_order_relaxed)) {
+        atomic_store_explicit(stat, value, memory_order_relaxed);
+    }
+}
+
+static inline uint64_t stat_get(_Atomic uint64_t *stat)
+{
+    return atomic_load_explicit(stat, memory_order_relaxed);
+}
+
+static inline void stat_set(_Atomic uint64_t *stat, uint64_t value)
+{
+    atomic_store_explicit(stat, value, memory_order_relaxed);
+}
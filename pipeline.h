@@ -0,0 +1,199 @@
+/* stream pipeline: the stream callback hands each block to a fan-out of
+ * sinks (record, timing, histogram, channelizer, spectrum), any combination
+ * of which can be enabled at the same time
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "latency_histogram.h"
+#include "logger.h"
+#include "output.h"
+#include "ring_buffer.h"
+#include "sample_clock.h"
+#include "sample_format.h"
+
+#define PIPELINE_MAX_SINKS 8
+#define PIPELINE_STATS_MAGIC 0x52545350    /* "PSTR" */
+#define PIPELINE_STATS_VERSION 1
+#define PIPELINE_STATS_NAME_SIZE 16
+#define SINK_RECORD_MAX_GAPS 4096
+
+typedef struct Sink Sink;
+
+/* every sink embeds this struct as its first member */
+struct Sink {
+    const char *name;
+    /* called from the stream callback for every block; must never block -
+     * sinks with real work to do hand the samples over to their own thread;
+     * sample_index is the stream index of the first sample of the block
+     * (counting the dropped samples, so a jump means a gap) */
+    void (*push)(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index);
+    /* finish the work left (draining its thread, closing its output),
+     * then print the sink statistics */
+    void (*stop)(Sink *sink);
+    /* release the sink */
+    void (*free)(Sink *sink);
+    /* ring buffer feeding the sink thread, for the stats (not in use if
+     * ring->buffer is NULL) */
+    RingBuffer *ring;
+};
+
+/* stream statistics, updated at the end of every callback with plain
+ * (relaxed atomic) stores - the callback thread is the only writer; with a
+ * shared memory segment (see pipeline_init()) an external monitor can map
+ * it read-only and poll it; all the times are in ns */
+typedef struct {
+    char name[PIPELINE_STATS_NAME_SIZE];
+    _Atomic uint64_t total_duration;        /* time spent in push() */
+    _Atomic uint64_t max_duration;
+    _Atomic uint64_t ring_size;             /* 0 -> no ring buffer */
+    _Atomic uint64_t ring_fill;             /* bytes, after the last push() */
+    _Atomic uint64_t ring_high_water_mark;
+    _Atomic uint64_t ring_overruns;
+} SinkStats;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t nsinks;
+    uint32_t reserved;
+    _Atomic uint64_t update_time;           /* CLOCK_MONOTONIC_RAW at the end of the last callback */
+    _Atomic uint64_t blocks;
+    _Atomic uint64_t samples;
+    _Atomic uint64_t dropped_samples;
+    _Atomic uint64_t last_duration;         /* callback entry to exit */
+    _Atomic uint64_t max_duration;
+    _Atomic uint64_t total_duration;
+    _Atomic uint64_t last_interval;         /* entry to entry of consecutive callbacks */
+    _Atomic uint64_t max_interval;
+    _Atomic uint64_t total_interval;
+    SinkStats sinks[PIPELINE_MAX_SINKS];
+} PipelineStats;
+
+typedef struct Pipeline Pipeline;
+
+struct Pipeline {
+    Sink *sinks[PIPELINE_MAX_SINKS];
+    int nsinks;
+    unsigned long long total_samples;
+    unsigned int next_sample_num;
+    unsigned long long dropped_samples;
+    /* index of the sample past the end of the last block, counting the
+     * dropped samples too (i.e. firstSampleNum + numSamples, unwrapped) */
+    uint64_t sample_index;
+    /* sample_index, for the other threads (e.g. the event callback) */
+    _Atomic uint64_t published_sample_index;
+    SampleClock clock;
+    /* first block: its firstSampleNum, published for the followers */
+    unsigned int first_sample_num;
+    atomic_int started;
+    /* follower (e.g. RSPduo tuner B): starts with the first block of the
+     * master, and counts the sample index from the master first sample, so
+     * that the same index is the same sample in both streams */
+    const Pipeline *master;
+    /* stream callback log queue (NULL -> print directly) */
+    LogQueue *log;
+    /* instrumentation */
+    PipelineStats *stats;
+    const char *stats_shm_name;     /* NULL -> stats in private memory */
+    uint64_t prev_entry_time;
+    LatencyHistogram durations;
+    /* previous values for the periodic stats line (main thread only) */
+    uint64_t report_blocks;
+    uint64_t report_duration;
+    uint64_t report_interval;
+};
+
+/* stats_shm_name: POSIX shared memory object for the statistics (e.g.
+ * "/single_tuner_recorder"), removed by pipeline_free(); NULL for none */
+int pipeline_init(Pipeline *pipeline, const char *stats_shm_name);
+int pipeline_add(Pipeline *pipeline, Sink *sink);
+/* make pipeline follow master (before streaming starts); the master must
+ * get each block before the follower */
+void pipeline_follow(Pipeline *pipeline, const Pipeline *master);
+/* called from the stream callback */
+void pipeline_push(Pipeline *pipeline, const short *xi, const short *xq, unsigned int firstSampleNum, unsigned int numSamples);
+/* stream index after the last block pushed, from any thread */
+uint64_t pipeline_sample_index(const Pipeline *pipeline);
+void pipeline_stop(Pipeline *pipeline);
+/* from the fit of the sample index versus the callback times */
+double pipeline_actual_sample_rate(const Pipeline *pipeline);
+/* one line summary of the statistics since the previous call */
+void pipeline_print_stats(Pipeline *pipeline, FILE *stream);
+void pipeline_free(Pipeline *pipeline);
+
+/* record: converts the samples to the output format and writes them to
+ * 'output' (which can be NULL to just track the sample range), either from
+ * the stream callback or, with ring_buffer_size > 0, from a writer thread
+ * (pinned to writer_cpu, if >= 0) */
+Sink *sink_record_open(Output *output, const SampleFormatSpec *format_spec, size_t ring_buffer_size, int writer_cpu);
+/* gaps in the recording, in the order they happened */
+typedef enum {
+    RECORD_GAP_DROPPED,     /* samples dropped by the device/API */
+    RECORD_GAP_OVERRUN,     /* lost to a ring buffer or output backend overrun (or a write error) */
+} RecordGapCause;
+
+typedef struct {
+    uint64_t frame;         /* index in the output of the first frame after the gap */
+    uint64_t sample_index;  /* stream index where the gap ends */
+    uint64_t missing;       /* samples lost */
+    RecordGapCause cause;
+} RecordGap;
+
+typedef struct {
+    SampleFormatSpec format_spec;   /* with the shift actually used */
+    size_t frame_size;
+    uint64_t first_sample_index;    /* stream index of the first frame */
+    uint64_t frames;                /* frames the output took */
+    const RecordGap *gaps;
+    unsigned int ngaps;
+    unsigned long long lost_gaps;   /* gaps past SINK_RECORD_MAX_GAPS */
+} SinkRecordInfo;
+
+/* what was recorded (valid after the sink has been stopped) */
+void sink_record_info(const Sink *sink, SinkRecordInfo *info);
+/* timing: histogram of the intervals between callbacks; reports the
+ * callbacks that arrive more than diff_threshold ns after the previous one,
+ * and optionally dumps all the intervals to intervals_filename */
+Sink *sink_time_diff_open(long diff_threshold, const char *intervals_filename);
+/* histogram of the I and Q sample values, counted on the stream callback
+ * thread or, with threaded = 1, on a worker thread */
+Sink *sink_histogram_open(int threaded);
+/* network: sends the blocks (iq16) to "udp:<host>:<port>" or
+ * "tcp:<host>:<port>" from a sender thread, as packets of at most
+ * max_packet_size bytes (0 -> 1472 with UDP, 64KiB with TCP), each one a
+ * NetPacketHeader followed by the interleaved samples */
+#define NET_PACKET_MAGIC 0x544e5149     /* "IQNT" */
+#define NET_PACKET_VERSION 1
+#define NET_PACKET_BLOCK_START 0x01     /* first packet of a callback block */
+#define NET_PACKET_BLOCK_END 0x02       /* last packet of a callback block */
+
+/* 24 bytes, little endian */
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t flags;
+    uint32_t sequence;      /* packet counter (lost packets are skipped too) */
+    uint32_t nsamples;
+    uint64_t sample_index;  /* stream index of the first sample (counting the dropped ones) */
+} NetPacketHeader;
+
+Sink *sink_net_open(const char *destination, size_t max_packet_size);
+/* shared memory ring: the blocks (iq16) in the POSIX shared memory object
+ * 'name', of ring_size bytes, for any number of local readers (layout and
+ * reader side in shm_ring.h) */
+Sink *sink_shm_open(const char *name, size_t ring_size, double sample_rate, double center_frequency);
+
+#endif /* PIPELINE_H */
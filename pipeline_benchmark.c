@@ -0,0 +1,602 @@
+/* pipeline benchmark: drives the stream pipeline sinks, the output formats,
+ * and the output backends from a synthetic source (tone + noise) or from the
+ * replay of an iq16 recording, without an RSP, and reports the cost per
+ * sample, the rate achieved, and the drops
+ * - the blocks are pushed back to back, or paced at a given sample rate
+ *   (the way the SDRplay API delivers them), which is what shows whether the
+ *   sinks with a thread of their own keep up
+ * - the source is generated (or read) before the start, so only the
+ *   pipeline is measured
+ * - the channelizer and the spectrum monitor take the rate (-r) as the
+ *   sample rate of the stream, as single_tuner_recorder takes the RSP one
+ * - the summary goes to stdout, one key=value line per item, the statistics
+ *   of the sinks to stderr as in single_tuner_recorder
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <math.h>
+#include <signal.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "channelizer.h"
+#include "output.h"
+#include "pipeline.h"
+#include "sample_format.h"
+#include "sample_kernels.h"
+#include "spectrum.h"
+
+#define MAX_PATH_SIZE 1024
+#define MAX_BLOCK_SIZE 65536
+#define SYNTHETIC_FRAMES (1 << 20)
+#define REPLAY_MAX_FRAMES (1 << 26)     /* 256MiB of iq16 */
+#define DEFAULT_BLOCK_SIZE 1008         /* zero IF, as delivered by the SDRplay API */
+
+typedef struct {
+    short *xi;
+    short *xq;
+    size_t nframes;
+} Source;
+
+/* as in single_tuner_recorder */
+typedef struct {
+    int mmap_output;
+    size_t direct_block_size;
+    unsigned int uring_queue_depth;
+    unsigned int compress_workers;  /* 0 -> not compressed */
+    size_t compress_chunk_size;
+    int may_block;
+    unsigned long long expected_size;
+} OutputOptions;
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void usage(const char* progname);
+static void on_signal(int sig);
+static int synthetic_source(Source *source, double amplitude, double noise, double tone);
+static int replay_source(Source *source, const char *filename);
+static Output *open_output(const char *filename, void *open_arg);
+static inline uint64_t now_ns(void);
+
+
+int main(int argc, char *argv[])
+{
+    double sample_rate = 0;
+    unsigned int block_size = DEFAULT_BLOCK_SIZE;
+    double seconds = 5;
+    unsigned long long max_samples = 0;
+    double amplitude = 1000;
+    double noise = 30;
+    double tone = 0.1;
+    const char *replay_file = NULL;
+    const char *output_file = "/dev/null";
+    SampleFormatSpec sample_format_spec = { SAMPLE_FORMAT_IQ16, 0, SAMPLE_FORMAT_CF32_SCALE };
+    int ring_buffer_size_MiB = 0;
+    int direct_block_size_MiB = 0;
+    int uring_queue_depth = 0;
+    int compress_workers = 0;
+    int compress_chunk_KiB = 1024;
+    int record_enable = 1;
+    int measure_time_diff_enable = 0;
+    int samples_histogram_enable = 0;
+    int samples_histogram_threaded = 0;
+    char net_destination[MAX_PATH_SIZE] = "";
+    size_t net_packet_size = 0;
+    const char *shm_ring_name = NULL;
+    int shm_ring_size_MiB = 64;
+    int mmap_output = 0;
+    ChannelSpec channel_specs[MAX_CHANNELS];
+    int nchannels = 0;
+    int channelizer_workers = 0;
+    SpectrumSpec spectrum_spec;
+    int spectrum_enable = 0;
+
+    int c;
+    while ((c = getopt(argc, argv, "r:b:x:n:g:i:o:F:B:mO:u:z:XTHwN:R:C:W:P:h")) != -1) {
+        int n = 0;
+        const char *comma;
+        switch (c) {
+            case 'r':
+                if (sscanf(optarg, "%lf", &sample_rate) != 1 || sample_rate < 0) {
+                    fprintf(stderr, "invalid sample rate: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'b':
+                if (sscanf(optarg, "%u", &block_size) != 1 || block_size == 0 || block_size > MAX_BLOCK_SIZE) {
+                    fprintf(stderr, "invalid block size: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'x':
+                if (sscanf(optarg, "%lf", &seconds) != 1 || seconds <= 0) {
+                    fprintf(stderr, "invalid duration: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'n':
+                if (sscanf(optarg, "%llu", &max_samples) != 1 || max_samples == 0) {
+                    fprintf(stderr, "invalid number of samples: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'g':
+                if (sscanf(optarg, "%lf,%lf,%lf", &amplitude, &noise, &tone) != 3 || amplitude < 0 || noise < 0) {
+                    fprintf(stderr, "invalid synthetic source: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'i':
+                replay_file = optarg;
+                break;
+            case 'o':
+                output_file = optarg;
+                break;
+            case 'F':
+                if (sample_format_parse(optarg, &sample_format_spec) == -1) {
+                    fprintf(stderr, "invalid output format: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'B':
+                if (sscanf(optarg, "%d", &ring_buffer_size_MiB) != 1 || ring_buffer_size_MiB < 0) {
+                    fprintf(stderr, "invalid ring buffer size: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'm':
+                mmap_output = 1;
+                break;
+            case 'O':
+                if (sscanf(optarg, "%d", &direct_block_size_MiB) != 1 || direct_block_size_MiB <= 0) {
+                    fprintf(stderr, "invalid O_DIRECT block size: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'u':
+                if (sscanf(optarg, "%d", &uring_queue_depth) != 1 || uring_queue_depth <= 0) {
+                    fprintf(stderr, "invalid io_uring queue depth: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'z':
+                if (sscanf(optarg, "%d%n", &compress_workers, &n) != 1 || compress_workers <= 0 || compress_workers > MAX_COMPRESSED_WORKERS ||
+                    (optarg[n] != '\0' && (sscanf(optarg + n, ",%d", &compress_chunk_KiB) != 1 || compress_chunk_KiB <= 0 || compress_chunk_KiB > 1024 * 1024))) {
+                    fprintf(stderr, "invalid compression workers or chunk size: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'X':
+                record_enable = 0;
+                break;
+            case 'T':
+                measure_time_diff_enable = 1;
+                break;
+            case 'H':
+                samples_histogram_enable = 1;
+                break;
+            case 'w':
+                samples_histogram_threaded = 1;
+                break;
+            case 'N':
+                comma = strrchr(optarg, ',');
+                if (comma != NULL && (sscanf(comma + 1, "%zu%n", &net_packet_size, &n) != 1 || comma[1 + n] != '\0' || net_packet_size == 0)) {
+                    fprintf(stderr, "invalid network packet size: %s\n", comma + 1);
+                    exit(1);
+                }
+                snprintf(net_destination, sizeof(net_destination), "%.*s", comma != NULL ? (int)(comma - optarg) : (int)strlen(optarg), optarg);
+                break;
+            case 'R':
+                {
+                    static char name[MAX_PATH_SIZE];
+                    comma = strrchr(optarg, ',');
+                    if (comma != NULL && (sscanf(comma + 1, "%d%n", &shm_ring_size_MiB, &n) != 1 || comma[1 + n] != '\0' || shm_ring_size_MiB <= 0)) {
+                        fprintf(stderr, "invalid shared memory ring size: %s\n", comma + 1);
+                        exit(1);
+                    }
+                    snprintf(name, sizeof(name), "%.*s", comma != NULL ? (int)(comma - optarg) : (int)strlen(optarg), optarg);
+                    shm_ring_name = name;
+                }
+                break;
+            case 'C':
+                if (nchannels == MAX_CHANNELS) {
+                    fprintf(stderr, "too many channels (max %d)\n", MAX_CHANNELS);
+                    exit(1);
+                }
+                if (channel_spec_parse(optarg, &channel_specs[nchannels]) == -1) {
+                    fprintf(stderr, "invalid channel: %s\n", optarg);
+                    exit(1);
+                }
+                nchannels++;
+                break;
+            case 'W':
+                if (sscanf(optarg, "%d", &channelizer_workers) != 1 || channelizer_workers <= 0 || channelizer_workers > MAX_CHANNELIZER_WORKERS) {
+                    fprintf(stderr, "invalid number of channelizer worker threads: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'P':
+                if (spectrum_spec_parse(optarg, &spectrum_spec) == -1) {
+                    fprintf(stderr, "invalid spectrum monitor: %s\n", optarg);
+                    exit(1);
+                }
+                spectrum_enable = 1;
+                break;
+            case 'h':
+                usage(argv[0]);
+                exit(0);
+            case '?':
+            default:
+                usage(argv[0]);
+                exit(1);
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+        exit(1);
+    }
+    if (compress_workers > 0 && sample_format_spec.format != SAMPLE_FORMAT_IQ16) {
+        fprintf(stderr, "compressed output (-z) is only possible with the iq16 output format\n");
+        exit(1);
+    }
+    if (compress_workers > 0 && ring_buffer_size_MiB == 0) {
+        fprintf(stderr, "compressed output (-z) needs the writer thread (-B), as in single_tuner_recorder\n");
+        exit(1);
+    }
+    if ((mmap_output != 0) + (direct_block_size_MiB > 0) + (uring_queue_depth > 0) > 1) {
+        fprintf(stderr, "memory mapped output (-m), O_DIRECT output (-O), and io_uring output (-u) are mutually exclusive\n");
+        exit(1);
+    }
+    if ((nchannels > 0 || spectrum_enable) && sample_rate == 0) {
+        fprintf(stderr, "channels (-C) and spectrum monitor (-P) need the sample rate (-r)\n");
+        exit(1);
+    }
+
+    sample_kernels_init();
+
+    Source source;
+    if ((replay_file != NULL ? replay_source(&source, replay_file) : synthetic_source(&source, amplitude, noise, tone)) == -1) {
+        exit(1);
+    }
+    if (source.nframes < block_size) {
+        fprintf(stderr, "the source is shorter than a block (%zu samples)\n", source.nframes);
+        exit(1);
+    }
+
+    Pipeline pipeline;
+    if (pipeline_init(&pipeline, NULL) == -1) {
+        exit(1);
+    }
+    Sink *record_sink = NULL;
+    if (record_enable) {
+        /* preallocate the mmap output for the whole run (when its length
+         * is known) */
+        double expected_frames = max_samples > 0 ? (double)max_samples : sample_rate * seconds;
+        OutputOptions output_options = {
+            .mmap_output = mmap_output,
+            .direct_block_size = (size_t)direct_block_size_MiB * 1024 * 1024,
+            .uring_queue_depth = uring_queue_depth,
+            .compress_workers = compress_workers,
+            .compress_chunk_size = (size_t)compress_chunk_KiB * 1024,
+            /* from the stream callback never wait; from the writer thread it's OK to */
+            .may_block = ring_buffer_size_MiB > 0,
+            .expected_size = (unsigned long long)expected_frames * sample_format_frame_size(sample_format_spec.format),
+        };
+        Output *output = open_output(output_file, &output_options);
+        if (output == NULL) {
+            exit(1);
+        }
+        record_sink = sink_record_open(output, &sample_format_spec, (size_t)ring_buffer_size_MiB * 1024 * 1024, -1);
+        if (record_sink == NULL) {
+            output->close(output);
+            exit(1);
+        }
+        pipeline_add(&pipeline, record_sink);
+    }
+    Sink *sinks[4] = { NULL, NULL, NULL, NULL };
+    if (measure_time_diff_enable) {
+        sinks[0] = sink_time_diff_open(5000 * 1000, NULL);
+    }
+    if (samples_histogram_enable) {
+        sinks[1] = sink_histogram_open(samples_histogram_threaded);
+    }
+    if (net_destination[0] != '\0') {
+        sinks[2] = sink_net_open(net_destination, net_packet_size);
+    }
+    if (shm_ring_name != NULL) {
+        sinks[3] = sink_shm_open(shm_ring_name, (size_t)shm_ring_size_MiB * 1024 * 1024, sample_rate, 0);
+    }
+    int enabled[4] = { measure_time_diff_enable, samples_histogram_enable, net_destination[0] != '\0', shm_ring_name != NULL };
+    for (int i = 0; i < 4; i++) {
+        if (enabled[i] && sinks[i] == NULL) {
+            pipeline_free(&pipeline);
+            exit(1);
+        }
+        if (sinks[i] != NULL) {
+            pipeline_add(&pipeline, sinks[i]);
+        }
+    }
+    /* channels are written from the channelizer thread, so blocking is OK */
+    static Channelizer channelizer;
+    static Spectrum spectrum;
+    OutputOptions channel_output_options = {
+        .mmap_output = mmap_output,
+        .direct_block_size = (size_t)direct_block_size_MiB * 1024 * 1024,
+        .uring_queue_depth = uring_queue_depth,
+        .may_block = 1,
+        .expected_size = 0,
+    };
+    if (nchannels > 0) {
+        if (channelizer_init(&channelizer, sample_rate, channel_specs, nchannels, channelizer_workers, open_output, &channel_output_options) == -1 ||
+            channelizer_start(&channelizer) == -1) {
+            pipeline_free(&pipeline);
+            exit(1);
+        }
+        pipeline_add(&pipeline, &channelizer.sink);
+    }
+    if (spectrum_enable) {
+        if (spectrum_init(&spectrum, &spectrum_spec, sample_rate, 0) == -1 ||
+            spectrum_start(&spectrum) == -1) {
+            pipeline_free(&pipeline);
+            exit(1);
+        }
+        pipeline_add(&pipeline, &spectrum.sink);
+    }
+    if (pipeline.nsinks == 0) {
+        fprintf(stderr, "no sinks\n");
+        pipeline_free(&pipeline);
+        exit(1);
+    }
+
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = on_signal;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+
+    fprintf(stderr, "benchmark: source=%s frames=%zu block_size=%u rate=%.0lf kernels=%s\n",
+            replay_file != NULL ? replay_file : "synthetic", source.nframes, block_size, sample_rate, sample_kernels_name());
+
+    /* a block more than one block period behind its due time is late: the
+     * pipeline doesn't keep up with the rate */
+    uint64_t block_period = sample_rate > 0 ? (uint64_t)(1e9 * block_size / sample_rate) : 0;
+    unsigned long long late_blocks = 0;
+    uint64_t max_lateness = 0;
+    unsigned long long samples = 0;
+    unsigned int first_sample_num = 0;
+    size_t position = 0;
+    uint64_t start_time = now_ns();
+    uint64_t end_time = start_time + (uint64_t)(seconds * 1e9);
+    while (!stop_requested) {
+        if (max_samples > 0 ? samples >= max_samples : now_ns() >= end_time) {
+            break;
+        }
+        if (sample_rate > 0) {
+            uint64_t due = start_time + (uint64_t)(samples * 1e9 / sample_rate);
+            uint64_t now = now_ns();
+            if (now < due) {
+                struct timespec ts = { (time_t)(due / 1000000000), (long)(due % 1000000000) };
+                while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL) == EINTR && !stop_requested) {
+                }
+            } else if (now - due > block_period) {
+                late_blocks++;
+                if (now - due > max_lateness) {
+                    max_lateness = now - due;
+                }
+            }
+        }
+        if (position + block_size > source.nframes) {
+            position = 0;
+        }
+        pipeline_push(&pipeline, source.xi + position, source.xq + position, first_sample_num, block_size);
+        position += block_size;
+        first_sample_num += block_size;
+        samples += block_size;
+    }
+    uint64_t push_time = now_ns() - start_time;
+
+    pipeline_stop(&pipeline);
+    uint64_t total_time = now_ns() - start_time;
+
+    /* summary */
+    PipelineStats *stats = pipeline.stats;
+    uint64_t blocks = atomic_load(&stats->blocks);
+    printf("samples=%llu blocks=%llu block_size=%u wall_time=%.3lfs\n", samples, (unsigned long long)blocks, block_size, total_time * 1e-9);
+    printf("achieved_rate=%.3lfMSps (push) %.3lfMSps (including the drain at stop)\n",
+           push_time > 0 ? samples * 1e3 / push_time : 0.0, total_time > 0 ? samples * 1e3 / total_time : 0.0);
+    printf("callback: ns_per_sample=%.3lf max_duration=%lluns\n", samples > 0 ? (double)atomic_load(&stats->total_duration) / samples : 0.0,
+           (unsigned long long)atomic_load(&stats->max_duration));
+    if (sample_rate > 0) {
+        printf("pacing: rate=%.0lf late_blocks=%llu max_lateness=%lluns\n", sample_rate, late_blocks, (unsigned long long)max_lateness);
+    }
+    unsigned long long total_ring_overruns = 0;
+    for (int i = 0; i < pipeline.nsinks; i++) {
+        SinkStats *sink_stats = &stats->sinks[i];
+        unsigned long long ring_overruns = atomic_load(&sink_stats->ring_overruns);
+        printf("sink %s: ns_per_sample=%.3lf max_duration=%lluns ring_overruns=%llu",
+               sink_stats->name, samples > 0 ? (double)atomic_load(&sink_stats->total_duration) / samples : 0.0,
+               (unsigned long long)atomic_load(&sink_stats->max_duration), ring_overruns);
+        total_ring_overruns += ring_overruns;
+        if (pipeline.sinks[i] == record_sink) {
+            SinkRecordInfo record_info;
+            sink_record_info(record_sink, &record_info);
+            unsigned long long lost = 0;
+            for (unsigned int j = 0; j < record_info.ngaps; j++) {
+                lost += record_info.gaps[j].missing;
+            }
+            printf(" format=%s frames=%llu lost_samples=%llu", sample_format_name(record_info.format_spec.format),
+                   (unsigned long long)record_info.frames, lost);
+        }
+        printf("\n");
+    }
+    printf("ring_overruns=%llu\n", total_ring_overruns);
+
+    pipeline_free(&pipeline);
+    free(source.xi);
+    free(source.xq);
+    return 0;
+}
+
+static void usage(const char* progname)
+{
+    fprintf(stderr, "usage: %s [options...]\n", progname);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "    -r <sample rate> push the blocks at this rate (default: 0 - as fast as possible)\n");
+    fprintf(stderr, "    -b <block size> samples per block (default: %d)\n", DEFAULT_BLOCK_SIZE);
+    fprintf(stderr, "    -x <seconds> how long to run (default: 5)\n");
+    fprintf(stderr, "    -n <samples> stop after this many samples instead\n");
+    fprintf(stderr, "    -g <tone amplitude>,<noise rms>,<tone frequency (fraction of the sample rate)> synthetic source (default: 1000,30,0.1)\n");
+    fprintf(stderr, "    -i <iq16 file> replay the recording, over and over, instead\n");
+    fprintf(stderr, "    -o <output file> record to this file (default: /dev/null - the samples are converted and written, but not stored)\n");
+    fprintf(stderr, "    -F <output format> 16 (iq16), 12[:<shift>|:auto] (packed iq12), 8[:<shift>|:auto] (iq8) (default shift: auto), or cf32[:<scale>] (default: 16)\n");
+    fprintf(stderr, "    -B <ring buffer size (MiB)> write output from a separate thread (default: 0 - write from the callback)\n");
+    fprintf(stderr, "    -m memory mapped output file, preallocated for the whole run with -n, or with -r and -x (default: disabled)\n");
+    fprintf(stderr, "    -O <block size (MiB)> write output file with O_DIRECT (default: disabled)\n");
+    fprintf(stderr, "    -u <queue depth> write output file with io_uring (default: disabled)\n");
+    fprintf(stderr, "    -z <workers>[,<chunk size (KiB)>] compress the output file (needs -B) (default: disabled)\n");
+    fprintf(stderr, "    -X no record sink\n");
+    fprintf(stderr, "    -T callback timing sink\n");
+    fprintf(stderr, "    -H sample values histogram sink\n");
+    fprintf(stderr, "    -w count the histogram on a worker thread\n");
+    fprintf(stderr, "    -N <udp|tcp>:<host>:<port>[,<max packet size>] network output sink\n");
+    fprintf(stderr, "    -R <shared memory name>[,<ring size (MiB)>] shared memory ring sink\n");
+    fprintf(stderr, "    -C <offset (Hz)>,<output rate (Hz)>,<output file> channelizer sink, extracting a channel to its own cf32 file (can be repeated up to %d times; needs -r)\n", MAX_CHANNELS);
+    fprintf(stderr, "    -W <worker threads> extract the channels with an FFT (overlap-save) filter bank (default: 0 - one NCO+FIR per channel)\n");
+    fprintf(stderr, "    -P <FFT size>,<averaging time (s)>[,rect|hann|hamming|blackman],<output file> spectrum monitor sink (needs -r)\n");
+    fprintf(stderr, "    -h show usage\n");
+}
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop_requested = 1;
+}
+
+/* a tone plus gaussian noise, saturated to 16 bits */
+static int synthetic_source(Source *source, double amplitude, double noise, double tone)
+{
+    source->nframes = SYNTHETIC_FRAMES;
+    source->xi = (short *) malloc(source->nframes * sizeof(short));
+    source->xq = (short *) malloc(source->nframes * sizeof(short));
+    if (source->xi == NULL || source->xq == NULL) {
+        fprintf(stderr, "source allocation failed\n");
+        free(source->xi);
+        free(source->xq);
+        return -1;
+    }
+    unsigned int seed = 1;
+    for (size_t i = 0; i < source->nframes; i++) {
+        double phase = 2 * M_PI * tone * i;
+        double v[2] = { amplitude * cos(phase), amplitude * sin(phase) };
+        for (int c = 0; c < 2; c++) {
+            /* Box-Muller */
+            double u1 = (rand_r(&seed) + 1.0) / (RAND_MAX + 2.0);
+            double u2 = (rand_r(&seed) + 1.0) / (RAND_MAX + 2.0);
+            v[c] += noise * sqrt(-2 * log(u1)) * cos(2 * M_PI * u2);
+            v[c] = v[c] > 32767 ? 32767 : v[c] < -32768 ? -32768 : v[c];
+        }
+        source->xi[i] = (short)lrint(v[0]);
+        source->xq[i] = (short)lrint(v[1]);
+    }
+    return 0;
+}
+
+/* the whole recording (up to REPLAY_MAX_FRAMES), deinterleaved */
+static int replay_source(Source *source, const char *filename)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "fopen(%s) failed: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fileno(fp), &st) == -1) {
+        fprintf(stderr, "fstat(%s) failed: %s\n", filename, strerror(errno));
+        fclose(fp);
+        return -1;
+    }
+    size_t nframes = st.st_size / (2 * sizeof(short));
+    source->nframes = nframes < REPLAY_MAX_FRAMES ? nframes : REPLAY_MAX_FRAMES;
+    source->xi = (short *) malloc(source->nframes * sizeof(short));
+    source->xq = (short *) malloc(source->nframes * sizeof(short));
+    short *buffer = (short *) malloc(2 * MAX_BLOCK_SIZE * sizeof(short));
+    if (source->xi == NULL || source->xq == NULL || buffer == NULL) {
+        fprintf(stderr, "source allocation failed\n");
+        free(source->xi);
+        free(source->xq);
+        free(buffer);
+        fclose(fp);
+        return -1;
+    }
+    size_t done = 0;
+    while (done < source->nframes) {
+        size_t n = source->nframes - done < MAX_BLOCK_SIZE ? source->nframes - done : MAX_BLOCK_SIZE;
+        if (fread(buffer, 2 * sizeof(short), n, fp) != n) {
+            fprintf(stderr, "fread(%s) failed\n", filename);
+            free(source->xi);
+            free(source->xq);
+            free(buffer);
+            fclose(fp);
+            return -1;
+        }
+        for (size_t i = 0; i < n; i++) {
+            source->xi[done + i] = buffer[2 * i];
+            source->xq[done + i] = buffer[2 * i + 1];
+        }
+        done += n;
+    }
+    free(buffer);
+    fclose(fp);
+    return 0;
+}
+
+static Output *open_output(const char *filename, void *open_arg)
+{
+    OutputOptions *output_options = (OutputOptions *)open_arg;
+    if (output_options->compress_workers > 0) {
+        /* the container goes through the other backends like a plain stream */
+        OutputOptions inner_options = *output_options;
+        inner_options.compress_workers = 0;
+        Output *inner = open_output(filename, &inner_options);
+        if (inner == NULL) {
+            return NULL;
+        }
+        return output_compressed_open(inner, output_options->compress_chunk_size, output_options->compress_workers);
+    }
+    if (output_options->mmap_output) {
+        return output_mmap_open(filename, output_options->expected_size, OUTPUT_MMAP_WINDOW_SIZE);
+    } else if (output_options->direct_block_size > 0) {
+        return output_direct_open(filename, output_options->direct_block_size);
+    } else if (output_options->uring_queue_depth > 0) {
+        return output_uring_open(filename, OUTPUT_URING_BLOCK_SIZE, output_options->uring_queue_depth, output_options->may_block);
+    }
+    int fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "open(%s) for writing failed: %s\n", filename, strerror(errno));
+        return NULL;
+    }
+    return output_fd_open(fd);
+}
+
+/* CLOCK_MONOTONIC, since it is the one for clock_nanosleep() */
+static inline uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
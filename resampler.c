@@ -0,0 +1,155 @@
+/* polyphase rational resampler (interpolate by L, decimate by M) for split
+ * complex float samples, with a Kaiser windowed sinc anti-aliasing filter
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "dsp_kernels.h"
+#include "resampler.h"
+
+static double bessel_i0(double x);
+
+
+/* design the anti-aliasing filter (cutoff at the output Nyquist frequency)
+ * and split it into L polyphase branches */
+int resampler_init(Resampler *resampler, unsigned long long input_rate, unsigned int output_rate, float gain, unsigned int max_input)
+{
+    memset(resampler, 0, sizeof(Resampler));
+    if (output_rate == 0 || output_rate > input_rate) {
+        fprintf(stderr, "invalid resampler output rate %u for an input rate of %llu\n", output_rate, input_rate);
+        return -1;
+    }
+    unsigned long long g = gcd(input_rate, output_rate);
+    if (output_rate / g > RESAMPLER_MAX_INTERPOLATION) {
+        fprintf(stderr, "output rate %u/input rate %llu ratio is too complex (interpolation > %d)\n", output_rate, input_rate, RESAMPLER_MAX_INTERPOLATION);
+        return -1;
+    }
+    resampler->L = output_rate / g;
+    resampler->M = input_rate / g;
+    resampler->max_input = max_input;
+
+    /* keep the transition band a fixed fraction of the output rate */
+    unsigned int taps = RESAMPLER_TAPS_PER_OUTPUT * ((resampler->M + resampler->L - 1) / resampler->L);
+    taps = (taps + 7) / 8 * 8;
+    resampler->taps = taps;
+    unsigned int L = resampler->L;
+    unsigned int N = L * taps;
+
+    resampler->phase_taps = (float *) calloc(N, sizeof(float));
+    resampler->buf_i = (float *) calloc(taps - 1 + max_input, sizeof(float));
+    resampler->buf_q = (float *) calloc(taps - 1 + max_input, sizeof(float));
+    if (resampler->phase_taps == NULL || resampler->buf_i == NULL || resampler->buf_q == NULL) {
+        fprintf(stderr, "resampler buffer allocation failed\n");
+        resampler_free(resampler);
+        return -1;
+    }
+
+    /* the prototype filter runs at input_rate * L; its gain of L makes up
+     * for the zero stuffing */
+    double fc = 0.5 / resampler->M;
+    double center = (N - 1) / 2.0;
+    for (unsigned int i = 0; i < N; i++) {
+        double t = i - center;
+        double sinc = t == 0 ? 2 * fc : sin(2 * M_PI * fc * t) / (M_PI * t);
+        unsigned int branch = i % L;
+        unsigned int j = i / L;
+        resampler->phase_taps[branch * taps + (taps - 1 - j)] = gain * L * sinc * kaiser_window(i, N, RESAMPLER_KAISER_BETA);
+    }
+
+    /* start with taps - 1 samples of (zero) history */
+    resampler->buffered = taps - 1;
+    resampler->pos = taps - 1;
+    resampler->branch = 0;
+    return 0;
+}
+
+void resampler_free(Resampler *resampler)
+{
+    free(resampler->phase_taps);
+    free(resampler->buf_i);
+    free(resampler->buf_q);
+    resampler->phase_taps = NULL;
+    resampler->buf_i = NULL;
+    resampler->buf_q = NULL;
+}
+
+float *resampler_input_i(Resampler *resampler)
+{
+    return resampler->buf_i + resampler->buffered;
+}
+
+float *resampler_input_q(Resampler *resampler)
+{
+    return resampler->buf_q + resampler->buffered;
+}
+
+unsigned int resampler_run(Resampler *resampler, unsigned int n, float *out)
+{
+    resampler->buffered += n;
+
+    /* y[k] = sum(h[branch + j*L] * x[pos - j]); the branch taps are stored
+     * time reversed, so each output is a single contiguous dot product */
+    unsigned int nout = 0;
+    while (resampler->pos < resampler->buffered) {
+        unsigned int start = resampler->pos + 1 - resampler->taps;
+        dot_complex(resampler->phase_taps + resampler->branch * resampler->taps, resampler->buf_i + start, resampler->buf_q + start, resampler->taps, &out[2*nout], &out[2*nout+1]);
+        nout++;
+        resampler->branch += resampler->M;
+        resampler->pos += resampler->branch / resampler->L;
+        resampler->branch %= resampler->L;
+    }
+
+    /* keep only the history needed by the next output */
+    unsigned int drop = resampler->pos + 1 - resampler->taps;
+    if (drop > resampler->buffered) {
+        drop = resampler->buffered;
+    }
+    memmove(resampler->buf_i, resampler->buf_i + drop, (resampler->buffered - drop) * sizeof(float));
+    memmove(resampler->buf_q, resampler->buf_q + drop, (resampler->buffered - drop) * sizeof(float));
+    resampler->buffered -= drop;
+    resampler->pos -= drop;
+    return nout;
+}
+
+double kaiser_window(unsigned int i, unsigned int n, double beta)
+{
+    if (n == 1) {
+        return 1.0;
+    }
+    double r = 2.0 * i / (n - 1) - 1.0;
+    return bessel_i0(beta * sqrt(1.0 - r * r)) / bessel_i0(beta);
+}
+
+unsigned long long gcd(unsigned long long a, unsigned long long b)
+{
+    while (b != 0) {
+        unsigned long long t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/* modified Bessel function of the first kind, order 0 (power series) */
+static double bessel_i0(double x)
+{
+    double sum = 1.0;
+    double term = 1.0;
+    for (int k = 1; k < 50; k++) {
+        term *= (x / (2 * k)) * (x / (2 * k));
+        sum += term;
+        if (term < sum * 1e-17) {
+            break;
+        }
+    }
+    return sum;
+}
@@ -0,0 +1,45 @@
+/* polyphase rational resampler (interpolate by L, decimate by M) for split
+ * complex float samples, with a Kaiser windowed sinc anti-aliasing filter
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef RESAMPLER_H
+#define RESAMPLER_H
+
+/* filter taps per output sample (per polyphase branch when interpolating) */
+#define RESAMPLER_TAPS_PER_OUTPUT 16
+/* largest interpolation factor */
+#define RESAMPLER_MAX_INTERPOLATION 1024
+/* Kaiser window beta for ~80dB of stopband attenuation */
+#define RESAMPLER_KAISER_BETA 8.0
+
+typedef struct {
+    unsigned int L;
+    unsigned int M;
+    unsigned int taps;          /* taps per polyphase branch */
+    float *phase_taps;          /* L branches of 'taps' coefficients, time reversed */
+    unsigned int max_input;     /* most samples per resampler_run() call */
+    float *buf_i;               /* input samples: taps - 1 of history + max_input */
+    float *buf_q;
+    unsigned int buffered;
+    unsigned int pos;           /* index in buf of the newest sample of the next output */
+    unsigned int branch;        /* polyphase branch of the next output */
+} Resampler;
+
+int resampler_init(Resampler *resampler, unsigned long long input_rate, unsigned int output_rate, float gain, unsigned int max_input);
+void resampler_free(Resampler *resampler);
+/* the caller writes up to max_input new samples here, then calls resampler_run() */
+float *resampler_input_i(Resampler *resampler);
+float *resampler_input_q(Resampler *resampler);
+/* returns the number of output samples (interleaved I/Q) stored in out,
+ * at most n * L / M + 1 */
+unsigned int resampler_run(Resampler *resampler, unsigned int n, float *out);
+double kaiser_window(unsigned int i, unsigned int n, double beta);
+unsigned long long gcd(unsigned long long a, unsigned long long b);
+
+#endif /* RESAMPLER_H */
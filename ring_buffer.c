@@ -0,0 +1,129 @@
+/* single producer/single consumer lock-free ring buffer
+ * used to move data out of the SDRplay API stream callback thread
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring_buffer.h"
+
+int ring_buffer_init(RingBuffer *rb, size_t size)
+{
+    rb->buffer = (unsigned char *) malloc(size);
+    if (rb->buffer == NULL) {
+        return -1;
+    }
+    /* touch every page now, so the stream callback never page faults */
+    memset(rb->buffer, 0, size);
+    rb->size = size;
+    atomic_init(&rb->head, 0);
+    atomic_init(&rb->tail, 0);
+    rb->high_water_mark = 0;
+    rb->overruns = 0;
+    rb->overrun_bytes = 0;
+    return 0;
+}
+
+void ring_buffer_free(RingBuffer *rb)
+{
+    free(rb->buffer);
+    rb->buffer = NULL;
+    rb->size = 0;
+}
+
+/* copy 'count' bytes into the ring buffer; never blocks - if there isn't
+ * enough space the whole block is dropped and counted as an overrun */
+int ring_buffer_write(RingBuffer *rb, const void *data, size_t count)
+{
+    uint64_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    size_t used = head - tail;
+    if (count > rb->size - used) {
+        rb->overruns++;
+        rb->overrun_bytes += count;
+        return -1;
+    }
+
+    size_t offset = head % rb->size;
+    size_t first = rb->size - offset;
+    if (first > count) {
+        first = count;
+    }
+    memcpy(rb->buffer + offset, data, first);
+    memcpy(rb->buffer, (const unsigned char *)data + first, count - first);
+    atomic_store_explicit(&rb->head, head + count, memory_order_release);
+
+    used += count;
+    if (used > rb->high_water_mark) {
+        rb->high_water_mark = used;
+    }
+    return 0;
+}
+
+/* zero copy version of ring_buffer_write(): reserve space for 'count' bytes
+ * and return where to write them; the first region is *data1 (of the size
+ * returned by this function) and the rest goes to *data2 (at the beginning
+ * of the buffer, if the block wraps around). Returns 0 and counts the block
+ * as an overrun if there isn't enough space.
+ * The data becomes visible to the consumer only after ring_buffer_commit() */
+size_t ring_buffer_reserve(RingBuffer *rb, size_t count, void **data1, void **data2)
+{
+    uint64_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    size_t used = head - tail;
+    if (count > rb->size - used) {
+        rb->overruns++;
+        rb->overrun_bytes += count;
+        return 0;
+    }
+
+    size_t offset = head % rb->size;
+    size_t first = rb->size - offset;
+    *data1 = rb->buffer + offset;
+    *data2 = rb->buffer;
+    return first < count ? first : count;
+}
+
+void ring_buffer_commit(RingBuffer *rb, size_t count)
+{
+    uint64_t head = atomic_load_explicit(&rb->head, memory_order_relaxed);
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_acquire);
+    atomic_store_explicit(&rb->head, head + count, memory_order_release);
+
+    size_t used = head + count - tail;
+    if (used > rb->high_water_mark) {
+        rb->high_water_mark = used;
+    }
+}
+
+size_t ring_buffer_read_available(RingBuffer *rb)
+{
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+    return head - tail;
+}
+
+/* return a pointer to the oldest data in the ring buffer and the number of
+ * bytes that can be read contiguously from there (i.e. up to the wrap point) */
+size_t ring_buffer_peek(RingBuffer *rb, const void **data)
+{
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    uint64_t head = atomic_load_explicit(&rb->head, memory_order_acquire);
+    size_t available = head - tail;
+    size_t offset = tail % rb->size;
+    size_t contiguous = rb->size - offset;
+    *data = rb->buffer + offset;
+    return available < contiguous ? available : contiguous;
+}
+
+void ring_buffer_consume(RingBuffer *rb, size_t count)
+{
+    uint64_t tail = atomic_load_explicit(&rb->tail, memory_order_relaxed);
+    atomic_store_explicit(&rb->tail, tail + count, memory_order_release);
+}
@@ -0,0 +1,46 @@
+/* single producer/single consumer lock-free ring buffer
+ * used to move data out of the SDRplay API stream callback thread
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef RING_BUFFER_H
+#define RING_BUFFER_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define CACHE_LINE_SIZE 64
+
+typedef struct {
+    unsigned char *buffer;
+    size_t size;
+    /* head and tail are free running byte counters; keep them on separate
+     * cache lines so producer and consumer don't fight over the same line */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t head;    /* producer only */
+    _Alignas(CACHE_LINE_SIZE) _Atomic uint64_t tail;    /* consumer only */
+    /* statistics - updated by the producer only */
+    _Alignas(CACHE_LINE_SIZE) size_t high_water_mark;
+    unsigned long long overruns;
+    unsigned long long overrun_bytes;
+} RingBuffer;
+
+int ring_buffer_init(RingBuffer *rb, size_t size);
+void ring_buffer_free(RingBuffer *rb);
+
+/* producer side */
+int ring_buffer_write(RingBuffer *rb, const void *data, size_t count);
+size_t ring_buffer_reserve(RingBuffer *rb, size_t count, void **data1, void **data2);
+void ring_buffer_commit(RingBuffer *rb, size_t count);
+
+/* consumer side */
+size_t ring_buffer_read_available(RingBuffer *rb);
+size_t ring_buffer_peek(RingBuffer *rb, const void **data);
+void ring_buffer_consume(RingBuffer *rb, size_t count);
+
+#endif /* RING_BUFFER_H */
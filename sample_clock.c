@@ -0,0 +1,89 @@
+/* sample clock: linear fit of the stream sample index versus time, for the
+ * actual sample rate, the clock drift, and sample aligned timestamps
+ * - only one block every block_interval is used, with the timestamp the
+ *   pipeline takes anyway; the least squares fit averages out the jitter of
+ *   the callback arrival times
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include "sample_clock.h"
+
+
+void sample_clock_init(SampleClock *sample_clock, unsigned int block_interval)
+{
+    sample_clock->block_interval = block_interval > 0 ? block_interval : 1;
+    sample_clock->block_count = 0;
+    sample_clock->sample0 = 0;
+    sample_clock->time0 = 0;
+    sample_clock->realtime0.tv_sec = 0;
+    sample_clock->realtime0.tv_nsec = 0;
+    sample_clock->npoints = 0;
+    sample_clock->mean_samples = 0.0;
+    sample_clock->mean_time = 0.0;
+    sample_clock->m2_samples = 0.0;
+    sample_clock->c_samples_time = 0.0;
+}
+
+void sample_clock_update(SampleClock *sample_clock, uint64_t samples, uint64_t time)
+{
+    if (sample_clock->block_count++ % sample_clock->block_interval != 0) {
+        return;
+    }
+    if (sample_clock->npoints == 0) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+        clock_gettime(CLOCK_REALTIME, &sample_clock->realtime0);
+        /* move the realtime reference back to 'time' */
+        int64_t delta = (int64_t)((uint64_t)now.tv_sec * 1000000000 + now.tv_nsec - time);
+        int64_t realtime0 = (int64_t)sample_clock->realtime0.tv_sec * 1000000000 + sample_clock->realtime0.tv_nsec - delta;
+        sample_clock->realtime0.tv_sec = realtime0 / 1000000000;
+        sample_clock->realtime0.tv_nsec = realtime0 % 1000000000;
+        sample_clock->sample0 = samples;
+        sample_clock->time0 = time;
+    }
+    double x = (double)(samples - sample_clock->sample0);
+    double y = (double)(time - sample_clock->time0);
+    sample_clock->npoints++;
+    double dx = x - sample_clock->mean_samples;
+    sample_clock->mean_samples += dx / sample_clock->npoints;
+    sample_clock->mean_time += (y - sample_clock->mean_time) / sample_clock->npoints;
+    sample_clock->m2_samples += dx * (x - sample_clock->mean_samples);
+    sample_clock->c_samples_time += dx * (y - sample_clock->mean_time);
+}
+
+double sample_clock_rate(const SampleClock *sample_clock)
+{
+    if (sample_clock->npoints < 2 || sample_clock->c_samples_time <= 0) {
+        return 0.0;
+    }
+    /* slope is ns per sample */
+    return 1e9 * sample_clock->m2_samples / sample_clock->c_samples_time;
+}
+
+double sample_clock_drift_ppm(const SampleClock *sample_clock, double nominal_rate)
+{
+    double rate = sample_clock_rate(sample_clock);
+    if (rate <= 0 || nominal_rate <= 0) {
+        return 0.0;
+    }
+    return (rate / nominal_rate - 1.0) * 1e6;
+}
+
+int sample_clock_realtime(const SampleClock *sample_clock, uint64_t sample, struct timespec *realtime)
+{
+    if (sample_clock->npoints < 2 || sample_clock->m2_samples <= 0) {
+        return -1;
+    }
+    double slope = sample_clock->c_samples_time / sample_clock->m2_samples;
+    double x = (double)((int64_t)(sample - sample_clock->sample0));
+    double y = sample_clock->mean_time + slope * (x - sample_clock->mean_samples);
+    int64_t t = (int64_t)sample_clock->realtime0.tv_sec * 1000000000 + sample_clock->realtime0.tv_nsec + (int64_t)(y + 0.5);
+    realtime->tv_sec = t / 1000000000;
+    realtime->tv_nsec = t % 1000000000;
+    return 0;
+}
@@ -0,0 +1,45 @@
+/* sample clock: linear fit of the stream sample index versus time, for the
+ * actual sample rate, the clock drift, and sample aligned timestamps
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SAMPLE_CLOCK_H
+#define SAMPLE_CLOCK_H
+
+#include <stdint.h>
+#include <time.h>
+
+#define SAMPLE_CLOCK_BLOCK_INTERVAL 16
+
+typedef struct {
+    unsigned int block_interval;    /* fit one block every block_interval */
+    unsigned int block_count;
+    /* running (Welford) means and co-moments, relative to the first point
+     * to keep the precision over long runs */
+    uint64_t sample0;
+    uint64_t time0;                 /* CLOCK_MONOTONIC_RAW (ns) */
+    struct timespec realtime0;      /* CLOCK_REALTIME at time0 */
+    unsigned long long npoints;
+    double mean_samples;
+    double mean_time;
+    double m2_samples;
+    double c_samples_time;
+} SampleClock;
+
+void sample_clock_init(SampleClock *sample_clock, unsigned int block_interval);
+/* samples: index of the sample past the end of the block that just
+ * arrived at 'time' (CLOCK_MONOTONIC_RAW, ns) */
+void sample_clock_update(SampleClock *sample_clock, uint64_t samples, uint64_t time);
+/* samples per second from the fit; 0 if there aren't enough points */
+double sample_clock_rate(const SampleClock *sample_clock);
+/* (rate / nominal_rate - 1) * 1e6 */
+double sample_clock_drift_ppm(const SampleClock *sample_clock, double nominal_rate);
+/* wall clock time of a sample (from the fit); -1 if not available yet */
+int sample_clock_realtime(const SampleClock *sample_clock, uint64_t sample, struct timespec *realtime);
+
+#endif /* SAMPLE_CLOCK_H */
@@ -0,0 +1,249 @@
+/* lossless iq16 codec and chunked container for the compressed recordings
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "sample_codec.h"
+
+#define RICE_MAX_PARAMETER 16
+#define RICE_ESCAPE 20              /* quotient from which the value is sent as is */
+#define RICE_ESCAPE_BITS 17         /* enough for any residual (zigzag of -65535..65535) */
+
+/* MSB first */
+typedef struct {
+    unsigned char *p;
+    unsigned char *end;
+    uint64_t acc;
+    unsigned int nbits;
+    int overflow;
+} BitWriter;
+
+typedef struct {
+    const unsigned char *p;
+    const unsigned char *end;
+    uint64_t acc;
+    unsigned int nbits;
+    uint64_t bits_read;
+} BitReader;
+
+static unsigned int rice_parameter(const uint32_t *u, unsigned int n, uint64_t sum);
+
+
+static inline uint32_t zigzag(int32_t d)
+{
+    return ((uint32_t)d << 1) ^ (uint32_t)(d >> 31);
+}
+
+static inline int32_t unzigzag(uint32_t u)
+{
+    return (int32_t)(u >> 1) ^ -(int32_t)(u & 1);
+}
+
+/* n <= 32; value has no bits set above n */
+static inline void put_bits(BitWriter *w, uint32_t value, unsigned int n)
+{
+    w->acc = (w->acc << n) | value;
+    w->nbits += n;
+    while (w->nbits >= 8) {
+        w->nbits -= 8;
+        if (w->p == w->end) {
+            w->overflow = 1;
+            continue;
+        }
+        *w->p++ = (unsigned char)(w->acc >> w->nbits);
+    }
+}
+
+static inline void put_rice(BitWriter *w, uint32_t u, unsigned int k)
+{
+    uint32_t q = u >> k;
+    if (q < RICE_ESCAPE) {
+        /* q ones and a zero */
+        put_bits(w, (1u << (q + 1)) - 2, q + 1);
+        if (k > 0) {
+            put_bits(w, u & ((1u << k) - 1), k);
+        }
+    } else {
+        put_bits(w, (1u << RICE_ESCAPE) - 1, RICE_ESCAPE);
+        put_bits(w, u, RICE_ESCAPE_BITS);
+    }
+}
+
+/* at least 49 bits in the accumulator afterwards (zeros past the end) */
+static inline void refill(BitReader *r)
+{
+    while (r->nbits <= 48) {
+        r->acc = (r->acc << 8) | (r->p < r->end ? *r->p++ : 0);
+        r->nbits += 8;
+    }
+}
+
+/* n <= 32 */
+static inline uint32_t get_bits(BitReader *r, unsigned int n)
+{
+    if (r->nbits < n) {
+        refill(r);
+    }
+    r->nbits -= n;
+    r->bits_read += n;
+    return (uint32_t)(r->acc >> r->nbits) & (uint32_t)((1ull << n) - 1);
+}
+
+static inline uint32_t get_rice(BitReader *r, unsigned int k)
+{
+    refill(r);
+    /* the valid bits at the top; below them zeros, i.e. ones in ~window */
+    uint64_t window = r->acc << (64 - r->nbits);
+    unsigned int ones = __builtin_clzll(~window);
+    if (ones >= RICE_ESCAPE) {
+        r->nbits -= RICE_ESCAPE;
+        r->bits_read += RICE_ESCAPE;
+        return get_bits(r, RICE_ESCAPE_BITS);
+    }
+    r->nbits -= ones + 1;
+    r->bits_read += ones + 1;
+    return (ones << k) | (k > 0 ? get_bits(r, k) : 0);
+}
+
+size_t sample_codec_encode(const short *in, unsigned int nframes, unsigned char *out, size_t out_size)
+{
+    BitWriter w = { out, out + out_size, 0, 0, 0 };
+    int32_t prev[2] = { 0, 0 };
+    uint32_t u[2][SAMPLE_CODEC_BLOCK_FRAMES];
+    for (unsigned int start = 0; start < nframes; start += SAMPLE_CODEC_BLOCK_FRAMES) {
+        unsigned int n = nframes - start < SAMPLE_CODEC_BLOCK_FRAMES ? nframes - start : SAMPLE_CODEC_BLOCK_FRAMES;
+        unsigned int k[2];
+        for (int c = 0; c < 2; c++) {
+            const short *x = in + 2 * start + c;
+            /* predictor: none (white noise) or the previous sample (oversampled) */
+            uint64_t sum0 = 0;
+            uint64_t sum1 = 0;
+            int32_t p = prev[c];
+            for (unsigned int i = 0; i < n; i++) {
+                int32_t v = x[2 * i];
+                sum0 += zigzag(v);
+                sum1 += zigzag(v - p);
+                p = v;
+            }
+            int order = sum1 < sum0;
+            p = prev[c];
+            for (unsigned int i = 0; i < n; i++) {
+                int32_t v = x[2 * i];
+                u[c][i] = zigzag(order ? v - p : v);
+                p = v;
+            }
+            prev[c] = p;
+            k[c] = rice_parameter(u[c], n, order ? sum1 : sum0);
+            put_bits(&w, (uint32_t)order << 5 | k[c], 6);
+        }
+        for (unsigned int i = 0; i < n; i++) {
+            put_rice(&w, u[0][i], k[0]);
+            put_rice(&w, u[1][i], k[1]);
+        }
+        if (w.overflow) {
+            return 0;
+        }
+    }
+    if (w.nbits > 0) {
+        put_bits(&w, 0, 8 - w.nbits);
+    }
+    return w.overflow ? 0 : (size_t)(w.p - out);
+}
+
+int sample_codec_decode(const unsigned char *in, size_t in_size, short *out, unsigned int nframes)
+{
+    BitReader r = { in, in + in_size, 0, 0, 0 };
+    int32_t prev[2] = { 0, 0 };
+    for (unsigned int start = 0; start < nframes; start += SAMPLE_CODEC_BLOCK_FRAMES) {
+        unsigned int n = nframes - start < SAMPLE_CODEC_BLOCK_FRAMES ? nframes - start : SAMPLE_CODEC_BLOCK_FRAMES;
+        int order[2];
+        unsigned int k[2];
+        for (int c = 0; c < 2; c++) {
+            uint32_t parameters = get_bits(&r, 6);
+            order[c] = parameters >> 5;
+            k[c] = parameters & 0x1f;
+            if (k[c] > RICE_MAX_PARAMETER) {
+                return -1;
+            }
+        }
+        short *x = out + 2 * start;
+        for (unsigned int i = 0; i < n; i++) {
+            for (int c = 0; c < 2; c++) {
+                int32_t v = unzigzag(get_rice(&r, k[c]));
+                if (order[c]) {
+                    v += prev[c];
+                }
+                if (v < -32768 || v > 32767) {
+                    return -1;
+                }
+                x[2 * i + c] = (short)v;
+                prev[c] = v;
+            }
+        }
+        if (r.bits_read > (uint64_t)in_size * 8) {
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* the Rice parameter with the fewest bits, around log2 of the mean */
+static unsigned int rice_parameter(const uint32_t *u, unsigned int n, uint64_t sum)
+{
+    uint64_t mean = sum / n;
+    int k0 = mean > 0 ? 63 - __builtin_clzll(mean) : 0;
+    unsigned int best_k = 0;
+    uint64_t best_bits = UINT64_MAX;
+    for (int k = k0 - 1; k <= k0 + 1; k++) {
+        if (k < 0 || k > RICE_MAX_PARAMETER) {
+            continue;
+        }
+        uint64_t bits = 0;
+        for (unsigned int i = 0; i < n; i++) {
+            uint32_t q = u[i] >> k;
+            bits += q < RICE_ESCAPE ? q + 1 + k : RICE_ESCAPE + RICE_ESCAPE_BITS;
+        }
+        if (bits < best_bits) {
+            best_bits = bits;
+            best_k = k;
+        }
+    }
+    return best_k;
+}
+
+int chunk_file_frames(const char *filename, uint64_t *frames)
+{
+    FILE *fp = fopen(filename, "rb");
+    if (fp == NULL) {
+        fprintf(stderr, "fopen(%s) failed: %s\n", filename, strerror(errno));
+        return -1;
+    }
+    int ret = -1;
+    ChunkFileTrailer trailer;
+    ChunkIndexEntry last;
+    if (fseek(fp, -(long)sizeof(trailer), SEEK_END) == 0 && fread(&trailer, sizeof(trailer), 1, fp) == 1 &&
+        memcmp(trailer.magic, CHUNK_INDEX_MAGIC, sizeof(trailer.magic)) == 0) {
+        if (trailer.nchunks == 0) {
+            *frames = 0;
+            ret = 0;
+        } else if (fseek(fp, trailer.index_offset + (trailer.nchunks - 1) * sizeof(last), SEEK_SET) == 0 &&
+                   fread(&last, sizeof(last), 1, fp) == 1) {
+            *frames = last.first_frame + last.nframes;
+            ret = 0;
+        }
+    }
+    if (ret == -1) {
+        fprintf(stderr, "%s: no chunk index\n", filename);
+    }
+    fclose(fp);
+    return ret;
+}
@@ -0,0 +1,79 @@
+/* lossless iq16 codec and chunked container for the compressed recordings
+ * - each chunk is coded on its own (no state carried over), so that any
+ *   chunk can be decoded from the index without reading the ones before it
+ * - the samples are mostly low amplitude noise, so each channel (I and Q)
+ *   is coded as the residuals of a fixed predictor (none, or the previous
+ *   sample), chosen per block of SAMPLE_CODEC_BLOCK_FRAMES frames, with
+ *   Rice codes whose parameter is also chosen per block
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SAMPLE_CODEC_H
+#define SAMPLE_CODEC_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SAMPLE_CODEC_BLOCK_FRAMES 256
+
+/* container layout (all little endian):
+ *   file header: ChunkFileHeader
+ *   chunks: ChunkHeader followed by size bytes of payload (codec raw:
+ *           the interleaved iq16 frames; codec rice: the coded frames)
+ *   index: ChunkIndexEntry[nchunks], one per chunk, in stream order
+ *   trailer: ChunkFileTrailer (the last 24 bytes of the file)
+ * without a trailer (e.g. the recorder was killed) the chunks can still be
+ * read in sequence, from one chunk header to the next */
+#define CHUNK_FILE_MAGIC "IQCHUNK\0"
+#define CHUNK_FILE_VERSION 1
+#define CHUNK_MAGIC 0x4b4e4843          /* "CHNK" */
+#define CHUNK_INDEX_MAGIC "IQINDEX\0"
+
+#define CHUNK_CODEC_RAW 0               /* didn't compress */
+#define CHUNK_CODEC_RICE 1
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t frame_size;                /* 4 (iq16) */
+    uint32_t chunk_frames;              /* frames in a full chunk */
+    uint32_t block_frames;              /* SAMPLE_CODEC_BLOCK_FRAMES */
+} ChunkFileHeader;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t codec;
+    uint32_t nframes;
+    uint32_t size;                      /* payload bytes */
+    uint64_t first_frame;               /* frames in the chunks before it */
+} ChunkHeader;
+
+typedef struct {
+    uint64_t offset;                    /* of the chunk header */
+    uint64_t first_frame;
+    uint32_t nframes;
+    uint32_t size;                      /* payload bytes */
+} ChunkIndexEntry;
+
+typedef struct {
+    uint64_t index_offset;
+    uint64_t nchunks;
+    char magic[8];
+} ChunkFileTrailer;
+
+/* code nframes interleaved iq16 frames into out; returns the coded size,
+ * or 0 if it would take more than out_size bytes (-> store the chunk raw) */
+size_t sample_codec_encode(const short *in, unsigned int nframes, unsigned char *out, size_t out_size);
+/* decode a CHUNK_CODEC_RICE payload of nframes frames into out; 0 on
+ * success, -1 if the payload is corrupt */
+int sample_codec_decode(const unsigned char *in, size_t in_size, short *out, unsigned int nframes);
+/* the frames in a complete container (from its index); 0 on success, -1
+ * if there is no index */
+int chunk_file_frames(const char *filename, uint64_t *frames);
+
+#endif /* SAMPLE_CODEC_H */
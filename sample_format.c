@@ -0,0 +1,146 @@
+/* output sample formats: interleaved 16 bit (iq16), packed 12 bit (iq12),
+ * 8 bit (iq8), and complex float (cf32)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "sample_format.h"
+
+static int max_value(SampleFormat format);
+
+
+/* <bits>[:<shift>|:auto] - e.g. '16', '12', '12:2', '8', '8:auto', '8:4';
+ * the default shift is 'auto' for both 12 and 8 bit (a fixed one would
+ * clip the 14 bit samples of most RSPs in 12 bit)
+ * cf32[:<scale>] - e.g. 'cf32', 'cf32:1' (default scale: 1/32768) */
+int sample_format_parse(const char *spec, SampleFormatSpec *format_spec)
+{
+    format_spec->shift = 0;
+    format_spec->scale = SAMPLE_FORMAT_CF32_SCALE;
+
+    if (strncmp(spec, "cf32", 4) == 0) {
+        format_spec->format = SAMPLE_FORMAT_CF32;
+        const char *p = spec + 4;
+        if (*p == '\0') {
+            return 0;
+        }
+        char *end;
+        if (*p != ':' || (format_spec->scale = strtof(p + 1, &end)) == 0.0f || *end != '\0') {
+            return -1;
+        }
+        return 0;
+    }
+
+    int bits;
+    int n;
+    if (sscanf(spec, "%d%n", &bits, &n) != 1) {
+        return -1;
+    }
+    switch (bits) {
+        case 16: format_spec->format = SAMPLE_FORMAT_IQ16; break;
+        case 12: format_spec->format = SAMPLE_FORMAT_IQ12; format_spec->shift = SAMPLE_FORMAT_AUTO_SHIFT; break;
+        case 8: format_spec->format = SAMPLE_FORMAT_IQ8; format_spec->shift = SAMPLE_FORMAT_AUTO_SHIFT; break;
+        default: return -1;
+    }
+    const char *p = spec + n;
+    if (*p == '\0') {
+        return 0;
+    }
+    if (*p != ':' || format_spec->format == SAMPLE_FORMAT_IQ16) {
+        return -1;
+    }
+    p++;
+    if (strcmp(p, "auto") == 0) {
+        format_spec->shift = SAMPLE_FORMAT_AUTO_SHIFT;
+        return 0;
+    }
+    int shift;
+    if (sscanf(p, "%d%n", &shift, &n) != 1 || p[n] != '\0' || shift < 0 || shift > 15) {
+        return -1;
+    }
+    format_spec->shift = shift;
+    return 0;
+}
+
+const char *sample_format_name(SampleFormat format)
+{
+    switch (format) {
+        case SAMPLE_FORMAT_IQ12: return "iq12";
+        case SAMPLE_FORMAT_IQ8: return "iq8";
+        case SAMPLE_FORMAT_CF32: return "cf32";
+        default: return "iq16";
+    }
+}
+
+size_t sample_format_frame_size(SampleFormat format)
+{
+    switch (format) {
+        case SAMPLE_FORMAT_IQ12: return 3;
+        case SAMPLE_FORMAT_IQ8: return 2;
+        case SAMPLE_FORMAT_CF32: return 2 * sizeof(float);
+        default: return 2 * sizeof(short);
+    }
+}
+
+/* smallest shift that leaves 6dB of headroom above the peak of the samples
+ * seen so far */
+int sample_format_auto_shift(SampleFormat format, const SampleRange *range)
+{
+    int peak = -range->imin;
+    peak = peak > range->imax ? peak : range->imax;
+    peak = peak > -range->qmin ? peak : -range->qmin;
+    peak = peak > range->qmax ? peak : range->qmax;
+    int shift = 0;
+    while (shift < 15 && (peak >> shift) > max_value(format) / 2) {
+        shift++;
+    }
+    return shift;
+}
+
+/* did any sample (in the whole range) saturate? */
+int sample_format_clipped(const SampleFormatSpec *format_spec, const SampleRange *range)
+{
+    if (format_spec->format == SAMPLE_FORMAT_CF32) {
+        return 0;
+    }
+    int shift = format_spec->shift;
+    int hi = max_value(format_spec->format);
+    int lo = -hi - 1;
+    return (range->imin >> shift) < lo || (range->imax >> shift) > hi ||
+           (range->qmin >> shift) < lo || (range->qmax >> shift) > hi;
+}
+
+void sample_format_pack(const SampleFormatSpec *format_spec, const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, SampleRange *range)
+{
+    switch (format_spec->format) {
+        case SAMPLE_FORMAT_IQ12:
+            pack12_minmax(xi, xq, out, numSamples, format_spec->shift, range);
+            break;
+        case SAMPLE_FORMAT_IQ8:
+            pack8_minmax(xi, xq, out, numSamples, format_spec->shift, range);
+            break;
+        case SAMPLE_FORMAT_CF32:
+            interleave_float_minmax(xi, xq, (float *)out, numSamples, format_spec->scale, range);
+            break;
+        default:
+            interleave_minmax(xi, xq, (short *)out, numSamples, range);
+            break;
+    }
+}
+
+static int max_value(SampleFormat format)
+{
+    switch (format) {
+        case SAMPLE_FORMAT_IQ12: return 2047;
+        case SAMPLE_FORMAT_IQ8: return 127;
+        default: return 32767;
+    }
+}
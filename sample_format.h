@@ -0,0 +1,47 @@
+/* output sample formats: interleaved 16 bit (iq16), packed 12 bit (iq12),
+ * 8 bit (iq8), and complex float (cf32)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SAMPLE_FORMAT_H
+#define SAMPLE_FORMAT_H
+
+#include <stddef.h>
+
+#include "sample_kernels.h"
+
+typedef enum {
+    SAMPLE_FORMAT_IQ16,
+    SAMPLE_FORMAT_IQ12,
+    SAMPLE_FORMAT_IQ8,
+    SAMPLE_FORMAT_CF32,
+} SampleFormat;
+
+typedef struct {
+    SampleFormat format;
+    int shift;        /* iq12/iq8 only */
+    float scale;      /* cf32 only */
+} SampleFormatSpec;
+
+/* pick the shift from the sample range of the first block */
+#define SAMPLE_FORMAT_AUTO_SHIFT -1
+
+/* default cf32 scale: full scale 16 bit samples -> [-1.0, 1.0) */
+#define SAMPLE_FORMAT_CF32_SCALE (1.0f / 32768.0f)
+
+/* largest frame (I/Q pair) size of all formats */
+#define SAMPLE_FORMAT_MAX_FRAME_SIZE (2 * sizeof(float))
+
+int sample_format_parse(const char *spec, SampleFormatSpec *format_spec);
+const char *sample_format_name(SampleFormat format);
+size_t sample_format_frame_size(SampleFormat format);
+int sample_format_auto_shift(SampleFormat format, const SampleRange *range);
+int sample_format_clipped(const SampleFormatSpec *format_spec, const SampleRange *range);
+void sample_format_pack(const SampleFormatSpec *format_spec, const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, SampleRange *range);
+
+#endif /* SAMPLE_FORMAT_H */
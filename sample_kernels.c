@@ -0,0 +1,548 @@
+/* sample processing kernels for the stream callback hot path
+ * (SSE2/AVX2/NEON with runtime CPU dispatch and a scalar fallback)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <limits.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#define HAVE_NEON_KERNELS
+#include <arm_neon.h>
+#endif
+
+#include "sample_kernels.h"
+
+static void interleave_minmax_scalar(const short *xi, const short *xq, short *out, unsigned int numSamples, SampleRange *range);
+static void minmax_scalar(const short *xi, const short *xq, unsigned int numSamples, SampleRange *range);
+static void pack8_minmax_scalar(const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, int shift, SampleRange *range);
+static void pack12_minmax_scalar(const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, int shift, SampleRange *range);
+static void interleave_float_minmax_scalar(const short *xi, const short *xq, float *out, unsigned int numSamples, float scale, SampleRange *range);
+
+InterleaveMinMaxFn interleave_minmax = interleave_minmax_scalar;
+MinMaxFn minmax = minmax_scalar;
+PackMinMaxFn pack8_minmax = pack8_minmax_scalar;
+/* the 12 bit packing is bound by the odd 3 byte stores; scalar only */
+PackMinMaxFn pack12_minmax = pack12_minmax_scalar;
+InterleaveFloatMinMaxFn interleave_float_minmax = interleave_float_minmax_scalar;
+static const char *kernels_name = "scalar";
+
+
+void sample_range_init(SampleRange *range)
+{
+    range->imin = SHRT_MAX;
+    range->imax = SHRT_MIN;
+    range->qmin = SHRT_MAX;
+    range->qmax = SHRT_MIN;
+}
+
+/* scalar versions - also used for the tail of the SIMD versions */
+static void interleave_minmax_scalar(const short *xi, const short *xq, short *out, unsigned int numSamples, SampleRange *range)
+{
+    short imin = range->imin;
+    short imax = range->imax;
+    short qmin = range->qmin;
+    short qmax = range->qmax;
+    for (unsigned int i = 0; i < numSamples; i++) {
+        short vi = xi[i];
+        short vq = xq[i];
+        imin = imin < vi ? imin : vi;
+        imax = imax > vi ? imax : vi;
+        qmin = qmin < vq ? qmin : vq;
+        qmax = qmax > vq ? qmax : vq;
+        out[2*i] = vi;
+        out[2*i+1] = vq;
+    }
+    range->imin = imin;
+    range->imax = imax;
+    range->qmin = qmin;
+    range->qmax = qmax;
+}
+
+static void minmax_scalar(const short *xi, const short *xq, unsigned int numSamples, SampleRange *range)
+{
+    short imin = range->imin;
+    short imax = range->imax;
+    short qmin = range->qmin;
+    short qmax = range->qmax;
+    for (unsigned int i = 0; i < numSamples; i++) {
+        imin = imin < xi[i] ? imin : xi[i];
+        imax = imax > xi[i] ? imax : xi[i];
+        qmin = qmin < xq[i] ? qmin : xq[i];
+        qmax = qmax > xq[i] ? qmax : xq[i];
+    }
+    range->imin = imin;
+    range->imax = imax;
+    range->qmin = qmin;
+    range->qmax = qmax;
+}
+
+static inline int saturate(int v, int lo, int hi)
+{
+    return v < lo ? lo : v > hi ? hi : v;
+}
+
+static void pack8_minmax_scalar(const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, int shift, SampleRange *range)
+{
+    short imin = range->imin;
+    short imax = range->imax;
+    short qmin = range->qmin;
+    short qmax = range->qmax;
+    for (unsigned int i = 0; i < numSamples; i++) {
+        short vi = xi[i];
+        short vq = xq[i];
+        imin = imin < vi ? imin : vi;
+        imax = imax > vi ? imax : vi;
+        qmin = qmin < vq ? qmin : vq;
+        qmax = qmax > vq ? qmax : vq;
+        out[2*i] = (unsigned char)saturate(vi >> shift, -128, 127);
+        out[2*i+1] = (unsigned char)saturate(vq >> shift, -128, 127);
+    }
+    range->imin = imin;
+    range->imax = imax;
+    range->qmin = qmin;
+    range->qmax = qmax;
+}
+
+/* 3 bytes per I/Q pair: I[7:0], Q[3:0]<<4 | I[11:8], Q[11:4] */
+static void pack12_minmax_scalar(const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, int shift, SampleRange *range)
+{
+    short imin = range->imin;
+    short imax = range->imax;
+    short qmin = range->qmin;
+    short qmax = range->qmax;
+    for (unsigned int i = 0; i < numSamples; i++) {
+        short vi = xi[i];
+        short vq = xq[i];
+        imin = imin < vi ? imin : vi;
+        imax = imax > vi ? imax : vi;
+        qmin = qmin < vq ? qmin : vq;
+        qmax = qmax > vq ? qmax : vq;
+        unsigned int pi = (unsigned int)saturate(vi >> shift, -2048, 2047) & 0xfff;
+        unsigned int pq = (unsigned int)saturate(vq >> shift, -2048, 2047) & 0xfff;
+        out[3*i] = pi & 0xff;
+        out[3*i+1] = (pi >> 8) | ((pq & 0x0f) << 4);
+        out[3*i+2] = pq >> 4;
+    }
+    range->imin = imin;
+    range->imax = imax;
+    range->qmin = qmin;
+    range->qmax = qmax;
+}
+
+static void interleave_float_minmax_scalar(const short *xi, const short *xq, float *out, unsigned int numSamples, float scale, SampleRange *range)
+{
+    short imin = range->imin;
+    short imax = range->imax;
+    short qmin = range->qmin;
+    short qmax = range->qmax;
+    for (unsigned int i = 0; i < numSamples; i++) {
+        short vi = xi[i];
+        short vq = xq[i];
+        imin = imin < vi ? imin : vi;
+        imax = imax > vi ? imax : vi;
+        qmin = qmin < vq ? qmin : vq;
+        qmax = qmax > vq ? qmax : vq;
+        out[2*i] = vi * scale;
+        out[2*i+1] = vq * scale;
+    }
+    range->imin = imin;
+    range->imax = imax;
+    range->qmin = qmin;
+    range->qmax = qmax;
+}
+
+#ifdef HAVE_X86_KERNELS
+__attribute__((target("sse2")))
+static inline short hmin_epi16(__m128i v)
+{
+    v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_min_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_min_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (short)_mm_extract_epi16(v, 0);
+}
+
+__attribute__((target("sse2")))
+static inline short hmax_epi16(__m128i v)
+{
+    v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(1, 0, 3, 2)));
+    v = _mm_max_epi16(v, _mm_shuffle_epi32(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    v = _mm_max_epi16(v, _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1)));
+    return (short)_mm_extract_epi16(v, 0);
+}
+
+__attribute__((target("sse2")))
+static void interleave_minmax_sse2(const short *xi, const short *xq, short *out, unsigned int numSamples, SampleRange *range)
+{
+    __m128i imin = _mm_set1_epi16(range->imin);
+    __m128i imax = _mm_set1_epi16(range->imax);
+    __m128i qmin = _mm_set1_epi16(range->qmin);
+    __m128i qmax = _mm_set1_epi16(range->qmax);
+    unsigned int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        __m128i vi = _mm_loadu_si128((const __m128i *)(xi + i));
+        __m128i vq = _mm_loadu_si128((const __m128i *)(xq + i));
+        imin = _mm_min_epi16(imin, vi);
+        imax = _mm_max_epi16(imax, vi);
+        qmin = _mm_min_epi16(qmin, vq);
+        qmax = _mm_max_epi16(qmax, vq);
+        _mm_storeu_si128((__m128i *)(out + 2*i), _mm_unpacklo_epi16(vi, vq));
+        _mm_storeu_si128((__m128i *)(out + 2*i + 8), _mm_unpackhi_epi16(vi, vq));
+    }
+    range->imin = hmin_epi16(imin);
+    range->imax = hmax_epi16(imax);
+    range->qmin = hmin_epi16(qmin);
+    range->qmax = hmax_epi16(qmax);
+    interleave_minmax_scalar(xi + i, xq + i, out + 2*i, numSamples - i, range);
+}
+
+__attribute__((target("sse2")))
+static void minmax_sse2(const short *xi, const short *xq, unsigned int numSamples, SampleRange *range)
+{
+    __m128i imin = _mm_set1_epi16(range->imin);
+    __m128i imax = _mm_set1_epi16(range->imax);
+    __m128i qmin = _mm_set1_epi16(range->qmin);
+    __m128i qmax = _mm_set1_epi16(range->qmax);
+    unsigned int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        __m128i vi = _mm_loadu_si128((const __m128i *)(xi + i));
+        __m128i vq = _mm_loadu_si128((const __m128i *)(xq + i));
+        imin = _mm_min_epi16(imin, vi);
+        imax = _mm_max_epi16(imax, vi);
+        qmin = _mm_min_epi16(qmin, vq);
+        qmax = _mm_max_epi16(qmax, vq);
+    }
+    range->imin = hmin_epi16(imin);
+    range->imax = hmax_epi16(imax);
+    range->qmin = hmin_epi16(qmin);
+    range->qmax = hmax_epi16(qmax);
+    minmax_scalar(xi + i, xq + i, numSamples - i, range);
+}
+
+__attribute__((target("sse2")))
+static void pack8_minmax_sse2(const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, int shift, SampleRange *range)
+{
+    __m128i imin = _mm_set1_epi16(range->imin);
+    __m128i imax = _mm_set1_epi16(range->imax);
+    __m128i qmin = _mm_set1_epi16(range->qmin);
+    __m128i qmax = _mm_set1_epi16(range->qmax);
+    __m128i count = _mm_cvtsi32_si128(shift);
+    unsigned int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        __m128i vi = _mm_loadu_si128((const __m128i *)(xi + i));
+        __m128i vq = _mm_loadu_si128((const __m128i *)(xq + i));
+        imin = _mm_min_epi16(imin, vi);
+        imax = _mm_max_epi16(imax, vi);
+        qmin = _mm_min_epi16(qmin, vq);
+        qmax = _mm_max_epi16(qmax, vq);
+        __m128i lo = _mm_sra_epi16(_mm_unpacklo_epi16(vi, vq), count);
+        __m128i hi = _mm_sra_epi16(_mm_unpackhi_epi16(vi, vq), count);
+        _mm_storeu_si128((__m128i *)(out + 2*i), _mm_packs_epi16(lo, hi));
+    }
+    range->imin = hmin_epi16(imin);
+    range->imax = hmax_epi16(imax);
+    range->qmin = hmin_epi16(qmin);
+    range->qmax = hmax_epi16(qmax);
+    pack8_minmax_scalar(xi + i, xq + i, out + 2*i, numSamples - i, shift, range);
+}
+
+/* SSE2 has no 16 -> 32 bit sign extension; unpack each value with itself
+ * and shift it down instead */
+__attribute__((target("sse2")))
+static inline __m128 cvtlo_epi16_ps(__m128i v, __m128 scale)
+{
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16)), scale);
+}
+
+__attribute__((target("sse2")))
+static inline __m128 cvthi_epi16_ps(__m128i v, __m128 scale)
+{
+    return _mm_mul_ps(_mm_cvtepi32_ps(_mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16)), scale);
+}
+
+__attribute__((target("sse2")))
+static void interleave_float_minmax_sse2(const short *xi, const short *xq, float *out, unsigned int numSamples, float scale, SampleRange *range)
+{
+    __m128i imin = _mm_set1_epi16(range->imin);
+    __m128i imax = _mm_set1_epi16(range->imax);
+    __m128i qmin = _mm_set1_epi16(range->qmin);
+    __m128i qmax = _mm_set1_epi16(range->qmax);
+    __m128 vscale = _mm_set1_ps(scale);
+    unsigned int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        __m128i vi = _mm_loadu_si128((const __m128i *)(xi + i));
+        __m128i vq = _mm_loadu_si128((const __m128i *)(xq + i));
+        imin = _mm_min_epi16(imin, vi);
+        imax = _mm_max_epi16(imax, vi);
+        qmin = _mm_min_epi16(qmin, vq);
+        qmax = _mm_max_epi16(qmax, vq);
+        __m128i lo = _mm_unpacklo_epi16(vi, vq);
+        __m128i hi = _mm_unpackhi_epi16(vi, vq);
+        _mm_storeu_ps(out + 2*i, cvtlo_epi16_ps(lo, vscale));
+        _mm_storeu_ps(out + 2*i + 4, cvthi_epi16_ps(lo, vscale));
+        _mm_storeu_ps(out + 2*i + 8, cvtlo_epi16_ps(hi, vscale));
+        _mm_storeu_ps(out + 2*i + 12, cvthi_epi16_ps(hi, vscale));
+    }
+    range->imin = hmin_epi16(imin);
+    range->imax = hmax_epi16(imax);
+    range->qmin = hmin_epi16(qmin);
+    range->qmax = hmax_epi16(qmax);
+    interleave_float_minmax_scalar(xi + i, xq + i, out + 2*i, numSamples - i, scale, range);
+}
+
+__attribute__((target("avx2")))
+static void interleave_minmax_avx2(const short *xi, const short *xq, short *out, unsigned int numSamples, SampleRange *range)
+{
+    __m256i imin = _mm256_set1_epi16(range->imin);
+    __m256i imax = _mm256_set1_epi16(range->imax);
+    __m256i qmin = _mm256_set1_epi16(range->qmin);
+    __m256i qmax = _mm256_set1_epi16(range->qmax);
+    unsigned int i = 0;
+    for (; i + 16 <= numSamples; i += 16) {
+        __m256i vi = _mm256_loadu_si256((const __m256i *)(xi + i));
+        __m256i vq = _mm256_loadu_si256((const __m256i *)(xq + i));
+        imin = _mm256_min_epi16(imin, vi);
+        imax = _mm256_max_epi16(imax, vi);
+        qmin = _mm256_min_epi16(qmin, vq);
+        qmax = _mm256_max_epi16(qmax, vq);
+        /* unpack works within each 128 bit lane, so put the lanes back in order */
+        __m256i lo = _mm256_unpacklo_epi16(vi, vq);
+        __m256i hi = _mm256_unpackhi_epi16(vi, vq);
+        _mm256_storeu_si256((__m256i *)(out + 2*i), _mm256_permute2x128_si256(lo, hi, 0x20));
+        _mm256_storeu_si256((__m256i *)(out + 2*i + 16), _mm256_permute2x128_si256(lo, hi, 0x31));
+    }
+    range->imin = hmin_epi16(_mm_min_epi16(_mm256_castsi256_si128(imin), _mm256_extracti128_si256(imin, 1)));
+    range->imax = hmax_epi16(_mm_max_epi16(_mm256_castsi256_si128(imax), _mm256_extracti128_si256(imax, 1)));
+    range->qmin = hmin_epi16(_mm_min_epi16(_mm256_castsi256_si128(qmin), _mm256_extracti128_si256(qmin, 1)));
+    range->qmax = hmax_epi16(_mm_max_epi16(_mm256_castsi256_si128(qmax), _mm256_extracti128_si256(qmax, 1)));
+    interleave_minmax_scalar(xi + i, xq + i, out + 2*i, numSamples - i, range);
+}
+
+__attribute__((target("avx2")))
+static void minmax_avx2(const short *xi, const short *xq, unsigned int numSamples, SampleRange *range)
+{
+    __m256i imin = _mm256_set1_epi16(range->imin);
+    __m256i imax = _mm256_set1_epi16(range->imax);
+    __m256i qmin = _mm256_set1_epi16(range->qmin);
+    __m256i qmax = _mm256_set1_epi16(range->qmax);
+    unsigned int i = 0;
+    for (; i + 16 <= numSamples; i += 16) {
+        __m256i vi = _mm256_loadu_si256((const __m256i *)(xi + i));
+        __m256i vq = _mm256_loadu_si256((const __m256i *)(xq + i));
+        imin = _mm256_min_epi16(imin, vi);
+        imax = _mm256_max_epi16(imax, vi);
+        qmin = _mm256_min_epi16(qmin, vq);
+        qmax = _mm256_max_epi16(qmax, vq);
+    }
+    range->imin = hmin_epi16(_mm_min_epi16(_mm256_castsi256_si128(imin), _mm256_extracti128_si256(imin, 1)));
+    range->imax = hmax_epi16(_mm_max_epi16(_mm256_castsi256_si128(imax), _mm256_extracti128_si256(imax, 1)));
+    range->qmin = hmin_epi16(_mm_min_epi16(_mm256_castsi256_si128(qmin), _mm256_extracti128_si256(qmin, 1)));
+    range->qmax = hmax_epi16(_mm_max_epi16(_mm256_castsi256_si128(qmax), _mm256_extracti128_si256(qmax, 1)));
+    minmax_scalar(xi + i, xq + i, numSamples - i, range);
+}
+
+__attribute__((target("avx2")))
+static void pack8_minmax_avx2(const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, int shift, SampleRange *range)
+{
+    __m256i imin = _mm256_set1_epi16(range->imin);
+    __m256i imax = _mm256_set1_epi16(range->imax);
+    __m256i qmin = _mm256_set1_epi16(range->qmin);
+    __m256i qmax = _mm256_set1_epi16(range->qmax);
+    __m128i count = _mm_cvtsi32_si128(shift);
+    unsigned int i = 0;
+    for (; i + 16 <= numSamples; i += 16) {
+        __m256i vi = _mm256_loadu_si256((const __m256i *)(xi + i));
+        __m256i vq = _mm256_loadu_si256((const __m256i *)(xq + i));
+        imin = _mm256_min_epi16(imin, vi);
+        imax = _mm256_max_epi16(imax, vi);
+        qmin = _mm256_min_epi16(qmin, vq);
+        qmax = _mm256_max_epi16(qmax, vq);
+        /* both unpack and pack work within each 128 bit lane, so the
+         * pairs come out in order without any lane permutation */
+        __m256i lo = _mm256_sra_epi16(_mm256_unpacklo_epi16(vi, vq), count);
+        __m256i hi = _mm256_sra_epi16(_mm256_unpackhi_epi16(vi, vq), count);
+        _mm256_storeu_si256((__m256i *)(out + 2*i), _mm256_packs_epi16(lo, hi));
+    }
+    range->imin = hmin_epi16(_mm_min_epi16(_mm256_castsi256_si128(imin), _mm256_extracti128_si256(imin, 1)));
+    range->imax = hmax_epi16(_mm_max_epi16(_mm256_castsi256_si128(imax), _mm256_extracti128_si256(imax, 1)));
+    range->qmin = hmin_epi16(_mm_min_epi16(_mm256_castsi256_si128(qmin), _mm256_extracti128_si256(qmin, 1)));
+    range->qmax = hmax_epi16(_mm_max_epi16(_mm256_castsi256_si128(qmax), _mm256_extracti128_si256(qmax, 1)));
+    pack8_minmax_scalar(xi + i, xq + i, out + 2*i, numSamples - i, shift, range);
+}
+
+__attribute__((target("avx2")))
+static void interleave_float_minmax_avx2(const short *xi, const short *xq, float *out, unsigned int numSamples, float scale, SampleRange *range)
+{
+    __m256i imin = _mm256_set1_epi16(range->imin);
+    __m256i imax = _mm256_set1_epi16(range->imax);
+    __m256i qmin = _mm256_set1_epi16(range->qmin);
+    __m256i qmax = _mm256_set1_epi16(range->qmax);
+    __m256 vscale = _mm256_set1_ps(scale);
+    unsigned int i = 0;
+    for (; i + 16 <= numSamples; i += 16) {
+        __m256i vi = _mm256_loadu_si256((const __m256i *)(xi + i));
+        __m256i vq = _mm256_loadu_si256((const __m256i *)(xq + i));
+        imin = _mm256_min_epi16(imin, vi);
+        imax = _mm256_max_epi16(imax, vi);
+        qmin = _mm256_min_epi16(qmin, vq);
+        qmax = _mm256_max_epi16(qmax, vq);
+        /* same lane fixup as interleave_minmax_avx2(), then widen 8 values at a time */
+        __m256i lo = _mm256_unpacklo_epi16(vi, vq);
+        __m256i hi = _mm256_unpackhi_epi16(vi, vq);
+        __m256i p0 = _mm256_permute2x128_si256(lo, hi, 0x20);
+        __m256i p1 = _mm256_permute2x128_si256(lo, hi, 0x31);
+        _mm256_storeu_ps(out + 2*i, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(p0))), vscale));
+        _mm256_storeu_ps(out + 2*i + 8, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(p0, 1))), vscale));
+        _mm256_storeu_ps(out + 2*i + 16, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_castsi256_si128(p1))), vscale));
+        _mm256_storeu_ps(out + 2*i + 24, _mm256_mul_ps(_mm256_cvtepi32_ps(_mm256_cvtepi16_epi32(_mm256_extracti128_si256(p1, 1))), vscale));
+    }
+    range->imin = hmin_epi16(_mm_min_epi16(_mm256_castsi256_si128(imin), _mm256_extracti128_si256(imin, 1)));
+    range->imax = hmax_epi16(_mm_max_epi16(_mm256_castsi256_si128(imax), _mm256_extracti128_si256(imax, 1)));
+    range->qmin = hmin_epi16(_mm_min_epi16(_mm256_castsi256_si128(qmin), _mm256_extracti128_si256(qmin, 1)));
+    range->qmax = hmax_epi16(_mm_max_epi16(_mm256_castsi256_si128(qmax), _mm256_extracti128_si256(qmax, 1)));
+    interleave_float_minmax_scalar(xi + i, xq + i, out + 2*i, numSamples - i, scale, range);
+}
+#endif /* HAVE_X86_KERNELS */
+
+#ifdef HAVE_NEON_KERNELS
+static void interleave_minmax_neon(const short *xi, const short *xq, short *out, unsigned int numSamples, SampleRange *range)
+{
+    int16x8_t imin = vdupq_n_s16(range->imin);
+    int16x8_t imax = vdupq_n_s16(range->imax);
+    int16x8_t qmin = vdupq_n_s16(range->qmin);
+    int16x8_t qmax = vdupq_n_s16(range->qmax);
+    unsigned int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        int16x8x2_t v;
+        v.val[0] = vld1q_s16(xi + i);
+        v.val[1] = vld1q_s16(xq + i);
+        imin = vminq_s16(imin, v.val[0]);
+        imax = vmaxq_s16(imax, v.val[0]);
+        qmin = vminq_s16(qmin, v.val[1]);
+        qmax = vmaxq_s16(qmax, v.val[1]);
+        vst2q_s16(out + 2*i, v);
+    }
+    range->imin = vminvq_s16(imin);
+    range->imax = vmaxvq_s16(imax);
+    range->qmin = vminvq_s16(qmin);
+    range->qmax = vmaxvq_s16(qmax);
+    interleave_minmax_scalar(xi + i, xq + i, out + 2*i, numSamples - i, range);
+}
+
+static void minmax_neon(const short *xi, const short *xq, unsigned int numSamples, SampleRange *range)
+{
+    int16x8_t imin = vdupq_n_s16(range->imin);
+    int16x8_t imax = vdupq_n_s16(range->imax);
+    int16x8_t qmin = vdupq_n_s16(range->qmin);
+    int16x8_t qmax = vdupq_n_s16(range->qmax);
+    unsigned int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        int16x8_t vi = vld1q_s16(xi + i);
+        int16x8_t vq = vld1q_s16(xq + i);
+        imin = vminq_s16(imin, vi);
+        imax = vmaxq_s16(imax, vi);
+        qmin = vminq_s16(qmin, vq);
+        qmax = vmaxq_s16(qmax, vq);
+    }
+    range->imin = vminvq_s16(imin);
+    range->imax = vmaxvq_s16(imax);
+    range->qmin = vminvq_s16(qmin);
+    range->qmax = vmaxvq_s16(qmax);
+    minmax_scalar(xi + i, xq + i, numSamples - i, range);
+}
+
+static void pack8_minmax_neon(const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, int shift, SampleRange *range)
+{
+    int16x8_t imin = vdupq_n_s16(range->imin);
+    int16x8_t imax = vdupq_n_s16(range->imax);
+    int16x8_t qmin = vdupq_n_s16(range->qmin);
+    int16x8_t qmax = vdupq_n_s16(range->qmax);
+    int16x8_t count = vdupq_n_s16(-shift);
+    unsigned int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        int16x8_t vi = vld1q_s16(xi + i);
+        int16x8_t vq = vld1q_s16(xq + i);
+        imin = vminq_s16(imin, vi);
+        imax = vmaxq_s16(imax, vi);
+        qmin = vminq_s16(qmin, vq);
+        qmax = vmaxq_s16(qmax, vq);
+        int8x8x2_t v;
+        v.val[0] = vqmovn_s16(vshlq_s16(vi, count));
+        v.val[1] = vqmovn_s16(vshlq_s16(vq, count));
+        vst2_s8((int8_t *)(out + 2*i), v);
+    }
+    range->imin = vminvq_s16(imin);
+    range->imax = vmaxvq_s16(imax);
+    range->qmin = vminvq_s16(qmin);
+    range->qmax = vmaxvq_s16(qmax);
+    pack8_minmax_scalar(xi + i, xq + i, out + 2*i, numSamples - i, shift, range);
+}
+
+static void interleave_float_minmax_neon(const short *xi, const short *xq, float *out, unsigned int numSamples, float scale, SampleRange *range)
+{
+    int16x8_t imin = vdupq_n_s16(range->imin);
+    int16x8_t imax = vdupq_n_s16(range->imax);
+    int16x8_t qmin = vdupq_n_s16(range->qmin);
+    int16x8_t qmax = vdupq_n_s16(range->qmax);
+    unsigned int i = 0;
+    for (; i + 8 <= numSamples; i += 8) {
+        int16x8_t vi = vld1q_s16(xi + i);
+        int16x8_t vq = vld1q_s16(xq + i);
+        imin = vminq_s16(imin, vi);
+        imax = vmaxq_s16(imax, vi);
+        qmin = vminq_s16(qmin, vq);
+        qmax = vmaxq_s16(qmax, vq);
+        float32x4x2_t v;
+        v.val[0] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(vi))), scale);
+        v.val[1] = vmulq_n_f32(vcvtq_f32_s32(vmovl_s16(vget_low_s16(vq))), scale);
+        vst2q_f32(out + 2*i, v);
+        v.val[0] = vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(vi)), scale);
+        v.val[1] = vmulq_n_f32(vcvtq_f32_s32(vmovl_high_s16(vq)), scale);
+        vst2q_f32(out + 2*i + 8, v);
+    }
+    range->imin = vminvq_s16(imin);
+    range->imax = vmaxvq_s16(imax);
+    range->qmin = vminvq_s16(qmin);
+    range->qmax = vmaxvq_s16(qmax);
+    interleave_float_minmax_scalar(xi + i, xq + i, out + 2*i, numSamples - i, scale, range);
+}
+#endif /* HAVE_NEON_KERNELS */
+
+/* pick the best kernels for this CPU; must be called before streaming starts */
+void sample_kernels_init(void)
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) {
+        interleave_minmax = interleave_minmax_avx2;
+        minmax = minmax_avx2;
+        pack8_minmax = pack8_minmax_avx2;
+        interleave_float_minmax = interleave_float_minmax_avx2;
+        kernels_name = "avx2";
+    } else if (__builtin_cpu_supports("sse2")) {
+        interleave_minmax = interleave_minmax_sse2;
+        minmax = minmax_sse2;
+        pack8_minmax = pack8_minmax_sse2;
+        interleave_float_minmax = interleave_float_minmax_sse2;
+        kernels_name = "sse2";
+    }
+#elif defined(HAVE_NEON_KERNELS)
+    interleave_minmax = interleave_minmax_neon;
+    minmax = minmax_neon;
+    pack8_minmax = pack8_minmax_neon;
+    interleave_float_minmax = interleave_float_minmax_neon;
+    kernels_name = "neon";
+#endif
+}
+
+const char *sample_kernels_name(void)
+{
+    return kernels_name;
+}
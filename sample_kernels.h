@@ -0,0 +1,43 @@
+/* sample processing kernels for the stream callback hot path
+ * (SSE2/AVX2/NEON with runtime CPU dispatch and a scalar fallback)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SAMPLE_KERNELS_H
+#define SAMPLE_KERNELS_H
+
+typedef struct {
+    short imin, imax;
+    short qmin, qmax;
+} SampleRange;
+
+/* interleave xi/xq into out (I,Q,I,Q,...) and update the running min/max in one pass */
+typedef void (*InterleaveMinMaxFn)(const short *xi, const short *xq, short *out, unsigned int numSamples, SampleRange *range);
+/* only update the running min/max */
+typedef void (*MinMaxFn)(const short *xi, const short *xq, unsigned int numSamples, SampleRange *range);
+
+/* pack xi/xq into out as I,Q pairs of (saturated) 8 or 12 bit values after an
+ * arithmetic right shift, and update the running min/max (of the unshifted
+ * samples) in one pass */
+typedef void (*PackMinMaxFn)(const short *xi, const short *xq, unsigned char *out, unsigned int numSamples, int shift, SampleRange *range);
+
+/* convert xi/xq to interleaved complex floats (I,Q,I,Q,...) multiplied by
+ * scale, and update the running min/max in one pass */
+typedef void (*InterleaveFloatMinMaxFn)(const short *xi, const short *xq, float *out, unsigned int numSamples, float scale, SampleRange *range);
+
+extern InterleaveMinMaxFn interleave_minmax;
+extern MinMaxFn minmax;
+extern PackMinMaxFn pack8_minmax;
+extern PackMinMaxFn pack12_minmax;
+extern InterleaveFloatMinMaxFn interleave_float_minmax;
+
+void sample_kernels_init(void);
+const char *sample_kernels_name(void);
+void sample_range_init(SampleRange *range);
+
+#endif /* SAMPLE_KERNELS_H */
@@ -0,0 +1,122 @@
+/* settings cache: fingerprints of the device settings already validated by
+ * the quick check (Init/Uninit), one per serial number and hardware
+ * version, so that a repeated run with the same settings can skip it
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "settings_cache.h"
+
+#define FNV_OFFSET_BASIS 0xcbf29ce484222325ULL
+#define FNV_PRIME 0x100000001b3ULL
+#define MAX_SERIAL_NUMBER_SIZE 64
+
+typedef struct {
+    char serial_number[MAX_SERIAL_NUMBER_SIZE];
+    int hwVer;
+    uint64_t fingerprint;
+} SettingsCacheEntry;
+
+static int read_entries(const char *cache_file, SettingsCacheEntry *entries, int max_entries);
+
+
+uint64_t settings_fingerprint(const char *settings)
+{
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (const unsigned char *p = (const unsigned char *)settings; *p != '\0'; p++) {
+        hash ^= *p;
+        hash *= FNV_PRIME;
+    }
+    return hash;
+}
+
+int settings_cache_lookup(const char *cache_file, const char *serial_number, int hwVer, uint64_t fingerprint)
+{
+    static SettingsCacheEntry entries[SETTINGS_CACHE_MAX_ENTRIES];
+    int nentries = read_entries(cache_file, entries, SETTINGS_CACHE_MAX_ENTRIES);
+    if (nentries == -1) {
+        return -1;
+    }
+    for (int i = 0; i < nentries; i++) {
+        if (strcmp(entries[i].serial_number, serial_number) == 0 && entries[i].hwVer == hwVer) {
+            return entries[i].fingerprint == fingerprint;
+        }
+    }
+    return 0;
+}
+
+int settings_cache_store(const char *cache_file, const char *serial_number, int hwVer, uint64_t fingerprint)
+{
+    static SettingsCacheEntry entries[SETTINGS_CACHE_MAX_ENTRIES];
+    int nentries = read_entries(cache_file, entries, SETTINGS_CACHE_MAX_ENTRIES - 1);
+    if (nentries == -1) {
+        return -1;
+    }
+
+    char tmp_file[1024];
+    snprintf(tmp_file, sizeof(tmp_file), "%s.tmp", cache_file);
+    FILE *fp = fopen(tmp_file, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "fopen(%s) failed: %s\n", tmp_file, strerror(errno));
+        return -1;
+    }
+    fprintf(fp, "# single_tuner_recorder settings cache: <serial number> <hwVer> <fingerprint>\n");
+    for (int i = 0; i < nentries; i++) {
+        if (!(strcmp(entries[i].serial_number, serial_number) == 0 && entries[i].hwVer == hwVer)) {
+            fprintf(fp, "%s %d %016" PRIx64 "\n", entries[i].serial_number, entries[i].hwVer, entries[i].fingerprint);
+        }
+    }
+    fprintf(fp, "%s %d %016" PRIx64 "\n", serial_number, hwVer, fingerprint);
+    int ret = 0;
+    if (ferror(fp)) {
+        fprintf(stderr, "write to %s failed\n", tmp_file);
+        ret = -1;
+    }
+    if (fclose(fp) == EOF) {
+        fprintf(stderr, "fclose(%s) failed: %s\n", tmp_file, strerror(errno));
+        ret = -1;
+    }
+    if (ret == 0 && rename(tmp_file, cache_file) == -1) {
+        fprintf(stderr, "rename(%s, %s) failed: %s\n", tmp_file, cache_file, strerror(errno));
+        ret = -1;
+    }
+    if (ret == -1) {
+        remove(tmp_file);
+    }
+    return ret;
+}
+
+/* a missing cache file is an empty one; malformed lines are skipped */
+static int read_entries(const char *cache_file, SettingsCacheEntry *entries, int max_entries)
+{
+    FILE *fp = fopen(cache_file, "r");
+    if (fp == NULL) {
+        if (errno == ENOENT) {
+            return 0;
+        }
+        fprintf(stderr, "fopen(%s) failed: %s\n", cache_file, strerror(errno));
+        return -1;
+    }
+    int nentries = 0;
+    char line[256];
+    while (nentries < max_entries && fgets(line, sizeof(line), fp) != NULL) {
+        SettingsCacheEntry *entry = &entries[nentries];
+        if (line[0] == '#') {
+            continue;
+        }
+        if (sscanf(line, "%63s %d %" SCNx64, entry->serial_number, &entry->hwVer, &entry->fingerprint) == 3) {
+            nentries++;
+        }
+    }
+    fclose(fp);
+    return nentries;
+}
@@ -0,0 +1,28 @@
+/* settings cache: fingerprints of the device settings already validated by
+ * the quick check (Init/Uninit), one per serial number and hardware
+ * version, so that a repeated run with the same settings can skip it
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SETTINGS_CACHE_H
+#define SETTINGS_CACHE_H
+
+#include <stdint.h>
+
+#define SETTINGS_CACHE_MAX_ENTRIES 256
+
+/* 64 bit FNV-1a hash of a canonical description of the settings */
+uint64_t settings_fingerprint(const char *settings);
+/* 1 if the cache file has this fingerprint for the device, 0 if not (or
+ * if there is no cache file yet), -1 on error */
+int settings_cache_lookup(const char *cache_file, const char *serial_number, int hwVer, uint64_t fingerprint);
+/* add or replace the fingerprint of the device (the file is rewritten
+ * atomically with a rename) */
+int settings_cache_store(const char *cache_file, const char *serial_number, int hwVer, uint64_t fingerprint);
+
+#endif /* SETTINGS_CACHE_H */
@@ -0,0 +1,133 @@
+/* shared memory ring: the I/Q stream (iq16) in a POSIX shared memory
+ * object, written once by the recorder and read by any number of local
+ * processes, each one with its own read position
+ * - the writer never waits for the readers (it doesn't even know about
+ *   them): a reader that falls more than a ring behind loses data, and it
+ *   finds out because the frames it has just copied were being overwritten
+ *   (reserve_frames is stored before the data, write_frames after it)
+ * - the reader side is here (static inline) so that the consumers only
+ *   need this header
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SHM_RING_H
+#define SHM_RING_H
+
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define SHM_RING_MAGIC 0x52535149       /* "IQSR" */
+#define SHM_RING_VERSION 1
+#define SHM_RING_HEADER_SIZE 4096       /* the frames start one page in */
+
+/* at the beginning of the shared memory object, followed (at header_size)
+ * by ring_frames frames of interleaved I/Q int16 samples (native endian);
+ * frame n of the stream is at index n % ring_frames */
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t header_size;
+    uint32_t frame_size;                /* 4 (iq16) */
+    uint64_t ring_frames;
+    double sample_rate;                 /* nominal (0 -> unknown) */
+    double center_frequency;
+    _Alignas(64) _Atomic uint64_t write_frames;     /* frames written (after the data) */
+    _Atomic uint64_t reserve_frames;    /* frames being written (before the data) */
+    _Atomic uint64_t sample_index;      /* stream index past the last frame (counting the dropped samples) */
+    _Atomic uint64_t dropped_samples;
+    _Atomic uint32_t running;           /* 0 once the writer has stopped */
+} ShmRingHeader;
+
+typedef struct {
+    const ShmRingHeader *header;
+    const unsigned char *frames;
+    size_t size;                        /* of the mapping */
+    uint64_t position;                  /* next frame to read */
+    unsigned long long overruns;
+    unsigned long long lost_frames;
+} ShmRingReader;
+
+/* map an existing ring read-only; reading starts from the newest frame */
+static inline int shm_ring_reader_open(ShmRingReader *reader, const char *name)
+{
+    int fd = shm_open(name, O_RDONLY, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    struct stat st;
+    if (fstat(fd, &st) == -1 || (size_t)st.st_size < SHM_RING_HEADER_SIZE) {
+        close(fd);
+        return -1;
+    }
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        return -1;
+    }
+    const ShmRingHeader *header = (const ShmRingHeader *)map;
+    if (header->magic != SHM_RING_MAGIC || header->version != SHM_RING_VERSION ||
+        header->header_size + header->ring_frames * header->frame_size > (uint64_t)st.st_size) {
+        munmap(map, st.st_size);
+        return -1;
+    }
+    reader->header = header;
+    reader->frames = (const unsigned char *)map + header->header_size;
+    reader->size = st.st_size;
+    reader->position = atomic_load_explicit(&((ShmRingHeader *)header)->write_frames, memory_order_acquire);
+    reader->overruns = 0;
+    reader->lost_frames = 0;
+    return 0;
+}
+
+/* copy up to max_frames frames to buffer; returns the number of frames
+ * copied (0 -> nothing new yet); after an overrun the reader skips ahead to
+ * the newest frame (counted in overruns and lost_frames) */
+static inline size_t shm_ring_read(ShmRingReader *reader, void *buffer, size_t max_frames)
+{
+    ShmRingHeader *header = (ShmRingHeader *)reader->header;
+    uint64_t ring_frames = header->ring_frames;
+    size_t frame_size = header->frame_size;
+    uint64_t written = atomic_load_explicit(&header->write_frames, memory_order_acquire);
+    if (written - reader->position > ring_frames) {
+        reader->overruns++;
+        reader->lost_frames += written - reader->position;
+        reader->position = written;
+        return 0;
+    }
+    size_t count = written - reader->position < max_frames ? written - reader->position : max_frames;
+    size_t offset = reader->position % ring_frames;
+    size_t first = ring_frames - offset < count ? ring_frames - offset : count;
+    memcpy(buffer, reader->frames + offset * frame_size, first * frame_size);
+    memcpy((unsigned char *)buffer + first * frame_size, reader->frames, (count - first) * frame_size);
+    /* were they being overwritten while they were copied? */
+    atomic_thread_fence(memory_order_acquire);
+    uint64_t reserved = atomic_load_explicit(&header->reserve_frames, memory_order_relaxed);
+    if (reserved - reader->position > ring_frames) {
+        written = atomic_load_explicit(&header->write_frames, memory_order_acquire);
+        reader->overruns++;
+        reader->lost_frames += written - reader->position;
+        reader->position = written;
+        return 0;
+    }
+    reader->position += count;
+    return count;
+}
+
+static inline void shm_ring_reader_close(ShmRingReader *reader)
+{
+    munmap((void *)reader->header, reader->size);
+    reader->header = NULL;
+}
+
+#endif /* SHM_RING_H */
@@ -0,0 +1,379 @@
+/* SigMF metadata: writes a .sigmf-meta sidecar next to each recording (or
+ * segment) with the capture settings, the actual sample rate, the start
+ * time, and the gaps in the recording
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sigmf.h"
+
+#define SIGMF_VERSION "1.0.0"
+#define SIGMF_EXTENSION_NAME "sdrplay"
+#define SIGMF_EXTENSION_VERSION "1.0.0"
+#define SIGMF_RECORDER "single_tuner_recorder"
+
+static const char *datatype(SampleFormat format);
+static uint64_t stream_index(const SinkRecordInfo *record, uint64_t frame);
+static uint64_t stream_frame(const SinkRecordInfo *record, uint64_t index);
+static void write_string(FILE *fp, const char *s);
+static void write_capture(FILE *fp, const SigMFCapture *capture, const SigMFRetune *settings, const SampleClock *clock, uint64_t sample_start, uint64_t global_index, int first);
+static int write_annotations(FILE *fp, const SigMFCapture *capture, const SinkRecordInfo *record, uint64_t start_frame, uint64_t end_frame, int last);
+static int compare_annotations(const void *a, const void *b);
+static void write_annotation(FILE *fp, const RecordGap *gap, uint64_t sample_start, int first);
+static void write_retune_annotation(FILE *fp, const SigMFRetune *retune, uint64_t sample_start, int first);
+static void write_event_annotation(FILE *fp, const SigMFEvent *event, uint64_t sample_start, int first);
+
+/* one annotation, to sort them by sample */
+typedef struct {
+    uint64_t frame;
+    unsigned int order;             /* gaps, then retunes, then events at the same frame */
+    const RecordGap *gap;
+    const SigMFRetune *retune;
+    const SigMFEvent *event;
+} Annotation;
+
+
+void sigmf_meta_filename(const char *data_filename, char *meta_filename, size_t size)
+{
+    const char *basename = strrchr(data_filename, '/');
+    basename = basename == NULL ? data_filename : basename + 1;
+    const char *extension = strrchr(basename, '.');
+    int length = extension == NULL || extension == basename ? (int)strlen(data_filename) : (int)(extension - data_filename);
+    snprintf(meta_filename, size, "%.*s%s", length, data_filename, SIGMF_META_EXTENSION);
+}
+
+int sigmf_write(const char *data_filename, const SigMFCapture *capture, const SinkRecordInfo *record,
+                uint64_t start_frame, uint64_t frames, const SampleClock *clock)
+{
+    char meta_filename[1024];
+    sigmf_meta_filename(data_filename, meta_filename, sizeof(meta_filename));
+    FILE *fp = fopen(meta_filename, "w");
+    if (fp == NULL) {
+        fprintf(stderr, "fopen(%s) failed: %s\n", meta_filename, strerror(errno));
+        return -1;
+    }
+
+    uint64_t end_frame = start_frame + frames;
+    /* a gap at the very end of the recording goes with its last file */
+    int last = end_frame >= record->frames;
+
+    double actual_sample_rate = sample_clock_rate(clock);
+    double sample_rate = capture->sample_rate > 0 ? capture->sample_rate : actual_sample_rate;
+    const char *dataset = strrchr(data_filename, '/');
+    dataset = dataset == NULL ? data_filename : dataset + 1;
+
+    fprintf(fp, "{\n");
+    fprintf(fp, "    \"global\": {\n");
+    fprintf(fp, "        \"core:datatype\": \"%s\",\n", datatype(record->format_spec.format));
+    fprintf(fp, "        \"core:sample_rate\": %.17g,\n", sample_rate);
+    fprintf(fp, "        \"core:version\": \"%s\",\n", SIGMF_VERSION);
+    fprintf(fp, "        \"core:num_channels\": 1,\n");
+    fprintf(fp, "        \"core:dataset\": ");
+    write_string(fp, dataset);
+    fprintf(fp, ",\n");
+    fprintf(fp, "        \"core:recorder\": \"%s\",\n", SIGMF_RECORDER);
+    fprintf(fp, "        \"core:hw\": ");
+    write_string(fp, capture->hw);
+    fprintf(fp, ",\n");
+    fprintf(fp, "        \"core:extensions\": [ { \"name\": \"%s\", \"version\": \"%s\", \"optional\": true } ],\n", SIGMF_EXTENSION_NAME, SIGMF_EXTENSION_VERSION);
+    fprintf(fp, "        \"sdrplay:rsp_sample_rate\": %.17g,\n", capture->rsp_sample_rate);
+    fprintf(fp, "        \"sdrplay:decimation\": %d,\n", capture->decimation);
+    fprintf(fp, "        \"sdrplay:if_frequency_khz\": %d,\n", capture->if_frequency);
+    fprintf(fp, "        \"sdrplay:if_bandwidth_khz\": %d,\n", capture->if_bandwidth);
+    fprintf(fp, "        \"sdrplay:agc\": %d,\n", capture->agc);
+    fprintf(fp, "        \"sdrplay:gain_reduction_db\": %d,\n", capture->gain_reduction);
+    fprintf(fp, "        \"sdrplay:lna_state\": %d,\n", capture->lna_state);
+    fprintf(fp, "        \"sdrplay:dc_enable\": %d,\n", capture->dc_enable);
+    fprintf(fp, "        \"sdrplay:iq_enable\": %d,\n", capture->iq_enable);
+    fprintf(fp, "        \"sdrplay:dc_cal\": %d,\n", capture->dc_cal);
+    fprintf(fp, "        \"sdrplay:speed_up\": %d,\n", capture->speed_up);
+    fprintf(fp, "        \"sdrplay:track_time\": %d,\n", capture->track_time);
+    fprintf(fp, "        \"sdrplay:refresh_rate_time\": %d,\n", capture->refresh_rate_time);
+    if (capture->antenna != NULL) {
+        fprintf(fp, "        \"sdrplay:antenna\": ");
+        write_string(fp, capture->antenna);
+        fprintf(fp, ",\n");
+    }
+    if (capture->hdr_enable >= 0) {
+        fprintf(fp, "        \"sdrplay:hdr_enable\": %d,\n", capture->hdr_enable);
+        fprintf(fp, "        \"sdrplay:hdr_bandwidth\": %d,\n", capture->hdr_bandwidth);
+    }
+    fprintf(fp, "        \"sdrplay:output_format\": \"%s\",\n", sample_format_name(record->format_spec.format));
+    if (capture->compression != NULL) {
+        fprintf(fp, "        \"sdrplay:compression\": \"%s\",\n", capture->compression);
+    }
+    if (record->format_spec.format == SAMPLE_FORMAT_IQ12 || record->format_spec.format == SAMPLE_FORMAT_IQ8) {
+        fprintf(fp, "        \"sdrplay:shift\": %d,\n", record->format_spec.shift);
+    } else if (record->format_spec.format == SAMPLE_FORMAT_CF32) {
+        fprintf(fp, "        \"sdrplay:scale\": %.9g,\n", record->format_spec.scale);
+    }
+    if (actual_sample_rate > 0) {
+        fprintf(fp, "        \"sdrplay:actual_sample_rate\": %.3lf,\n", actual_sample_rate);
+        if (capture->sample_rate > 0) {
+            fprintf(fp, "        \"sdrplay:clock_drift_ppm\": %.3lf,\n", sample_clock_drift_ppm(clock, capture->sample_rate));
+        }
+    }
+    fprintf(fp, "        \"sdrplay:dropped_samples\": %llu,\n", capture->dropped_samples);
+    if (capture->nretunes > 0 || capture->lost_retunes > 0) {
+        fprintf(fp, "        \"sdrplay:retunes\": %u,\n", capture->nretunes);
+        fprintf(fp, "        \"sdrplay:lost_retunes\": %llu,\n", capture->lost_retunes);
+    }
+    if (capture->nevents > 0 || capture->lost_events > 0) {
+        fprintf(fp, "        \"sdrplay:events\": %u,\n", capture->nevents);
+        fprintf(fp, "        \"sdrplay:lost_events\": %llu,\n", capture->lost_events);
+    }
+    fprintf(fp, "        \"sdrplay:lost_gaps\": %llu\n", record->lost_gaps);
+    fprintf(fp, "    },\n");
+
+    /* the settings at the start of this file */
+    SigMFRetune settings = {
+        .sample_index = 0,
+        .frequency = capture->frequency,
+        .agc = capture->agc,
+        .gain_reduction = capture->gain_reduction,
+        .lna_state = capture->lna_state,
+        .if_bandwidth = capture->if_bandwidth,
+    };
+    unsigned int r = 0;
+    for (; r < capture->nretunes && stream_frame(record, capture->retunes[r].sample_index) <= start_frame; r++) {
+        settings = capture->retunes[r];
+    }
+
+    /* a new capture after each gap, so that core:global_index stays right,
+     * and after each retune */
+    fprintf(fp, "    \"captures\": [\n");
+    write_capture(fp, capture, &settings, clock, 0, stream_index(record, start_frame), 1);
+    unsigned int g = 0;
+    while (1) {
+        while (g < record->ngaps && record->gaps[g].frame <= start_frame) {
+            g++;
+        }
+        uint64_t gap_frame = g < record->ngaps ? record->gaps[g].frame : UINT64_MAX;
+        uint64_t retune_frame = r < capture->nretunes ? stream_frame(record, capture->retunes[r].sample_index) : UINT64_MAX;
+        uint64_t frame = gap_frame < retune_frame ? gap_frame : retune_frame;
+        if (frame >= end_frame) {
+            break;
+        }
+        while (g < record->ngaps && record->gaps[g].frame == frame) {
+            g++;
+        }
+        while (r < capture->nretunes && stream_frame(record, capture->retunes[r].sample_index) == frame) {
+            settings = capture->retunes[r];
+            r++;
+        }
+        write_capture(fp, capture, &settings, clock, frame - start_frame, stream_index(record, frame), 0);
+    }
+    fprintf(fp, "\n    ],\n");
+
+    if (write_annotations(fp, capture, record, start_frame, end_frame, last) == -1) {
+        fclose(fp);
+        return -1;
+    }
+    fprintf(fp, "}\n");
+
+    int ret = 0;
+    if (ferror(fp)) {
+        fprintf(stderr, "write to %s failed\n", meta_filename);
+        ret = -1;
+    }
+    if (fclose(fp) == EOF) {
+        fprintf(stderr, "fclose(%s) failed: %s\n", meta_filename, strerror(errno));
+        ret = -1;
+    }
+    return ret;
+}
+
+static const char *datatype(SampleFormat format)
+{
+    switch (format) {
+        case SAMPLE_FORMAT_IQ16: return "ci16_le";
+        /* not a SigMF type: 12 bit samples packed 3 bytes per I/Q pair */
+        case SAMPLE_FORMAT_IQ12: return "ci12_le";
+        case SAMPLE_FORMAT_IQ8: return "ci8";
+        case SAMPLE_FORMAT_CF32: return "cf32_le";
+    }
+    return "unknown";
+}
+
+/* stream index of a frame in the output, counting the gaps up to it */
+static uint64_t stream_index(const SinkRecordInfo *record, uint64_t frame)
+{
+    uint64_t index = record->first_sample_index + frame;
+    for (unsigned int i = 0; i < record->ngaps && record->gaps[i].frame <= frame; i++) {
+        index += record->gaps[i].missing;
+    }
+    return index;
+}
+
+/* frame in the output of a stream index (the first frame after the gap, if
+ * that sample is missing) */
+static uint64_t stream_frame(const SinkRecordInfo *record, uint64_t index)
+{
+    if (index <= record->first_sample_index) {
+        return 0;
+    }
+    uint64_t frame = index - record->first_sample_index;
+    for (unsigned int i = 0; i < record->ngaps; i++) {
+        const RecordGap *gap = &record->gaps[i];
+        if (index >= gap->sample_index) {
+            frame -= gap->missing;
+        } else if (index >= gap->sample_index - gap->missing) {
+            return gap->frame;
+        } else {
+            break;
+        }
+    }
+    return frame;
+}
+
+static void write_string(FILE *fp, const char *s)
+{
+    fputc('"', fp);
+    for (; *s != '\0'; s++) {
+        unsigned char c = (unsigned char)*s;
+        if (c == '"' || c == '\\') {
+            fprintf(fp, "\\%c", c);
+        } else if (c < 0x20) {
+            fprintf(fp, "\\u%04x", c);
+        } else {
+            fputc(c, fp);
+        }
+    }
+    fputc('"', fp);
+}
+
+static void write_capture(FILE *fp, const SigMFCapture *capture, const SigMFRetune *settings, const SampleClock *clock, uint64_t sample_start, uint64_t global_index, int first)
+{
+    fprintf(fp, "%s        {\n", first ? "" : ",\n");
+    fprintf(fp, "            \"core:sample_start\": %llu,\n", (unsigned long long)sample_start);
+    fprintf(fp, "            \"core:global_index\": %llu,\n", (unsigned long long)global_index);
+    struct timespec realtime;
+    if (sample_clock_realtime(clock, global_index, &realtime) == 0) {
+        struct tm tm;
+        char datetime[32];
+        gmtime_r(&realtime.tv_sec, &tm);
+        strftime(datetime, sizeof(datetime), "%Y-%m-%dT%H:%M:%S", &tm);
+        fprintf(fp, "            \"core:datetime\": \"%s.%06ldZ\",\n", datetime, realtime.tv_nsec / 1000);
+    }
+    if (capture->nretunes > 0) {
+        fprintf(fp, "            \"sdrplay:agc\": %d,\n", settings->agc);
+        fprintf(fp, "            \"sdrplay:gain_reduction_db\": %d,\n", settings->gain_reduction);
+        fprintf(fp, "            \"sdrplay:lna_state\": %d,\n", settings->lna_state);
+        fprintf(fp, "            \"sdrplay:if_bandwidth_khz\": %d,\n", settings->if_bandwidth);
+    }
+    fprintf(fp, "            \"core:frequency\": %.17g\n", settings->frequency);
+    fprintf(fp, "        }");
+}
+
+/* gaps, retunes, and events, in sample order */
+static int write_annotations(FILE *fp, const SigMFCapture *capture, const SinkRecordInfo *record, uint64_t start_frame, uint64_t end_frame, int last)
+{
+    size_t max_annotations = record->ngaps + capture->nretunes + capture->nevents;
+    Annotation *annotations = NULL;
+    if (max_annotations > 0) {
+        annotations = (Annotation *) malloc(max_annotations * sizeof(Annotation));
+        if (annotations == NULL) {
+            fprintf(stderr, "annotations allocation failed\n");
+            return -1;
+        }
+    }
+    size_t nannotations = 0;
+    for (unsigned int i = 0; i < record->ngaps; i++) {
+        const RecordGap *gap = &record->gaps[i];
+        if (gap->frame >= start_frame && (gap->frame < end_frame || (last && gap->frame == end_frame))) {
+            annotations[nannotations] = (Annotation){ gap->frame, nannotations, gap, NULL, NULL };
+            nannotations++;
+        }
+    }
+    for (unsigned int i = 0; i < capture->nretunes; i++) {
+        const SigMFRetune *retune = &capture->retunes[i];
+        uint64_t frame = stream_frame(record, retune->sample_index);
+        if (frame >= start_frame && frame < end_frame) {
+            annotations[nannotations] = (Annotation){ frame, nannotations, NULL, retune, NULL };
+            nannotations++;
+        }
+    }
+    for (unsigned int i = 0; i < capture->nevents; i++) {
+        const SigMFEvent *event = &capture->events[i];
+        uint64_t frame = stream_frame(record, event->sample_index);
+        if (frame >= start_frame && (frame < end_frame || (last && frame == end_frame))) {
+            annotations[nannotations] = (Annotation){ frame, nannotations, NULL, NULL, event };
+            nannotations++;
+        }
+    }
+    qsort(annotations, nannotations, sizeof(Annotation), compare_annotations);
+
+    fprintf(fp, "    \"annotations\": [");
+    for (size_t i = 0; i < nannotations; i++) {
+        const Annotation *annotation = &annotations[i];
+        uint64_t sample_start = annotation->frame - start_frame;
+        if (annotation->gap != NULL) {
+            write_annotation(fp, annotation->gap, sample_start, i == 0);
+        } else if (annotation->retune != NULL) {
+            write_retune_annotation(fp, annotation->retune, sample_start, i == 0);
+        } else {
+            write_event_annotation(fp, annotation->event, sample_start, i == 0);
+        }
+    }
+    fprintf(fp, nannotations > 0 ? "\n    ]\n" : "]\n");
+    free(annotations);
+    return 0;
+}
+
+static int compare_annotations(const void *a, const void *b)
+{
+    const Annotation *annotation_a = (const Annotation *)a;
+    const Annotation *annotation_b = (const Annotation *)b;
+    if (annotation_a->frame != annotation_b->frame) {
+        return annotation_a->frame < annotation_b->frame ? -1 : 1;
+    }
+    return annotation_a->order < annotation_b->order ? -1 : annotation_a->order > annotation_b->order;
+}
+
+static void write_annotation(FILE *fp, const RecordGap *gap, uint64_t sample_start, int first)
+{
+    const char *cause = gap->cause == RECORD_GAP_DROPPED ? "dropped" : "overrun";
+    fprintf(fp, "%s\n        {\n", first ? "" : ",");
+    fprintf(fp, "            \"core:sample_start\": %llu,\n", (unsigned long long)sample_start);
+    fprintf(fp, "            \"core:sample_count\": 0,\n");
+    fprintf(fp, "            \"core:comment\": \"%llu samples %s before this sample\",\n", (unsigned long long)gap->missing,
+            gap->cause == RECORD_GAP_DROPPED ? "dropped by the device" : "lost to an overrun");
+    fprintf(fp, "            \"sdrplay:gap_cause\": \"%s\",\n", cause);
+    fprintf(fp, "            \"sdrplay:gap_samples\": %llu,\n", (unsigned long long)gap->missing);
+    fprintf(fp, "            \"sdrplay:gap_end_index\": %llu\n", (unsigned long long)gap->sample_index);
+    fprintf(fp, "        }");
+}
+
+static void write_retune_annotation(FILE *fp, const SigMFRetune *retune, uint64_t sample_start, int first)
+{
+    fprintf(fp, "%s\n        {\n", first ? "" : ",");
+    fprintf(fp, "            \"core:sample_start\": %llu,\n", (unsigned long long)sample_start);
+    fprintf(fp, "            \"core:sample_count\": 0,\n");
+    fprintf(fp, "            \"core:comment\": \"retuned to %.0lfHz (AGC=%d gRdB=%d LNAstate=%d BW=%dkHz)\",\n",
+            retune->frequency, retune->agc, retune->gain_reduction, retune->lna_state, retune->if_bandwidth);
+    fprintf(fp, "            \"sdrplay:retune_index\": %llu\n", (unsigned long long)retune->sample_index);
+    fprintf(fp, "        }");
+}
+
+static void write_event_annotation(FILE *fp, const SigMFEvent *event, uint64_t sample_start, int first)
+{
+    fprintf(fp, "%s\n        {\n", first ? "" : ",");
+    fprintf(fp, "            \"core:sample_start\": %llu,\n", (unsigned long long)sample_start);
+    fprintf(fp, "            \"core:sample_count\": 0,\n");
+    fprintf(fp, "            \"core:comment\": ");
+    write_string(fp, event->comment);
+    fprintf(fp, ",\n");
+    fprintf(fp, "            \"sdrplay:event\": \"%s\",\n", event->type);
+    fprintf(fp, "            \"sdrplay:event_index\": %llu\n", (unsigned long long)event->sample_index);
+    fprintf(fp, "        }");
+}
@@ -0,0 +1,82 @@
+/* SigMF metadata: writes a .sigmf-meta sidecar next to each recording (or
+ * segment) with the capture settings, the actual sample rate, the start
+ * time, and the gaps in the recording
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SIGMF_H
+#define SIGMF_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "pipeline.h"
+#include "sample_clock.h"
+
+#define SIGMF_META_EXTENSION ".sigmf-meta"
+/* the data file is a chunked container (sample_codec.h), not the raw samples */
+#define SIGMF_COMPRESSION_CHUNKED "iqchunk-rice"
+
+/* settings changed while streaming (e.g. from the control socket) */
+typedef struct {
+    uint64_t sample_index;          /* stream index of the first sample with the new settings */
+    double frequency;
+    int agc;
+    int gain_reduction;
+    int lna_state;
+    int if_bandwidth;               /* kHz */
+} SigMFRetune;
+
+/* device events (overloads, gain changes, ...), as annotations */
+typedef struct {
+    uint64_t sample_index;          /* stream position when the event arrived (approximate) */
+    const char *type;               /* e.g. "overload_detected" */
+    char comment[80];
+} SigMFEvent;
+
+/* capture settings, as reported by the device */
+typedef struct {
+    const char *hw;                 /* e.g. "SDRplay RSPdx SerNo=..." */
+    double sample_rate;             /* nominal; 0 -> unknown (the one from the clock fit is used) */
+    double frequency;               /* center frequency (Hz) */
+    double rsp_sample_rate;
+    int decimation;
+    int if_frequency;               /* kHz */
+    int if_bandwidth;               /* kHz */
+    int agc;
+    int gain_reduction;
+    int lna_state;
+    int dc_enable;
+    int iq_enable;
+    int dc_cal;
+    int speed_up;
+    int track_time;
+    int refresh_rate_time;
+    const char *antenna;            /* NULL -> default */
+    int hdr_enable;                 /* -1 -> not an RSPdx/RSPdx-R2 */
+    int hdr_bandwidth;
+    unsigned long long dropped_samples;     /* in the whole stream */
+    const SigMFRetune *retunes;     /* in stream order; each one starts a new capture */
+    unsigned int nretunes;
+    unsigned long long lost_retunes;
+    const SigMFEvent *events;       /* any order (sorted when written) */
+    unsigned int nevents;
+    unsigned long long lost_events;
+    const char *compression;        /* NULL -> none */
+} SigMFCapture;
+
+/* the sidecar file name: data file name without its extension + ".sigmf-meta" */
+void sigmf_meta_filename(const char *data_filename, char *meta_filename, size_t size);
+/* write the sidecar for frames [start_frame, start_frame + frames) of the
+ * recording, which are in data_filename (the whole recording, or one of
+ * its segments); clock gives the actual sample rate and the start time
+ * of each capture */
+int sigmf_write(const char *data_filename, const SigMFCapture *capture, const SinkRecordInfo *record,
+                uint64_t start_frame, uint64_t frames, const SampleClock *clock);
+
+#endif /* SIGMF_H */
@@ -9,173 +9,476 @@
  * SPDX-License-Identifier: GPL-3.0-or-later
  */
 
+#define _GNU_SOURCE
+
 #include <errno.h>
 #include <fcntl.h>
 #include <getopt.h>
 #include <limits.h>
+#include <pthread.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdarg.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <time.h>
 #include <unistd.h>
-#include <sys/time.h>
+#include <sys/stat.h>
 
 #include <sdrplay_api.h>
 
+#include "channelizer.h"
+#include "control.h"
+#include "dsp_kernels.h"
+#include "logger.h"
+#include "output.h"
+#include "pipeline.h"
+#include "sample_codec.h"
+#include "sample_format.h"
+#include "sample_kernels.h"
+#include "settings_cache.h"
+#include "sigmf.h"
+#include "spectrum.h"
+#include "sweep.h"
+
 #define UNUSED(x) (void)(x)
 #define MAX_PATH_SIZE 1024
 
-#define SIXTEEN_BITS_SIZE 65536
+#define MAX_RECEIVERS 8
+#define MAX_RETUNES 1024
+#define MAX_EVENTS 1024
+#define SHM_RING_DEFAULT_SIZE_MiB 64
+#define COMPRESS_DEFAULT_CHUNK_KiB 1024
+
+typedef struct {
+    int mmap_output;
+    size_t direct_block_size;
+    unsigned int uring_queue_depth;
+    unsigned int compress_workers;  /* 0 -> not compressed */
+    size_t compress_chunk_size;
+    int may_block;
+    unsigned long long expected_size;
+} OutputOptions;
+
+/* settings of one RSP; each '-s' starts a new one, with the options given
+ * before the first '-s' as its defaults */
+typedef struct {
+    const char *serial_number;
+    double rsp_sample_rate;
+    int decimation;
+    sdrplay_api_If_kHzT if_frequency;
+    sdrplay_api_Bw_MHzT if_bandwidth;
+    sdrplay_api_AgcControlT agc;
+    int gRdB;
+    int LNAstate;
+    int DCenable;
+    int IQenable;
+    int dcCal;
+    int speedUp;
+    int trackTime;
+    int refreshRateTime;
+    double frequency;
+    const char *antenna;
+    int hdrEnable;
+    sdrplay_api_RspDx_HdrModeBwT hdrBw;
+    int dual_tuner;                 /* RSPduo: record tuner A and tuner B */
+    const char *output_file;        /* 'SERIAL' -> serial number, 'TUNER' -> A/B */
+    char net_destination[MAX_PATH_SIZE];    /* "" -> no network output */
+    size_t net_packet_size;         /* 0 -> default for the protocol */
+    char shm_ring_name[MAX_PATH_SIZE];  /* "" -> no shared memory ring; 'SERIAL', 'TUNER' */
+    int shm_ring_size_MiB;
+    int mmap_output;
+    int direct_block_size_MiB;      /* 0 -> no O_DIRECT */
+    int uring_queue_depth;          /* 0 -> no io_uring */
+    int compress_workers;           /* 0 -> no compression */
+    int compress_chunk_KiB;
+    int ring_buffer_size_MiB;       /* 0 -> write directly from the stream callback */
+    SampleFormatSpec sample_format_spec;
+    ChannelSpec channel_specs[MAX_CHANNELS];
+    int nchannels;
+    int channelizer_workers;        /* 0 -> direct channelizer (no FFT) */
+    SpectrumSpec spectrum_spec;
+    int spectrum_enable;
+    SweepSpec sweep_spec;
+    int sweep_enable;
+    unsigned long long segment_bytes;
+    double segment_seconds;
+    const char *stats_shm_name;     /* 'SERIAL' -> serial number, 'TUNER' -> A/B */
+    int measure_time_diff_enable;
+    long time_diff_threshold_us;
+    const char *time_diff_intervals_file;
+    int samples_histogram_enable;
+    int samples_histogram_threaded;
+    int writer_cpu;                 /* -1 -> no pinning */
+    int callback_cpu;               /* -1 -> no pinning */
+} ReceiverConfig;
 
+/* the stream of one tuner, with its own pipeline and output file */
 typedef struct {
-    struct timeval earliest_callback;
-    struct timeval latest_callback;
-    unsigned long long total_samples;
-    unsigned int next_sample_num;
-    int output_fd;
-    short imin, imax;
-    short qmin, qmax;
-} RXContextRecord;
+    char tuner;                     /* 'A'/'B' in RSPduo dual tuner mode, else '\0' */
+    char name[64];                  /* log and stats prefix ("" -> none) */
+    char output_file[MAX_PATH_SIZE];
+    char stats_shm_name[MAX_PATH_SIZE];
+    char shm_ring_name[MAX_PATH_SIZE];
+    char hw[128];
+    SigMFCapture sigmf_capture;
+    Pipeline pipeline;
+    int pipeline_ok;
+    Sink *record_sink;
+    unsigned int segment_count;
+    OutputOptions output_options;
+    /* settings changed while streaming (stream callback only) */
+    SigMFRetune retunes[MAX_RETUNES];
+    unsigned int nretunes;
+    unsigned long long lost_retunes;
+    /* set by the control thread for the changes the stream callback
+     * parameters don't flag (AGC, IF bandwidth) */
+    atomic_int settings_changed;
+    int sweeping;                   /* the sweep retunes are not recorded */
+    /* events from the event callback; the slots are reserved with an
+     * atomic increment (read only after sdrplay_api_Uninit()) */
+    SigMFEvent events[MAX_EVENTS];
+    atomic_uint nevents;
+} ReceiverStream;
 
+/* one RSP, with its own pipelines (and sinks, threads, and output files):
+ * one stream, or two in RSPduo dual tuner mode; the channelizer and the
+ * spectrum monitor are on the first one */
 typedef struct {
-    struct timespec prev_time;
-    long callback_count;
-    long diff_threshold;
-} RXContextMeasureTimeDiff;
+    ReceiverConfig config;
+    char name[64];                  /* serial number with more than one RSP, else "" */
+    int selected;
+    sdrplay_api_DeviceT device;
+    sdrplay_api_DeviceParamsT *device_params;
+    ReceiverStream streams[2];
+    int nstreams;
+    Channelizer channelizer;
+    Spectrum spectrum;
+    Sweep sweep;
+    LogQueue *event_log;            /* event callback (one more thread) */
+    atomic_flag event_log_busy;     /* the API may call it from more than one */
+    atomic_int removed;
+    int streaming;
+} Receiver;
 
+/* what the control socket commands act on */
 typedef struct {
-    unsigned long long total_samples;
-    unsigned int next_sample_num;
-    unsigned long long *i_histogram;
-    unsigned long long *q_histogram;
-} RXContextSamplesHistogram;
+    Receiver *receivers;
+    int nreceivers;
+} ControlContext;
 
 static void usage(const char* progname);
-static void rx_callback_record(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext);
-static void rx_callback_measure_time_diff(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext);
-static void rx_callback_samples_histogram(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext);
+static void receiver_config_init(ReceiverConfig *config);
+static int parse_segment_length(const char *arg, unsigned long long *segment_bytes, double *segment_seconds);
+static int select_devices(Receiver *receivers, int nreceivers);
+static int configure_receiver(Receiver *receiver, int debug_enable);
+static void configure_rx_channel(const ReceiverConfig *config, sdrplay_api_RxChannelParamsT *rx_channel_params);
+static int check_receiver(Receiver *receiver, int quick_check);
+static void describe_settings(const Receiver *receiver, char *settings, size_t size);
+static int check_rx_channel(const ReceiverConfig *config, const sdrplay_api_RxChannelParamsT *rx_channel_params, const char *prefix);
+static void fill_sigmf_capture(Receiver *receiver, ReceiverStream *stream, const sdrplay_api_RxChannelParamsT *rx_channel_params);
+static int start_receiver_sinks(Receiver *receiver, Logger *logger, int streaming_time);
+static int open_record_sink(ReceiverStream *stream, const ReceiverConfig *config, int streaming_time);
+static int start_receiver_stream(Receiver *receiver);
+static int stop_receiver_stream(Receiver *receiver);
+static int stop_removed_receivers(Receiver *receivers, int nreceivers);
+static void finish_receiver(Receiver *receiver, int nreceivers);
+static void finish_stream(const ReceiverConfig *config, ReceiverStream *stream);
+static void fail(Receiver *receivers, int nreceivers);
+static int pin_to_cpu(int cpu, cpu_set_t *saved);
+static void unpin(const cpu_set_t *saved);
+static Output *open_output(const char *filename, void *open_arg);
+static double stream_sample_rate(double rsp_sample_rate, int decimation, sdrplay_api_If_kHzT if_frequency);
+static const char *rsp_model(unsigned char hwVer);
+static void replace_names(const char *filename, const char *serial_number, char tuner, char *new_filename, size_t size);
+static void replace_string(const char *s, const char *from_string, const char *to_string, char *new_s, size_t size);
+static void replace_samplerate(const char *filename, int rounded_sample_rate_kHz, char *new_filename, size_t size);
+static int wait_for_stop_signal(const sigset_t *stop_signals, int streaming_time, Receiver *receivers, int nreceivers, int stats_interval);
+static void control_command(void *arg, char *command, char *reply, size_t reply_size);
+static int update_receiver(Receiver *receiver, const char *name, const char *value, char *reply, size_t reply_size);
+static void rx_callback(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext);
+static void rx_callback_b(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext);
+static void stream_callback(ReceiverStream *stream, const sdrplay_api_RxChannelParamsT *rx_channel_params, short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples);
 static void event_callback(sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tuner, sdrplay_api_EventParamsT *params, void *cbContext);
+static int sweep_retune(void *arg, double frequency);
+static void record_event(Receiver *receiver, sdrplay_api_TunerSelectT tuner, const char *type, const char *format, ...) __attribute__((format(printf, 4, 5)));
 
 
 int main(int argc, char *argv[])
 {
-    const char *serial_number = NULL;
-    double rsp_sample_rate = 0.0;
-    int decimation = 1;
-    sdrplay_api_If_kHzT if_frequency = sdrplay_api_IF_Zero;
-    sdrplay_api_Bw_MHzT if_bandwidth = sdrplay_api_BW_0_200;
-    sdrplay_api_AgcControlT agc = sdrplay_api_AGC_DISABLE;
-    int gRdB = 40;
-    int LNAstate = 0;
-    int DCenable = 1;
-    int IQenable = 1;
-    int dcCal = 3;
-    int speedUp = 0;
-    int trackTime = 1;
-    int refreshRateTime = 2048;
-    double frequency = 100e6;
-    const char *antenna = NULL;
-    int hdrEnable = 0;
-    sdrplay_api_RspDx_HdrModeBwT hdrBw = sdrplay_api_RspDx_HDRMODE_BW_0_200;
-    int streaming_time = 10;  /* streaming time in seconds */
-    const char *output_file = NULL;
+    int streaming_time = 10;  /* streaming time in seconds (0 -> until SIGINT/SIGTERM) */
     int debug_enable = 0;
-    int measure_time_diff_only = 0;
-    int samples_histogram_only = 0;
+    int quick_check_enable = 1;
+    const char *settings_cache_file = NULL;     /* NULL -> always do the quick check */
+    const char *control_socket = NULL;          /* NULL -> no control socket */
+    int stats_interval = 0;         /* 0 -> no periodic stats line */
+
+    Receiver *receivers = (Receiver *) calloc(MAX_RECEIVERS, sizeof(Receiver));
+    if (receivers == NULL) {
+        fprintf(stderr, "receivers allocation failed\n");
+        exit(1);
+    }
+    int nreceivers = 0;
+    ReceiverConfig defaults;
+    receiver_config_init(&defaults);
+    ReceiverConfig *config = &defaults;
 
     int c;
-    while ((c = getopt(argc, argv, "s:r:d:i:b:g:l:DIy:f:a:Kk:x:o:LTHh")) != -1) {
+    while ((c = getopt(argc, argv, "s:r:d:i:b:g:l:DIy:f:a:Kk:jx:o:N:R:F:mO:u:z:S:B:C:W:P:G:p:M:c:nQ:U:LTt:A:Hwh")) != -1) {
         switch (c) {
             case 's':
-                serial_number = optarg;
+                if (nreceivers == MAX_RECEIVERS) {
+                    fprintf(stderr, "too many RSPs (max %d)\n", MAX_RECEIVERS);
+                    exit(1);
+                }
+                receivers[nreceivers].config = defaults;
+                config = &receivers[nreceivers].config;
+                config->serial_number = optarg;
+                nreceivers++;
                 break;
             case 'r':
-                if (sscanf(optarg, "%lg", &rsp_sample_rate) != 1) {
+                if (sscanf(optarg, "%lg", &config->rsp_sample_rate) != 1) {
                     fprintf(stderr, "invalid RSP sample rate: %s\n", optarg);
                     exit(1);
                 }
                 break;
             case 'd':
-                if (sscanf(optarg, "%d", &decimation) != 1) {
+                if (sscanf(optarg, "%d", &config->decimation) != 1) {
                     fprintf(stderr, "invalid decimation: %s\n", optarg);
                     exit(1);
                 }
                 break;
             case 'i':
-                if (sscanf(optarg, "%d", (int *)(&if_frequency)) != 1) {
+                if (sscanf(optarg, "%d", (int *)(&config->if_frequency)) != 1) {
                     fprintf(stderr, "invalid IF frequency: %s\n", optarg);
                     exit(1);
                 }
                 break;
             case 'b':
-                if (sscanf(optarg, "%d", (int *)(&if_bandwidth)) != 1) {
+                if (sscanf(optarg, "%d", (int *)(&config->if_bandwidth)) != 1) {
                     fprintf(stderr, "invalid IF bandwidth: %s\n", optarg);
                     exit(1);
                 }
                 break;
             case 'g':
                 if (strcmp(optarg, "AGC") == 0) {
-                    agc = sdrplay_api_AGC_50HZ;
-                } else if (sscanf(optarg, "%d", &gRdB) == 1) {
-                    agc = sdrplay_api_AGC_DISABLE;
+                    config->agc = sdrplay_api_AGC_50HZ;
+                } else if (sscanf(optarg, "%d", &config->gRdB) == 1) {
+                    config->agc = sdrplay_api_AGC_DISABLE;
                 } else {
                     fprintf(stderr, "invalid IF gain reduction: %s\n", optarg);
                     exit(1);
                 }
                 break;
             case 'l':
-                if (sscanf(optarg, "%d", &LNAstate) != 1) {
+                if (sscanf(optarg, "%d", &config->LNAstate) != 1) {
                     fprintf(stderr, "invalid LNA state: %s\n", optarg);
                     exit(1);
                 }
                 break;
             case 'D':
-                DCenable = 0;
+                config->DCenable = 0;
                 break;
             case 'I':
-                IQenable = 0;
+                config->IQenable = 0;
                 break;
             case 'y':
-                if (sscanf(optarg, "%d,%d,%d,%d", &dcCal, &speedUp, &trackTime, &refreshRateTime) != 4) {
+                if (sscanf(optarg, "%d,%d,%d,%d", &config->dcCal, &config->speedUp, &config->trackTime, &config->refreshRateTime) != 4) {
                     fprintf(stderr, "invalid tuner DC offset compensation parameters: %s\n", optarg);
                     exit(1);
                 }
                 break;
             case 'f':
-                if (sscanf(optarg, "%lg", &frequency) != 1) {
+                if (sscanf(optarg, "%lg", &config->frequency) != 1) {
                     fprintf(stderr, "invalid frequency: %s\n", optarg);
                     exit(1);
                 }
                 break;
             case 'a':
-                antenna = optarg;
+                config->antenna = optarg;
                 break;
             case 'K':
-                hdrEnable = 1;
+                config->hdrEnable = 1;
                 break;
             case 'k':
-                if (sscanf(optarg, "%d", (int *)(&hdrBw)) != 1) {
+                if (sscanf(optarg, "%d", (int *)(&config->hdrBw)) != 1) {
                     fprintf(stderr, "invalid HDR bandwidth: %s\n", optarg);
                     exit(1);
                 }
                 break;
+            case 'j':
+                config->dual_tuner = 1;
+                break;
             case 'x':
-                if (sscanf(optarg, "%d", &streaming_time) != 1) {
+                if (sscanf(optarg, "%d", &streaming_time) != 1 || streaming_time < 0) {
                     fprintf(stderr, "invalid streaming time: %s\n", optarg);
                     exit(1);
                 }
                 break;
             case 'o':
-                output_file = optarg;
+                config->output_file = optarg;
+                break;
+            case 'N':
+                {
+                    /* <udp|tcp>:<host>:<port>[,<max packet size>] */
+                    int n = 0;
+                    const char *comma = strrchr(optarg, ',');
+                    config->net_packet_size = 0;
+                    if (comma != NULL && (sscanf(comma + 1, "%zu%n", &config->net_packet_size, &n) != 1 || comma[1 + n] != '\0' || config->net_packet_size == 0)) {
+                        fprintf(stderr, "invalid network packet size: %s\n", comma + 1);
+                        exit(1);
+                    }
+                    int length = comma != NULL ? (int)(comma - optarg) : (int)strlen(optarg);
+                    if (length >= (int)sizeof(config->net_destination)) {
+                        fprintf(stderr, "network destination too long: %s\n", optarg);
+                        exit(1);
+                    }
+                    snprintf(config->net_destination, sizeof(config->net_destination), "%.*s", length, optarg);
+                }
+                break;
+            case 'R':
+                {
+                    /* <shared memory name>[,<ring size (MiB)>] */
+                    int n = 0;
+                    const char *comma = strrchr(optarg, ',');
+                    config->shm_ring_size_MiB = SHM_RING_DEFAULT_SIZE_MiB;
+                    if (comma != NULL && (sscanf(comma + 1, "%d%n", &config->shm_ring_size_MiB, &n) != 1 || comma[1 + n] != '\0' || config->shm_ring_size_MiB <= 0)) {
+                        fprintf(stderr, "invalid shared memory ring size: %s\n", comma + 1);
+                        exit(1);
+                    }
+                    int length = comma != NULL ? (int)(comma - optarg) : (int)strlen(optarg);
+                    if (length == 0 || length >= (int)sizeof(config->shm_ring_name)) {
+                        fprintf(stderr, "invalid shared memory name: %s\n", optarg);
+                        exit(1);
+                    }
+                    snprintf(config->shm_ring_name, sizeof(config->shm_ring_name), "%.*s", length, optarg);
+                }
+                break;
+            case 'F':
+                if (sample_format_parse(optarg, &config->sample_format_spec) == -1) {
+                    fprintf(stderr, "invalid output format: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'm':
+                config->mmap_output = 1;
+                break;
+            case 'O':
+                if (sscanf(optarg, "%d", &config->direct_block_size_MiB) != 1 || config->direct_block_size_MiB <= 0) {
+                    fprintf(stderr, "invalid O_DIRECT block size: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'u':
+                if (sscanf(optarg, "%d", &config->uring_queue_depth) != 1 || config->uring_queue_depth <= 0) {
+                    fprintf(stderr, "invalid io_uring queue depth: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'z':
+                {
+                    /* <workers>[,<chunk size (KiB)>] */
+                    int n = 0;
+                    config->compress_chunk_KiB = COMPRESS_DEFAULT_CHUNK_KiB;
+                    if (sscanf(optarg, "%d%n", &config->compress_workers, &n) != 1 || config->compress_workers <= 0 || config->compress_workers > MAX_COMPRESSED_WORKERS ||
+                        (optarg[n] != '\0' && (sscanf(optarg + n, ",%d", &config->compress_chunk_KiB) != 1 || config->compress_chunk_KiB <= 0 || config->compress_chunk_KiB > 1024 * 1024))) {
+                        fprintf(stderr, "invalid compression workers or chunk size: %s\n", optarg);
+                        exit(1);
+                    }
+                }
+                break;
+            case 'S':
+                if (parse_segment_length(optarg, &config->segment_bytes, &config->segment_seconds) == -1) {
+                    fprintf(stderr, "invalid segment length: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'B':
+                if (sscanf(optarg, "%d", &config->ring_buffer_size_MiB) != 1 || config->ring_buffer_size_MiB < 0) {
+                    fprintf(stderr, "invalid ring buffer size: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'C':
+                if (config->nchannels == MAX_CHANNELS) {
+                    fprintf(stderr, "too many channels (max %d)\n", MAX_CHANNELS);
+                    exit(1);
+                }
+                if (channel_spec_parse(optarg, &config->channel_specs[config->nchannels]) == -1) {
+                    fprintf(stderr, "invalid channel: %s\n", optarg);
+                    exit(1);
+                }
+                config->nchannels++;
+                break;
+            case 'W':
+                if (sscanf(optarg, "%d", &config->channelizer_workers) != 1 || config->channelizer_workers <= 0 || config->channelizer_workers > MAX_CHANNELIZER_WORKERS) {
+                    fprintf(stderr, "invalid number of channelizer worker threads: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'P':
+                if (spectrum_spec_parse(optarg, &config->spectrum_spec) == -1) {
+                    fprintf(stderr, "invalid spectrum monitor: %s\n", optarg);
+                    exit(1);
+                }
+                config->spectrum_enable = 1;
+                break;
+            case 'G':
+                if (sweep_spec_parse(optarg, &config->sweep_spec) == -1) {
+                    fprintf(stderr, "invalid sweep: %s\n", optarg);
+                    exit(1);
+                }
+                config->sweep_enable = 1;
+                break;
+            case 'p':
+                if (sscanf(optarg, "%d", &stats_interval) != 1 || stats_interval <= 0) {
+                    fprintf(stderr, "invalid stats interval: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'M':
+                config->stats_shm_name = optarg;
+                break;
+            case 'c':
+                {
+                    int n = 0;
+                    if (sscanf(optarg, "%d%n", &config->writer_cpu, &n) != 1 || config->writer_cpu < 0 || config->writer_cpu >= CPU_SETSIZE ||
+                        (optarg[n] != '\0' && (sscanf(optarg + n, ",%d", &config->callback_cpu) != 1 || config->callback_cpu < 0 || config->callback_cpu >= CPU_SETSIZE))) {
+                        fprintf(stderr, "invalid CPU: %s\n", optarg);
+                        exit(1);
+                    }
+                }
+                break;
+            case 'n':
+                quick_check_enable = 0;
+                break;
+            case 'Q':
+                settings_cache_file = optarg;
+                break;
+            case 'U':
+                control_socket = optarg;
                 break;
             case 'L':
                 debug_enable = 1;
                 break;
             case 'T':
-                measure_time_diff_only = 1;
+                config->measure_time_diff_enable = 1;
+                break;
+            case 't':
+                if (sscanf(optarg, "%ld", &config->time_diff_threshold_us) != 1 || config->time_diff_threshold_us <= 0) {
+                    fprintf(stderr, "invalid callback interval threshold: %s\n", optarg);
+                    exit(1);
+                }
+                break;
+            case 'A':
+                config->time_diff_intervals_file = optarg;
                 break;
             case 'H':
-                samples_histogram_only = 1;
+                config->samples_histogram_enable = 1;
+                break;
+            case 'w':
+                config->samples_histogram_threaded = 1;
                 break;
 
             // help
@@ -189,6 +492,75 @@ int main(int argc, char *argv[])
         }
     }
 
+    /* no '-s': the first RSP available */
+    if (nreceivers == 0) {
+        receivers[0].config = defaults;
+        nreceivers = 1;
+    }
+
+    int stdout_outputs = 0;
+    for (int i = 0; i < nreceivers; i++) {
+        config = &receivers[i].config;
+        if (config->output_file != NULL && strcmp(config->output_file, "-") == 0) {
+            if (config->segment_bytes > 0 || config->segment_seconds > 0) {
+                fprintf(stderr, "segmented output is not possible on stdout\n");
+                exit(1);
+            }
+            stdout_outputs++;
+        }
+        if ((config->mmap_output != 0) + (config->direct_block_size_MiB > 0) + (config->uring_queue_depth > 0) > 1) {
+            fprintf(stderr, "memory mapped output (-m), O_DIRECT output (-O), and io_uring output (-u) are mutually exclusive\n");
+            exit(1);
+        }
+        if (config->writer_cpu >= 0 && config->ring_buffer_size_MiB == 0) {
+            fprintf(stderr, "the writer CPU (-c) is for the writer thread (-B); without it the output is written by the stream callback\n");
+            exit(1);
+        }
+        if (config->compress_workers > 0 && config->sample_format_spec.format != SAMPLE_FORMAT_IQ16) {
+            fprintf(stderr, "compressed output (-z) is only possible with the iq16 output format\n");
+            exit(1);
+        }
+        if (config->compress_workers > 0 && config->ring_buffer_size_MiB == 0) {
+            fprintf(stderr, "compressed output (-z) needs the writer thread (-B); the chunks are written out by the thread that hands them to the workers\n");
+            exit(1);
+        }
+        if (config->dual_tuner) {
+            /* the two tuners share the ADC clock, so only the low IF modes */
+            if (!((config->rsp_sample_rate == 6000000 && config->if_frequency == sdrplay_api_IF_1_620) ||
+                  (config->rsp_sample_rate == 8000000 && config->if_frequency == sdrplay_api_IF_2_048))) {
+                fprintf(stderr, "RSPduo dual tuner mode (-j) needs -r 6000000 -i 1620 or -r 8000000 -i 2048\n");
+                exit(1);
+            }
+            if ((config->output_file != NULL && strstr(config->output_file, "TUNER") == NULL) ||
+                (config->stats_shm_name != NULL && strstr(config->stats_shm_name, "TUNER") == NULL) ||
+                (config->shm_ring_name[0] != '\0' && strstr(config->shm_ring_name, "TUNER") == NULL)) {
+                fprintf(stderr, "RSPduo dual tuner mode (-j) needs 'TUNER' in the output file and shared memory names\n");
+                exit(1);
+            }
+        }
+        if (config->sweep_enable) {
+            if (config->dual_tuner) {
+                fprintf(stderr, "sweep (-G) is not possible in RSPduo dual tuner mode (-j)\n");
+                exit(1);
+            }
+            /* the sweep starts where the tuner is */
+            config->frequency = sweep_first_frequency(&config->sweep_spec);
+        }
+    }
+    if (stdout_outputs > 1) {
+        fprintf(stderr, "only one RSP can be recorded to stdout\n");
+        exit(1);
+    }
+
+    /* block SIGINT and SIGTERM in every thread (including the ones started
+     * by the SDRplay API), so they can be handled synchronously in main */
+    sigset_t stop_signals;
+    sigemptyset(&stop_signals);
+    sigaddset(&stop_signals, SIGINT);
+    sigaddset(&stop_signals, SIGTERM);
+    sigaddset(&stop_signals, SIGUSR1);      /* an RSP was removed */
+    pthread_sigmask(SIG_BLOCK, &stop_signals, NULL);
+
     /* open SDRplay API and check version */
     sdrplay_api_ErrT err;
     err = sdrplay_api_Open();
@@ -202,126 +574,412 @@ int main(int argc, char *argv[])
         fprintf(stderr, "sdrplay_api_ApiVersion() failed: %s\n", sdrplay_api_GetErrorString(err));
         sdrplay_api_Close();
         exit(1);
-    }       
+    }
     if (ver != SDRPLAY_API_VERSION) {
         fprintf(stderr, "SDRplay API version mismatch - expected=%.2f found=%.2f\n", SDRPLAY_API_VERSION, ver);
         sdrplay_api_Close();
         exit(1);
     }
 
-    /* select device */
+    /* select the devices, then configure and check each of them; they all
+     * share the same API session */
+    if (select_devices(receivers, nreceivers) == -1) {
+        fail(receivers, nreceivers);
+    }
+    for (int i = 0; i < nreceivers; i++) {
+        Receiver *receiver = &receivers[i];
+        const ReceiverConfig *receiver_config = &receiver->config;
+        receiver->nstreams = receiver_config->dual_tuner ? 2 : 1;
+        snprintf(receiver->name, sizeof(receiver->name), "%s", nreceivers > 1 ? receiver->device.SerNo : "");
+        atomic_flag_clear(&receiver->event_log_busy);
+        for (int s = 0; s < receiver->nstreams; s++) {
+            ReceiverStream *stream = &receiver->streams[s];
+            stream->tuner = receiver_config->dual_tuner ? 'A' + s : '\0';
+            stream->sweeping = receiver_config->sweep_enable;
+            snprintf(stream->name, sizeof(stream->name), "%s%s%s%c", nreceivers > 1 ? receiver->device.SerNo : "",
+                     nreceivers > 1 && stream->tuner != '\0' ? " " : "", stream->tuner != '\0' ? "tuner " : "", stream->tuner);
+            replace_names(receiver_config->output_file, receiver->device.SerNo, stream->tuner, stream->output_file, sizeof(stream->output_file));
+            replace_names(receiver_config->stats_shm_name, receiver->device.SerNo, stream->tuner, stream->stats_shm_name, sizeof(stream->stats_shm_name));
+            replace_names(receiver_config->shm_ring_name[0] != '\0' ? receiver_config->shm_ring_name : NULL, receiver->device.SerNo, stream->tuner, stream->shm_ring_name, sizeof(stream->shm_ring_name));
+        }
+        for (int j = 0; j <= i; j++) {
+            for (int s = 0; s < receiver->nstreams; s++) {
+                const ReceiverStream *stream = &receiver->streams[s];
+                for (int t = 0; t < (j < i ? receivers[j].nstreams : s); t++) {
+                    const ReceiverStream *other = &receivers[j].streams[t];
+                    if ((receiver_config->output_file != NULL && receivers[j].config.output_file != NULL && strcmp(stream->output_file, other->output_file) == 0) ||
+                        (receiver_config->stats_shm_name != NULL && receivers[j].config.stats_shm_name != NULL && strcmp(stream->stats_shm_name, other->stats_shm_name) == 0) ||
+                        (receiver_config->shm_ring_name[0] != '\0' && receivers[j].config.shm_ring_name[0] != '\0' && strcmp(stream->shm_ring_name, other->shm_ring_name) == 0)) {
+                        fprintf(stderr, "RSPs %s and %s have the same output file or shared memory name (use 'SERIAL' in the names)\n", receivers[j].device.SerNo, receiver->device.SerNo);
+                        fail(receivers, nreceivers);
+                    }
+                }
+            }
+        }
+        if (configure_receiver(receiver, debug_enable) == -1) {
+            fail(receivers, nreceivers);
+        }
+        /* the quick check costs a whole Init/Uninit cycle: skip it if asked
+         * to, or if the same settings were already validated on this RSP */
+        int quick_check = quick_check_enable;
+        uint64_t fingerprint = 0;
+        if (quick_check && settings_cache_file != NULL) {
+            char settings[1024];
+            describe_settings(receiver, settings, sizeof(settings));
+            fingerprint = settings_fingerprint(settings);
+            if (settings_cache_lookup(settings_cache_file, receiver->device.SerNo, receiver->device.hwVer, fingerprint) == 1) {
+                fprintf(stderr, "settings for SerNo=%s already validated (%s) - skipping the quick check\n", receiver->device.SerNo, settings_cache_file);
+                quick_check = 0;
+            }
+        }
+        if (check_receiver(receiver, quick_check) == -1) {
+            fail(receivers, nreceivers);
+        }
+        if (quick_check && settings_cache_file != NULL) {
+            /* not fatal: the next run will just do the quick check again */
+            settings_cache_store(settings_cache_file, receiver->device.SerNo, receiver->device.hwVer, fingerprint);
+        }
+    }
+
+    /* now for the real thing */
+    sample_kernels_init();
+    dsp_kernels_init();
+
+    /* nothing is printed directly from the stream callbacks */
+    Logger logger;
+    logger_init(&logger, stderr);
+    for (int i = 0; i < nreceivers; i++) {
+        if (start_receiver_sinks(&receivers[i], &logger, streaming_time) == -1) {
+            fail(receivers, nreceivers);
+        }
+    }
+    if (logger_start(&logger) == -1) {
+        fail(receivers, nreceivers);
+    }
+    for (int i = 0; i < nreceivers; i++) {
+        if (start_receiver_stream(&receivers[i]) == -1) {
+            fail(receivers, nreceivers);
+        }
+    }
+    ControlContext control_context = { receivers, nreceivers };
+    Control control;
+    if (control_socket != NULL && control_start(&control, control_socket, control_command, &control_context) == -1) {
+        fail(receivers, nreceivers);
+    }
+
+    if (streaming_time > 0) {
+        fprintf(stderr, "streaming for %d seconds\n", streaming_time);
+    } else {
+        fprintf(stderr, "streaming until SIGINT or SIGTERM\n");
+    }
+    int sig = wait_for_stop_signal(&stop_signals, streaming_time, receivers, nreceivers, stats_interval);
+    if (sig == SIGUSR1) {
+        fprintf(stderr, "%s removed - stopping\n", nreceivers > 1 ? "all the RSPs" : "RSP");
+    } else if (sig > 0) {
+        fprintf(stderr, "received %s - stopping\n", strsignal(sig));
+    }
+    /* from now on a second SIGINT/SIGTERM aborts the shutdown */
+    pthread_sigmask(SIG_UNBLOCK, &stop_signals, NULL);
+    if (control_socket != NULL) {
+        control_stop(&control);
+    }
+
+    /* the files are finished even if sdrplay_api_Uninit() fails (which is
+     * likely on a removed RSP): the stream has stopped anyway */
+    int uninit_ok = 1;
+    for (int i = 0; i < nreceivers; i++) {
+        if (receivers[i].streaming && stop_receiver_stream(&receivers[i]) == -1) {
+            uninit_ok = 0;
+        }
+    }
+
+    /* wait one second after sdrplay_api_Uninit() before closing the files */
+    sleep(1);
+
+    logger_stop(&logger);
+    for (int i = 0; i < nreceivers; i++) {
+        finish_receiver(&receivers[i], nreceivers);
+    }
+    logger_free(&logger);
+
+    int release_ok = 1;
+    for (int i = 0; i < nreceivers; i++) {
+        err = sdrplay_api_ReleaseDevice(&receivers[i].device);
+        if (err != sdrplay_api_Success) {
+            fprintf(stderr, "sdrplay_api_ReleaseDevice() failed: %s\n", sdrplay_api_GetErrorString(err));
+            release_ok = 0;
+        }
+    }
+    int removed = 0;
+    for (int i = 0; i < nreceivers; i++) {
+        removed |= atomic_load(&receivers[i].removed);
+    }
+    free(receivers);
+    if (!uninit_ok || !release_ok) {
+        sdrplay_api_Close();
+        exit(1);
+    }
+
+    /* all done: close SDRplay API */
+    err = sdrplay_api_Close();
+    if (err != sdrplay_api_Success) {
+        fprintf(stderr, "sdrplay_api_Close() failed: %s\n", sdrplay_api_GetErrorString(err));
+        exit(1);
+    }
+
+    /* the recording was cut short */
+    if (removed) {
+        exit(1);
+    }
+
+    return 0;
+}
+
+static void usage(const char* progname)
+{
+    fprintf(stderr, "usage: %s [options...]\n", progname);
+    fprintf(stderr, "options:\n");
+    fprintf(stderr, "    -s <serial number> (repeat it to record from up to %d RSPs at the same time: the options after each -s apply to that RSP only, the ones before the first -s to all of them)\n", MAX_RECEIVERS);
+    fprintf(stderr, "    -r <RSPduo sample rate>\n");
+    fprintf(stderr, "    -d <decimation>\n");
+    fprintf(stderr, "    -i <IF frequency>\n");
+    fprintf(stderr, "    -b <IF bandwidth>\n");
+    fprintf(stderr, "    -g <IF gain reduction> (\"AGC\" to enable AGC)\n");
+    fprintf(stderr, "    -l <LNA state>\n");
+    fprintf(stderr, "    -D disable post tuner DC offset compensation (default: enabled)\n");
+    fprintf(stderr, "    -I disable post tuner I/Q balance compensation (default: enabled)\n");
+    fprintf(stderr, "    -y tuner DC offset compensation parameters <dcCal,speedUp,trackTime,refeshRateTime> (default: 3,0,1,2048)\n");
+    fprintf(stderr, "    -f <center frequency>\n");
+    fprintf(stderr, "    -a <antenna>\n");
+    fprintf(stderr, "    -K enable HDR mode for RSPdx/RSPdx-R2\n");
+    fprintf(stderr, "    -k <HDR mode bandwidth> (for RSPdx/RSPdx-R2 only)\n");
+    fprintf(stderr, "    -j RSPduo dual tuner mode: record both tuners, sample aligned, with the same settings (needs -r 6000000 -i 1620 or -r 8000000 -i 2048, and 'TUNER' in -o/-M) (default: single tuner)\n");
+    fprintf(stderr, "    -x <streaming time (s)> (0: until SIGINT/SIGTERM) (default: 10s)\n");
+    fprintf(stderr, "    -o <output file> ('-' for stdout; 'SAMPLERATE' in the file name will be replaced by the estimated sample rate in kHz, 'SERIAL' by the serial number, and 'TUNER' by the RSPduo tuner in dual tuner mode)\n");
+    fprintf(stderr, "    -N <udp|tcp>:<host>:<port>[,<max packet size>] send the I/Q stream (iq16) over the network, in packets with a sequence number and the sample index (see README; tuner A only in dual tuner mode) (default: disabled)\n");
+    fprintf(stderr, "    -R <shared memory name>[,<ring size (MiB)>] write the I/Q stream (iq16) to a shared memory ring for any number of local readers (see shm_ring.h; 'SERIAL' will be replaced by the serial number, and 'TUNER' by the tuner) (default ring size: 64MiB) (default: disabled)\n");
+    fprintf(stderr, "    -F <output format> 16 (iq16), 12[:<shift>|:auto] (packed iq12), 8[:<shift>|:auto] (iq8) (default shift: auto), or cf32[:<scale>] (default: 16)\n");
+    fprintf(stderr, "    -m memory mapped output file, preallocated for the whole streaming time (needs a filesystem with fallocate() support) (default: disabled)\n");
+    fprintf(stderr, "    -O <block size (MiB)> write output file with O_DIRECT from double buffered blocks (default: disabled)\n");
+    fprintf(stderr, "    -u <queue depth> write output file asynchronously with io_uring (default: disabled)\n");
+    fprintf(stderr, "    -z <workers>[,<chunk size (KiB)>] compress the output file (iq16 only, needs -B) losslessly on a pool of worker threads, into a chunked container with an index (see sample_codec.h) (default chunk size: %dKiB) (default: disabled)\n", COMPRESS_DEFAULT_CHUNK_KiB);
+    fprintf(stderr, "    -S <segment length> rotate the output file every <N>s/m/h or every <N>k/M/G bytes (default: disabled)\n");
+    fprintf(stderr, "    -B <ring buffer size (MiB)> (write output from a separate thread; default: 0 - write from the stream callback)\n");
+    fprintf(stderr, "    -C <offset (Hz)>,<output rate (Hz)>,<output file> extract a channel to its own cf32 file (can be repeated up to %d times) (default: none)\n", MAX_CHANNELS);
+    fprintf(stderr, "    -W <worker threads> extract the channels with an FFT (overlap-save) filter bank spread over <worker threads> (default: 0 - one NCO+FIR per channel on a single thread)\n");
+    fprintf(stderr, "    -P <FFT size>,<averaging time (s)>[,rect|hann|hamming|blackman],<output file> write averaged power spectra to <output file> (window default: hann) (default: disabled)\n");
+    fprintf(stderr, "    -G <start>:<stop>:<step>|<f1>/<f2>/...,<FFT size>,<dwell time (s)>[,rect|hann|hamming|blackman],<output file> sweep the tuner through the frequencies (Hz), and write one stitched power spectrum per sweep to <output file> (default: disabled)\n");
+    fprintf(stderr, "    -p <stats interval (s)> print the stream and callback statistics every <stats interval> seconds (default: disabled)\n");
+    fprintf(stderr, "    -M <shared memory name> publish the stream and callback statistics in a POSIX shared memory object (e.g. /single_tuner_recorder; 'SERIAL' will be replaced by the serial number, and 'TUNER' by the tuner) (default: disabled)\n");
+    fprintf(stderr, "    -c <writer CPU>[,<callback CPU>] pin the writer thread of the RSP (needs -B) to <writer CPU>, and the threads of its stream callback to <callback CPU>; the worker threads are not pinned (default: not pinned)\n");
+    fprintf(stderr, "    -n skip the quick check of the settings (an Init/Uninit cycle before streaming) (default: enabled)\n");
+    fprintf(stderr, "    -Q <settings cache file> skip the quick check when the same settings were already validated on the same RSP, as recorded in <settings cache file> (default: disabled)\n");
+    fprintf(stderr, "    -U <control socket> accept commands on the UNIX socket <control socket> to change frequency, gains, and IF bandwidth while streaming (see README) (default: disabled)\n");
+    fprintf(stderr, "    -L enable SDRplay API debug log level (default: disabled)\n");
+    fprintf(stderr, "    -T measure callback time difference (default: disabled)\n");
+    fprintf(stderr, "    -t <threshold (us)> report the callbacks that arrive more than <threshold> after the previous one (with -T) (default: 5000)\n");
+    fprintf(stderr, "    -A <intervals file> dump all the callback intervals to <intervals file> (with -T) (default: disabled)\n");
+    fprintf(stderr, "    -H get histogram of sample values (default: disabled)\n");
+    fprintf(stderr, "    -w count the histogram of sample values (-H) on a worker thread (default: on the stream callback thread)\n");
+    fprintf(stderr, "    -h show usage\n");
+}
+
+/* segment length: <N>s, <N>m, <N>h for time, <N>, <N>k, <N>M, <N>G for bytes */
+static int parse_segment_length(const char *arg, unsigned long long *segment_bytes, double *segment_seconds)
+{
+    double value;
+    char unit = '\0';
+    int n = sscanf(arg, "%lf%c", &value, &unit);
+    if (n < 1 || value <= 0) {
+        return -1;
+    }
+    *segment_bytes = 0;
+    *segment_seconds = 0.0;
+    switch (unit) {
+        case 's': *segment_seconds = value; break;
+        case 'm': *segment_seconds = value * 60; break;
+        case 'h': *segment_seconds = value * 3600; break;
+        case '\0': *segment_bytes = (unsigned long long)value; break;
+        case 'k': *segment_bytes = (unsigned long long)(value * 1024); break;
+        case 'M': *segment_bytes = (unsigned long long)(value * 1024 * 1024); break;
+        case 'G': *segment_bytes = (unsigned long long)(value * 1024 * 1024 * 1024); break;
+        default: return -1;
+    }
+    return 0;
+}
+
+/* the defaults of the settings of an RSP (see usage()) */
+static void receiver_config_init(ReceiverConfig *config)
+{
+    memset(config, 0, sizeof(ReceiverConfig));
+    config->serial_number = NULL;
+    config->rsp_sample_rate = 0.0;
+    config->decimation = 1;
+    config->if_frequency = sdrplay_api_IF_Zero;
+    config->if_bandwidth = sdrplay_api_BW_0_200;
+    config->agc = sdrplay_api_AGC_DISABLE;
+    config->gRdB = 40;
+    config->LNAstate = 0;
+    config->DCenable = 1;
+    config->IQenable = 1;
+    config->dcCal = 3;
+    config->speedUp = 0;
+    config->trackTime = 1;
+    config->refreshRateTime = 2048;
+    config->frequency = 100e6;
+    config->antenna = NULL;
+    config->hdrEnable = 0;
+    config->hdrBw = sdrplay_api_RspDx_HDRMODE_BW_0_200;
+    config->output_file = NULL;
+    config->net_destination[0] = '\0';
+    config->net_packet_size = 0;
+    config->shm_ring_name[0] = '\0';
+    config->shm_ring_size_MiB = SHM_RING_DEFAULT_SIZE_MiB;
+    config->compress_workers = 0;
+    config->compress_chunk_KiB = COMPRESS_DEFAULT_CHUNK_KiB;
+    config->sample_format_spec = (SampleFormatSpec){ SAMPLE_FORMAT_IQ16, 0, SAMPLE_FORMAT_CF32_SCALE };
+    config->nchannels = 0;
+    config->channelizer_workers = 0;
+    config->spectrum_enable = 0;
+    config->sweep_enable = 0;
+    config->segment_bytes = 0;
+    config->segment_seconds = 0.0;
+    config->stats_shm_name = NULL;
+    config->measure_time_diff_enable = 0;
+    config->time_diff_threshold_us = 5000;    /* 5ms */
+    config->time_diff_intervals_file = NULL;
+    config->samples_histogram_enable = 0;
+    config->samples_histogram_threaded = 0;
+    config->writer_cpu = -1;
+    config->callback_cpu = -1;
+}
+
+/* pick a device for each receiver (by serial number, or the first one
+ * still available) and select all of them */
+static int select_devices(Receiver *receivers, int nreceivers)
+{
+    sdrplay_api_ErrT err;
     err = sdrplay_api_LockDeviceApi();
     if (err != sdrplay_api_Success) {
         fprintf(stderr, "sdrplay_api_LockDeviceApi() failed: %s\n", sdrplay_api_GetErrorString(err));
-        sdrplay_api_Close();
-        exit(1);
+        return -1;
     }
 #ifdef SDRPLAY_MAX_DEVICES
 #undef SDRPLAY_MAX_DEVICES
 #endif
-#define SDRPLAY_MAX_DEVICES 4
+#define SDRPLAY_MAX_DEVICES 16
     unsigned int ndevices = SDRPLAY_MAX_DEVICES;
     sdrplay_api_DeviceT devices[SDRPLAY_MAX_DEVICES];
     err = sdrplay_api_GetDevices(devices, &ndevices, ndevices);
     if (err != sdrplay_api_Success) {
         fprintf(stderr, "sdrplay_api_GetDevices() failed: %s\n", sdrplay_api_GetErrorString(err));
         sdrplay_api_UnlockDeviceApi();
-        sdrplay_api_Close();
-        exit(1);
+        return -1;
     }
-    int device_index = -1;
-    for (unsigned int i = 0; i < ndevices; i++) {
-        if (devices[i].valid &&
-            (serial_number == NULL || strcmp(devices[i].SerNo, serial_number) == 0)) {
-            device_index = i;
-            break;
+    int used[SDRPLAY_MAX_DEVICES] = { 0 };
+    for (int r = 0; r < nreceivers; r++) {
+        Receiver *receiver = &receivers[r];
+        const char *serial_number = receiver->config.serial_number;
+        int device_index = -1;
+        for (unsigned int i = 0; i < ndevices; i++) {
+            if (devices[i].valid && !used[i] &&
+                (serial_number == NULL || strcmp(devices[i].SerNo, serial_number) == 0)) {
+                device_index = i;
+                break;
+            }
         }
-    }
-    if (device_index == -1) {
-        fprintf(stderr, "SDRplay RSP not found or not available\n");
-        sdrplay_api_UnlockDeviceApi();
-        sdrplay_api_Close();
-        exit(1);
-    }
-    sdrplay_api_DeviceT device = devices[device_index];
-
-    /* for RSPduo make sure single tuner mode is available */
-    if (device.hwVer == SDRPLAY_RSPduo_ID) {
-        if ((device.rspDuoMode & sdrplay_api_RspDuoMode_Single_Tuner) != sdrplay_api_RspDuoMode_Single_Tuner) {
-            fprintf(stderr, "SDRplay RSPduo single tuner mode not available\n");
+        if (device_index == -1) {
+            if (serial_number != NULL) {
+                fprintf(stderr, "SDRplay RSP %s not found or not available\n", serial_number);
+            } else {
+                fprintf(stderr, "SDRplay RSP not found or not available\n");
+            }
             sdrplay_api_UnlockDeviceApi();
-            sdrplay_api_Close();
-            exit(1);
-        } else {
-            device.rspDuoMode = sdrplay_api_RspDuoMode_Single_Tuner;
-            if (antenna != NULL) {
-                if (strcmp(antenna, "Tuner 1 50 ohm") == 0 || strcmp(antenna, "High Z") == 0) {
-                    device.tuner = sdrplay_api_Tuner_A;
-                } else if (strcmp(antenna, "Tuner 2 50 ohm") == 0) {
-                    device.tuner = sdrplay_api_Tuner_B;
-                } else {
-                    device.tuner = sdrplay_api_Tuner_A;
+            return -1;
+        }
+        used[device_index] = 1;
+        sdrplay_api_DeviceT *device = &receiver->device;
+        *device = devices[device_index];
+
+        /* for RSPduo make sure single (or dual) tuner mode is available */
+        if (receiver->config.dual_tuner) {
+            if (device->hwVer != SDRPLAY_RSPduo_ID || (device->rspDuoMode & sdrplay_api_RspDuoMode_Dual_Tuner) != sdrplay_api_RspDuoMode_Dual_Tuner) {
+                fprintf(stderr, "SDRplay RSPduo dual tuner mode not available on %s\n", device->SerNo);
+                sdrplay_api_UnlockDeviceApi();
+                return -1;
+            }
+            device->rspDuoMode = sdrplay_api_RspDuoMode_Dual_Tuner;
+            device->tuner = sdrplay_api_Tuner_Both;
+            device->rspDuoSampleFreq = receiver->config.rsp_sample_rate;
+        } else if (device->hwVer == SDRPLAY_RSPduo_ID) {
+            if ((device->rspDuoMode & sdrplay_api_RspDuoMode_Single_Tuner) != sdrplay_api_RspDuoMode_Single_Tuner) {
+                fprintf(stderr, "SDRplay RSPduo single tuner mode not available\n");
+                sdrplay_api_UnlockDeviceApi();
+                return -1;
+            } else {
+                const char *antenna = receiver->config.antenna;
+                device->rspDuoMode = sdrplay_api_RspDuoMode_Single_Tuner;
+                if (antenna != NULL) {
+                    if (strcmp(antenna, "Tuner 1 50 ohm") == 0 || strcmp(antenna, "High Z") == 0) {
+                        device->tuner = sdrplay_api_Tuner_A;
+                    } else if (strcmp(antenna, "Tuner 2 50 ohm") == 0) {
+                        device->tuner = sdrplay_api_Tuner_B;
+                    } else {
+                        device->tuner = sdrplay_api_Tuner_A;
+                    }
                 }
+                device->rspDuoSampleFreq = 0;
             }
-            device.rspDuoSampleFreq = 0;
         }
-    }
 
-    err = sdrplay_api_SelectDevice(&device);
-    if (err != sdrplay_api_Success) {
-        fprintf(stderr, "sdrplay_api_SelectDevice() failed: %s\n", sdrplay_api_GetErrorString(err));
-        sdrplay_api_UnlockDeviceApi();
-        sdrplay_api_Close();
-        exit(1);
+        err = sdrplay_api_SelectDevice(device);
+        if (err != sdrplay_api_Success) {
+            fprintf(stderr, "sdrplay_api_SelectDevice() failed: %s\n", sdrplay_api_GetErrorString(err));
+            sdrplay_api_UnlockDeviceApi();
+            return -1;
+        }
+        receiver->selected = 1;
     }
 
     err = sdrplay_api_UnlockDeviceApi();
     if (err != sdrplay_api_Success) {
         fprintf(stderr, "sdrplay_api_UnlockDeviceApi() failed: %s\n", sdrplay_api_GetErrorString(err));
-        sdrplay_api_ReleaseDevice(&device);
-        sdrplay_api_Close();
-        exit(1);
+        return -1;
     }
+    return 0;
+}
 
+static int configure_receiver(Receiver *receiver, int debug_enable)
+{
+    const ReceiverConfig *config = &receiver->config;
+    sdrplay_api_DeviceT *device = &receiver->device;
+    sdrplay_api_ErrT err;
     if (debug_enable) {
-        err = sdrplay_api_DebugEnable(device.dev, sdrplay_api_DbgLvl_Verbose);
+        err = sdrplay_api_DebugEnable(device->dev, sdrplay_api_DbgLvl_Verbose);
         if (err != sdrplay_api_Success) {
             fprintf(stderr, "sdrplay_api_DebugEnable() failed: %s\n", sdrplay_api_GetErrorString(err));
-            sdrplay_api_ReleaseDevice(&device);
-            sdrplay_api_Close();
-            exit(1);
+            return -1;
         }
     }
 
     // select device settings
     sdrplay_api_DeviceParamsT *device_params;
-    err = sdrplay_api_GetDeviceParams(device.dev, &device_params);
+    err = sdrplay_api_GetDeviceParams(device->dev, &device_params);
     if (err != sdrplay_api_Success) {
         fprintf(stderr, "sdrplay_api_GetDeviceParams() failed: %s\n", sdrplay_api_GetErrorString(err));
-        sdrplay_api_ReleaseDevice(&device);
-        sdrplay_api_Close();
-        exit(1);
+        return -1;
     }
+    receiver->device_params = device_params;
     sdrplay_api_RxChannelParamsT *rx_channel_params = device_params->rxChannelA ;
-    device_params->devParams->fsFreq.fsHz = rsp_sample_rate;
-    rx_channel_params->ctrlParams.decimation.enable = decimation > 1;
-    rx_channel_params->ctrlParams.decimation.decimationFactor = decimation;
-    rx_channel_params->tunerParams.ifType = if_frequency;
-    rx_channel_params->tunerParams.bwType = if_bandwidth;
-    rx_channel_params->ctrlParams.agc.enable = agc;
-    if (agc == sdrplay_api_AGC_DISABLE) {
-        rx_channel_params->tunerParams.gain.gRdB = gRdB;
-    }
-    rx_channel_params->tunerParams.gain.LNAstate = LNAstate;
-    rx_channel_params->ctrlParams.dcOffset.DCenable = DCenable;
-    rx_channel_params->ctrlParams.dcOffset.IQenable = IQenable;
-    rx_channel_params->tunerParams.dcOffsetTuner.dcCal = dcCal;
-    rx_channel_params->tunerParams.dcOffsetTuner.speedUp = speedUp;
-    rx_channel_params->tunerParams.dcOffsetTuner.trackTime = trackTime;
-    rx_channel_params->tunerParams.dcOffsetTuner.refreshRateTime = refreshRateTime;
-    rx_channel_params->tunerParams.rfFreq.rfHz = frequency;
+    device_params->devParams->fsFreq.fsHz = config->rsp_sample_rate;
+    configure_rx_channel(config, rx_channel_params);
+    if (config->dual_tuner) {
+        /* same settings for tuner B */
+        configure_rx_channel(config, device_params->rxChannelB);
+    }
+    const char *antenna = config->antenna;
     if (antenna != NULL) {
-        if (device.hwVer == SDRPLAY_RSP2_ID) {
+        if (device->hwVer == SDRPLAY_RSP2_ID) {
             if (strcmp(antenna, "Antenna A") == 0) {
                 rx_channel_params->rsp2TunerParams.antennaSel = sdrplay_api_Rsp2_ANTENNA_A;
                 rx_channel_params->rsp2TunerParams.amPortSel = sdrplay_api_Rsp2_AMPORT_2;
@@ -332,13 +990,13 @@ int main(int argc, char *argv[])
                 rx_channel_params->rsp2TunerParams.antennaSel = sdrplay_api_Rsp2_ANTENNA_A;
                 rx_channel_params->rsp2TunerParams.amPortSel = sdrplay_api_Rsp2_AMPORT_1;
             }
-        } else if (device.hwVer == SDRPLAY_RSPduo_ID) {
+        } else if (device->hwVer == SDRPLAY_RSPduo_ID) {
             if (strcmp(antenna, "High Z") == 0) {
                 rx_channel_params->rspDuoTunerParams.tuner1AmPortSel = sdrplay_api_RspDuo_AMPORT_1;
             } else {
                 rx_channel_params->rspDuoTunerParams.tuner1AmPortSel = sdrplay_api_RspDuo_AMPORT_2;
             }
-        } else if (device.hwVer == SDRPLAY_RSPdx_ID) {
+        } else if (device->hwVer == SDRPLAY_RSPdx_ID) {
             if (strcmp(antenna, "Antenna A") == 0) {
                 device_params->devParams->rspDxParams.antennaSel = sdrplay_api_RspDx_ANTENNA_A;
             } else if (strcmp(antenna, "Antenna B") == 0) {
@@ -346,7 +1004,7 @@ int main(int argc, char *argv[])
             } else if (strcmp(antenna, "Antenna C") == 0) {
                 device_params->devParams->rspDxParams.antennaSel = sdrplay_api_RspDx_ANTENNA_C;
             }
-        } else if (device.hwVer == SDRPLAY_RSPdxR2_ID) {
+        } else if (device->hwVer == SDRPLAY_RSPdxR2_ID) {
             if (strcmp(antenna, "Antenna A") == 0) {
                 device_params->devParams->rspDxParams.antennaSel = sdrplay_api_RspDx_ANTENNA_A;
             } else if (strcmp(antenna, "Antenna B") == 0) {
@@ -357,456 +1015,1044 @@ int main(int argc, char *argv[])
         }
     }
 
-    if (device.hwVer == SDRPLAY_RSPdx_ID) {
-        device_params->devParams->rspDxParams.hdrEnable = hdrEnable;
-        rx_channel_params->rspDxTunerParams.hdrBw = hdrBw;
-    } else if (device.hwVer == SDRPLAY_RSPdxR2_ID) {
-        device_params->devParams->rspDxParams.hdrEnable = hdrEnable;
-        rx_channel_params->rspDxTunerParams.hdrBw = hdrBw;
+    if (device->hwVer == SDRPLAY_RSPdx_ID) {
+        device_params->devParams->rspDxParams.hdrEnable = config->hdrEnable;
+        rx_channel_params->rspDxTunerParams.hdrBw = config->hdrBw;
+    } else if (device->hwVer == SDRPLAY_RSPdxR2_ID) {
+        device_params->devParams->rspDxParams.hdrEnable = config->hdrEnable;
+        rx_channel_params->rspDxTunerParams.hdrBw = config->hdrBw;
     }
+    return 0;
+}
 
-    /* quick check */
-    sdrplay_api_CallbackFnsT callbackNullFns = { NULL, NULL, NULL };
-    err = sdrplay_api_Init(device.dev, &callbackNullFns, NULL);
-    if (err != sdrplay_api_Success) {
-        fprintf(stderr, "sdrplay_api_Init() failed: %s\n", sdrplay_api_GetErrorString(err));
-        sdrplay_api_ReleaseDevice(&device);
-        sdrplay_api_Close();
-        exit(1);
+static void configure_rx_channel(const ReceiverConfig *config, sdrplay_api_RxChannelParamsT *rx_channel_params)
+{
+    rx_channel_params->ctrlParams.decimation.enable = config->decimation > 1;
+    rx_channel_params->ctrlParams.decimation.decimationFactor = config->decimation;
+    rx_channel_params->tunerParams.ifType = config->if_frequency;
+    rx_channel_params->tunerParams.bwType = config->if_bandwidth;
+    rx_channel_params->ctrlParams.agc.enable = config->agc;
+    if (config->agc == sdrplay_api_AGC_DISABLE) {
+        rx_channel_params->tunerParams.gain.gRdB = config->gRdB;
+    }
+    rx_channel_params->tunerParams.gain.LNAstate = config->LNAstate;
+    rx_channel_params->ctrlParams.dcOffset.DCenable = config->DCenable;
+    rx_channel_params->ctrlParams.dcOffset.IQenable = config->IQenable;
+    rx_channel_params->tunerParams.dcOffsetTuner.dcCal = config->dcCal;
+    rx_channel_params->tunerParams.dcOffsetTuner.speedUp = config->speedUp;
+    rx_channel_params->tunerParams.dcOffsetTuner.trackTime = config->trackTime;
+    rx_channel_params->tunerParams.dcOffsetTuner.refreshRateTime = config->refreshRateTime;
+    rx_channel_params->tunerParams.rfFreq.rfHz = config->frequency;
+}
+
+/* quick check: initialize the device without callbacks, make sure the
+ * settings weren't changed, and print them; without the quick check they
+ * are printed as they were set */
+static int check_receiver(Receiver *receiver, int quick_check)
+{
+    const ReceiverConfig *config = &receiver->config;
+    sdrplay_api_DeviceT *device = &receiver->device;
+    sdrplay_api_DeviceParamsT *device_params = receiver->device_params;
+    sdrplay_api_RxChannelParamsT *rx_channel_params = device_params->rxChannelA;
+    sdrplay_api_ErrT err;
+    if (quick_check) {
+        sdrplay_api_CallbackFnsT callbackNullFns = { NULL, NULL, NULL };
+        err = sdrplay_api_Init(device->dev, &callbackNullFns, NULL);
+        if (err != sdrplay_api_Success) {
+            fprintf(stderr, "sdrplay_api_Init() failed: %s\n", sdrplay_api_GetErrorString(err));
+            return -1;
+        }
     }
 
     /* print settings */
-    fprintf(stderr, "SerNo=%s hwVer=%d tuner=0x%02x\n", device.SerNo, device.hwVer, device.tuner);
+    fprintf(stderr, "SerNo=%s hwVer=%d tuner=0x%02x\n", device->SerNo, device->hwVer, device->tuner);
     fprintf(stderr, "SR=%.0lf LO=%.0lf BW=%d If=%d Dec=%d IFagc=%d IFgain=%d LNAgain=%d\n", device_params->devParams->fsFreq.fsHz, rx_channel_params->tunerParams.rfFreq.rfHz, rx_channel_params->tunerParams.bwType, rx_channel_params->tunerParams.ifType, rx_channel_params->ctrlParams.decimation.decimationFactor, rx_channel_params->ctrlParams.agc.enable, rx_channel_params->tunerParams.gain.gRdB, rx_channel_params->tunerParams.gain.LNAstate);
-    if (device.hwVer == SDRPLAY_RSP2_ID) {
+    if (device->hwVer == SDRPLAY_RSP2_ID) {
         fprintf(stderr, "antenna=%d amPort=%d\n", rx_channel_params->rsp2TunerParams.antennaSel, rx_channel_params->rsp2TunerParams.antennaSel);
-    } else if (device.hwVer == SDRPLAY_RSPduo_ID) {
-        fprintf(stderr, "tuner=%d amPort=%d\n", device.tuner, rx_channel_params->rspDuoTunerParams.tuner1AmPortSel);
-    } else if (device.hwVer == SDRPLAY_RSPdx_ID) {
+    } else if (device->hwVer == SDRPLAY_RSPduo_ID) {
+        fprintf(stderr, "tuner=%d amPort=%d\n", device->tuner, rx_channel_params->rspDuoTunerParams.tuner1AmPortSel);
+    } else if (device->hwVer == SDRPLAY_RSPdx_ID) {
         fprintf(stderr, "antenna=%d hdrEnable=%d hdrBw=%d\n", device_params->devParams->rspDxParams.antennaSel, device_params->devParams->rspDxParams.hdrEnable, rx_channel_params->rspDxTunerParams.hdrBw);
-    } else if (device.hwVer == SDRPLAY_RSPdxR2_ID) {
+    } else if (device->hwVer == SDRPLAY_RSPdxR2_ID) {
         fprintf(stderr, "antenna=%d hdrEnable=%d hdrBw=%d\n", device_params->devParams->rspDxParams.antennaSel, device_params->devParams->rspDxParams.hdrEnable, rx_channel_params->rspDxTunerParams.hdrBw);
     }
     fprintf(stderr, "DCenable=%d IQenable=%d dcCal=%d speedUp=%d trackTime=%d refreshRateTime=%d\n", (int)(rx_channel_params->ctrlParams.dcOffset.DCenable), (int)(rx_channel_params->ctrlParams.dcOffset.IQenable), (int)(rx_channel_params->tunerParams.dcOffsetTuner.dcCal), (int)(rx_channel_params->tunerParams.dcOffsetTuner.speedUp), rx_channel_params->tunerParams.dcOffsetTuner.trackTime, rx_channel_params->tunerParams.dcOffsetTuner.refreshRateTime);
 
+    if (config->dual_tuner) {
+        sdrplay_api_RxChannelParamsT *rx_channel_b_params = device_params->rxChannelB;
+        fprintf(stderr, "tuner B: LO=%.0lf BW=%d If=%d Dec=%d IFagc=%d IFgain=%d LNAgain=%d\n", rx_channel_b_params->tunerParams.rfFreq.rfHz, rx_channel_b_params->tunerParams.bwType, rx_channel_b_params->tunerParams.ifType, rx_channel_b_params->ctrlParams.decimation.decimationFactor, rx_channel_b_params->ctrlParams.agc.enable, rx_channel_b_params->tunerParams.gain.gRdB, rx_channel_b_params->tunerParams.gain.LNAstate);
+    }
+
+    /* same settings for the SigMF sidecars */
+    fill_sigmf_capture(receiver, &receiver->streams[0], rx_channel_params);
+    if (config->dual_tuner) {
+        fill_sigmf_capture(receiver, &receiver->streams[1], device_params->rxChannelB);
+    }
+
+    if (!quick_check) {
+        return 0;
+    }
+
     int init_ok = 1;
-    if (device.tuner != sdrplay_api_Tuner_A) {
-        fprintf(stderr, "unexpected change - tuner: 0x%02x -> 0x%02x\n", sdrplay_api_Tuner_A, device.tuner);
+    sdrplay_api_TunerSelectT expected_tuner = config->dual_tuner ? sdrplay_api_Tuner_Both : sdrplay_api_Tuner_A;
+    if (device->tuner != expected_tuner) {
+        fprintf(stderr, "unexpected change - tuner: 0x%02x -> 0x%02x\n", expected_tuner, device->tuner);
         init_ok = 0;
     }
-    if (device.hwVer == SDRPLAY_RSPduo_ID) {
-        if (device.rspDuoMode != sdrplay_api_RspDuoMode_Single_Tuner) {
-            fprintf(stderr, "unexpected change - rspDuoMode: 0x%02x -> 0x%02x\n", sdrplay_api_RspDuoMode_Single_Tuner, device.rspDuoMode);
+    if (device->hwVer == SDRPLAY_RSPduo_ID) {
+        sdrplay_api_RspDuoModeT expected_mode = config->dual_tuner ? sdrplay_api_RspDuoMode_Dual_Tuner : sdrplay_api_RspDuoMode_Single_Tuner;
+        if (device->rspDuoMode != expected_mode) {
+            fprintf(stderr, "unexpected change - rspDuoMode: 0x%02x -> 0x%02x\n", expected_mode, device->rspDuoMode);
             init_ok = 0;
         }
     } else {
-        if (device.rspDuoMode != sdrplay_api_RspDuoMode_Unknown) {
-            fprintf(stderr, "unexpected change - rspDuoMode: 0x%02x -> 0x%02x\n", sdrplay_api_RspDuoMode_Unknown, device.rspDuoMode);
+        if (device->rspDuoMode != sdrplay_api_RspDuoMode_Unknown) {
+            fprintf(stderr, "unexpected change - rspDuoMode: 0x%02x -> 0x%02x\n", sdrplay_api_RspDuoMode_Unknown, device->rspDuoMode);
             init_ok = 0;
         }
     }
-    if (device.rspDuoSampleFreq != 0) {
-        fprintf(stderr, "unexpected change - rspDuoSampleFreq: %.0lf -> %.0lf\n", 0.0, device.rspDuoSampleFreq);
+    double expected_rsp_duo_sample_freq = config->dual_tuner ? config->rsp_sample_rate : 0.0;
+    if (device->rspDuoSampleFreq != expected_rsp_duo_sample_freq) {
+        fprintf(stderr, "unexpected change - rspDuoSampleFreq: %.0lf -> %.0lf\n", expected_rsp_duo_sample_freq, device->rspDuoSampleFreq);
         init_ok = 0;
     }
-    if (device_params->devParams->fsFreq.fsHz != rsp_sample_rate) {
-        fprintf(stderr, "unexpected change - fsHz: %.0lf -> %.0lf\n", rsp_sample_rate, device_params->devParams->fsFreq.fsHz);
+    if (device_params->devParams->fsFreq.fsHz != config->rsp_sample_rate) {
+        fprintf(stderr, "unexpected change - fsHz: %.0lf -> %.0lf\n", config->rsp_sample_rate, device_params->devParams->fsFreq.fsHz);
         init_ok = 0;
     }
-    if (rx_channel_params->ctrlParams.decimation.enable != (decimation > 1)) {
-        fprintf(stderr, "unexpected change - decimation.enable: %d -> %d\n", decimation > 1, rx_channel_params->ctrlParams.decimation.enable);
+    if (check_rx_channel(config, rx_channel_params, "") == -1) {
         init_ok = 0;
     }
-    if (rx_channel_params->ctrlParams.decimation.decimationFactor != decimation) {
-        fprintf(stderr, "unexpected change - decimation.decimationFactor: %d -> %d\n", decimation, rx_channel_params->ctrlParams.decimation.decimationFactor);
+    if (config->dual_tuner && check_rx_channel(config, device_params->rxChannelB, "rxChannelB.") == -1) {
         init_ok = 0;
     }
-    if (rx_channel_params->tunerParams.ifType != if_frequency) {
-        fprintf(stderr, "unexpected change - ifType: %d -> %d\n", if_frequency, rx_channel_params->tunerParams.ifType);
-        init_ok = 0;
+    if (device->hwVer == SDRPLAY_RSPdx_ID || device->hwVer == SDRPLAY_RSPdxR2_ID) {
+        if (device_params->devParams->rspDxParams.hdrEnable != config->hdrEnable) {
+            fprintf(stderr, "unexpected change - hdrEnable: %d -> %d\n", config->hdrEnable, device_params->devParams->rspDxParams.hdrEnable);
+            init_ok = 0;
+        }
+        if (rx_channel_params->rspDxTunerParams.hdrBw != config->hdrBw) {
+            fprintf(stderr, "unexpected change - hdrBw: %d -> %d\n", config->hdrBw, rx_channel_params->rspDxTunerParams.hdrBw);
+            init_ok = 0;
+        }
     }
-    if (rx_channel_params->tunerParams.bwType != if_bandwidth) {
-        fprintf(stderr, "unexpected change - bwType: %d -> %d\n", if_bandwidth, rx_channel_params->tunerParams.bwType);
-        init_ok = 0;
+
+    if (!init_ok) {
+        sdrplay_api_Uninit(device->dev);
+        return -1;
     }
-    if (rx_channel_params->ctrlParams.agc.enable != agc) {
-        fprintf(stderr, "unexpected change - agc.enable: %d -> %d\n", agc, rx_channel_params->ctrlParams.agc.enable);
-        init_ok = 0;
+
+    err = sdrplay_api_Uninit(device->dev);
+    if (err != sdrplay_api_Success) {
+        fprintf(stderr, "sdrplay_api_Uninit() failed: %s\n", sdrplay_api_GetErrorString(err));
+        return -1;
     }
-    if (agc == sdrplay_api_AGC_DISABLE) {
-        if (rx_channel_params->tunerParams.gain.gRdB != gRdB) {
-            fprintf(stderr, "unexpected change - gain.gRdB: %d -> %d\n", gRdB, rx_channel_params->tunerParams.gain.gRdB);
-            init_ok = 0;
+    return 0;
+}
+
+/* canonical description of everything the quick check validates, for the
+ * settings cache fingerprint */
+static void describe_settings(const Receiver *receiver, char *settings, size_t size)
+{
+    const ReceiverConfig *config = &receiver->config;
+    const sdrplay_api_DeviceT *device = &receiver->device;
+    snprintf(settings, size, "api=%.2f SerNo=%s hwVer=%d dual=%d tuner=%d rspDuoMode=%d rspDuoSampleFreq=%.0lf "
+             "fsHz=%.0lf dec=%d if=%d bw=%d agc=%d gRdB=%d LNAstate=%d DCenable=%d IQenable=%d "
+             "dcCal=%d speedUp=%d trackTime=%d refreshRateTime=%d rfHz=%.0lf antenna=%s hdrEnable=%d hdrBw=%d",
+             SDRPLAY_API_VERSION, device->SerNo, device->hwVer, config->dual_tuner, device->tuner, device->rspDuoMode, device->rspDuoSampleFreq,
+             config->rsp_sample_rate, config->decimation, config->if_frequency, config->if_bandwidth, config->agc,
+             config->agc == sdrplay_api_AGC_DISABLE ? config->gRdB : -1, config->LNAstate, config->DCenable, config->IQenable,
+             config->dcCal, config->speedUp, config->trackTime, config->refreshRateTime, config->frequency,
+             config->antenna != NULL ? config->antenna : "", config->hdrEnable, config->hdrBw);
+}
+
+/* the settings of one tuner; prefix is for the messages */
+static int check_rx_channel(const ReceiverConfig *config, const sdrplay_api_RxChannelParamsT *rx_channel_params, const char *prefix)
+{
+    int ok = 1;
+    if (rx_channel_params->ctrlParams.decimation.enable != (config->decimation > 1)) {
+        fprintf(stderr, "unexpected change - %sdecimation.enable: %d -> %d\n", prefix, config->decimation > 1, rx_channel_params->ctrlParams.decimation.enable);
+        ok = 0;
+    }
+    if (rx_channel_params->ctrlParams.decimation.decimationFactor != config->decimation) {
+        fprintf(stderr, "unexpected change - %sdecimation.decimationFactor: %d -> %d\n", prefix, config->decimation, rx_channel_params->ctrlParams.decimation.decimationFactor);
+        ok = 0;
+    }
+    if (rx_channel_params->tunerParams.ifType != config->if_frequency) {
+        fprintf(stderr, "unexpected change - %sifType: %d -> %d\n", prefix, config->if_frequency, rx_channel_params->tunerParams.ifType);
+        ok = 0;
+    }
+    if (rx_channel_params->tunerParams.bwType != config->if_bandwidth) {
+        fprintf(stderr, "unexpected change - %sbwType: %d -> %d\n", prefix, config->if_bandwidth, rx_channel_params->tunerParams.bwType);
+        ok = 0;
+    }
+    if (rx_channel_params->ctrlParams.agc.enable != config->agc) {
+        fprintf(stderr, "unexpected change - %sagc.enable: %d -> %d\n", prefix, config->agc, rx_channel_params->ctrlParams.agc.enable);
+        ok = 0;
+    }
+    if (config->agc == sdrplay_api_AGC_DISABLE) {
+        if (rx_channel_params->tunerParams.gain.gRdB != config->gRdB) {
+            fprintf(stderr, "unexpected change - %sgain.gRdB: %d -> %d\n", prefix, config->gRdB, rx_channel_params->tunerParams.gain.gRdB);
+            ok = 0;
         }
     }
-    if (rx_channel_params->tunerParams.gain.LNAstate != LNAstate) {
-        fprintf(stderr, "unexpected change - gain.LNAstate: %d -> %d\n", LNAstate, rx_channel_params->tunerParams.gain.LNAstate);
-        init_ok = 0;
+    if (rx_channel_params->tunerParams.gain.LNAstate != config->LNAstate) {
+        fprintf(stderr, "unexpected change - %sgain.LNAstate: %d -> %d\n", prefix, config->LNAstate, rx_channel_params->tunerParams.gain.LNAstate);
+        ok = 0;
     }
-    if (rx_channel_params->ctrlParams.dcOffset.DCenable != DCenable) {
-        fprintf(stderr, "unexpected change - dcOffset.DCenable: %d -> %d\n", DCenable, rx_channel_params->ctrlParams.dcOffset.DCenable);
-        init_ok = 0;
+    if (rx_channel_params->ctrlParams.dcOffset.DCenable != config->DCenable) {
+        fprintf(stderr, "unexpected change - %sdcOffset.DCenable: %d -> %d\n", prefix, config->DCenable, rx_channel_params->ctrlParams.dcOffset.DCenable);
+        ok = 0;
     }
-    if (rx_channel_params->ctrlParams.dcOffset.IQenable != IQenable) {
-        fprintf(stderr, "unexpected change - dcOffset.IQenable: %d -> %d\n", IQenable, rx_channel_params->ctrlParams.dcOffset.IQenable);
-        init_ok = 0;
+    if (rx_channel_params->ctrlParams.dcOffset.IQenable != config->IQenable) {
+        fprintf(stderr, "unexpected change - %sdcOffset.IQenable: %d -> %d\n", prefix, config->IQenable, rx_channel_params->ctrlParams.dcOffset.IQenable);
+        ok = 0;
     }
-    if (rx_channel_params->tunerParams.dcOffsetTuner.dcCal != dcCal) {
-        fprintf(stderr, "unexpected change - dcOffsetTuner.dcCal: %d -> %d\n", dcCal, rx_channel_params->tunerParams.dcOffsetTuner.dcCal);
-        init_ok = 0;
+    if (rx_channel_params->tunerParams.dcOffsetTuner.dcCal != config->dcCal) {
+        fprintf(stderr, "unexpected change - %sdcOffsetTuner.dcCal: %d -> %d\n", prefix, config->dcCal, rx_channel_params->tunerParams.dcOffsetTuner.dcCal);
+        ok = 0;
     }
-    if (rx_channel_params->tunerParams.dcOffsetTuner.speedUp != speedUp) {
-        fprintf(stderr, "unexpected change - dcOffsetTuner.speedUp: %d -> %d\n", speedUp, rx_channel_params->tunerParams.dcOffsetTuner.speedUp);
-        init_ok = 0;
+    if (rx_channel_params->tunerParams.dcOffsetTuner.speedUp != config->speedUp) {
+        fprintf(stderr, "unexpected change - %sdcOffsetTuner.speedUp: %d -> %d\n", prefix, config->speedUp, rx_channel_params->tunerParams.dcOffsetTuner.speedUp);
+        ok = 0;
     }
-    if (rx_channel_params->tunerParams.dcOffsetTuner.trackTime != trackTime) {
-        fprintf(stderr, "unexpected change - dcOffsetTuner.trackTime: %d -> %d\n", trackTime, rx_channel_params->tunerParams.dcOffsetTuner.trackTime);
-        init_ok = 0;
+    if (rx_channel_params->tunerParams.dcOffsetTuner.trackTime != config->trackTime) {
+        fprintf(stderr, "unexpected change - %sdcOffsetTuner.trackTime: %d -> %d\n", prefix, config->trackTime, rx_channel_params->tunerParams.dcOffsetTuner.trackTime);
+        ok = 0;
     }
-    if (rx_channel_params->tunerParams.dcOffsetTuner.refreshRateTime != refreshRateTime) {
-        fprintf(stderr, "unexpected change - dcOffsetTuner.refreshRateTime: %d -> %d\n", refreshRateTime, rx_channel_params->tunerParams.dcOffsetTuner.refreshRateTime);
-        init_ok = 0;
+    if (rx_channel_params->tunerParams.dcOffsetTuner.refreshRateTime != config->refreshRateTime) {
+        fprintf(stderr, "unexpected change - %sdcOffsetTuner.refreshRateTime: %d -> %d\n", prefix, config->refreshRateTime, rx_channel_params->tunerParams.dcOffsetTuner.refreshRateTime);
+        ok = 0;
     }
-    if (device.hwVer == SDRPLAY_RSPdx_ID || device.hwVer == SDRPLAY_RSPdxR2_ID) {
-        if (device_params->devParams->rspDxParams.hdrEnable != hdrEnable) {
-            fprintf(stderr, "unexpected change - hdrEnable: %d -> %d\n", hdrEnable, device_params->devParams->rspDxParams.hdrEnable);
-            init_ok = 0;
+    if (rx_channel_params->tunerParams.rfFreq.rfHz != config->frequency) {
+        fprintf(stderr, "unexpected change - %srfHz: %.0lf -> %.0lf\n", prefix, config->frequency, rx_channel_params->tunerParams.rfFreq.rfHz);
+        ok = 0;
+    }
+    return ok ? 0 : -1;
+}
+
+static void fill_sigmf_capture(Receiver *receiver, ReceiverStream *stream, const sdrplay_api_RxChannelParamsT *rx_channel_params)
+{
+    const ReceiverConfig *config = &receiver->config;
+    const sdrplay_api_DeviceT *device = &receiver->device;
+    const sdrplay_api_DeviceParamsT *device_params = receiver->device_params;
+    if (stream->tuner != '\0') {
+        snprintf(stream->hw, sizeof(stream->hw), "SDRplay %s SerNo=%s tuner %c", rsp_model(device->hwVer), device->SerNo, stream->tuner);
+    } else {
+        snprintf(stream->hw, sizeof(stream->hw), "SDRplay %s SerNo=%s", rsp_model(device->hwVer), device->SerNo);
+    }
+    stream->sigmf_capture = (SigMFCapture){
+        .hw = stream->hw,
+        .sample_rate = stream_sample_rate(config->rsp_sample_rate, config->decimation, config->if_frequency),
+        .frequency = rx_channel_params->tunerParams.rfFreq.rfHz,
+        .rsp_sample_rate = device_params->devParams->fsFreq.fsHz,
+        .decimation = rx_channel_params->ctrlParams.decimation.decimationFactor,
+        .if_frequency = rx_channel_params->tunerParams.ifType,
+        .if_bandwidth = rx_channel_params->tunerParams.bwType,
+        .agc = rx_channel_params->ctrlParams.agc.enable,
+        .gain_reduction = rx_channel_params->tunerParams.gain.gRdB,
+        .lna_state = rx_channel_params->tunerParams.gain.LNAstate,
+        .dc_enable = rx_channel_params->ctrlParams.dcOffset.DCenable,
+        .iq_enable = rx_channel_params->ctrlParams.dcOffset.IQenable,
+        .dc_cal = rx_channel_params->tunerParams.dcOffsetTuner.dcCal,
+        .speed_up = rx_channel_params->tunerParams.dcOffsetTuner.speedUp,
+        .track_time = rx_channel_params->tunerParams.dcOffsetTuner.trackTime,
+        .refresh_rate_time = rx_channel_params->tunerParams.dcOffsetTuner.refreshRateTime,
+        .antenna = config->antenna,
+        .hdr_enable = -1,
+    };
+    if (device->hwVer == SDRPLAY_RSPdx_ID || device->hwVer == SDRPLAY_RSPdxR2_ID) {
+        stream->sigmf_capture.hdr_enable = device_params->devParams->rspDxParams.hdrEnable;
+        stream->sigmf_capture.hdr_bandwidth = rx_channel_params->rspDxTunerParams.hdrBw;
+    }
+}
+
+/* the pipelines of a receiver and their sinks; of their threads only the
+ * writer is pinned (to the receiver writer CPU, if any), the worker pools
+ * get all the CPUs */
+static int start_receiver_sinks(Receiver *receiver, Logger *logger, int streaming_time)
+{
+    const ReceiverConfig *config = &receiver->config;
+
+    /* record: always, unless only the analysis sinks (-T, -H) were asked for */
+    int record_enable = config->output_file != NULL || !(config->measure_time_diff_enable || config->samples_histogram_enable);
+
+    for (int s = 0; s < receiver->nstreams; s++) {
+        ReceiverStream *stream = &receiver->streams[s];
+        if (pipeline_init(&stream->pipeline, config->stats_shm_name != NULL ? stream->stats_shm_name : NULL) == -1) {
+            return -1;
         }
-        if (rx_channel_params->rspDxTunerParams.hdrBw != hdrBw) {
-            fprintf(stderr, "unexpected change - hdrBw: %d -> %d\n", hdrBw, rx_channel_params->rspDxTunerParams.hdrBw);
-            init_ok = 0;
+        stream->pipeline_ok = 1;
+        stream->pipeline.log = logger_queue(logger, stream->name[0] != '\0' ? stream->name : NULL);
+        if (stream->pipeline.log == NULL || (record_enable && open_record_sink(stream, config, streaming_time) == -1)) {
+            return -1;
+        }
+        if (config->shm_ring_name[0] != '\0') {
+            Sink *sink = sink_shm_open(stream->shm_ring_name, (size_t)config->shm_ring_size_MiB * 1024 * 1024,
+                                       stream_sample_rate(config->rsp_sample_rate, config->decimation, config->if_frequency), config->frequency);
+            if (sink == NULL) {
+                return -1;
+            }
+            pipeline_add(&stream->pipeline, sink);
         }
     }
-    if (rx_channel_params->tunerParams.rfFreq.rfHz != frequency) {
-        fprintf(stderr, "unexpected change - rfHz: %.0lf -> %.0lf\n", frequency, rx_channel_params->tunerParams.rfFreq.rfHz);
-        init_ok = 0;
+    receiver->event_log = logger_queue(logger, receiver->name[0] != '\0' ? receiver->name : NULL);
+    if (receiver->event_log == NULL) {
+        return -1;
     }
 
-    if (!init_ok) {
-        sdrplay_api_Uninit(device.dev);
-        sdrplay_api_ReleaseDevice(&device);
-        sdrplay_api_Close();
-        exit(1);
+    /* tuner B starts with the first block of tuner A, so that the two
+     * recordings are sample aligned */
+    if (receiver->nstreams == 2) {
+        pipeline_follow(&receiver->streams[1].pipeline, &receiver->streams[0].pipeline);
     }
 
-    err = sdrplay_api_Uninit(device.dev);
-    if (err != sdrplay_api_Success) {
-        fprintf(stderr, "sdrplay_api_Uninit() failed: %s\n", sdrplay_api_GetErrorString(err));
-        sdrplay_api_ReleaseDevice(&device);
-        sdrplay_api_Close();
-        exit(1);
+    /* the analysis sinks, the network sink, the channels and the spectrum on
+     * the first tuner only */
+    Pipeline *pipeline = &receiver->streams[0].pipeline;
+
+    if (config->measure_time_diff_enable) {
+        Sink *sink = sink_time_diff_open(config->time_diff_threshold_us * 1000, config->time_diff_intervals_file);
+        if (sink == NULL) {
+            return -1;
+        }
+        pipeline_add(pipeline, sink);
     }
 
-    /* now for the real thing */
-    RXContextRecord rx_context_record = {
-        .earliest_callback = {0, 0},
-        .latest_callback = {0, 0},
-        .total_samples = 0,
-        .next_sample_num = 0xffffffff,
-        .output_fd = -1,
-        .imin = SHRT_MAX,
-        .imax = SHRT_MIN,
-        .qmin = SHRT_MAX,
-        .qmax = SHRT_MIN,
-    };
+    if (config->samples_histogram_enable) {
+        Sink *sink = sink_histogram_open(config->samples_histogram_threaded);
+        if (sink == NULL) {
+            return -1;
+        }
+        pipeline_add(pipeline, sink);
+    }
 
-    RXContextMeasureTimeDiff rx_context_measure_time_diff = {
-        .prev_time = {0, 0},
-        .callback_count = 0,
-        .diff_threshold = 5000000,   /* 5ms */
-    };
+    if (config->net_destination[0] != '\0') {
+        Sink *sink = sink_net_open(config->net_destination, config->net_packet_size);
+        if (sink == NULL) {
+            return -1;
+        }
+        pipeline_add(pipeline, sink);
+    }
 
-    RXContextSamplesHistogram rx_context_samples_histogram = {
-        .total_samples = 0,
-        .next_sample_num = 0xffffffff,
-        .i_histogram = NULL,
-        .q_histogram = NULL,
-    };
+    if (config->nchannels > 0) {
+        double channel_input_rate = stream_sample_rate(config->rsp_sample_rate, config->decimation, config->if_frequency);
+        if (channel_input_rate <= 0) {
+            fprintf(stderr, "channels (-C) need an explicit sample rate (-r) with zero IF, or the 6MHz/1620kHz or 8MHz/2048kHz low IF modes\n");
+            return -1;
+        }
+        /* channels are written from the channelizer thread, so blocking is OK */
+        OutputOptions channel_output_options = {
+            .mmap_output = config->mmap_output,
+            .direct_block_size = (size_t)config->direct_block_size_MiB * 1024 * 1024,
+            .uring_queue_depth = config->uring_queue_depth,
+            .may_block = 1,
+            .expected_size = 0,
+        };
+        if (channelizer_init(&receiver->channelizer, channel_input_rate, config->channel_specs, config->nchannels, config->channelizer_workers, open_output, &channel_output_options) == -1 ||
+            channelizer_start(&receiver->channelizer) == -1) {
+            return -1;
+        }
+        pipeline_add(pipeline, &receiver->channelizer.sink);
+    }
 
-    sdrplay_api_StreamCallback_t stream_callback_fn = NULL;
-    void *callback_ctx = NULL;
+    if (config->spectrum_enable) {
+        double spectrum_sample_rate = stream_sample_rate(config->rsp_sample_rate, config->decimation, config->if_frequency);
+        if (spectrum_sample_rate <= 0) {
+            fprintf(stderr, "spectrum monitor (-P) needs an explicit sample rate (-r) with zero IF, or the 6MHz/1620kHz or 8MHz/2048kHz low IF modes\n");
+            return -1;
+        }
+        if (spectrum_init(&receiver->spectrum, &config->spectrum_spec, spectrum_sample_rate, config->frequency) == -1 ||
+            spectrum_start(&receiver->spectrum) == -1) {
+            return -1;
+        }
+        pipeline_add(pipeline, &receiver->spectrum.sink);
+    }
 
-    if (!(measure_time_diff_only || samples_histogram_only)) {
-        stream_callback_fn = rx_callback_record;
-        callback_ctx = &rx_context_record;
-    } else if (measure_time_diff_only) {
-        stream_callback_fn = rx_callback_measure_time_diff;
-        callback_ctx = &rx_context_measure_time_diff;
-    } else if (samples_histogram_only) {
-        stream_callback_fn = rx_callback_samples_histogram;
-        callback_ctx = &rx_context_samples_histogram;
+    if (config->sweep_enable) {
+        double sweep_sample_rate = stream_sample_rate(config->rsp_sample_rate, config->decimation, config->if_frequency);
+        if (sweep_sample_rate <= 0) {
+            fprintf(stderr, "sweep (-G) needs an explicit sample rate (-r) with zero IF, or the 6MHz/1620kHz or 8MHz/2048kHz low IF modes\n");
+            return -1;
+        }
+        if (sweep_init(&receiver->sweep, &config->sweep_spec, sweep_sample_rate, sweep_retune, receiver) == -1 ||
+            sweep_start(&receiver->sweep) == -1) {
+            return -1;
+        }
+        pipeline_add(pipeline, &receiver->sweep.sink);
     }
-     
-    sdrplay_api_CallbackFnsT callbackFns = {
-        stream_callback_fn,
-        NULL,
-        event_callback
-    };
 
-    if (!(measure_time_diff_only || samples_histogram_only)) {
-        if (output_file != NULL) {
-            int fd;
-            if (strcmp(output_file, "-") == 0) {
-                fd = STDOUT_FILENO;
-            } else {
-                fd = open(output_file, O_WRONLY | O_CREAT | O_TRUNC, 0644);
-                if (fd == -1) {
-                    fprintf(stderr, "open(%s) for writing failed: %s\n", output_file, strerror(errno));
-                    sdrplay_api_ReleaseDevice(&device);
-                    sdrplay_api_Close();
-                    exit(1);
-                }
-            }
-            rx_context_record.output_fd = fd;
+    return 0;
+}
+
+static int open_record_sink(ReceiverStream *stream, const ReceiverConfig *config, int streaming_time)
+{
+    const char *output_file = config->output_file != NULL ? stream->output_file : NULL;
+    size_t frame_size = sample_format_frame_size(config->sample_format_spec.format);
+    Output *output = NULL;
+    if (output_file != NULL) {
+        if ((config->mmap_output || config->direct_block_size_MiB > 0 || config->uring_queue_depth > 0) && strcmp(output_file, "-") == 0) {
+            fprintf(stderr, "memory mapped, O_DIRECT, or io_uring output is not possible on stdout\n");
+            return -1;
         }
-    } else if (measure_time_diff_only) {
-        ;
-    } else if (samples_histogram_only) {
-        unsigned long long *i_histogram = (unsigned long long *) malloc(SIXTEEN_BITS_SIZE * sizeof(unsigned long long));
-        unsigned long long *q_histogram = (unsigned long long *) malloc(SIXTEEN_BITS_SIZE * sizeof(unsigned long long));
-        for (int i = 0; i < SIXTEEN_BITS_SIZE; i++) {
-            i_histogram[i] = 0;
+        /* upper bound estimate of the output file (or segment) size for
+         * preallocation; the unused space is given back when the file is
+         * closed */
+        double output_sample_rate = stream_sample_rate(config->rsp_sample_rate, config->decimation, config->if_frequency);
+        if (output_sample_rate <= 0) {
+            output_sample_rate = config->rsp_sample_rate / config->decimation;
         }
-        for (int i = 0; i < SIXTEEN_BITS_SIZE; i++) {
-            q_histogram[i] = 0;
+        double output_seconds = streaming_time;
+        if (config->segment_seconds > 0) {
+            output_seconds = config->segment_seconds;
+        }
+        unsigned long long expected_size = (unsigned long long)(output_sample_rate * output_seconds) * frame_size;
+        if (config->segment_bytes > 0 && (expected_size == 0 || config->segment_bytes < expected_size)) {
+            expected_size = config->segment_bytes;
+        }
+        OutputOptions *output_options = &stream->output_options;
+        output_options->mmap_output = config->mmap_output;
+        output_options->direct_block_size = (size_t)config->direct_block_size_MiB * 1024 * 1024;
+        output_options->uring_queue_depth = config->uring_queue_depth;
+        output_options->compress_workers = config->compress_workers;
+        output_options->compress_chunk_size = (size_t)config->compress_chunk_KiB * 1024;
+        /* from the stream callback never wait for a free block; from the writer thread it's OK to */
+        output_options->may_block = config->ring_buffer_size_MiB > 0;
+        output_options->expected_size = expected_size;
+        if (config->segment_bytes > 0 || config->segment_seconds > 0) {
+            output = output_segmented_open(output_file, open_output, output_options, config->segment_bytes, config->segment_seconds, frame_size, &stream->segment_count);
+        } else {
+            output = open_output(output_file, output_options);
+        }
+        if (output == NULL) {
+            return -1;
         }
-        rx_context_samples_histogram.i_histogram = i_histogram;
-        rx_context_samples_histogram.q_histogram = q_histogram;
     }
+    stream->record_sink = sink_record_open(output, &config->sample_format_spec, (size_t)config->ring_buffer_size_MiB * 1024 * 1024, config->writer_cpu);
+    if (stream->record_sink == NULL) {
+        if (output != NULL) {
+            output->close(output);
+        }
+        return -1;
+    }
+    pipeline_add(&stream->pipeline, stream->record_sink);
+    return 0;
+}
 
-    err = sdrplay_api_Init(device.dev, &callbackFns, callback_ctx);
+static int start_receiver_stream(Receiver *receiver)
+{
+    sdrplay_api_CallbackFnsT callbackFns = {
+        rx_callback,
+        receiver->config.dual_tuner ? rx_callback_b : NULL,
+        event_callback
+    };
+
+    /* the threads the SDRplay API starts for the callbacks inherit the
+     * affinity of main: pin them to the receiver callback CPU (if any) */
+    cpu_set_t saved_cpus;
+    if (pin_to_cpu(receiver->config.callback_cpu, &saved_cpus) == -1) {
+        return -1;
+    }
+    sdrplay_api_ErrT err = sdrplay_api_Init(receiver->device.dev, &callbackFns, receiver);
+    unpin(&saved_cpus);
     if (err != sdrplay_api_Success) {
         fprintf(stderr, "sdrplay_api_Init() failed: %s\n", sdrplay_api_GetErrorString(err));
-        sdrplay_api_ReleaseDevice(&device);
-        sdrplay_api_Close();
-        exit(1);
+        return -1;
     }
+    receiver->streaming = 1;
+    return 0;
+}
 
-    fprintf(stderr, "streaming for %d seconds\n", streaming_time);
-    sleep(streaming_time);
-
-    err = sdrplay_api_Uninit(device.dev);
+static int stop_receiver_stream(Receiver *receiver)
+{
+    if (receiver->config.sweep_enable) {
+        sweep_stop_retunes(&receiver->sweep);
+    }
+    receiver->streaming = 0;
+    sdrplay_api_ErrT err = sdrplay_api_Uninit(receiver->device.dev);
     if (err != sdrplay_api_Success) {
         fprintf(stderr, "sdrplay_api_Uninit() failed: %s\n", sdrplay_api_GetErrorString(err));
-        sdrplay_api_ReleaseDevice(&device);
-        sdrplay_api_Close();
-        exit(1);
+        return -1;
     }
+    return 0;
+}
 
-    /* wait one second after sdrplay_api_Uninit() before closing the files */
-    sleep(1);
-
-    if (!(measure_time_diff_only || samples_histogram_only)) {
-        if (rx_context_record.output_fd > 0) {
-            if (close(rx_context_record.output_fd) == -1) {
-                fprintf(stderr, "close(%d) failed: %s\n", rx_context_record.output_fd, strerror(errno));
+/* stop the stream of the RSPs that were removed (their files are finished
+ * with the others at the end); returns how many are still streaming */
+static int stop_removed_receivers(Receiver *receivers, int nreceivers)
+{
+    int streaming = 0;
+    for (int i = 0; i < nreceivers; i++) {
+        Receiver *receiver = &receivers[i];
+        if (receiver->streaming && atomic_load(&receiver->removed)) {
+            if (nreceivers > 1) {
+                fprintf(stderr, "SerNo=%s removed - stopping its stream\n", receiver->device.SerNo);
             }
+            /* the exit status is 1 anyway */
+            stop_receiver_stream(receiver);
+        }
+        streaming += receiver->streaming;
+    }
+    return streaming;
+}
+
+static void finish_receiver(Receiver *receiver, int nreceivers)
+{
+    for (int s = 0; s < receiver->nstreams; s++) {
+        ReceiverStream *stream = &receiver->streams[s];
+        if (stream->tuner != '\0') {
+            fprintf(stderr, "SerNo=%s tuner=%c\n", receiver->device.SerNo, stream->tuner);
+        } else if (nreceivers > 1) {
+            fprintf(stderr, "SerNo=%s\n", receiver->device.SerNo);
         }
+        finish_stream(&receiver->config, stream);
     }
+}
+
+/* stop the sinks, print the summary, then rename the output files and
+ * write their SigMF sidecars */
+static void finish_stream(const ReceiverConfig *config, ReceiverStream *stream)
+{
+    Pipeline *pipeline = &stream->pipeline;
+    const char *output_file = config->output_file != NULL ? stream->output_file : NULL;
+    pipeline_stop(pipeline);
 
     /* estimate actual sample rate */
-    if (!(measure_time_diff_only || samples_histogram_only)) {
-        double elapsed_sec = (rx_context_record.latest_callback.tv_sec - rx_context_record.earliest_callback.tv_sec) + 1e-6 * (rx_context_record.latest_callback.tv_usec - rx_context_record.earliest_callback.tv_usec);
-        double actual_sample_rate = (double)(rx_context_record.total_samples) / elapsed_sec;
-        int rounded_sample_rate_kHz = (int)(actual_sample_rate / 1000.0 + 0.5);
-        fprintf(stderr, "total_samples=%llu actual_sample_rate=%.0lf rounded_sample_rate_kHz=%d\n", rx_context_record.total_samples, actual_sample_rate, rounded_sample_rate_kHz);
-        fprintf(stderr, "I_range=[%hd,%hd] Q_range=[%hd,%hd]\n", rx_context_record.imin, rx_context_record.imax, rx_context_record.qmin, rx_context_record.qmax);
-        const char *samplerate_string = "SAMPLERATE";
-        if (output_file != NULL && strstr(output_file, samplerate_string)) {
-            char *p = strstr(output_file, samplerate_string);
-            int from = p - output_file;
-            int to = from + strlen(samplerate_string);
-            char new_filename[MAX_PATH_SIZE];
-            snprintf(new_filename, MAX_PATH_SIZE, "%.*s%d%s", from, output_file, rounded_sample_rate_kHz, output_file + to);
-            if (rename(output_file, new_filename) == -1) {
-                fprintf(stderr, "rename(%s, %s) failed: %s\n", output_file, new_filename, strerror(errno));
+    double actual_sample_rate = pipeline_actual_sample_rate(pipeline);
+    int rounded_sample_rate_kHz = (int)(actual_sample_rate / 1000.0 + 0.5);
+    fprintf(stderr, "total_samples=%llu dropped_samples=%llu actual_sample_rate=%.3lf rounded_sample_rate_kHz=%d\n", pipeline->total_samples, pipeline->dropped_samples, actual_sample_rate, rounded_sample_rate_kHz);
+    double nominal_sample_rate = stream_sample_rate(config->rsp_sample_rate, config->decimation, config->if_frequency);
+    if (nominal_sample_rate > 0 && actual_sample_rate > 0) {
+        fprintf(stderr, "nominal_sample_rate=%.0lf clock_drift=%.2lfppm (fit of %llu blocks)\n", nominal_sample_rate, sample_clock_drift_ppm(&pipeline->clock, nominal_sample_rate), pipeline->clock.npoints);
+    }
+
+    unsigned int nevents = atomic_load(&stream->nevents);
+    if (nevents > 0) {
+        fprintf(stderr, "events=%u\n", nevents);
+    }
+
+    /* final file names, and a SigMF sidecar for each of them */
+    SigMFCapture *sigmf_capture = &stream->sigmf_capture;
+    SinkRecordInfo record_info;
+    if (output_file != NULL) {
+        sigmf_capture->dropped_samples = pipeline->dropped_samples;
+        sigmf_capture->retunes = stream->retunes;
+        sigmf_capture->nretunes = stream->nretunes;
+        sigmf_capture->lost_retunes = stream->lost_retunes;
+        sigmf_capture->events = stream->events;
+        sigmf_capture->nevents = nevents < MAX_EVENTS ? nevents : MAX_EVENTS;
+        sigmf_capture->lost_events = nevents > MAX_EVENTS ? nevents - MAX_EVENTS : 0;
+        sigmf_capture->compression = config->compress_workers > 0 ? SIGMF_COMPRESSION_CHUNKED : NULL;
+        sink_record_info(stream->record_sink, &record_info);
+    }
+    if (output_file != NULL && stream->segment_count > 0) {
+        uint64_t start_frame = 0;
+        for (unsigned int i = 0; i < stream->segment_count; i++) {
+            char segment_filename[MAX_SEGMENT_FILENAME_SIZE];
+            char final_filename[MAX_PATH_SIZE];
+            output_segment_filename(output_file, i, segment_filename, sizeof(segment_filename));
+            struct stat st;
+            if (stat(segment_filename, &st) == -1) {
+                fprintf(stderr, "stat(%s) failed: %s\n", segment_filename, strerror(errno));
+                continue;
             }
+            uint64_t frames = st.st_size / record_info.frame_size;
+            if (config->compress_workers > 0 && chunk_file_frames(segment_filename, &frames) == -1) {
+                frames = 0;
+            }
+            replace_samplerate(segment_filename, rounded_sample_rate_kHz, final_filename, sizeof(final_filename));
+            sigmf_write(final_filename, sigmf_capture, &record_info, start_frame, frames, &pipeline->clock);
+            start_frame += frames;
         }
+    } else if (output_file != NULL && strcmp(output_file, "-") != 0) {
+        char final_filename[MAX_PATH_SIZE];
+        replace_samplerate(output_file, rounded_sample_rate_kHz, final_filename, sizeof(final_filename));
+        sigmf_write(final_filename, sigmf_capture, &record_info, 0, record_info.frames, &pipeline->clock);
     }
 
-    /* output sample values histograms */
-    if (samples_histogram_only) {
-        fprintf(stderr, "total_samples=%llu\n", rx_context_samples_histogram.total_samples);
-        fprintf(stderr, "# Sample values histogram:\n");
-        fprintf(stderr, "#\n");
-        unsigned long long i_total = 0;
-        unsigned long long q_total = 0;
-        for (int i = 0; i < SIXTEEN_BITS_SIZE; i++) {
-            unsigned long long i_bin_count = rx_context_samples_histogram.i_histogram[i];
-            unsigned long long q_bin_count = rx_context_samples_histogram.q_histogram[i];
-            i_total += i_bin_count;
-            q_total += q_bin_count;
-            if (i_bin_count || q_bin_count) {
-                fprintf(stderr, "%d\t%llu\t%llu\n", i - SIXTEEN_BITS_SIZE / 2,
-                       i_bin_count, q_bin_count);
+    pipeline_free(pipeline);
+    stream->pipeline_ok = 0;
+}
+
+/* give back all the devices and exit */
+static void fail(Receiver *receivers, int nreceivers)
+{
+    for (int i = 0; i < nreceivers; i++) {
+        Receiver *receiver = &receivers[i];
+        if (receiver->streaming) {
+            sdrplay_api_Uninit(receiver->device.dev);
+        }
+        for (int s = 0; s < receiver->nstreams; s++) {
+            if (receiver->streams[s].pipeline_ok) {
+                pipeline_free(&receiver->streams[s].pipeline);
             }
         }
-        fprintf(stderr, "total_i_samples_in_histogram=%llu total_q_samples_in_histogram=%llu\n", i_total, q_total);
-        free(rx_context_samples_histogram.i_histogram);
-        free(rx_context_samples_histogram.q_histogram);
+        if (receiver->selected) {
+            sdrplay_api_ReleaseDevice(&receiver->device);
+        }
     }
+    sdrplay_api_Close();
+    exit(1);
+}
 
-    err = sdrplay_api_ReleaseDevice(&device);
-    if (err != sdrplay_api_Success) {
-        fprintf(stderr, "sdrplay_api_ReleaseDevice() failed: %s\n", sdrplay_api_GetErrorString(err));
-        sdrplay_api_Close();
-        exit(1);
+/* pin the calling thread to a CPU, saving its current affinity (no-op if cpu < 0) */
+static int pin_to_cpu(int cpu, cpu_set_t *saved)
+{
+    CPU_ZERO(saved);
+    if (cpu < 0) {
+        return 0;
     }
+    int ret = pthread_getaffinity_np(pthread_self(), sizeof(cpu_set_t), saved);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_getaffinity_np() failed: %s\n", strerror(ret));
+        return -1;
+    }
+    cpu_set_t cpus;
+    CPU_ZERO(&cpus);
+    CPU_SET(cpu, &cpus);
+    ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpus);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_setaffinity_np(%d) failed: %s\n", cpu, strerror(ret));
+        CPU_ZERO(saved);
+        return -1;
+    }
+    return 0;
+}
 
-    /* all done: close SDRplay API */
-    err = sdrplay_api_Close();
-    if (err != sdrplay_api_Success) {
-        fprintf(stderr, "sdrplay_api_Close() failed: %s\n", sdrplay_api_GetErrorString(err));
-        exit(1);
+static void unpin(const cpu_set_t *saved)
+{
+    if (CPU_COUNT(saved) > 0) {
+        pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), saved);
     }
+}
 
-    return 0;
+/* open an output file with the backend selected on the command line */
+static Output *open_output(const char *filename, void *open_arg)
+{
+    OutputOptions *output_options = (OutputOptions *)open_arg;
+    if (output_options->compress_workers > 0) {
+        /* the container goes through the other backends like a plain stream */
+        OutputOptions inner_options = *output_options;
+        inner_options.compress_workers = 0;
+        Output *inner = open_output(filename, &inner_options);
+        if (inner == NULL) {
+            return NULL;
+        }
+        return output_compressed_open(inner, output_options->compress_chunk_size, output_options->compress_workers);
+    }
+    if (output_options->mmap_output) {
+        return output_mmap_open(filename, output_options->expected_size, OUTPUT_MMAP_WINDOW_SIZE);
+    } else if (output_options->direct_block_size > 0) {
+        return output_direct_open(filename, output_options->direct_block_size);
+    } else if (output_options->uring_queue_depth > 0) {
+        return output_uring_open(filename, OUTPUT_URING_BLOCK_SIZE, output_options->uring_queue_depth, output_options->may_block);
+    }
+    int fd;
+    if (strcmp(filename, "-") == 0) {
+        fd = STDOUT_FILENO;
+    } else {
+        fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            fprintf(stderr, "open(%s) for writing failed: %s\n", filename, strerror(errno));
+            return NULL;
+        }
+    }
+    return output_fd_open(fd);
 }
 
-static void usage(const char* progname)
+static const char *rsp_model(unsigned char hwVer)
 {
-    fprintf(stderr, "usage: %s [options...]\n", progname);
-    fprintf(stderr, "options:\n");
-    fprintf(stderr, "    -s <serial number>\n");
-    fprintf(stderr, "    -r <RSPduo sample rate>\n");
-    fprintf(stderr, "    -d <decimation>\n");
-    fprintf(stderr, "    -i <IF frequency>\n");
-    fprintf(stderr, "    -b <IF bandwidth>\n");
-    fprintf(stderr, "    -g <IF gain reduction> (\"AGC\" to enable AGC)\n");
-    fprintf(stderr, "    -l <LNA state>\n");
-    fprintf(stderr, "    -D disable post tuner DC offset compensation (default: enabled)\n");
-    fprintf(stderr, "    -I disable post tuner I/Q balance compensation (default: enabled)\n");
-    fprintf(stderr, "    -y tuner DC offset compensation parameters <dcCal,speedUp,trackTime,refeshRateTime> (default: 3,0,1,2048)\n");
-    fprintf(stderr, "    -f <center frequency>\n");
-    fprintf(stderr, "    -a <antenna>\n");
-    fprintf(stderr, "    -K enable HDR mode for RSPdx/RSPdx-R2\n");
-    fprintf(stderr, "    -k <HDR mode bandwidth> (for RSPdx/RSPdx-R2 only)\n");
-    fprintf(stderr, "    -x <streaming time (s)> (default: 10s)\n");
-    fprintf(stderr, "    -o <output file> ('-' for stdout; 'SAMPLERATE' in the file name will be replaced by the estimated sample rate in kHz)\n");
-    fprintf(stderr, "    -L enable SDRplay API debug log level (default: disabled)\n");
-    fprintf(stderr, "    -T measure callback time difference only (no output) (default: disabled)\n");
-    fprintf(stderr, "    -H get histogram of sample values (no output) (default: disabled)\n");
-    fprintf(stderr, "    -h show usage\n");
+    switch (hwVer) {
+        case SDRPLAY_RSP1_ID: return "RSP1";
+        case SDRPLAY_RSP1A_ID: return "RSP1A";
+#ifdef SDRPLAY_RSP1B_ID
+        case SDRPLAY_RSP1B_ID: return "RSP1B";
+#endif
+        case SDRPLAY_RSP2_ID: return "RSP2";
+        case SDRPLAY_RSPduo_ID: return "RSPduo";
+        case SDRPLAY_RSPdx_ID: return "RSPdx";
+        case SDRPLAY_RSPdxR2_ID: return "RSPdx-R2";
+    }
+    return "RSP";
 }
 
-static void rx_callback_record(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext)
+/* replace 'SERIAL' in a file name with the serial number of the RSP, and
+ * 'TUNER' with the RSPduo tuner (if any) */
+static void replace_names(const char *filename, const char *serial_number, char tuner, char *new_filename, size_t size)
 {
-    UNUSED(reset);
+    if (filename == NULL) {
+        new_filename[0] = '\0';
+        return;
+    }
+    char tuner_name[2] = { tuner, '\0' };
+    char serial_filename[MAX_PATH_SIZE];
+    replace_string(filename, "SERIAL", serial_number, serial_filename, sizeof(serial_filename));
+    if (tuner != '\0') {
+        replace_string(serial_filename, "TUNER", tuner_name, new_filename, size);
+    } else {
+        snprintf(new_filename, size, "%s", serial_filename);
+    }
+}
 
-    RXContextRecord *rxContext = (RXContextRecord *)cbContext;
+static void replace_string(const char *s, const char *from_string, const char *to_string, char *new_s, size_t size)
+{
+    const char *p = strstr(s, from_string);
+    if (p == NULL) {
+        snprintf(new_s, size, "%s", s);
+        return;
+    }
+    int from = p - s;
+    int to = from + strlen(from_string);
+    snprintf(new_s, size, "%.*s%s%s", from, s, to_string, s + to);
+}
 
-    /* track callback timestamp */
-    gettimeofday(&rxContext->latest_callback, NULL);
-    if (rxContext->earliest_callback.tv_sec == 0) {
-        rxContext->earliest_callback.tv_sec = rxContext->latest_callback.tv_sec;
-        rxContext->earliest_callback.tv_usec = rxContext->latest_callback.tv_usec;
+/* sample rate after the SDRplay API decimation (and the low IF to zero IF
+ * conversion, which always ends at 2MHz); 0 if it can't be known in advance */
+static double stream_sample_rate(double rsp_sample_rate, int decimation, sdrplay_api_If_kHzT if_frequency)
+{
+    if (if_frequency == sdrplay_api_IF_Zero) {
+        return rsp_sample_rate / decimation;
+    } else if ((if_frequency == sdrplay_api_IF_1_620 && rsp_sample_rate == 6000000) ||
+               (if_frequency == sdrplay_api_IF_2_048 && rsp_sample_rate == 8000000)) {
+        return 2000000.0 / decimation;
     }
-    rxContext->total_samples += numSamples;
+    return 0.0;
+}
 
-    /* check for dropped samples */
-    if (rxContext->next_sample_num != 0xffffffff && params->firstSampleNum != rxContext->next_sample_num) {
-        unsigned int dropped_samples;
-        if (rxContext->next_sample_num < params->firstSampleNum) {
-            dropped_samples = params->firstSampleNum - rxContext->next_sample_num;
-        } else {
-            dropped_samples = UINT_MAX - (params->firstSampleNum - rxContext->next_sample_num) + 1;
+/* replace 'SAMPLERATE' in the file name with the estimated sample rate in
+ * kHz; new_filename is the name of the file after the rename */
+static void replace_samplerate(const char *filename, int rounded_sample_rate_kHz, char *new_filename, size_t size)
+{
+    const char *samplerate_string = "SAMPLERATE";
+    const char *p = strstr(filename, samplerate_string);
+    if (p == NULL) {
+        snprintf(new_filename, size, "%s", filename);
+        return;
+    }
+    int from = p - filename;
+    int to = from + strlen(samplerate_string);
+    snprintf(new_filename, size, "%.*s%d%s", from, filename, rounded_sample_rate_kHz, filename + to);
+    if (rename(filename, new_filename) == -1) {
+        fprintf(stderr, "rename(%s, %s) failed: %s\n", filename, new_filename, strerror(errno));
+        snprintf(new_filename, size, "%s", filename);
+    }
+}
+
+/* wait for SIGINT/SIGTERM, for every RSP to be removed (SIGUSR1; the ones
+ * removed before are stopped on the way), or for the end of the streaming
+ * time (0 -> forever), printing the pipeline stats every stats_interval
+ * seconds (0 -> never); returns the signal number or 0 on timeout */
+static int wait_for_stop_signal(const sigset_t *stop_signals, int streaming_time, Receiver *receivers, int nreceivers, int stats_interval)
+{
+    if (streaming_time == 0 && stats_interval == 0) {
+        int sig;
+        while (sigwait(stop_signals, &sig) != 0 || (sig == SIGUSR1 && stop_removed_receivers(receivers, nreceivers) > 0)) {
+            ;
+        }
+        return sig;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    long long deadline_ns = streaming_time > 0 ? streaming_time * 1000000000LL : LLONG_MAX;
+    long long next_stats_ns = stats_interval > 0 ? stats_interval * 1000000000LL : LLONG_MAX;
+    while (1) {
+        struct timespec now;
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        long long elapsed_ns = (now.tv_sec - start.tv_sec) * 1000000000LL + (now.tv_nsec - start.tv_nsec);
+        if (elapsed_ns >= deadline_ns) {
+            return 0;
+        }
+        if (elapsed_ns >= next_stats_ns) {
+            for (int i = 0; i < nreceivers; i++) {
+                for (int s = 0; s < receivers[i].nstreams; s++) {
+                    ReceiverStream *stream = &receivers[i].streams[s];
+                    if (stream->name[0] != '\0') {
+                        fprintf(stderr, "%s ", stream->name);
+                    }
+                    pipeline_print_stats(&stream->pipeline, stderr);
+                }
+            }
+            next_stats_ns += stats_interval * 1000000000LL;
+            continue;
         }
-        fprintf(stderr, "dropped %d samples\n", dropped_samples);
+        long long remaining_ns = (deadline_ns < next_stats_ns ? deadline_ns : next_stats_ns) - elapsed_ns;
+        struct timespec timeout = { remaining_ns / 1000000000LL, remaining_ns % 1000000000LL };
+        int sig = sigtimedwait(stop_signals, NULL, &timeout);
+        if (sig > 0 && (sig != SIGUSR1 || stop_removed_receivers(receivers, nreceivers) == 0)) {
+            return sig;
+        }
+        /* EAGAIN (timeout) or EINTR - check the time again */
     }
-    rxContext->next_sample_num = params->firstSampleNum + numSamples;
+}
 
-    short imin = SHRT_MAX;
-    short imax = SHRT_MIN;
-    short qmin = SHRT_MAX;
-    short qmax = SHRT_MIN;
-    for (unsigned int i = 0; i < numSamples; i++) {
-        imin = imin < xi[i] ? imin : xi[i];
-        imax = imax > xi[i] ? imax : xi[i];
+/* control socket commands: "[<serial number>] <setting> [<value>]", or
+ * "status"; without a serial number the change goes to all the RSPs */
+static void control_command(void *arg, char *command, char *reply, size_t reply_size)
+{
+    ControlContext *context = (ControlContext *)arg;
+    char *tokens[4];
+    int ntokens = 0;
+    char *saveptr;
+    for (char *token = strtok_r(command, " \t", &saveptr); token != NULL && ntokens < 4; token = strtok_r(NULL, " \t", &saveptr)) {
+        tokens[ntokens++] = token;
     }
-    for (unsigned int i = 0; i < numSamples; i++) {
-        qmin = qmin < xq[i] ? qmin : xq[i];
-        qmax = qmax > xq[i] ? qmax : xq[i];
+    if (ntokens == 0) {
+        snprintf(reply, reply_size, "error: empty command");
+        return;
     }
-    rxContext->imin = rxContext->imin < imin ? rxContext->imin : imin;
-    rxContext->imax = rxContext->imax > imax ? rxContext->imax : imax;
-    rxContext->qmin = rxContext->qmin < qmin ? rxContext->qmin : qmin;
-    rxContext->qmax = rxContext->qmax > qmax ? rxContext->qmax : qmax;
 
-    /* write samples to output file */
-    if (rxContext->output_fd > 0) {
-        short samples[4096];
-        for (unsigned int i = 0; i < numSamples; i++) {
-            samples[2*i] = xi[i];
+    if (strcmp(tokens[0], "status") == 0 && ntokens == 1) {
+        size_t length = 0;
+        for (int i = 0; i < context->nreceivers && length < reply_size; i++) {
+            const Receiver *receiver = &context->receivers[i];
+            for (int s = 0; s < receiver->nstreams && length < reply_size; s++) {
+                const sdrplay_api_RxChannelParamsT *rx_channel_params = s == 0 ? receiver->device_params->rxChannelA : receiver->device_params->rxChannelB;
+                const ReceiverStream *stream = &receiver->streams[s];
+                char tuner[16] = "";
+                if (stream->tuner != '\0') {
+                    snprintf(tuner, sizeof(tuner), " tuner=%c", stream->tuner);
+                }
+                length += snprintf(reply + length, reply_size - length, "%sSerNo=%s%s freq=%.0lf agc=%d gain=%d lna=%d bw=%d",
+                                   length > 0 ? "; " : "", receiver->device.SerNo, tuner,
+                                   rx_channel_params->tunerParams.rfFreq.rfHz, rx_channel_params->ctrlParams.agc.enable,
+                                   rx_channel_params->tunerParams.gain.gRdB, rx_channel_params->tunerParams.gain.LNAstate,
+                                   rx_channel_params->tunerParams.bwType);
+            }
         }
-        for (unsigned int i = 0; i < numSamples; i++) {
-            samples[2*i+1] = xq[i];
+        return;
+    }
+
+    /* leading serial number: that RSP only */
+    const char *serial_number = NULL;
+    int first = 0;
+    for (int i = 0; i < context->nreceivers; i++) {
+        if (strcmp(tokens[0], context->receivers[i].device.SerNo) == 0) {
+            serial_number = tokens[0];
+            first = 1;
+            break;
+        }
+    }
+    if (ntokens - first < 1 || ntokens - first > 2) {
+        snprintf(reply, reply_size, "error: usage: [<serial number>] freq <Hz> | gain <gRdB> | agc | lna <LNA state> | bw <kHz>, or status");
+        return;
+    }
+    const char *name = tokens[first];
+    const char *value = ntokens - first == 2 ? tokens[first + 1] : NULL;
+    for (int i = 0; i < context->nreceivers; i++) {
+        Receiver *receiver = &context->receivers[i];
+        if (serial_number != NULL && strcmp(receiver->device.SerNo, serial_number) != 0) {
+            continue;
         }
-        size_t count = numSamples * 2 * sizeof(short);
-        ssize_t nwritten = write(rxContext->output_fd, samples, count);
-        if (nwritten == -1) {
-            fprintf(stderr, "write() failed: %s\n", strerror(errno));
-        } else if ((size_t)nwritten != count) {
-            fprintf(stderr, "incomplete write() - expected: %ld bytes - actual: %ld bytes\n", count, nwritten);
+        if (update_receiver(receiver, name, value, reply, reply_size) == -1) {
+            return;
         }
     }
+    snprintf(reply, reply_size, "ok");
 }
 
-static void rx_callback_measure_time_diff(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext)
+/* change one setting of an RSP (both tuners in dual tuner mode) with
+ * sdrplay_api_Update() */
+static int update_receiver(Receiver *receiver, const char *name, const char *value, char *reply, size_t reply_size)
 {
-    UNUSED(xi);
-    UNUSED(xq);
-    UNUSED(params);
-    UNUSED(reset);
-
-    RXContextMeasureTimeDiff *rxContext = (RXContextMeasureTimeDiff *)cbContext;
+    double frequency = 0;
+    int number = 0;
+    int has_value = value != NULL && (strcmp(name, "freq") == 0 ? sscanf(value, "%lg", &frequency) : sscanf(value, "%d", &number)) == 1;
+    int is_agc = strcmp(name, "agc") == 0;
+    if (is_agc ? value != NULL : !has_value) {
+        snprintf(reply, reply_size, "error: invalid command: %s%s%s", name, value != NULL ? " " : "", value != NULL ? value : "");
+        return -1;
+    }
+    sdrplay_api_ReasonForUpdateT reason;
+    if (strcmp(name, "freq") == 0 && frequency > 0) {
+        reason = sdrplay_api_Update_Tuner_Frf;
+    } else if (strcmp(name, "gain") == 0 && number >= 20 && number <= 59) {
+        reason = sdrplay_api_Update_Tuner_Gr;
+    } else if (strcmp(name, "lna") == 0 && number >= 0 && number <= 27) {
+        reason = sdrplay_api_Update_Tuner_Gr;
+    } else if (is_agc) {
+        reason = sdrplay_api_Update_Ctrl_Agc;
+    } else if (strcmp(name, "bw") == 0 && (number == sdrplay_api_BW_0_200 || number == sdrplay_api_BW_0_300 || number == sdrplay_api_BW_0_600 ||
+                                           number == sdrplay_api_BW_1_536 || number == sdrplay_api_BW_5_000 || number == sdrplay_api_BW_6_000 ||
+                                           number == sdrplay_api_BW_7_000 || number == sdrplay_api_BW_8_000)) {
+        reason = sdrplay_api_Update_Tuner_BwType;
+    } else {
+        snprintf(reply, reply_size, "error: invalid command: %s %s", name, value);
+        return -1;
+    }
 
-    struct timespec current_time;
-    clock_gettime(CLOCK_REALTIME, &current_time);
-    if (rxContext->prev_time.tv_sec > 0) {
-        long diff = (current_time.tv_sec - rxContext->prev_time.tv_sec) * 1000000000 + (current_time.tv_nsec - rxContext->prev_time.tv_nsec);
-        if (diff > rxContext->diff_threshold) {
-            fprintf(stderr, "%ld %u %ld\n", rxContext->callback_count, numSamples, diff);
+    for (int s = 0; s < receiver->nstreams; s++) {
+        sdrplay_api_RxChannelParamsT *rx_channel_params = s == 0 ? receiver->device_params->rxChannelA : receiver->device_params->rxChannelB;
+        sdrplay_api_TunerSelectT tuner = receiver->nstreams == 1 ? receiver->device.tuner : (s == 0 ? sdrplay_api_Tuner_A : sdrplay_api_Tuner_B);
+        sdrplay_api_ErrT err;
+        if (strcmp(name, "gain") == 0 && rx_channel_params->ctrlParams.agc.enable != sdrplay_api_AGC_DISABLE) {
+            /* a fixed gain means no AGC */
+            rx_channel_params->ctrlParams.agc.enable = sdrplay_api_AGC_DISABLE;
+            err = sdrplay_api_Update(receiver->device.dev, tuner, sdrplay_api_Update_Ctrl_Agc, sdrplay_api_Update_Ext1_None);
+            if (err != sdrplay_api_Success) {
+                snprintf(reply, reply_size, "error: sdrplay_api_Update(Ctrl_Agc) failed: %s", sdrplay_api_GetErrorString(err));
+                return -1;
+            }
+        }
+        if (reason == sdrplay_api_Update_Tuner_Frf) {
+            rx_channel_params->tunerParams.rfFreq.rfHz = frequency;
+        } else if (strcmp(name, "gain") == 0) {
+            rx_channel_params->tunerParams.gain.gRdB = number;
+        } else if (strcmp(name, "lna") == 0) {
+            rx_channel_params->tunerParams.gain.LNAstate = number;
+        } else if (is_agc) {
+            rx_channel_params->ctrlParams.agc.enable = sdrplay_api_AGC_50HZ;
+        } else {
+            rx_channel_params->tunerParams.bwType = number;
+        }
+        err = sdrplay_api_Update(receiver->device.dev, tuner, reason, sdrplay_api_Update_Ext1_None);
+        if (err != sdrplay_api_Success) {
+            snprintf(reply, reply_size, "error: sdrplay_api_Update() failed: %s", sdrplay_api_GetErrorString(err));
+            return -1;
+        }
+        /* the frequency and gain changes are flagged in the stream callback
+         * parameters, on the first block with the new settings */
+        if (reason == sdrplay_api_Update_Ctrl_Agc || reason == sdrplay_api_Update_Tuner_BwType) {
+            atomic_store(&receiver->streams[s].settings_changed, 1);
         }
     }
-    rxContext->prev_time.tv_sec = current_time.tv_sec;
-    rxContext->prev_time.tv_nsec = current_time.tv_nsec;
-    rxContext->callback_count++;
+    return 0;
+}
+
+static void rx_callback(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext)
+{
+    Receiver *receiver = (Receiver *)cbContext;
+    if (receiver->config.sweep_enable) {
+        sweep_block(&receiver->sweep, params->rfChanged, reset);
+    }
+    stream_callback(&receiver->streams[0], receiver->device_params->rxChannelA, xi, xq, params, numSamples);
 }
 
-static void rx_callback_samples_histogram(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext)
+/* RSPduo dual tuner mode: tuner B, always called after tuner A for the same block */
+static void rx_callback_b(short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples, unsigned int reset, void *cbContext)
 {
     UNUSED(reset);
 
-    RXContextSamplesHistogram *rxContext = (RXContextSamplesHistogram *)cbContext;
+    Receiver *receiver = (Receiver *)cbContext;
+    stream_callback(&receiver->streams[1], receiver->device_params->rxChannelB, xi, xq, params, numSamples);
+}
 
-    rxContext->total_samples += numSamples;
+/* push the block, and take note of the settings changed from this block on
+ * for the SigMF sidecar (the gain only without AGC, or every AGC step
+ * would be one) */
+static void stream_callback(ReceiverStream *stream, const sdrplay_api_RxChannelParamsT *rx_channel_params, short *xi, short *xq, sdrplay_api_StreamCbParamsT *params, unsigned int numSamples)
+{
+    Pipeline *pipeline = &stream->pipeline;
+    pipeline_push(pipeline, xi, xq, params->firstSampleNum, numSamples);
 
-    /* check for dropped samples */
-    if (rxContext->next_sample_num != 0xffffffff && params->firstSampleNum != rxContext->next_sample_num) {
-        unsigned int dropped_samples;
-        if (rxContext->next_sample_num < params->firstSampleNum) {
-            dropped_samples = params->firstSampleNum - rxContext->next_sample_num;
+    int agc_enable = rx_channel_params->ctrlParams.agc.enable != sdrplay_api_AGC_DISABLE;
+    if ((params->rfChanged && !stream->sweeping) || (params->grChanged && !agc_enable) ||
+        (atomic_load_explicit(&stream->settings_changed, memory_order_relaxed) && atomic_exchange(&stream->settings_changed, 0))) {
+        if (stream->nretunes == MAX_RETUNES) {
+            stream->lost_retunes++;
+            return;
+        }
+        SigMFRetune *retune = &stream->retunes[stream->nretunes++];
+        retune->sample_index = pipeline->sample_index >= numSamples ? pipeline->sample_index - numSamples : 0;
+        retune->frequency = rx_channel_params->tunerParams.rfFreq.rfHz;
+        retune->agc = rx_channel_params->ctrlParams.agc.enable;
+        retune->gain_reduction = rx_channel_params->tunerParams.gain.gRdB;
+        retune->lna_state = rx_channel_params->tunerParams.gain.LNAstate;
+        retune->if_bandwidth = rx_channel_params->tunerParams.bwType;
+        log_message(pipeline->log, "retuned at sample %llu: LO=%.0lf IFagc=%d IFgain=%d LNAgain=%d BW=%d", (unsigned long long)retune->sample_index,
+                    retune->frequency, retune->agc, retune->gain_reduction, retune->lna_state, retune->if_bandwidth);
+    }
+}
+
+/* the events are recorded (with the sample index the stream has got to)
+ * and logged; an overload is acknowledged right away, so the API keeps
+ * reporting them, and a removed RSP stops the recording */
+static void event_callback(sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tuner, sdrplay_api_EventParamsT *params, void *cbContext)
+{
+    Receiver *receiver = (Receiver *)cbContext;
+    sdrplay_api_ErrT err;
+    switch (eventId) {
+    case sdrplay_api_GainChange:
+        /* with AGC the gain changes all the time: recorded, not logged */
+        if (receiver->device_params->rxChannelA->ctrlParams.agc.enable != sdrplay_api_AGC_DISABLE) {
+            record_event(receiver, tuner, "gain_change", NULL);
+            break;
+        }
+        record_event(receiver, tuner, "gain_change", "gain change - tuner=%d gRdB=%u lnaGRdB=%u currGain=%.2lf", tuner, params->gainParams.gRdB, params->gainParams.lnaGRdB, params->gainParams.currGain);
+        break;
+    case sdrplay_api_PowerOverloadChange:
+        err = sdrplay_api_Update(receiver->device.dev, tuner, sdrplay_api_Update_Ctrl_OverloadMsgAck, sdrplay_api_Update_Ext1_None);
+        if (params->powerOverloadParams.powerOverloadChangeType == sdrplay_api_Overload_Detected) {
+            record_event(receiver, tuner, "overload_detected", "overload detected - tuner=%d", tuner);
         } else {
-            dropped_samples = UINT_MAX - (params->firstSampleNum - rxContext->next_sample_num) + 1;
+            record_event(receiver, tuner, "overload_corrected", "overload corrected - tuner=%d", tuner);
+        }
+        if (err != sdrplay_api_Success) {
+            record_event(receiver, tuner, NULL, "overload ack failed: %s", sdrplay_api_GetErrorString(err));
         }
-        fprintf(stderr, "dropped %d samples\n", dropped_samples);
+        break;
+    case sdrplay_api_DeviceRemoved:
+        record_event(receiver, tuner, "device_removed", "RSP removed");
+        /* main does the shutdown (this is an API thread) */
+        atomic_store(&receiver->removed, 1);
+        kill(getpid(), SIGUSR1);
+        break;
+    case sdrplay_api_RspDuoModeChange:
+        record_event(receiver, tuner, "rspduo_mode_change", "RSPduo mode change - type=%d", params->rspDuoModeParams.modeChangeType);
+        break;
+    default:
+        record_event(receiver, tuner, NULL, "event %d - tuner=%d", eventId, tuner);
+        break;
     }
-    rxContext->next_sample_num = params->firstSampleNum + numSamples;
+}
 
-    for (unsigned int i = 0; i < numSamples; i++) {
-        rxContext->i_histogram[xi[i] + SIXTEEN_BITS_SIZE / 2]++;
+/* record the event in the streams of the tuner (type NULL -> not
+ * recorded), and log it (format NULL -> not logged) */
+static void record_event(Receiver *receiver, sdrplay_api_TunerSelectT tuner, const char *type, const char *format, ...)
+{
+    char comment[LOGGER_MESSAGE_SIZE];
+    comment[0] = '\0';
+    if (format != NULL) {
+        va_list ap;
+        va_start(ap, format);
+        vsnprintf(comment, sizeof(comment), format, ap);
+        va_end(ap);
     }
-    for (unsigned int i = 0; i < numSamples; i++) {
-        rxContext->q_histogram[xq[i] + SIXTEEN_BITS_SIZE / 2]++;
+
+    for (int s = 0; type != NULL && s < receiver->nstreams; s++) {
+        ReceiverStream *stream = &receiver->streams[s];
+        if ((stream->tuner == 'A' && tuner == sdrplay_api_Tuner_B) ||
+            (stream->tuner == 'B' && tuner == sdrplay_api_Tuner_A)) {
+            continue;
+        }
+        unsigned int n = atomic_fetch_add(&stream->nevents, 1);
+        if (n >= MAX_EVENTS) {
+            continue;
+        }
+        SigMFEvent *event = &stream->events[n];
+        event->sample_index = pipeline_sample_index(&stream->pipeline);
+        event->type = type;
+        snprintf(event->comment, sizeof(event->comment), "%s", comment);
+    }
+
+    if (format != NULL) {
+        while (atomic_flag_test_and_set_explicit(&receiver->event_log_busy, memory_order_acquire)) {
+            ;
+        }
+        log_message(receiver->event_log, "%s", comment);
+        atomic_flag_clear_explicit(&receiver->event_log_busy, memory_order_release);
     }
 }
 
-static void event_callback(sdrplay_api_EventT eventId, sdrplay_api_TunerSelectT tuner, sdrplay_api_EventParamsT *params, void *cbContext)
+/* the next step of the sweep (from the sweep retune thread) */
+static int sweep_retune(void *arg, double frequency)
 {
-    UNUSED(eventId);
-    UNUSED(tuner);
-    UNUSED(params);
-    UNUSED(cbContext);
-    /* do nothing for now */
-    return;
+    Receiver *receiver = (Receiver *)arg;
+    receiver->device_params->rxChannelA->tunerParams.rfFreq.rfHz = frequency;
+    sdrplay_api_ErrT err = sdrplay_api_Update(receiver->device.dev, receiver->device.tuner, sdrplay_api_Update_Tuner_Frf, sdrplay_api_Update_Ext1_None);
+    if (err != sdrplay_api_Success) {
+        fprintf(stderr, "sdrplay_api_Update(Tuner_Frf) failed: %s\n", sdrplay_api_GetErrorString(err));
+        return -1;
+    }
+    return 0;
 }
@@ -0,0 +1,279 @@
+/* stream pipeline sinks
+ * histogram sink: histogram of the I and Q sample values
+ * - the ADC is at most 14 bits, so the hot path only has 16384 bins per
+ *   component, with 32 bit counters that are flushed to the 64 bit totals
+ *   before they can overflow; values outside of that range (possible after
+ *   the API DC/IQ corrections) go to a full range 64 bit table
+ * - consecutive samples are counted in different sub-histograms, so runs of
+ *   the same value don't serialize on a store-to-load dependency
+ * - it runs either on the stream callback thread, or on its own worker
+ *   thread fed by a ring buffer
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <pthread.h>
+#include <time.h>
+
+#include "pipeline.h"
+#include "ring_buffer.h"
+#include "sample_kernels.h"
+
+#define UNUSED(x) (void)(x)
+#define SIXTEEN_BITS_SIZE 65536
+#define HISTOGRAM_COMPACT_BITS 14
+#define HISTOGRAM_COMPACT_SIZE (1 << HISTOGRAM_COMPACT_BITS)
+#define HISTOGRAM_SUB_HISTOGRAMS 4
+#define HISTOGRAM_RING_SIZE (16 * 1024 * 1024)
+#define HISTOGRAM_CHUNK_SAMPLES 8192
+#define HISTOGRAM_POLL_INTERVAL_NS 1000000   /* 1ms */
+
+typedef struct {
+    uint32_t compact[HISTOGRAM_SUB_HISTOGRAMS][HISTOGRAM_COMPACT_SIZE];
+    unsigned long long full[SIXTEEN_BITS_SIZE];     /* 64 bit totals */
+} ComponentHistogram;
+
+typedef struct {
+    Sink sink;
+    ComponentHistogram *i_histogram;
+    ComponentHistogram *q_histogram;
+    /* samples counted since the last flush of the 32 bit counters */
+    unsigned long long pending_samples;
+    unsigned long long flushes;
+    /* worker mode */
+    RingBuffer ring;
+    pthread_t thread;
+    atomic_int stop;
+    int threaded;
+    int stopped;
+} SinkHistogram;
+
+static void sink_histogram_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index);
+static void sink_histogram_stop(Sink *sink);
+static void sink_histogram_free(Sink *sink);
+static void histogram_count(SinkHistogram *sink_histogram, const short *xi, const short *xq, size_t stride, unsigned int n);
+static void component_histogram_count(ComponentHistogram *histogram, const short *x, size_t stride, unsigned int n);
+static void histogram_flush(SinkHistogram *sink_histogram);
+static void component_histogram_flush(ComponentHistogram *histogram);
+static void *histogram_thread(void *arg);
+
+
+Sink *sink_histogram_open(int threaded)
+{
+    SinkHistogram *sink_histogram = (SinkHistogram *) calloc(1, sizeof(SinkHistogram));
+    if (sink_histogram == NULL) {
+        return NULL;
+    }
+    sink_histogram->sink.name = "histogram";
+    sink_histogram->sink.push = sink_histogram_push;
+    sink_histogram->sink.stop = sink_histogram_stop;
+    sink_histogram->sink.free = sink_histogram_free;
+    sink_histogram->sink.ring = &sink_histogram->ring;
+    atomic_init(&sink_histogram->stop, 0);
+    sink_histogram->i_histogram = (ComponentHistogram *) calloc(1, sizeof(ComponentHistogram));
+    sink_histogram->q_histogram = (ComponentHistogram *) calloc(1, sizeof(ComponentHistogram));
+    if (sink_histogram->i_histogram == NULL || sink_histogram->q_histogram == NULL) {
+        fprintf(stderr, "histogram allocation failed\n");
+        sink_histogram_free(&sink_histogram->sink);
+        return NULL;
+    }
+    if (threaded) {
+        if (ring_buffer_init(&sink_histogram->ring, HISTOGRAM_RING_SIZE) == -1) {
+            fprintf(stderr, "histogram ring buffer allocation failed\n");
+            sink_histogram_free(&sink_histogram->sink);
+            return NULL;
+        }
+        int ret = pthread_create(&sink_histogram->thread, NULL, histogram_thread, sink_histogram);
+        if (ret != 0) {
+            fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+            sink_histogram_free(&sink_histogram->sink);
+            return NULL;
+        }
+        sink_histogram->threaded = 1;
+    }
+    return &sink_histogram->sink;
+}
+
+static void sink_histogram_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index)
+{
+    UNUSED(sample_index);
+
+    SinkHistogram *sink_histogram = (SinkHistogram *)sink;
+
+    if (!sink_histogram->threaded) {
+        histogram_count(sink_histogram, xi, xq, 1, numSamples);
+        return;
+    }
+
+    /* worker mode: copy the samples into the ring buffer; never blocks */
+    size_t count = numSamples * 2 * sizeof(short);
+    void *data1;
+    void *data2;
+    size_t count1 = ring_buffer_reserve(&sink_histogram->ring, count, &data1, &data2);
+    if (count1 == 0) {
+        return;
+    }
+    SampleRange range;
+    sample_range_init(&range);
+    unsigned int n1 = count1 / (2 * sizeof(short));
+    interleave_minmax(xi, xq, (short *)data1, n1, &range);
+    interleave_minmax(xi + n1, xq + n1, (short *)data2, numSamples - n1, &range);
+    ring_buffer_commit(&sink_histogram->ring, count);
+}
+
+/* output sample values histograms */
+static void sink_histogram_stop(Sink *sink)
+{
+    SinkHistogram *sink_histogram = (SinkHistogram *)sink;
+    if (sink_histogram->threaded) {
+        atomic_store(&sink_histogram->stop, 1);
+        pthread_join(sink_histogram->thread, NULL);
+    }
+    sink_histogram->stopped = 1;
+    histogram_flush(sink_histogram);
+
+    fprintf(stderr, "# Sample values histogram:\n");
+    fprintf(stderr, "#\n");
+    unsigned long long i_total = 0;
+    unsigned long long q_total = 0;
+    for (int i = 0; i < SIXTEEN_BITS_SIZE; i++) {
+        unsigned long long i_bin_count = sink_histogram->i_histogram->full[i];
+        unsigned long long q_bin_count = sink_histogram->q_histogram->full[i];
+        i_total += i_bin_count;
+        q_total += q_bin_count;
+        if (i_bin_count || q_bin_count) {
+            fprintf(stderr, "%d\t%llu\t%llu\n", i - SIXTEEN_BITS_SIZE / 2,
+                   i_bin_count, q_bin_count);
+        }
+    }
+    fprintf(stderr, "total_i_samples_in_histogram=%llu total_q_samples_in_histogram=%llu\n", i_total, q_total);
+    if (sink_histogram->threaded) {
+        RingBuffer *ring = &sink_histogram->ring;
+        fprintf(stderr, "histogram: mode=worker flushes=%llu high_water_mark=%zu (%.1lf%%) overruns=%llu overrun_bytes=%llu\n", sink_histogram->flushes, ring->high_water_mark, 100.0 * ring->high_water_mark / ring->size, ring->overruns, ring->overrun_bytes);
+    } else {
+        fprintf(stderr, "histogram: mode=callback flushes=%llu\n", sink_histogram->flushes);
+    }
+}
+
+static void sink_histogram_free(Sink *sink)
+{
+    SinkHistogram *sink_histogram = (SinkHistogram *)sink;
+    if (sink_histogram->threaded && !sink_histogram->stopped) {
+        atomic_store(&sink_histogram->stop, 1);
+        pthread_join(sink_histogram->thread, NULL);
+    }
+    if (sink_histogram->ring.buffer != NULL) {
+        ring_buffer_free(&sink_histogram->ring);
+    }
+    free(sink_histogram->i_histogram);
+    free(sink_histogram->q_histogram);
+    free(sink_histogram);
+}
+
+static void histogram_count(SinkHistogram *sink_histogram, const short *xi, const short *xq, size_t stride, unsigned int n)
+{
+    /* a 32 bit counter can't overflow as long as fewer than 2^32 samples
+     * have been counted since the last flush */
+    if (sink_histogram->pending_samples + n > UINT32_MAX) {
+        histogram_flush(sink_histogram);
+    }
+    sink_histogram->pending_samples += n;
+    component_histogram_count(sink_histogram->i_histogram, xi, stride, n);
+    component_histogram_count(sink_histogram->q_histogram, xq, stride, n);
+}
+
+static void component_histogram_count(ComponentHistogram *histogram, const short *x, size_t stride, unsigned int n)
+{
+    uint32_t (*compact)[HISTOGRAM_COMPACT_SIZE] = histogram->compact;
+    unsigned long long *full = histogram->full;
+    const unsigned int offset = HISTOGRAM_COMPACT_SIZE / 2;
+    unsigned int i = 0;
+    for (; i + HISTOGRAM_SUB_HISTOGRAMS <= n; i += HISTOGRAM_SUB_HISTOGRAMS) {
+        unsigned int b0 = (unsigned int)(x[(i + 0) * stride] + offset);
+        unsigned int b1 = (unsigned int)(x[(i + 1) * stride] + offset);
+        unsigned int b2 = (unsigned int)(x[(i + 2) * stride] + offset);
+        unsigned int b3 = (unsigned int)(x[(i + 3) * stride] + offset);
+        if ((b0 | b1 | b2 | b3) < HISTOGRAM_COMPACT_SIZE) {
+            compact[0][b0]++;
+            compact[1][b1]++;
+            compact[2][b2]++;
+            compact[3][b3]++;
+            continue;
+        }
+        /* at least one sample outside of the 14 bit range - rare */
+        for (unsigned int k = 0; k < HISTOGRAM_SUB_HISTOGRAMS; k++) {
+            short v = x[(i + k) * stride];
+            unsigned int b = (unsigned int)(v + offset);
+            if (b < HISTOGRAM_COMPACT_SIZE) {
+                compact[k][b]++;
+            } else {
+                full[v + SIXTEEN_BITS_SIZE / 2]++;
+            }
+        }
+    }
+    for (; i < n; i++) {
+        short v = x[i * stride];
+        unsigned int b = (unsigned int)(v + offset);
+        if (b < HISTOGRAM_COMPACT_SIZE) {
+            compact[0][b]++;
+        } else {
+            full[v + SIXTEEN_BITS_SIZE / 2]++;
+        }
+    }
+}
+
+static void histogram_flush(SinkHistogram *sink_histogram)
+{
+    component_histogram_flush(sink_histogram->i_histogram);
+    component_histogram_flush(sink_histogram->q_histogram);
+    sink_histogram->pending_samples = 0;
+    sink_histogram->flushes++;
+}
+
+static void component_histogram_flush(ComponentHistogram *histogram)
+{
+    unsigned long long *full = histogram->full + SIXTEEN_BITS_SIZE / 2 - HISTOGRAM_COMPACT_SIZE / 2;
+    for (int k = 0; k < HISTOGRAM_SUB_HISTOGRAMS; k++) {
+        uint32_t *compact = histogram->compact[k];
+        for (int i = 0; i < HISTOGRAM_COMPACT_SIZE; i++) {
+            full[i] += compact[i];
+        }
+        memset(compact, 0, sizeof(histogram->compact[k]));
+    }
+}
+
+static void *histogram_thread(void *arg)
+{
+    SinkHistogram *sink_histogram = (SinkHistogram *)arg;
+    RingBuffer *ring = &sink_histogram->ring;
+    struct timespec poll_interval = { 0, HISTOGRAM_POLL_INTERVAL_NS };
+
+    while (1) {
+        int stop = atomic_load(&sink_histogram->stop);
+        size_t available = ring_buffer_read_available(ring);
+        if (available == 0 && stop) {
+            break;
+        }
+        if (available == 0) {
+            nanosleep(&poll_interval, NULL);
+            continue;
+        }
+        const void *data;
+        size_t contiguous = ring_buffer_peek(ring, &data);
+        size_t count = contiguous < HISTOGRAM_CHUNK_SAMPLES * 2 * sizeof(short) ? contiguous : HISTOGRAM_CHUNK_SAMPLES * 2 * sizeof(short);
+        unsigned int n = count / (2 * sizeof(short));
+        const short *iq = (const short *)data;
+        histogram_count(sink_histogram, iq, iq + 1, 2, n);
+        ring_buffer_consume(ring, n * 2 * sizeof(short));
+    }
+    return NULL;
+}
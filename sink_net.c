@@ -0,0 +1,349 @@
+/* stream pipeline sinks
+ * network sink: sends the I/Q stream (iq16) to a UDP or TCP destination as
+ * packets with a small header (NetPacketHeader), from a sender thread
+ * - each block is split into packets of at most max_packet_size bytes;
+ *   the stream callback writes them (header and samples) straight into a
+ *   ring buffer of fixed size slots, all the packets of a block at once, so
+ *   a block is either sent whole or lost whole (with its sequence numbers
+ *   skipped, so the receivers can tell)
+ * - the sender thread hands the slots to the kernel without copying them:
+ *   with UDP up to NET_BATCH_PACKETS datagrams per sendmmsg(), with TCP up
+ *   to NET_BATCH_PACKETS packets per sendmsg() on a socket with large
+ *   buffers
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+
+#include "pipeline.h"
+#include "ring_buffer.h"
+#include "sample_kernels.h"
+
+#define NET_RING_SIZE (32 * 1024 * 1024)   /* about 4s of iq16 at 2MS/s, whatever the packet size */
+#define NET_BATCH_PACKETS 64
+#define NET_UDP_PACKET_SIZE 1472        /* 1500 bytes MTU - IP and UDP headers */
+#define NET_UDP_MAX_PACKET_SIZE 65507
+#define NET_TCP_PACKET_SIZE 65536
+#define NET_TCP_SOCKET_BUFFER_SIZE (8 * 1024 * 1024)
+#define NET_MAX_HOST_SIZE 256
+#define NET_POLL_INTERVAL_NS 1000000    /* 1ms */
+
+typedef struct {
+    Sink sink;
+    int fd;
+    int tcp;
+    size_t slot_size;
+    unsigned int max_samples;       /* per packet */
+    RingBuffer ring;
+    uint32_t sequence;              /* stream callback only */
+    /* sender thread */
+    unsigned long long packets;
+    unsigned long long bytes;
+    unsigned long long send_calls;
+    unsigned long long send_errors;
+    int failed;                     /* TCP: connection lost */
+    pthread_t thread;
+    atomic_int stop;
+    int started;
+} SinkNet;
+
+static int net_connect(const char *destination, int tcp);
+static void *net_thread(void *arg);
+static size_t send_batch(SinkNet *sink_net, const unsigned char *slots, unsigned int npackets);
+static void sink_net_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index);
+static void sink_net_stop(Sink *sink);
+static void sink_net_free(Sink *sink);
+
+
+/* destination: udp:<host>:<port> or tcp:<host>:<port> */
+Sink *sink_net_open(const char *destination, size_t max_packet_size)
+{
+    int tcp;
+    if (strncmp(destination, "udp:", 4) == 0) {
+        tcp = 0;
+    } else if (strncmp(destination, "tcp:", 4) == 0) {
+        tcp = 1;
+    } else {
+        fprintf(stderr, "invalid network destination (udp:<host>:<port> or tcp:<host>:<port>): %s\n", destination);
+        return NULL;
+    }
+    if (max_packet_size == 0) {
+        max_packet_size = tcp ? NET_TCP_PACKET_SIZE : NET_UDP_PACKET_SIZE;
+    }
+    if (max_packet_size < sizeof(NetPacketHeader) + 2 * sizeof(short) || (!tcp && max_packet_size > NET_UDP_MAX_PACKET_SIZE)) {
+        fprintf(stderr, "invalid network packet size: %zu\n", max_packet_size);
+        return NULL;
+    }
+
+    SinkNet *sink_net = (SinkNet *) calloc(1, sizeof(SinkNet));
+    if (sink_net == NULL) {
+        return NULL;
+    }
+    sink_net->sink.name = "net";
+    sink_net->sink.push = sink_net_push;
+    sink_net->sink.stop = sink_net_stop;
+    sink_net->sink.free = sink_net_free;
+    sink_net->sink.ring = &sink_net->ring;
+    sink_net->tcp = tcp;
+    /* slots of a whole number of samples, 8 bytes aligned */
+    sink_net->max_samples = (max_packet_size - sizeof(NetPacketHeader)) / (2 * sizeof(short));
+    sink_net->slot_size = (sizeof(NetPacketHeader) + sink_net->max_samples * 2 * sizeof(short) + 7) & ~(size_t)7;
+    atomic_init(&sink_net->stop, 0);
+
+    sink_net->fd = net_connect(destination + 4, tcp);
+    if (sink_net->fd == -1) {
+        free(sink_net);
+        return NULL;
+    }
+    /* every write is a whole number of slots, so a slot never wraps around */
+    if (ring_buffer_init(&sink_net->ring, NET_RING_SIZE / sink_net->slot_size * sink_net->slot_size) == -1) {
+        fprintf(stderr, "network ring buffer allocation failed\n");
+        sink_net_free(&sink_net->sink);
+        return NULL;
+    }
+    int ret = pthread_create(&sink_net->thread, NULL, net_thread, sink_net);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        sink_net_free(&sink_net->sink);
+        return NULL;
+    }
+    sink_net->started = 1;
+    fprintf(stderr, "net: %s %s packets of up to %u samples\n", tcp ? "TCP" : "UDP", destination + 4, sink_net->max_samples);
+    return &sink_net->sink;
+}
+
+/* <host>:<port> (an IPv6 address in brackets) */
+static int net_connect(const char *destination, int tcp)
+{
+    char host[NET_MAX_HOST_SIZE];
+    const char *port = strrchr(destination, ':');
+    if (port == NULL || port == destination || (size_t)(port - destination) >= sizeof(host) || port[1] == '\0') {
+        fprintf(stderr, "invalid network destination: %s\n", destination);
+        return -1;
+    }
+    snprintf(host, sizeof(host), "%.*s", (int)(port - destination), destination);
+    port++;
+    char *h = host;
+    size_t length = strlen(host);
+    if (length >= 2 && host[0] == '[' && host[length - 1] == ']') {
+        host[length - 1] = '\0';
+        h++;
+    }
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = tcp ? SOCK_STREAM : SOCK_DGRAM;
+    struct addrinfo *result;
+    int ret = getaddrinfo(h, port, &hints, &result);
+    if (ret != 0) {
+        fprintf(stderr, "getaddrinfo(%s) failed: %s\n", destination, gai_strerror(ret));
+        return -1;
+    }
+    int fd = -1;
+    for (struct addrinfo *ai = result; ai != NULL; ai = ai->ai_next) {
+        fd = socket(ai->ai_family, ai->ai_socktype | SOCK_CLOEXEC, ai->ai_protocol);
+        if (fd == -1) {
+            continue;
+        }
+        if (tcp) {
+            int size = NET_TCP_SOCKET_BUFFER_SIZE;
+            int one = 1;
+            if (setsockopt(fd, SOL_SOCKET, SO_SNDBUF, &size, sizeof(size)) == -1) {
+                fprintf(stderr, "setsockopt(SO_SNDBUF) failed: %s\n", strerror(errno));
+            }
+            if (setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one)) == -1) {
+                fprintf(stderr, "setsockopt(TCP_NODELAY) failed: %s\n", strerror(errno));
+            }
+        }
+        /* a connected UDP socket: no address in every datagram */
+        if (connect(fd, ai->ai_addr, ai->ai_addrlen) == 0) {
+            break;
+        }
+        fprintf(stderr, "connect(%s) failed: %s\n", destination, strerror(errno));
+        close(fd);
+        fd = -1;
+    }
+    freeaddrinfo(result);
+    return fd;
+}
+
+/* the ring buffer only has whole slots, so what ring_buffer_peek() returns
+ * is a whole number of packets */
+static void *net_thread(void *arg)
+{
+    SinkNet *sink_net = (SinkNet *)arg;
+    RingBuffer *ring = &sink_net->ring;
+    struct timespec poll_interval = { 0, NET_POLL_INTERVAL_NS };
+
+    while (1) {
+        int stop = atomic_load(&sink_net->stop);
+        const void *data;
+        size_t contiguous = ring_buffer_peek(ring, &data);
+        if (contiguous == 0 && stop) {
+            break;
+        }
+        if (contiguous == 0) {
+            nanosleep(&poll_interval, NULL);
+            continue;
+        }
+        unsigned int npackets = contiguous / sink_net->slot_size;
+        if (npackets > NET_BATCH_PACKETS) {
+            npackets = NET_BATCH_PACKETS;
+        }
+        size_t sent = sink_net->failed ? npackets : send_batch(sink_net, (const unsigned char *)data, npackets);
+        ring_buffer_consume(ring, sent * sink_net->slot_size);
+    }
+    return NULL;
+}
+
+/* returns the number of packets done with (sent, or given up on) */
+static size_t send_batch(SinkNet *sink_net, const unsigned char *slots, unsigned int npackets)
+{
+    struct iovec iov[NET_BATCH_PACKETS];
+    size_t total = 0;
+    for (unsigned int j = 0; j < npackets; j++) {
+        const NetPacketHeader *header = (const NetPacketHeader *)(slots + j * sink_net->slot_size);
+        iov[j].iov_base = (void *)header;
+        iov[j].iov_len = sizeof(NetPacketHeader) + header->nsamples * 2 * sizeof(short);
+        total += iov[j].iov_len;
+    }
+
+    if (!sink_net->tcp) {
+        struct mmsghdr msgs[NET_BATCH_PACKETS];
+        memset(msgs, 0, npackets * sizeof(struct mmsghdr));
+        for (unsigned int j = 0; j < npackets; j++) {
+            msgs[j].msg_hdr.msg_iov = &iov[j];
+            msgs[j].msg_hdr.msg_iovlen = 1;
+        }
+        sink_net->send_calls++;
+        int n = sendmmsg(sink_net->fd, msgs, npackets, 0);
+        if (n == -1) {
+            if (errno == EINTR) {
+                return 0;
+            }
+            /* e.g. ECONNREFUSED: nobody listening (yet); drop the batch */
+            if (sink_net->send_errors++ == 0) {
+                fprintf(stderr, "sendmmsg() failed: %s\n", strerror(errno));
+            }
+            return npackets;
+        }
+        for (int j = 0; j < n; j++) {
+            sink_net->bytes += msgs[j].msg_len;
+        }
+        sink_net->packets += n;
+        return n;
+    }
+
+    /* TCP: the whole batch, resuming after short writes */
+    struct msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = iov;
+    msg.msg_iovlen = npackets;
+    size_t left = total;
+    while (left > 0) {
+        sink_net->send_calls++;
+        ssize_t n = sendmsg(sink_net->fd, &msg, MSG_NOSIGNAL);
+        if (n == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            fprintf(stderr, "sendmsg() failed: %s - network output stopped\n", strerror(errno));
+            sink_net->send_errors++;
+            sink_net->failed = 1;
+            return npackets;
+        }
+        left -= n;
+        sink_net->bytes += n;
+        while (n > 0 && (size_t)n >= msg.msg_iov->iov_len) {
+            n -= msg.msg_iov->iov_len;
+            msg.msg_iov++;
+            msg.msg_iovlen--;
+        }
+        if (n > 0) {
+            msg.msg_iov->iov_base = (unsigned char *)msg.msg_iov->iov_base + n;
+            msg.msg_iov->iov_len -= n;
+        }
+    }
+    sink_net->packets += npackets;
+    return npackets;
+}
+
+static void sink_net_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index)
+{
+    SinkNet *sink_net = (SinkNet *)sink;
+    unsigned int npackets = (numSamples + sink_net->max_samples - 1) / sink_net->max_samples;
+    size_t count = npackets * sink_net->slot_size;
+    void *data1;
+    void *data2;
+    size_t count1 = ring_buffer_reserve(&sink_net->ring, count, &data1, &data2);
+    if (count1 == 0) {
+        sink_net->sequence += npackets;
+        return;
+    }
+    /* the sample range is tracked by the stream callback already */
+    SampleRange range;
+    sample_range_init(&range);
+    unsigned int i = 0;
+    for (unsigned int j = 0; j < npackets; j++) {
+        size_t offset = j * sink_net->slot_size;
+        unsigned char *slot = offset < count1 ? (unsigned char *)data1 + offset : (unsigned char *)data2 + (offset - count1);
+        unsigned int m = numSamples - i < sink_net->max_samples ? numSamples - i : sink_net->max_samples;
+        NetPacketHeader *header = (NetPacketHeader *)slot;
+        header->magic = NET_PACKET_MAGIC;
+        header->version = NET_PACKET_VERSION;
+        header->flags = (j == 0 ? NET_PACKET_BLOCK_START : 0) | (j == npackets - 1 ? NET_PACKET_BLOCK_END : 0);
+        header->sequence = sink_net->sequence++;
+        header->nsamples = m;
+        header->sample_index = sample_index + i;
+        interleave_minmax(xi + i, xq + i, (short *)(slot + sizeof(NetPacketHeader)), m, &range);
+        i += m;
+    }
+    ring_buffer_commit(&sink_net->ring, count);
+}
+
+static void sink_net_stop(Sink *sink)
+{
+    SinkNet *sink_net = (SinkNet *)sink;
+    atomic_store(&sink_net->stop, 1);
+    pthread_join(sink_net->thread, NULL);
+    sink_net->started = 0;
+    RingBuffer *ring = &sink_net->ring;
+    fprintf(stderr, "net: packets=%llu bytes=%llu send_calls=%llu (%.1lf packets per call) send_errors=%llu high_water_mark=%zu (%.1lf%%) overruns=%llu overrun_bytes=%llu\n",
+            sink_net->packets, sink_net->bytes, sink_net->send_calls, sink_net->send_calls > 0 ? (double)sink_net->packets / sink_net->send_calls : 0.0,
+            sink_net->send_errors, ring->high_water_mark, 100.0 * ring->high_water_mark / ring->size, ring->overruns, ring->overrun_bytes);
+}
+
+static void sink_net_free(Sink *sink)
+{
+    SinkNet *sink_net = (SinkNet *)sink;
+    if (sink_net->started) {
+        atomic_store(&sink_net->stop, 1);
+        pthread_join(sink_net->thread, NULL);
+    }
+    if (sink_net->ring.buffer != NULL) {
+        ring_buffer_free(&sink_net->ring);
+    }
+    close(sink_net->fd);
+    free(sink_net);
+}
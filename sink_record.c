@@ -0,0 +1,311 @@
+/* stream pipeline sinks
+ * record sink: converts the samples to the output format and writes them
+ * to the output, from the stream callback or through a ring buffer drained
+ * by a writer thread
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "ring_buffer.h"
+#include "sample_kernels.h"
+#include "writer.h"
+
+#define STAGING_BUFFER_SAMPLES 65536
+
+typedef struct {
+    Sink sink;
+    Output *output;
+    SampleFormatSpec format_spec;
+    size_t frame_size;
+    SampleRange range;
+    /* either ring buffer + writer thread, or staging buffer */
+    RingBuffer ring;
+    Writer writer;
+    unsigned char *staging_buffer;
+    int stopped;
+    /* what went into the output, and the gaps in it */
+    int started;
+    uint64_t first_sample_index;
+    uint64_t next_sample_index;
+    uint64_t frames;
+    RecordGap gaps[SINK_RECORD_MAX_GAPS];
+    unsigned int ngaps;
+    unsigned long long lost_gaps;
+} SinkRecord;
+
+static void sink_record_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index);
+static void sink_record_stop(Sink *sink);
+static void sink_record_free(Sink *sink);
+static void add_gap(SinkRecord *sink_record, uint64_t sample_index, uint64_t missing, RecordGapCause cause);
+static void append_gap(SinkRecord *sink_record, uint64_t frame, uint64_t sample_index, uint64_t missing, RecordGapCause cause);
+static void add_writer_losses(SinkRecord *sink_record);
+
+
+Sink *sink_record_open(Output *output, const SampleFormatSpec *format_spec, size_t ring_buffer_size, int writer_cpu)
+{
+    SinkRecord *sink_record = (SinkRecord *) calloc(1, sizeof(SinkRecord));
+    if (sink_record == NULL) {
+        return NULL;
+    }
+    sink_record->sink.name = "record";
+    sink_record->sink.push = sink_record_push;
+    sink_record->sink.stop = sink_record_stop;
+    sink_record->sink.free = sink_record_free;
+    sink_record->sink.ring = &sink_record->ring;
+    sink_record->output = output;
+    sink_record->format_spec = *format_spec;
+    sink_record->frame_size = sample_format_frame_size(format_spec->format);
+    sample_range_init(&sink_record->range);
+
+    if (output != NULL && ring_buffer_size > 0) {
+        if (ring_buffer_init(&sink_record->ring, ring_buffer_size) == -1) {
+            fprintf(stderr, "ring buffer allocation (%zu MiB) failed\n", ring_buffer_size / (1024 * 1024));
+            free(sink_record);
+            return NULL;
+        }
+        if (writer_start(&sink_record->writer, &sink_record->ring, output, WRITER_BATCH_SIZE, writer_cpu) == -1) {
+            ring_buffer_free(&sink_record->ring);
+            free(sink_record);
+            return NULL;
+        }
+    } else if (output != NULL) {
+        sink_record->staging_buffer = (unsigned char *) malloc(STAGING_BUFFER_SAMPLES * sink_record->frame_size);
+        if (sink_record->staging_buffer == NULL) {
+            fprintf(stderr, "staging buffer allocation failed\n");
+            free(sink_record);
+            return NULL;
+        }
+    }
+    return &sink_record->sink;
+}
+
+static void sink_record_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index)
+{
+    SinkRecord *sink_record = (SinkRecord *)sink;
+
+    /* no output file: just keep track of the sample range */
+    if (sink_record->output == NULL) {
+        minmax(xi, xq, numSamples, &sink_record->range);
+        return;
+    }
+
+    if (!sink_record->started) {
+        sink_record->started = 1;
+        sink_record->first_sample_index = sample_index;
+    } else if (sample_index > sink_record->next_sample_index) {
+        add_gap(sink_record, sample_index, sample_index - sink_record->next_sample_index, RECORD_GAP_DROPPED);
+    }
+    sink_record->next_sample_index = sample_index + numSamples;
+
+    /* packed formats: the shift is chosen once, from the first block */
+    if (sink_record->format_spec.shift == SAMPLE_FORMAT_AUTO_SHIFT) {
+        SampleRange first_block_range;
+        sample_range_init(&first_block_range);
+        minmax(xi, xq, numSamples, &first_block_range);
+        sink_record->format_spec.shift = sample_format_auto_shift(sink_record->format_spec.format, &first_block_range);
+    }
+
+    size_t frame_size = sink_record->frame_size;
+
+    /* ring buffer: convert samples (and update the sample range) directly
+     * into the ring buffer memory; the writer thread does the actual I/O */
+    if (sink_record->ring.buffer != NULL) {
+        size_t count = numSamples * frame_size;
+        void *data1;
+        void *data2;
+        size_t count1 = ring_buffer_reserve(&sink_record->ring, count, &data1, &data2);
+        if (count1 == 0) {
+            /* overrun - never block here */
+            minmax(xi, xq, numSamples, &sink_record->range);
+            add_gap(sink_record, sample_index + numSamples, numSamples, RECORD_GAP_OVERRUN);
+            return;
+        }
+        unsigned int n1 = count1 / frame_size;
+        sample_format_pack(&sink_record->format_spec, xi, xq, (unsigned char *)data1, n1, &sink_record->range);
+        unsigned char *out2 = (unsigned char *)data2;
+        size_t partial = count1 - n1 * frame_size;
+        if (partial > 0) {
+            /* with 3 byte frames the wrap around can split a frame */
+            _Alignas(float) unsigned char frame[SAMPLE_FORMAT_MAX_FRAME_SIZE];
+            sample_format_pack(&sink_record->format_spec, xi + n1, xq + n1, frame, 1, &sink_record->range);
+            memcpy((unsigned char *)data1 + n1 * frame_size, frame, partial);
+            memcpy(out2, frame + partial, frame_size - partial);
+            out2 += frame_size - partial;
+            n1++;
+        }
+        sample_format_pack(&sink_record->format_spec, xi + n1, xq + n1, out2, numSamples - n1, &sink_record->range);
+        ring_buffer_commit(&sink_record->ring, count);
+        sink_record->frames += numSamples;
+        return;
+    }
+
+    /* convert samples and update the sample range in a single pass,
+     * then write them to the output file (in chunks if the block is larger
+     * than the staging buffer); what the output drops is a gap */
+    for (unsigned int offset = 0; offset < numSamples; offset += STAGING_BUFFER_SAMPLES) {
+        unsigned int n = numSamples - offset < STAGING_BUFFER_SAMPLES ? numSamples - offset : STAGING_BUFFER_SAMPLES;
+        sample_format_pack(&sink_record->format_spec, xi + offset, xq + offset, sink_record->staging_buffer, n, &sink_record->range);
+        unsigned long long bytes_written = sink_record->output->bytes_written;
+        ssize_t taken = sink_record->output->write(sink_record->output, sink_record->staging_buffer, n * frame_size);
+        if (taken == -1) {
+            /* what the output counted before failing */
+            taken = sink_record->output->bytes_written - bytes_written;
+        }
+        unsigned int nwritten = taken / frame_size;
+        sink_record->frames += nwritten;
+        if (nwritten < n) {
+            add_gap(sink_record, sample_index + offset + n, n - nwritten, RECORD_GAP_OVERRUN);
+        }
+    }
+}
+
+static void sink_record_stop(Sink *sink)
+{
+    SinkRecord *sink_record = (SinkRecord *)sink;
+    if (sink_record->ring.buffer != NULL) {
+        writer_stop(&sink_record->writer);
+        add_writer_losses(sink_record);
+    }
+    sink_record->stopped = 1;
+    if (sink_record->output != NULL) {
+        sink_record->output->close(sink_record->output);
+        sink_record->output = NULL;
+    }
+
+    fprintf(stderr, "I_range=[%hd,%hd] Q_range=[%hd,%hd]\n", sink_record->range.imin, sink_record->range.imax, sink_record->range.qmin, sink_record->range.qmax);
+    const SampleFormatSpec *format_spec = &sink_record->format_spec;
+    if ((sink_record->ring.buffer != NULL || sink_record->staging_buffer != NULL) &&
+        (format_spec->format == SAMPLE_FORMAT_IQ12 || format_spec->format == SAMPLE_FORMAT_IQ8)) {
+        fprintf(stderr, "output_format=%s shift=%d clipped=%s\n", sample_format_name(format_spec->format), format_spec->shift, sample_format_clipped(format_spec, &sink_record->range) ? "yes" : "no");
+    }
+    if (sink_record->ring.buffer != NULL) {
+        RingBuffer *ring = &sink_record->ring;
+        fprintf(stderr, "ring_buffer_size=%zu high_water_mark=%zu (%.1lf%%) overruns=%llu overrun_bytes=%llu write_calls=%llu write_errors=%llu\n", ring->size, ring->high_water_mark, 100.0 * ring->high_water_mark / ring->size, ring->overruns, ring->overrun_bytes, sink_record->writer.write_calls, sink_record->writer.write_errors);
+    }
+}
+
+void sink_record_info(const Sink *sink, SinkRecordInfo *info)
+{
+    const SinkRecord *sink_record = (const SinkRecord *)sink;
+    info->format_spec = sink_record->format_spec;
+    info->frame_size = sink_record->frame_size;
+    info->first_sample_index = sink_record->first_sample_index;
+    info->frames = sink_record->frames;
+    info->gaps = sink_record->gaps;
+    info->ngaps = sink_record->ngaps;
+    info->lost_gaps = sink_record->lost_gaps;
+}
+
+static void sink_record_free(Sink *sink)
+{
+    SinkRecord *sink_record = (SinkRecord *)sink;
+    if (sink_record->ring.buffer != NULL && !sink_record->stopped) {
+        writer_stop(&sink_record->writer);
+    }
+    if (sink_record->output != NULL) {
+        sink_record->output->close(sink_record->output);
+    }
+    if (sink_record->ring.buffer != NULL) {
+        ring_buffer_free(&sink_record->ring);
+    }
+    free(sink_record->staging_buffer);
+    free(sink_record);
+}
+
+/* a gap right before the next frame */
+static void add_gap(SinkRecord *sink_record, uint64_t sample_index, uint64_t missing, RecordGapCause cause)
+{
+    append_gap(sink_record, sink_record->frames, sample_index, missing, cause);
+}
+
+/* consecutive gaps with the same cause (e.g. a run of overruns) are merged
+ * into one */
+static void append_gap(SinkRecord *sink_record, uint64_t frame, uint64_t sample_index, uint64_t missing, RecordGapCause cause)
+{
+    if (sink_record->ngaps > 0) {
+        RecordGap *last = &sink_record->gaps[sink_record->ngaps - 1];
+        if (last->frame == frame && last->cause == cause) {
+            last->sample_index = sample_index;
+            last->missing += missing;
+            return;
+        }
+    }
+    if (sink_record->ngaps == SINK_RECORD_MAX_GAPS) {
+        sink_record->lost_gaps++;
+        return;
+    }
+    RecordGap *gap = &sink_record->gaps[sink_record->ngaps++];
+    gap->frame = frame;
+    gap->sample_index = sample_index;
+    gap->missing = missing;
+    gap->cause = cause;
+}
+
+/* what the output didn't take from the writer thread is lost too; until
+ * the writer has stopped, the frames and the gaps count everything
+ * committed to the ring buffer, so merge its losses (as overruns) into the
+ * gaps here, and take the lost frames out of the ones that follow */
+static void add_writer_losses(SinkRecord *sink_record)
+{
+    const Writer *writer = &sink_record->writer;
+    if (writer->lost_bytes == 0) {
+        return;
+    }
+    size_t frame_size = sink_record->frame_size;
+    unsigned int ngaps = sink_record->ngaps;
+    RecordGap *gaps = (RecordGap *) malloc((ngaps + 1) * sizeof(RecordGap));
+    if (gaps == NULL) {
+        fprintf(stderr, "gaps allocation failed - the write errors are not in the gaps\n");
+        return;
+    }
+    memcpy(gaps, sink_record->gaps, ngaps * sizeof(RecordGap));
+    sink_record->ngaps = 0;
+
+    uint64_t lost = 0;          /* frames lost to the writer so far */
+    uint64_t missing = 0;       /* samples missing in the gaps so far */
+    uint64_t end = 0;           /* frame (as committed) after the last loss */
+    uint64_t lost_bytes = 0;
+    unsigned int i = 0;
+    for (unsigned int j = 0; j < writer->nlosses; j++) {
+        const WriterLoss *loss = &writer->losses[j];
+        lost_bytes += loss->bytes;
+        /* a frame with any byte lost is lost whole */
+        uint64_t start = loss->offset / frame_size;
+        uint64_t stop = (loss->offset + loss->bytes + frame_size - 1) / frame_size;
+        if (start < end) {
+            start = end;
+        }
+        while (start < stop) {
+            /* the gaps before the lost frames (or among them) go first */
+            while (i < ngaps && gaps[i].frame <= start) {
+                append_gap(sink_record, gaps[i].frame - lost, gaps[i].sample_index, gaps[i].missing, gaps[i].cause);
+                missing += gaps[i].missing;
+                i++;
+            }
+            uint64_t piece_stop = i < ngaps && gaps[i].frame < stop ? gaps[i].frame : stop;
+            lost += piece_stop - start;
+            append_gap(sink_record, piece_stop - lost, sink_record->first_sample_index + piece_stop + missing, piece_stop - start, RECORD_GAP_OVERRUN);
+            start = piece_stop;
+        }
+        if (stop > end) {
+            end = stop;
+        }
+    }
+    for (; i < ngaps; i++) {
+        append_gap(sink_record, gaps[i].frame - lost, gaps[i].sample_index, gaps[i].missing, gaps[i].cause);
+    }
+    free(gaps);
+
+    /* the losses past WRITER_MAX_LOSSES are only counted */
+    sink_record->frames -= lost + (writer->lost_bytes - lost_bytes) / frame_size;
+    sink_record->lost_gaps += writer->lost_losses;
+}
@@ -0,0 +1,153 @@
+/* stream pipeline sinks
+ * shared memory ring sink: the stream callback writes the interleaved
+ * samples once into a POSIX shared memory ring (see shm_ring.h), and any
+ * number of local processes map it read-only and read it at their own pace
+ * - the readers can come and go while streaming; the ring is removed when
+ *   the sink is stopped (the readers that still have it mapped keep it)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "sample_kernels.h"
+#include "shm_ring.h"
+
+#define SHM_RING_FRAME_SIZE (2 * sizeof(short))
+
+typedef struct {
+    Sink sink;
+    char name[256];
+    ShmRingHeader *header;
+    short *frames;
+    size_t size;                    /* of the mapping */
+    uint64_t ring_frames;
+    uint64_t next_sample_index;     /* stream callback only */
+    int started;
+} SinkShm;
+
+static void sink_shm_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index);
+static void sink_shm_stop(Sink *sink);
+static void sink_shm_free(Sink *sink);
+
+
+Sink *sink_shm_open(const char *name, size_t ring_size, double sample_rate, double center_frequency)
+{
+    if (strlen(name) >= sizeof(((SinkShm *)NULL)->name)) {
+        fprintf(stderr, "shared memory name too long: %s\n", name);
+        return NULL;
+    }
+    SinkShm *sink_shm = (SinkShm *) calloc(1, sizeof(SinkShm));
+    if (sink_shm == NULL) {
+        return NULL;
+    }
+    sink_shm->sink.name = "shm";
+    sink_shm->sink.push = sink_shm_push;
+    sink_shm->sink.stop = sink_shm_stop;
+    sink_shm->sink.free = sink_shm_free;
+    sink_shm->sink.ring = NULL;
+    snprintf(sink_shm->name, sizeof(sink_shm->name), "%s", name);
+    sink_shm->ring_frames = ring_size / SHM_RING_FRAME_SIZE;
+    sink_shm->size = SHM_RING_HEADER_SIZE + sink_shm->ring_frames * SHM_RING_FRAME_SIZE;
+
+    int fd = shm_open(name, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd == -1) {
+        fprintf(stderr, "shm_open(%s) failed: %s\n", name, strerror(errno));
+        free(sink_shm);
+        return NULL;
+    }
+    if (ftruncate(fd, sink_shm->size) == -1) {
+        fprintf(stderr, "ftruncate() failed: %s\n", strerror(errno));
+        close(fd);
+        shm_unlink(name);
+        free(sink_shm);
+        return NULL;
+    }
+    void *map = mmap(NULL, sink_shm->size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) {
+        fprintf(stderr, "mmap() failed: %s\n", strerror(errno));
+        shm_unlink(name);
+        free(sink_shm);
+        return NULL;
+    }
+    /* touch every page now, so the stream callback never page faults */
+    memset(map, 0, sink_shm->size);
+    sink_shm->header = (ShmRingHeader *)map;
+    sink_shm->frames = (short *)((unsigned char *)map + SHM_RING_HEADER_SIZE);
+
+    ShmRingHeader *header = sink_shm->header;
+    header->header_size = SHM_RING_HEADER_SIZE;
+    header->frame_size = SHM_RING_FRAME_SIZE;
+    header->ring_frames = sink_shm->ring_frames;
+    header->sample_rate = sample_rate;
+    header->center_frequency = center_frequency;
+    atomic_store(&header->running, 1);
+    header->version = SHM_RING_VERSION;
+    /* the magic last: a reader that sees it sees a complete header */
+    atomic_thread_fence(memory_order_release);
+    header->magic = SHM_RING_MAGIC;
+    sink_shm->started = 1;
+    fprintf(stderr, "shm: /dev/shm%s%s ring of %llu frames (%.3lfs)\n", name[0] == '/' ? "" : "/", name,
+            (unsigned long long)sink_shm->ring_frames, sample_rate > 0 ? sink_shm->ring_frames / sample_rate : 0.0);
+    return &sink_shm->sink;
+}
+
+/* reserve_frames before the data, write_frames after it, so that a reader
+ * can tell if what it has copied was being overwritten */
+static void sink_shm_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index)
+{
+    SinkShm *sink_shm = (SinkShm *)sink;
+    ShmRingHeader *header = sink_shm->header;
+    uint64_t ring_frames = sink_shm->ring_frames;
+    if (numSamples > ring_frames) {
+        return;
+    }
+    if (sink_shm->next_sample_index != 0 && sample_index > sink_shm->next_sample_index) {
+        atomic_store_explicit(&header->dropped_samples, atomic_load_explicit(&header->dropped_samples, memory_order_relaxed) + (sample_index - sink_shm->next_sample_index), memory_order_relaxed);
+    }
+    sink_shm->next_sample_index = sample_index + numSamples;
+
+    uint64_t written = atomic_load_explicit(&header->write_frames, memory_order_relaxed);
+    atomic_store_explicit(&header->reserve_frames, written + numSamples, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+
+    /* the sample range is tracked by the stream callback already */
+    SampleRange range;
+    sample_range_init(&range);
+    size_t offset = written % ring_frames;
+    unsigned int first = ring_frames - offset < numSamples ? ring_frames - offset : numSamples;
+    interleave_minmax(xi, xq, sink_shm->frames + 2 * offset, first, &range);
+    interleave_minmax(xi + first, xq + first, sink_shm->frames, numSamples - first, &range);
+
+    atomic_store_explicit(&header->sample_index, sample_index + numSamples, memory_order_relaxed);
+    atomic_store_explicit(&header->write_frames, written + numSamples, memory_order_release);
+}
+
+static void sink_shm_stop(Sink *sink)
+{
+    SinkShm *sink_shm = (SinkShm *)sink;
+    ShmRingHeader *header = sink_shm->header;
+    atomic_store(&header->running, 0);
+    fprintf(stderr, "shm: frames=%llu dropped_samples=%llu\n", (unsigned long long)atomic_load(&header->write_frames),
+            (unsigned long long)atomic_load(&header->dropped_samples));
+}
+
+static void sink_shm_free(Sink *sink)
+{
+    SinkShm *sink_shm = (SinkShm *)sink;
+    if (sink_shm->started) {
+        atomic_store(&sink_shm->header->running, 0);
+        munmap(sink_shm->header, sink_shm->size);
+        shm_unlink(sink_shm->name);
+    }
+    free(sink_shm);
+}
@@ -0,0 +1,196 @@
+/* stream pipeline sinks
+ * timing sink: histogram of the intervals between callbacks (measured with
+ * CLOCK_MONOTONIC_RAW, so NTP slewing doesn't skew them), with the
+ * callbacks that arrive too late after the previous one reported at the end
+ * - nothing is printed from the stream callback; the optional dump of the
+ *   raw intervals goes through a ring buffer to a writer thread
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "latency_histogram.h"
+#include "pipeline.h"
+#include "ring_buffer.h"
+#include "writer.h"
+
+#define UNUSED(x) (void)(x)
+
+#define TIMING_MAX_LATE_CALLBACKS 1000
+#define TIMING_RING_SIZE (1024 * 1024)
+
+typedef struct {
+    long callback_count;
+    unsigned int numSamples;
+    long diff;
+} LateCallback;
+
+/* raw intervals file record (little endian) */
+typedef struct {
+    uint64_t timestamp;         /* CLOCK_MONOTONIC_RAW (ns) */
+    uint32_t interval;          /* ns since the previous callback (saturated; 0 for the first one) */
+    uint32_t num_samples;
+} TimingRecord;
+
+typedef struct {
+    Sink sink;
+    struct timespec prev_time;
+    long callback_count;
+    long diff_threshold;
+    LatencyHistogram intervals;
+    unsigned long long late_callbacks;
+    LateCallback late[TIMING_MAX_LATE_CALLBACKS];
+    /* raw intervals dump */
+    RingBuffer ring;
+    Writer writer;
+    Output *output;
+    int stopped;
+} SinkTimeDiff;
+
+static void sink_time_diff_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index);
+static void sink_time_diff_stop(Sink *sink);
+static void sink_time_diff_free(Sink *sink);
+
+
+/* intervals_filename can be NULL (no dump) */
+Sink *sink_time_diff_open(long diff_threshold, const char *intervals_filename)
+{
+    SinkTimeDiff *sink_time_diff = (SinkTimeDiff *) malloc(sizeof(SinkTimeDiff));
+    if (sink_time_diff == NULL) {
+        return NULL;
+    }
+    sink_time_diff->sink.name = "timing";
+    sink_time_diff->sink.push = sink_time_diff_push;
+    sink_time_diff->sink.stop = sink_time_diff_stop;
+    sink_time_diff->sink.free = sink_time_diff_free;
+    sink_time_diff->sink.ring = &sink_time_diff->ring;
+    sink_time_diff->prev_time.tv_sec = 0;
+    sink_time_diff->prev_time.tv_nsec = 0;
+    sink_time_diff->callback_count = 0;
+    sink_time_diff->diff_threshold = diff_threshold;
+    latency_histogram_init(&sink_time_diff->intervals);
+    sink_time_diff->late_callbacks = 0;
+    sink_time_diff->ring.buffer = NULL;
+    sink_time_diff->output = NULL;
+    sink_time_diff->stopped = 0;
+
+    if (intervals_filename != NULL) {
+        int fd = open(intervals_filename, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd == -1) {
+            fprintf(stderr, "open(%s) for writing failed: %s\n", intervals_filename, strerror(errno));
+            free(sink_time_diff);
+            return NULL;
+        }
+        sink_time_diff->output = output_fd_open(fd);
+        if (sink_time_diff->output == NULL) {
+            close(fd);
+            free(sink_time_diff);
+            return NULL;
+        }
+        if (ring_buffer_init(&sink_time_diff->ring, TIMING_RING_SIZE) == -1) {
+            fprintf(stderr, "timing ring buffer allocation failed\n");
+            sink_time_diff->output->close(sink_time_diff->output);
+            free(sink_time_diff);
+            return NULL;
+        }
+        if (writer_start(&sink_time_diff->writer, &sink_time_diff->ring, sink_time_diff->output, WRITER_BATCH_SIZE, -1) == -1) {
+            ring_buffer_free(&sink_time_diff->ring);
+            sink_time_diff->output->close(sink_time_diff->output);
+            free(sink_time_diff);
+            return NULL;
+        }
+    }
+    return &sink_time_diff->sink;
+}
+
+static void sink_time_diff_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index)
+{
+    UNUSED(xi);
+    UNUSED(xq);
+    UNUSED(sample_index);
+
+    SinkTimeDiff *sink_time_diff = (SinkTimeDiff *)sink;
+
+    struct timespec current_time;
+    clock_gettime(CLOCK_MONOTONIC_RAW, &current_time);
+    long diff = 0;
+    if (sink_time_diff->callback_count > 0) {
+        diff = (current_time.tv_sec - sink_time_diff->prev_time.tv_sec) * 1000000000 + (current_time.tv_nsec - sink_time_diff->prev_time.tv_nsec);
+        latency_histogram_record(&sink_time_diff->intervals, diff);
+        if (diff > sink_time_diff->diff_threshold) {
+            if (sink_time_diff->late_callbacks < TIMING_MAX_LATE_CALLBACKS) {
+                LateCallback *late = &sink_time_diff->late[sink_time_diff->late_callbacks];
+                late->callback_count = sink_time_diff->callback_count;
+                late->numSamples = numSamples;
+                late->diff = diff;
+            }
+            sink_time_diff->late_callbacks++;
+        }
+    }
+    if (sink_time_diff->ring.buffer != NULL) {
+        TimingRecord record = {
+            .timestamp = (uint64_t)current_time.tv_sec * 1000000000 + current_time.tv_nsec,
+            .interval = diff < UINT32_MAX ? (uint32_t)diff : UINT32_MAX,
+            .num_samples = numSamples,
+        };
+        /* on overrun the record is dropped (and counted) */
+        ring_buffer_write(&sink_time_diff->ring, &record, sizeof(record));
+    }
+    sink_time_diff->prev_time.tv_sec = current_time.tv_sec;
+    sink_time_diff->prev_time.tv_nsec = current_time.tv_nsec;
+    sink_time_diff->callback_count++;
+}
+
+static void sink_time_diff_stop(Sink *sink)
+{
+    SinkTimeDiff *sink_time_diff = (SinkTimeDiff *)sink;
+    if (sink_time_diff->ring.buffer != NULL) {
+        writer_stop(&sink_time_diff->writer);
+        sink_time_diff->output->close(sink_time_diff->output);
+        sink_time_diff->output = NULL;
+    }
+    sink_time_diff->stopped = 1;
+
+    /* callback number, samples, interval (ns) */
+    unsigned long long nlate = sink_time_diff->late_callbacks < TIMING_MAX_LATE_CALLBACKS ? sink_time_diff->late_callbacks : TIMING_MAX_LATE_CALLBACKS;
+    for (unsigned long long i = 0; i < nlate; i++) {
+        const LateCallback *late = &sink_time_diff->late[i];
+        fprintf(stderr, "%ld %u %ld\n", late->callback_count, late->numSamples, late->diff);
+    }
+    if (sink_time_diff->late_callbacks > nlate) {
+        fprintf(stderr, "(%llu more late callbacks not shown)\n", sink_time_diff->late_callbacks - nlate);
+    }
+    fprintf(stderr, "callback_count=%ld late_callbacks=%llu (interval > %ldns)\n", sink_time_diff->callback_count, sink_time_diff->late_callbacks, sink_time_diff->diff_threshold);
+    latency_histogram_print(&sink_time_diff->intervals, "callback interval (ns)", stderr);
+    if (sink_time_diff->ring.buffer != NULL) {
+        RingBuffer *ring = &sink_time_diff->ring;
+        fprintf(stderr, "timing: intervals_dump high_water_mark=%zu (%.1lf%%) overruns=%llu\n", ring->high_water_mark, 100.0 * ring->high_water_mark / ring->size, ring->overruns);
+    }
+}
+
+static void sink_time_diff_free(Sink *sink)
+{
+    SinkTimeDiff *sink_time_diff = (SinkTimeDiff *)sink;
+    if (sink_time_diff->ring.buffer != NULL) {
+        if (!sink_time_diff->stopped) {
+            writer_stop(&sink_time_diff->writer);
+        }
+        ring_buffer_free(&sink_time_diff->ring);
+    }
+    if (sink_time_diff->output != NULL) {
+        sink_time_diff->output->close(sink_time_diff->output);
+    }
+    free(sink_time_diff);
+}
@@ -0,0 +1,365 @@
+/* spectrum monitor: averaged power spectra computed on a worker thread and
+ * written periodically to a compact binary file
+ * - Welch method: windowed FFT frames with 50% overlap; |X|^2 is averaged
+ *   over the frames in each record (averaging time)
+ * - each record is stored as int16 values in 1/100 dB relative to full scale
+ *   (a full scale tone at the center of a bin reads 0dBFS)
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sample_kernels.h"
+#include "spectrum.h"
+
+#define UNUSED(x) (void)(x)
+#define SPECTRUM_POLL_INTERVAL_NS 1000000   /* 1ms */
+
+static const char *window_names[] = {
+    [SPECTRUM_WINDOW_RECTANGULAR] = "rect",
+    [SPECTRUM_WINDOW_HANN] = "hann",
+    [SPECTRUM_WINDOW_HAMMING] = "hamming",
+    [SPECTRUM_WINDOW_BLACKMAN_HARRIS] = "blackman",
+};
+
+static int write_header(Spectrum *spectrum, double sample_rate, double center_frequency);
+static void process_frame(Spectrum *spectrum);
+static void write_record(Spectrum *spectrum);
+static void *spectrum_thread(void *arg);
+static void spectrum_sink_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index);
+static void spectrum_sink_stop(Sink *sink);
+static void spectrum_sink_free(Sink *sink);
+
+
+/* <fft size>,<averaging time (s)>[,<window>],<output file> */
+int spectrum_spec_parse(const char *spec, SpectrumSpec *spectrum_spec)
+{
+    int n;
+    if (sscanf(spec, "%u,%lg,%n", &spectrum_spec->fft_size, &spectrum_spec->averaging_time, &n) != 2 || spec[n] == '\0') {
+        return -1;
+    }
+    if (spectrum_spec->fft_size < 16 || spectrum_spec->fft_size > SPECTRUM_MAX_FFT_SIZE ||
+        (spectrum_spec->fft_size & (spectrum_spec->fft_size - 1)) != 0 || spectrum_spec->averaging_time <= 0) {
+        return -1;
+    }
+    spec = spectrum_window_parse(spec + n, &spectrum_spec->window);
+    if (*spec == '\0') {
+        return -1;
+    }
+    spectrum_spec->filename = spec;
+    return 0;
+}
+
+const char *spectrum_window_parse(const char *spec, SpectrumWindow *window)
+{
+    *window = SPECTRUM_WINDOW_HANN;
+    for (unsigned int i = 0; i < sizeof(window_names) / sizeof(window_names[0]); i++) {
+        size_t len = strlen(window_names[i]);
+        if (strncmp(spec, window_names[i], len) == 0 && spec[len] == ',') {
+            *window = (SpectrumWindow)i;
+            return spec + len + 1;
+        }
+    }
+    return spec;
+}
+
+const char *spectrum_window_name(SpectrumWindow window)
+{
+    return window_names[window];
+}
+
+int spectrum_init(Spectrum *spectrum, const SpectrumSpec *spec, double sample_rate, double center_frequency)
+{
+    memset(spectrum, 0, sizeof(Spectrum));
+    spectrum->sink.name = "spectrum";
+    spectrum->sink.push = spectrum_sink_push;
+    spectrum->sink.stop = spectrum_sink_stop;
+    spectrum->sink.free = spectrum_sink_free;
+    spectrum->sink.ring = &spectrum->ring;
+    spectrum->spec = *spec;
+    atomic_init(&spectrum->stop, 0);
+
+    unsigned int n = spec->fft_size;
+    unsigned int hop = n / 2;
+    spectrum->frames_per_record = (unsigned int)lround(spec->averaging_time * sample_rate / hop);
+    if (spectrum->frames_per_record == 0) {
+        spectrum->frames_per_record = 1;
+    }
+
+    if (fft_plan_init(&spectrum->plan, n) == -1) {
+        return -1;
+    }
+    spectrum->window = (float *)malloc(n * sizeof(float));
+    spectrum->frame = (float *)malloc(2 * n * sizeof(float));
+    spectrum->fft_buf = (float *)malloc(2 * n * sizeof(float));
+    spectrum->power = (double *)calloc(n, sizeof(double));
+    spectrum->record = (int16_t *)malloc(n * sizeof(int16_t));
+    if (spectrum->window == NULL || spectrum->frame == NULL || spectrum->fft_buf == NULL ||
+        spectrum->power == NULL || spectrum->record == NULL) {
+        fprintf(stderr, "spectrum buffers allocation failed\n");
+        spectrum_free(spectrum);
+        return -1;
+    }
+    spectrum_window_init(spectrum->window, n, spec->window);
+    /* coherent gain of the window, squared, times the full scale power */
+    double window_sum = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        window_sum += spectrum->window[i];
+    }
+    spectrum->normalization = window_sum * window_sum * 32768.0 * 32768.0;
+
+    if (ring_buffer_init(&spectrum->ring, SPECTRUM_RING_SIZE) == -1) {
+        fprintf(stderr, "spectrum ring buffer allocation failed\n");
+        spectrum_free(spectrum);
+        return -1;
+    }
+
+    spectrum->file = fopen(spec->filename, "wb");
+    if (spectrum->file == NULL) {
+        fprintf(stderr, "fopen(%s) failed: %s\n", spec->filename, strerror(errno));
+        spectrum_free(spectrum);
+        return -1;
+    }
+    if (write_header(spectrum, sample_rate, center_frequency) == -1) {
+        spectrum_free(spectrum);
+        return -1;
+    }
+    fprintf(stderr, "spectrum: fft_size=%u window=%s frames_per_record=%u (%.3lfs) -> %s\n", n, window_names[spec->window], spectrum->frames_per_record, sample_rate > 0 ? (double)spectrum->frames_per_record * hop / sample_rate : 0.0, spec->filename);
+    return 0;
+}
+
+int spectrum_start(Spectrum *spectrum)
+{
+    int ret = pthread_create(&spectrum->thread, NULL, spectrum_thread, spectrum);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/* copy the samples into the spectrum ring buffer; never blocks */
+void spectrum_push(Spectrum *spectrum, const short *xi, const short *xq, unsigned int numSamples)
+{
+    size_t count = numSamples * 2 * sizeof(short);
+    void *data1;
+    void *data2;
+    size_t count1 = ring_buffer_reserve(&spectrum->ring, count, &data1, &data2);
+    if (count1 == 0) {
+        return;
+    }
+    /* the sample range is tracked by the stream callback already */
+    SampleRange range;
+    sample_range_init(&range);
+    unsigned int n1 = count1 / (2 * sizeof(short));
+    interleave_minmax(xi, xq, (short *)data1, n1, &range);
+    interleave_minmax(xi + n1, xq + n1, (short *)data2, numSamples - n1, &range);
+    ring_buffer_commit(&spectrum->ring, count);
+}
+
+/* stop the spectrum thread after it has processed everything left in the
+ * ring buffer; a partial average at the end is written out as well */
+void spectrum_stop(Spectrum *spectrum)
+{
+    atomic_store(&spectrum->stop, 1);
+    pthread_join(spectrum->thread, NULL);
+    if (spectrum->frames > 0) {
+        write_record(spectrum);
+    }
+    if (fclose(spectrum->file) != 0) {
+        fprintf(stderr, "fclose(%s) failed: %s\n", spectrum->spec.filename, strerror(errno));
+    }
+    spectrum->file = NULL;
+    fprintf(stderr, "spectrum: records=%llu samples_in=%llu high_water_mark=%zu (%.1lf%%) overruns=%llu overrun_bytes=%llu\n", spectrum->records, spectrum->samples_in, spectrum->ring.high_water_mark, 100.0 * spectrum->ring.high_water_mark / spectrum->ring.size, spectrum->ring.overruns, spectrum->ring.overrun_bytes);
+}
+
+void spectrum_free(Spectrum *spectrum)
+{
+    if (spectrum->file != NULL) {
+        fclose(spectrum->file);
+        spectrum->file = NULL;
+    }
+    if (spectrum->ring.buffer != NULL) {
+        ring_buffer_free(&spectrum->ring);
+        spectrum->ring.buffer = NULL;
+    }
+    fft_plan_free(&spectrum->plan);
+    free(spectrum->window);
+    free(spectrum->frame);
+    free(spectrum->fft_buf);
+    free(spectrum->power);
+    free(spectrum->record);
+    spectrum->window = NULL;
+    spectrum->frame = NULL;
+    spectrum->fft_buf = NULL;
+    spectrum->power = NULL;
+    spectrum->record = NULL;
+}
+
+void spectrum_window_init(float *window, unsigned int n, SpectrumWindow type)
+{
+    /* periodic windows (DFT-even), which is what spectral analysis wants */
+    for (unsigned int i = 0; i < n; i++) {
+        double x = 2 * M_PI * i / n;
+        switch (type) {
+        case SPECTRUM_WINDOW_RECTANGULAR:
+            window[i] = 1.0f;
+            break;
+        case SPECTRUM_WINDOW_HANN:
+            window[i] = (float)(0.5 - 0.5 * cos(x));
+            break;
+        case SPECTRUM_WINDOW_HAMMING:
+            window[i] = (float)(0.54 - 0.46 * cos(x));
+            break;
+        case SPECTRUM_WINDOW_BLACKMAN_HARRIS:
+            window[i] = (float)(0.35875 - 0.48829 * cos(x) + 0.14128 * cos(2 * x) - 0.01168 * cos(3 * x));
+            break;
+        }
+    }
+}
+
+static int write_header(Spectrum *spectrum, double sample_rate, double center_frequency)
+{
+    uint32_t version = SPECTRUM_FILE_VERSION;
+    uint32_t fft_size = spectrum->spec.fft_size;
+    uint32_t window = spectrum->spec.window;
+    uint32_t frames_per_record = spectrum->frames_per_record;
+    if (fwrite(SPECTRUM_FILE_MAGIC, 8, 1, spectrum->file) != 1 ||
+        fwrite(&version, sizeof(version), 1, spectrum->file) != 1 ||
+        fwrite(&fft_size, sizeof(fft_size), 1, spectrum->file) != 1 ||
+        fwrite(&sample_rate, sizeof(sample_rate), 1, spectrum->file) != 1 ||
+        fwrite(&center_frequency, sizeof(center_frequency), 1, spectrum->file) != 1 ||
+        fwrite(&window, sizeof(window), 1, spectrum->file) != 1 ||
+        fwrite(&frames_per_record, sizeof(frames_per_record), 1, spectrum->file) != 1) {
+        fprintf(stderr, "fwrite(%s) failed: %s\n", spectrum->spec.filename, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void process_frame(Spectrum *spectrum)
+{
+    unsigned int n = spectrum->spec.fft_size;
+    const float *window = spectrum->window;
+    const float *frame = spectrum->frame;
+    float *buf = spectrum->fft_buf;
+    for (unsigned int i = 0; i < n; i++) {
+        buf[2 * i] = frame[2 * i] * window[i];
+        buf[2 * i + 1] = frame[2 * i + 1] * window[i];
+    }
+    fft_forward(&spectrum->plan, buf);
+    double *power = spectrum->power;
+    for (unsigned int k = 0; k < n; k++) {
+        power[k] += (double)buf[2 * k] * buf[2 * k] + (double)buf[2 * k + 1] * buf[2 * k + 1];
+    }
+    if (spectrum->frames == 0) {
+        spectrum->record_first_sample = spectrum->samples_in - n;
+    }
+    spectrum->frames++;
+    if (spectrum->frames == spectrum->frames_per_record) {
+        write_record(spectrum);
+    }
+
+    /* 50% overlap: keep the second half of the frame */
+    memmove(spectrum->frame, spectrum->frame + n, n * sizeof(float));
+    spectrum->frame_fill = n / 2;
+}
+
+static void write_record(Spectrum *spectrum)
+{
+    unsigned int n = spectrum->spec.fft_size;
+    double scale = spectrum->frames * spectrum->normalization;
+    /* FFT shift, so that the record goes from -fs/2 to +fs/2 */
+    for (unsigned int k = 0; k < n; k++) {
+        double p = spectrum->power[(k + n / 2) % n] / scale;
+        double db = p > 0 ? 10 * log10(p) : -327.68;
+        long v = lround(db * 100);
+        spectrum->record[k] = (int16_t)(v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v);
+    }
+    memset(spectrum->power, 0, n * sizeof(double));
+
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t timestamp = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    uint64_t first_sample = spectrum->record_first_sample;
+    uint32_t frames = spectrum->frames;
+    spectrum->frames = 0;
+    if (fwrite(&timestamp, sizeof(timestamp), 1, spectrum->file) != 1 ||
+        fwrite(&first_sample, sizeof(first_sample), 1, spectrum->file) != 1 ||
+        fwrite(&frames, sizeof(frames), 1, spectrum->file) != 1 ||
+        fwrite(spectrum->record, sizeof(int16_t), n, spectrum->file) != n) {
+        fprintf(stderr, "fwrite(%s) failed: %s\n", spectrum->spec.filename, strerror(errno));
+        return;
+    }
+    /* each record is small; flush it so that the file can be followed live */
+    fflush(spectrum->file);
+    spectrum->records++;
+}
+
+static void *spectrum_thread(void *arg)
+{
+    Spectrum *spectrum = (Spectrum *)arg;
+    RingBuffer *ring = &spectrum->ring;
+    unsigned int n = spectrum->spec.fft_size;
+    struct timespec poll_interval = { 0, SPECTRUM_POLL_INTERVAL_NS };
+
+    while (1) {
+        int stop = atomic_load(&spectrum->stop);
+        size_t available = ring_buffer_read_available(ring);
+        if (available == 0 && stop) {
+            break;
+        }
+        if (available == 0) {
+            nanosleep(&poll_interval, NULL);
+            continue;
+        }
+        const void *data;
+        size_t contiguous = ring_buffer_peek(ring, &data);
+        const short *iq = (const short *)data;
+        unsigned int nsamples = contiguous / (2 * sizeof(short));
+        unsigned int i = 0;
+        while (i < nsamples) {
+            unsigned int m = n - spectrum->frame_fill;
+            if (m > nsamples - i) {
+                m = nsamples - i;
+            }
+            float *frame = spectrum->frame + 2 * spectrum->frame_fill;
+            for (unsigned int j = 0; j < 2 * m; j++) {
+                frame[j] = iq[2 * i + j];
+            }
+            spectrum->frame_fill += m;
+            spectrum->samples_in += m;
+            i += m;
+            if (spectrum->frame_fill == n) {
+                process_frame(spectrum);
+            }
+        }
+        ring_buffer_consume(ring, nsamples * 2 * sizeof(short));
+    }
+    return NULL;
+}
+
+static void spectrum_sink_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index)
+{
+    UNUSED(sample_index);
+    spectrum_push((Spectrum *)sink, xi, xq, numSamples);
+}
+
+static void spectrum_sink_stop(Sink *sink)
+{
+    spectrum_stop((Spectrum *)sink);
+}
+
+static void spectrum_sink_free(Sink *sink)
+{
+    spectrum_free((Spectrum *)sink);
+}
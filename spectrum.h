@@ -0,0 +1,86 @@
+/* spectrum monitor: averaged power spectra computed on a worker thread and
+ * written periodically to a compact binary file
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SPECTRUM_H
+#define SPECTRUM_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fft.h"
+#include "pipeline.h"
+#include "ring_buffer.h"
+
+#define SPECTRUM_RING_SIZE (16 * 1024 * 1024)
+#define SPECTRUM_MAX_FFT_SIZE (1024 * 1024)
+
+/* file layout (all little endian):
+ *   header: "IQSPECTR" magic, uint32 version, uint32 fft_size,
+ *           float64 sample_rate, float64 center_frequency, uint32 window,
+ *           uint32 frames_per_record
+ *   records: int64 timestamp (ns since the epoch, at the end of the record),
+ *            uint64 first_sample, uint32 frames,
+ *            int16 power[fft_size] (dBFS * 100, from -sample_rate/2 to
+ *            +sample_rate/2) */
+#define SPECTRUM_FILE_MAGIC "IQSPECTR"
+#define SPECTRUM_FILE_VERSION 1
+
+typedef enum {
+    SPECTRUM_WINDOW_RECTANGULAR,
+    SPECTRUM_WINDOW_HANN,
+    SPECTRUM_WINDOW_HAMMING,
+    SPECTRUM_WINDOW_BLACKMAN_HARRIS,
+} SpectrumWindow;
+
+typedef struct {
+    unsigned int fft_size;
+    double averaging_time;      /* seconds */
+    SpectrumWindow window;
+    const char *filename;
+} SpectrumSpec;
+
+typedef struct {
+    Sink sink;                  /* pipeline sink (stop/free -> spectrum_stop/free) */
+    SpectrumSpec spec;
+    RingBuffer ring;
+    FFTPlan plan;
+    float *window;
+    float *frame;               /* samples of the next frame (interleaved) */
+    unsigned int frame_fill;
+    float *fft_buf;
+    double *power;              /* accumulated |X|^2 */
+    int16_t *record;
+    unsigned int frames;
+    unsigned int frames_per_record;
+    double normalization;
+    unsigned long long samples_in;
+    unsigned long long record_first_sample;
+    unsigned long long records;
+    FILE *file;
+    pthread_t thread;
+    atomic_int stop;
+} Spectrum;
+
+int spectrum_spec_parse(const char *spec, SpectrumSpec *spectrum_spec);
+/* an optional "<window>," at the start of spec (default: Hann); returns
+ * what follows it */
+const char *spectrum_window_parse(const char *spec, SpectrumWindow *window);
+const char *spectrum_window_name(SpectrumWindow window);
+void spectrum_window_init(float *window, unsigned int n, SpectrumWindow type);
+int spectrum_init(Spectrum *spectrum, const SpectrumSpec *spec, double sample_rate, double center_frequency);
+int spectrum_start(Spectrum *spectrum);
+/* called from the stream callback */
+void spectrum_push(Spectrum *spectrum, const short *xi, const short *xq, unsigned int numSamples);
+void spectrum_stop(Spectrum *spectrum);
+void spectrum_free(Spectrum *spectrum);
+
+#endif /* SPECTRUM_H */
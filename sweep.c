@@ -0,0 +1,493 @@
+/* sweep scanner: steps the tuner through a list or a range of frequencies,
+ * computes an averaged power spectrum for each dwell on a worker thread,
+ * and stitches them into one wideband power record per sweep
+ * - the retune to the next frequency is requested as soon as a dwell has
+ *   been captured, so that it (and the settling time after it) overlaps
+ *   with the FFTs of that dwell on the worker thread
+ * - after each retune the samples are discarded until the first block at
+ *   the new frequency (the one the SDRplay API flags with rfChanged), and
+ *   for SWEEP_SETTLING_TIME after it; a gap (dropped samples or a stream
+ *   reset) while capturing restarts the dwell
+ * - each dwell is a Welch average (50% overlap), scaled as in the spectrum
+ *   monitor; only the central bins_per_step bins of each one are kept
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "sample_kernels.h"
+#include "sweep.h"
+
+#define SWEEP_POLL_INTERVAL_NS 1000000      /* 1ms */
+
+static int parse_frequencies(const char *spec, SweepSpec *sweep_spec, int *n);
+static int write_header(Sweep *sweep);
+static void process_dwell(Sweep *sweep, const short *iq, unsigned int step);
+static void write_record(Sweep *sweep);
+static void *sweep_thread(void *arg);
+static void *retune_thread(void *arg);
+static void sweep_sink_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index);
+static void sweep_sink_stop(Sink *sink);
+static void sweep_sink_free(Sink *sink);
+
+
+/* <start>:<stop>:<step>|<f1>/<f2>/...,<fft size>,<dwell time (s)>[,<window>],<output file> */
+int sweep_spec_parse(const char *spec, SweepSpec *sweep_spec)
+{
+    int n;
+    if (parse_frequencies(spec, sweep_spec, &n) == -1) {
+        return -1;
+    }
+    spec += n;
+    if (sscanf(spec, ",%u,%lg,%n", &sweep_spec->fft_size, &sweep_spec->dwell_time, &n) != 2 || spec[n] == '\0') {
+        return -1;
+    }
+    if (sweep_spec->fft_size < 16 || sweep_spec->fft_size > SPECTRUM_MAX_FFT_SIZE ||
+        (sweep_spec->fft_size & (sweep_spec->fft_size - 1)) != 0 || sweep_spec->dwell_time <= 0) {
+        return -1;
+    }
+    spec = spectrum_window_parse(spec + n, &sweep_spec->window);
+    if (*spec == '\0') {
+        return -1;
+    }
+    sweep_spec->filename = spec;
+    return 0;
+}
+
+double sweep_first_frequency(const SweepSpec *spec)
+{
+    return spec->nlist > 0 ? spec->list[0] : spec->start;
+}
+
+int sweep_init(Sweep *sweep, const SweepSpec *spec, double sample_rate, SweepRetune retune, void *retune_arg)
+{
+    memset(sweep, 0, sizeof(Sweep));
+    sweep->sink.name = "sweep";
+    sweep->sink.push = sweep_sink_push;
+    sweep->sink.stop = sweep_sink_stop;
+    sweep->sink.free = sweep_sink_free;
+    sweep->spec = *spec;
+    sweep->sample_rate = sample_rate;
+    sweep->retune = retune;
+    sweep->retune_arg = retune_arg;
+    atomic_init(&sweep->slots_written, 0);
+    atomic_init(&sweep->slots_read, 0);
+    atomic_init(&sweep->retune_step, 0);
+    atomic_init(&sweep->retune_failed, 0);
+    atomic_init(&sweep->retune_stop, 0);
+    atomic_init(&sweep->stop, 0);
+    if (sem_init(&sweep->retune_request, 0, 0) == -1) {
+        fprintf(stderr, "sem_init() failed: %s\n", strerror(errno));
+        return -1;
+    }
+    sweep->sem_ok = 1;
+
+    /* a whole number of 50% overlapping frames per dwell */
+    unsigned int n = spec->fft_size;
+    unsigned int hop = n / 2;
+    long dwell_samples = lround(spec->dwell_time * sample_rate);
+    unsigned int nframes = dwell_samples > n ? (dwell_samples - n) / hop + 1 : 1;
+    sweep->dwell_samples = (nframes - 1) * hop + n;
+    sweep->settling_samples = (unsigned int)lround(SWEEP_SETTLING_TIME * sample_rate);
+
+    double bin_width = sample_rate / n;
+    if (spec->nlist > 0) {
+        sweep->nsteps = spec->nlist;
+        sweep->bins_per_step = (unsigned int)lround(n * SWEEP_LIST_BANDWIDTH);
+    } else {
+        sweep->nsteps = (unsigned int)floor((spec->stop - spec->start) / spec->step + 1e-9) + 1;
+        sweep->bins_per_step = (unsigned int)lround(spec->step / bin_width);
+        if (sweep->bins_per_step == 0 || sweep->bins_per_step > n) {
+            fprintf(stderr, "sweep step must be between the bin width (%.3lfHz) and the sample rate (%.0lfHz)\n", bin_width, sample_rate);
+            sweep_free(sweep);
+            return -1;
+        }
+        if (fabs(sweep->bins_per_step * bin_width - spec->step) > 1e-6 * spec->step) {
+            fprintf(stderr, "sweep: step is not a multiple of the bin width (%.3lfHz); each step is stitched as %u bins\n", bin_width, sweep->bins_per_step);
+        }
+    }
+    if (sweep->nsteps > SWEEP_MAX_STEPS) {
+        fprintf(stderr, "too many sweep steps: %u (max %d)\n", sweep->nsteps, SWEEP_MAX_STEPS);
+        sweep_free(sweep);
+        return -1;
+    }
+    sweep->frequencies = (double *)malloc(sweep->nsteps * sizeof(double));
+    if (sweep->frequencies == NULL) {
+        fprintf(stderr, "sweep buffers allocation failed\n");
+        sweep_free(sweep);
+        return -1;
+    }
+    for (unsigned int i = 0; i < sweep->nsteps; i++) {
+        sweep->frequencies[i] = spec->nlist > 0 ? spec->list[i] : spec->start + i * spec->step;
+    }
+
+    if (fft_plan_init(&sweep->plan, n) == -1) {
+        sweep_free(sweep);
+        return -1;
+    }
+    for (int i = 0; i < SWEEP_SLOTS; i++) {
+        sweep->slots[i] = (short *)malloc(sweep->dwell_samples * 2 * sizeof(short));
+    }
+    sweep->window = (float *)malloc(n * sizeof(float));
+    sweep->fft_buf = (float *)malloc(2 * n * sizeof(float));
+    sweep->power = (double *)malloc(n * sizeof(double));
+    sweep->record = (int16_t *)malloc((size_t)sweep->nsteps * sweep->bins_per_step * sizeof(int16_t));
+    int slots_ok = 1;
+    for (int i = 0; i < SWEEP_SLOTS; i++) {
+        slots_ok &= sweep->slots[i] != NULL;
+    }
+    if (!slots_ok || sweep->window == NULL || sweep->fft_buf == NULL || sweep->power == NULL || sweep->record == NULL) {
+        fprintf(stderr, "sweep buffers allocation failed\n");
+        sweep_free(sweep);
+        return -1;
+    }
+    /* no page faults in the stream callback */
+    for (int i = 0; i < SWEEP_SLOTS; i++) {
+        memset(sweep->slots[i], 0, sweep->dwell_samples * 2 * sizeof(short));
+    }
+    spectrum_window_init(sweep->window, n, spec->window);
+    double window_sum = 0;
+    for (unsigned int i = 0; i < n; i++) {
+        window_sum += sweep->window[i];
+    }
+    sweep->normalization = window_sum * window_sum * 32768.0 * 32768.0;
+
+    sweep->file = fopen(spec->filename, "wb");
+    if (sweep->file == NULL) {
+        fprintf(stderr, "fopen(%s) failed: %s\n", spec->filename, strerror(errno));
+        sweep_free(sweep);
+        return -1;
+    }
+    if (write_header(sweep) == -1) {
+        sweep_free(sweep);
+        return -1;
+    }
+
+    /* the tuner starts on the first frequency */
+    sweep->state = SWEEP_SETTLING;
+    sweep->settle_left = sweep->settling_samples;
+    fprintf(stderr, "sweep: nsteps=%u %.0lf-%.0lfHz fft_size=%u window=%s dwell=%u samples (%.3lfms) bins_per_step=%u -> %s\n",
+            sweep->nsteps, sweep->frequencies[0], sweep->frequencies[sweep->nsteps - 1], n, spectrum_window_name(spec->window),
+            sweep->dwell_samples, 1000.0 * sweep->dwell_samples / sample_rate, sweep->bins_per_step, spec->filename);
+    return 0;
+}
+
+int sweep_start(Sweep *sweep)
+{
+    int ret = pthread_create(&sweep->thread, NULL, sweep_thread, sweep);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        return -1;
+    }
+    ret = pthread_create(&sweep->retune_thread, NULL, retune_thread, sweep);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        atomic_store(&sweep->stop, 1);
+        pthread_join(sweep->thread, NULL);
+        return -1;
+    }
+    sweep->retune_thread_started = 1;
+    return 0;
+}
+
+void sweep_block(Sweep *sweep, int rf_changed, int reset)
+{
+    if (rf_changed) {
+        sweep->rf_changed = 1;
+    }
+    if (reset && sweep->state == SWEEP_CAPTURING) {
+        sweep->state = SWEEP_SETTLING;
+        sweep->settle_left = sweep->settling_samples;
+        sweep->restarts++;
+    }
+}
+
+void sweep_stop_retunes(Sweep *sweep)
+{
+    if (!sweep->retune_thread_started) {
+        return;
+    }
+    atomic_store(&sweep->retune_stop, 1);
+    sem_post(&sweep->retune_request);
+    pthread_join(sweep->retune_thread, NULL);
+    sweep->retune_thread_started = 0;
+}
+
+/* stop the worker after it has processed the dwells already captured; an
+ * incomplete sweep at the end is not written */
+void sweep_stop(Sweep *sweep)
+{
+    sweep_stop_retunes(sweep);
+    atomic_store(&sweep->stop, 1);
+    pthread_join(sweep->thread, NULL);
+    if (fclose(sweep->file) != 0) {
+        fprintf(stderr, "fclose(%s) failed: %s\n", sweep->spec.filename, strerror(errno));
+    }
+    sweep->file = NULL;
+    fprintf(stderr, "sweep: sweeps=%llu dwells=%llu restarts=%llu slot_waits=%llu%s\n", sweep->sweeps, sweep->dwells, sweep->restarts, sweep->slot_waits,
+            atomic_load(&sweep->retune_failed) ? " (stopped by a failed retune)" : "");
+}
+
+void sweep_free(Sweep *sweep)
+{
+    if (sweep->file != NULL) {
+        fclose(sweep->file);
+        sweep->file = NULL;
+    }
+    if (sweep->sem_ok) {
+        sem_destroy(&sweep->retune_request);
+        sweep->sem_ok = 0;
+    }
+    fft_plan_free(&sweep->plan);
+    for (int i = 0; i < SWEEP_SLOTS; i++) {
+        free(sweep->slots[i]);
+        sweep->slots[i] = NULL;
+    }
+    free(sweep->frequencies);
+    free(sweep->window);
+    free(sweep->fft_buf);
+    free(sweep->power);
+    free(sweep->record);
+    sweep->frequencies = NULL;
+    sweep->window = NULL;
+    sweep->fft_buf = NULL;
+    sweep->power = NULL;
+    sweep->record = NULL;
+}
+
+/* <start>:<stop>:<step> or <f1>/<f2>/... (Hz); n is set to the length */
+static int parse_frequencies(const char *spec, SweepSpec *sweep_spec, int *n)
+{
+    sweep_spec->nlist = 0;
+    if (sscanf(spec, "%lg:%lg:%lg%n", &sweep_spec->start, &sweep_spec->stop, &sweep_spec->step, n) == 3) {
+        if (sweep_spec->start <= 0 || sweep_spec->step <= 0 || sweep_spec->stop < sweep_spec->start) {
+            return -1;
+        }
+        return spec[*n] == ',' ? 0 : -1;
+    }
+    int length = 0;
+    while (1) {
+        int m;
+        if (sweep_spec->nlist == SWEEP_MAX_LIST || sscanf(spec + length, "%lg%n", &sweep_spec->list[sweep_spec->nlist], &m) != 1 ||
+            sweep_spec->list[sweep_spec->nlist] <= 0) {
+            return -1;
+        }
+        sweep_spec->nlist++;
+        length += m;
+        if (spec[length] != '/') {
+            break;
+        }
+        length++;
+    }
+    *n = length;
+    return spec[length] == ',' ? 0 : -1;
+}
+
+static int write_header(Sweep *sweep)
+{
+    uint32_t version = SWEEP_FILE_VERSION;
+    uint32_t fft_size = sweep->spec.fft_size;
+    uint32_t window = sweep->spec.window;
+    uint32_t nsteps = sweep->nsteps;
+    uint32_t bins_per_step = sweep->bins_per_step;
+    uint32_t dwell_samples = sweep->dwell_samples;
+    if (fwrite(SWEEP_FILE_MAGIC, 8, 1, sweep->file) != 1 ||
+        fwrite(&version, sizeof(version), 1, sweep->file) != 1 ||
+        fwrite(&fft_size, sizeof(fft_size), 1, sweep->file) != 1 ||
+        fwrite(&sweep->sample_rate, sizeof(sweep->sample_rate), 1, sweep->file) != 1 ||
+        fwrite(&window, sizeof(window), 1, sweep->file) != 1 ||
+        fwrite(&nsteps, sizeof(nsteps), 1, sweep->file) != 1 ||
+        fwrite(&bins_per_step, sizeof(bins_per_step), 1, sweep->file) != 1 ||
+        fwrite(&dwell_samples, sizeof(dwell_samples), 1, sweep->file) != 1 ||
+        fwrite(sweep->frequencies, sizeof(double), sweep->nsteps, sweep->file) != sweep->nsteps) {
+        fprintf(stderr, "fwrite(%s) failed: %s\n", sweep->spec.filename, strerror(errno));
+        return -1;
+    }
+    return 0;
+}
+
+static void process_dwell(Sweep *sweep, const short *iq, unsigned int step)
+{
+    unsigned int n = sweep->spec.fft_size;
+    unsigned int hop = n / 2;
+    const float *window = sweep->window;
+    float *buf = sweep->fft_buf;
+    double *power = sweep->power;
+    memset(power, 0, n * sizeof(double));
+    unsigned int frames = 0;
+    for (unsigned int offset = 0; offset + n <= sweep->dwell_samples; offset += hop) {
+        const short *frame = iq + 2 * offset;
+        for (unsigned int i = 0; i < n; i++) {
+            buf[2 * i] = frame[2 * i] * window[i];
+            buf[2 * i + 1] = frame[2 * i + 1] * window[i];
+        }
+        fft_forward(&sweep->plan, buf);
+        for (unsigned int k = 0; k < n; k++) {
+            power[k] += (double)buf[2 * k] * buf[2 * k] + (double)buf[2 * k + 1] * buf[2 * k + 1];
+        }
+        frames++;
+    }
+
+    /* the central bins, from the lowest frequency up (FFT shift) */
+    unsigned int bins = sweep->bins_per_step;
+    double scale = frames * sweep->normalization;
+    int16_t *record = sweep->record + (size_t)step * bins;
+    for (unsigned int k = 0; k < bins; k++) {
+        double p = power[(n / 2 - bins / 2 + k + n / 2) % n] / scale;
+        double db = p > 0 ? 10 * log10(p) : -327.68;
+        long v = lround(db * 100);
+        record[k] = (int16_t)(v < INT16_MIN ? INT16_MIN : v > INT16_MAX ? INT16_MAX : v);
+    }
+    sweep->dwells++;
+    if (step == sweep->nsteps - 1) {
+        write_record(sweep);
+    }
+}
+
+static void write_record(Sweep *sweep)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_REALTIME, &now);
+    int64_t timestamp = (int64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+    uint32_t number = (uint32_t)sweep->sweeps;
+    size_t count = (size_t)sweep->nsteps * sweep->bins_per_step;
+    if (fwrite(&timestamp, sizeof(timestamp), 1, sweep->file) != 1 ||
+        fwrite(&number, sizeof(number), 1, sweep->file) != 1 ||
+        fwrite(sweep->record, sizeof(int16_t), count, sweep->file) != count) {
+        fprintf(stderr, "fwrite(%s) failed: %s\n", sweep->spec.filename, strerror(errno));
+        return;
+    }
+    fflush(sweep->file);
+    sweep->sweeps++;
+}
+
+/* the dwells come in step order, starting from step 0, so a record is
+ * complete when the last step is done */
+static void *sweep_thread(void *arg)
+{
+    Sweep *sweep = (Sweep *)arg;
+    struct timespec poll_interval = { 0, SWEEP_POLL_INTERVAL_NS };
+
+    while (1) {
+        int stop = atomic_load(&sweep->stop);
+        unsigned int read = atomic_load_explicit(&sweep->slots_read, memory_order_relaxed);
+        unsigned int written = atomic_load_explicit(&sweep->slots_written, memory_order_acquire);
+        if (read == written && stop) {
+            break;
+        }
+        if (read == written) {
+            nanosleep(&poll_interval, NULL);
+            continue;
+        }
+        unsigned int slot = read % SWEEP_SLOTS;
+        process_dwell(sweep, sweep->slots[slot], sweep->slot_step[slot]);
+        atomic_store_explicit(&sweep->slots_read, read + 1, memory_order_release);
+    }
+    return NULL;
+}
+
+/* sdrplay_api_Update() is not for the stream callback: it posts the step
+ * to tune to, and this thread does it */
+static void *retune_thread(void *arg)
+{
+    Sweep *sweep = (Sweep *)arg;
+    while (1) {
+        while (sem_wait(&sweep->retune_request) == -1 && errno == EINTR) {
+            ;
+        }
+        if (atomic_load(&sweep->retune_stop)) {
+            break;
+        }
+        unsigned int step = atomic_load(&sweep->retune_step);
+        if (sweep->retune(sweep->retune_arg, sweep->frequencies[step]) != 0) {
+            atomic_store(&sweep->retune_failed, 1);
+            break;
+        }
+    }
+    return NULL;
+}
+
+static void sweep_sink_push(Sink *sink, const short *xi, const short *xq, unsigned int numSamples, uint64_t sample_index)
+{
+    Sweep *sweep = (Sweep *)sink;
+    if (sweep->state == SWEEP_CAPTURING && sweep->fill > 0 && sample_index != sweep->next_sample_index) {
+        sweep->state = SWEEP_SETTLING;
+        sweep->settle_left = sweep->settling_samples;
+        sweep->restarts++;
+    }
+    sweep->next_sample_index = sample_index + numSamples;
+    int rf_changed = sweep->rf_changed;
+    sweep->rf_changed = 0;
+    if (sweep->state == SWEEP_WAIT_RETUNE) {
+        if (!rf_changed) {
+            return;
+        }
+        sweep->state = SWEEP_SETTLING;
+        sweep->settle_left = sweep->settling_samples;
+    }
+
+    unsigned int i = 0;
+    while (i < numSamples) {
+        if (sweep->state == SWEEP_SETTLING) {
+            unsigned int m = sweep->settle_left < numSamples - i ? sweep->settle_left : numSamples - i;
+            sweep->settle_left -= m;
+            i += m;
+            if (sweep->settle_left > 0) {
+                break;
+            }
+            /* all the slots are still with the worker: try again with the
+             * next block */
+            unsigned int written = atomic_load_explicit(&sweep->slots_written, memory_order_relaxed);
+            if (written - atomic_load_explicit(&sweep->slots_read, memory_order_acquire) == SWEEP_SLOTS) {
+                sweep->slot_waits++;
+                break;
+            }
+            sweep->state = SWEEP_CAPTURING;
+            sweep->fill = 0;
+        }
+
+        unsigned int written = atomic_load_explicit(&sweep->slots_written, memory_order_relaxed);
+        unsigned int slot = written % SWEEP_SLOTS;
+        unsigned int m = sweep->dwell_samples - sweep->fill < numSamples - i ? sweep->dwell_samples - sweep->fill : numSamples - i;
+        /* the sample range is tracked by the stream callback already */
+        SampleRange range;
+        sample_range_init(&range);
+        interleave_minmax(xi + i, xq + i, sweep->slots[slot] + 2 * sweep->fill, m, &range);
+        sweep->fill += m;
+        i += m;
+        if (sweep->fill < sweep->dwell_samples) {
+            continue;
+        }
+        sweep->slot_step[slot] = sweep->step;
+        atomic_store_explicit(&sweep->slots_written, written + 1, memory_order_release);
+        sweep->step = (sweep->step + 1) % sweep->nsteps;
+        if (sweep->nsteps > 1) {
+            atomic_store(&sweep->retune_step, sweep->step);
+            sem_post(&sweep->retune_request);
+            sweep->state = SWEEP_WAIT_RETUNE;
+            break;
+        }
+        /* a single frequency: the next dwell right away */
+        sweep->state = SWEEP_SETTLING;
+        sweep->settle_left = 0;
+    }
+}
+
+static void sweep_sink_stop(Sink *sink)
+{
+    sweep_stop((Sweep *)sink);
+}
+
+static void sweep_sink_free(Sink *sink)
+{
+    sweep_free((Sweep *)sink);
+}
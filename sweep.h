@@ -0,0 +1,126 @@
+/* sweep scanner: steps the tuner through a list or a range of frequencies,
+ * computes an averaged power spectrum for each dwell on a worker thread,
+ * and stitches them into one wideband power record per sweep
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef SWEEP_H
+#define SWEEP_H
+
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "fft.h"
+#include "pipeline.h"
+#include "spectrum.h"
+
+#define SWEEP_MAX_LIST 256
+#define SWEEP_MAX_STEPS 65536
+#define SWEEP_SLOTS 4                   /* dwells captured ahead of the worker */
+#define SWEEP_SETTLING_TIME 0.001       /* s discarded after each retune */
+#define SWEEP_LIST_BANDWIDTH 0.75       /* fraction of the sample rate kept for a list */
+
+/* file layout (all little endian):
+ *   header: "IQSWEEP\0" magic, uint32 version, uint32 fft_size,
+ *           float64 sample_rate, uint32 window, uint32 nsteps,
+ *           uint32 bins_per_step, uint32 dwell_samples,
+ *           float64 frequencies[nsteps]
+ *   records: int64 timestamp (ns since the epoch, at the end of the sweep),
+ *            uint32 sweep,
+ *            int16 power[nsteps * bins_per_step] (dBFS * 100); bin k of
+ *            step s is at frequencies[s] + (k - bins_per_step / 2) *
+ *            sample_rate / fft_size
+ * with a range the steps are exactly bins_per_step bins apart, so a record
+ * is one contiguous spectrum from start - step / 2 to stop + step / 2 */
+#define SWEEP_FILE_MAGIC "IQSWEEP\0"
+#define SWEEP_FILE_VERSION 1
+
+typedef struct {
+    double start;               /* range (start:stop:step) */
+    double stop;
+    double step;
+    double list[SWEEP_MAX_LIST];    /* or list (f1/f2/...); nlist == 0 -> range */
+    unsigned int nlist;
+    unsigned int fft_size;
+    double dwell_time;          /* seconds */
+    SpectrumWindow window;
+    const char *filename;
+} SweepSpec;
+
+/* called from the retune thread: tune to frequency (Hz); 0 on success */
+typedef int (*SweepRetune)(void *arg, double frequency);
+
+typedef enum {
+    SWEEP_WAIT_RETUNE,          /* until the first block at the new frequency */
+    SWEEP_SETTLING,
+    SWEEP_CAPTURING,
+} SweepState;
+
+typedef struct {
+    Sink sink;                  /* pipeline sink (stop/free -> sweep_stop/free) */
+    SweepSpec spec;
+    double sample_rate;
+    double *frequencies;
+    unsigned int nsteps;
+    unsigned int dwell_samples;
+    unsigned int settling_samples;
+    unsigned int bins_per_step;
+    /* dwells, from the stream callback to the worker */
+    short *slots[SWEEP_SLOTS];  /* interleaved I/Q, dwell_samples each */
+    unsigned int slot_step[SWEEP_SLOTS];
+    atomic_uint slots_written;
+    atomic_uint slots_read;
+    /* stream callback only */
+    SweepState state;
+    unsigned int step;
+    unsigned int fill;
+    unsigned int settle_left;
+    int rf_changed;
+    uint64_t next_sample_index;
+    unsigned long long restarts;
+    unsigned long long slot_waits;
+    /* retune thread */
+    SweepRetune retune;
+    void *retune_arg;
+    sem_t retune_request;
+    int sem_ok;
+    atomic_uint retune_step;
+    atomic_int retune_failed;
+    atomic_int retune_stop;
+    pthread_t retune_thread;
+    int retune_thread_started;
+    /* worker */
+    FFTPlan plan;
+    float *window;
+    float *fft_buf;
+    double *power;
+    int16_t *record;
+    double normalization;
+    unsigned long long dwells;
+    unsigned long long sweeps;
+    FILE *file;
+    pthread_t thread;
+    atomic_int stop;
+} Sweep;
+
+int sweep_spec_parse(const char *spec, SweepSpec *sweep_spec);
+/* the first frequency of the sweep (where the tuner starts) */
+double sweep_first_frequency(const SweepSpec *spec);
+int sweep_init(Sweep *sweep, const SweepSpec *spec, double sample_rate, SweepRetune retune, void *retune_arg);
+int sweep_start(Sweep *sweep);
+/* called from the stream callback before the block is pushed */
+void sweep_block(Sweep *sweep, int rf_changed, int reset);
+/* no more retunes (before sdrplay_api_Uninit()) */
+void sweep_stop_retunes(Sweep *sweep);
+void sweep_stop(Sweep *sweep);
+void sweep_free(Sweep *sweep);
+
+#endif /* SWEEP_H */
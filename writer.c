@@ -0,0 +1,120 @@
+/* writer thread: drains a ring buffer to the output backend
+ * with large batched writes
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#define _GNU_SOURCE
+
+#include <sched.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include "writer.h"
+
+#define WRITER_POLL_INTERVAL_NS 1000000   /* 1ms */
+
+static void *writer_thread(void *arg);
+static void add_loss(Writer *writer, uint64_t offset, uint64_t bytes);
+
+
+int writer_start(Writer *writer, RingBuffer *ring, Output *output, size_t batch_size, int cpu)
+{
+    writer->ring = ring;
+    writer->output = output;
+    writer->batch_size = batch_size < ring->size / 2 ? batch_size : ring->size / 2;
+    atomic_init(&writer->stop, 0);
+    writer->write_calls = 0;
+    writer->write_errors = 0;
+    writer->offset = 0;
+    writer->lost_bytes = 0;
+    writer->nlosses = 0;
+    writer->lost_losses = 0;
+    pthread_attr_t attr;
+    pthread_attr_init(&attr);
+    if (cpu >= 0) {
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        pthread_attr_setaffinity_np(&attr, sizeof(cpu_set_t), &cpus);
+    }
+    int ret = pthread_create(&writer->thread, &attr, writer_thread, writer);
+    pthread_attr_destroy(&attr);
+    if (ret != 0) {
+        fprintf(stderr, "pthread_create() failed: %s\n", strerror(ret));
+        return -1;
+    }
+    return 0;
+}
+
+/* stop the writer thread after it has written out everything left in the ring buffer */
+void writer_stop(Writer *writer)
+{
+    atomic_store(&writer->stop, 1);
+    pthread_join(writer->thread, NULL);
+}
+
+static void *writer_thread(void *arg)
+{
+    Writer *writer = (Writer *)arg;
+    RingBuffer *ring = writer->ring;
+    struct timespec poll_interval = { 0, WRITER_POLL_INTERVAL_NS };
+
+    while (1) {
+        int stop = atomic_load(&writer->stop);
+        size_t available = ring_buffer_read_available(ring);
+        if (available == 0 && stop) {
+            break;
+        }
+        if (available < writer->batch_size && !stop) {
+            nanosleep(&poll_interval, NULL);
+            continue;
+        }
+        /* write out a batch, in two pieces if it wraps around */
+        size_t count = available < writer->batch_size || stop ? available : writer->batch_size;
+        while (count > 0) {
+            const void *data;
+            size_t contiguous = ring_buffer_peek(ring, &data);
+            size_t n = contiguous < count ? contiguous : count;
+            unsigned long long bytes_written = writer->output->bytes_written;
+            ssize_t taken = writer->output->write(writer->output, data, n);
+            if (taken != (ssize_t)n) {
+                /* the output took the beginning (on an error, what it
+                 * counted before failing) */
+                size_t written = taken >= 0 ? (size_t)taken : writer->output->bytes_written - bytes_written;
+                writer->write_errors++;
+                add_loss(writer, writer->offset + written, n - written);
+            }
+            writer->write_calls++;
+            writer->offset += n;
+            ring_buffer_consume(ring, n);
+            count -= n;
+        }
+    }
+    return NULL;
+}
+
+/* consecutive losses (e.g. a full disk) are merged into one */
+static void add_loss(Writer *writer, uint64_t offset, uint64_t bytes)
+{
+    writer->lost_bytes += bytes;
+    if (writer->nlosses > 0) {
+        WriterLoss *last = &writer->losses[writer->nlosses - 1];
+        if (last->offset + last->bytes == offset) {
+            last->bytes += bytes;
+            return;
+        }
+    }
+    if (writer->nlosses == WRITER_MAX_LOSSES) {
+        writer->lost_losses++;
+        return;
+    }
+    WriterLoss *loss = &writer->losses[writer->nlosses++];
+    loss->offset = offset;
+    loss->bytes = bytes;
+}
@@ -0,0 +1,51 @@
+/* writer thread: drains a ring buffer to the output backend
+ * with large batched writes
+ */
+
+/*
+ * Copyright 2023-2024 Franco Venturi.
+ *
+ * SPDX-License-Identifier: GPL-3.0-or-later
+ */
+
+#ifndef WRITER_H
+#define WRITER_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+
+#include "output.h"
+#include "ring_buffer.h"
+
+#define WRITER_BATCH_SIZE (1024 * 1024)
+#define WRITER_MAX_LOSSES 4096
+
+/* bytes the output didn't take (a write error, or a short write), at
+ * their position in the stream of bytes drained from the ring buffer */
+typedef struct {
+    uint64_t offset;
+    uint64_t bytes;
+} WriterLoss;
+
+typedef struct {
+    RingBuffer *ring;
+    Output *output;
+    size_t batch_size;
+    pthread_t thread;
+    atomic_int stop;
+    unsigned long long write_calls;
+    unsigned long long write_errors;
+    /* written by the writer thread only; read them after writer_stop() */
+    uint64_t offset;                    /* bytes drained so far */
+    uint64_t lost_bytes;
+    WriterLoss losses[WRITER_MAX_LOSSES];
+    unsigned int nlosses;
+    unsigned long long lost_losses;     /* losses past WRITER_MAX_LOSSES */
+} Writer;
+
+/* cpu >= 0: pin the writer thread to that CPU */
+int writer_start(Writer *writer, RingBuffer *ring, Output *output, size_t batch_size, int cpu);
+void writer_stop(Writer *writer);
+
+#endif /* WRITER_H */